@@ -0,0 +1,306 @@
+// Microbenchmarks of the per step kernels in isolation, from L1 sized grids to
+// grids far larger than the last level cache. Every benchmark warms up, then takes
+// a number of timed samples that each run long enough to be above clock noise.
+// Results go to stdout as a table and, with --json, to a file for tracking.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+#include <fmt/core.h>
+
+#include "Diffusion/Animation.h"
+#include "Diffusion/Colormap.h"
+#include "Diffusion/Cpu.h"
+#include "Diffusion/Field.h"
+#include "Diffusion/InPlace.h"
+#include "Diffusion/Kernel.h"
+#include "Diffusion/PixelBuffer.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Summary
+{
+    double min = 0.0;
+    double median = 0.0;
+    double mean = 0.0;
+    double max = 0.0;
+    double stddev = 0.0;
+};
+
+struct Result
+{
+    std::string name;
+    int64_t width = 0;
+    int64_t height = 0;
+    int64_t items = 0;       // Cells one iteration processes
+    double bytesPerItem = 0; // Minimum memory traffic per cell
+    int64_t iterations = 0;  // Per sample
+    Summary nsPerItem;
+};
+
+struct Options
+{
+    std::vector<int64_t> sizes = {32, 64, 128, 256, 512, 1024, 2048};
+    int reps = 15;
+    double minSampleMs = 20.0;
+    double warmupMs = 100.0;
+    std::string filter;
+    std::string json;
+    bool upload = true;
+};
+
+Summary
+summarize(std::vector<double> samples)
+{
+    Summary s;
+    std::sort(samples.begin(), samples.end());
+    const size_t n = samples.size();
+    s.min = samples.front();
+    s.max = samples.back();
+    s.median = n % 2 ? samples[n / 2] : 0.5 * (samples[n / 2 - 1] + samples[n / 2]);
+    for (double v : samples)
+        s.mean += v;
+    s.mean /= n;
+    for (double v : samples)
+        s.stddev += (v - s.mean) * (v - s.mean);
+    s.stddev = n > 1 ? std::sqrt(s.stddev / (n - 1)) : 0.0;
+    return s;
+}
+
+// Calibrates the iteration count on the warm-up, then times `reps` samples.
+Result
+measure(const Options& options, const std::string& name, int64_t width, int64_t height, int64_t items,
+        double bytesPerItem, const std::function<void()>& body)
+{
+    auto elapsedMs = [](Clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+    };
+
+    int64_t iterations = 0;
+    auto start = Clock::now();
+    do
+    {
+        body();
+        iterations++;
+    } while (elapsedMs(start) < options.warmupMs);
+    const double msPerIteration = elapsedMs(start) / iterations;
+    iterations = std::max<int64_t>(1, (int64_t)std::ceil(options.minSampleMs / msPerIteration));
+
+    std::vector<double> samples;
+    for (int r = 0; r < options.reps; r++)
+    {
+        start = Clock::now();
+        for (int64_t i = 0; i < iterations; i++)
+            body();
+        samples.push_back(elapsedMs(start) * 1e6 / (double(iterations) * items));
+    }
+
+    Result result{name, width, height, items, bytesPerItem, iterations, summarize(samples)};
+    const double mcells = 1e3 / result.nsPerItem.median;
+    fmt::print("{:<10} {:>6}x{:<6} {:>9.3f} ns/cell (+-{:>6.3f}) {:>9.1f} Mcells/s {:>7.2f} GB/s\n", name, width, height,
+               result.nsPerItem.median, result.nsPerItem.stddev, mcells, mcells * bytesPerItem / 1e3);
+    return result;
+}
+
+void
+seed(Diffusion::Field& field)
+{
+    // A square of B in the middle, like the simulator starts, so the reaction term isn't trivially zero
+    const int64_t w = field.Width();
+    const int64_t h = field.Height();
+    for (int64_t y = h / 4; y < 3 * h / 4; y++)
+    {
+        for (int64_t x = w / 4; x < 3 * w / 4; x++)
+        {
+            field.A()[field.Index(x, y)] = 0.5;
+            field.B()[field.Index(x, y)] = 0.25 + 0.5 * ((x ^ y) & 1);
+        }
+    }
+}
+
+bool
+selected(const Options& options, const char* name)
+{
+    return options.filter.empty() || options.filter.find(name) != std::string::npos;
+}
+
+bool
+writeJson(const std::string& path, const std::vector<Result>& results)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file)
+    {
+        fmt::print(stderr, "Could not open {}\n", path);
+        return false;
+    }
+    fmt::print(file, "{{\n  \"avx2\": {},\n  \"results\": [\n", Diffusion::CpuHasAVX2() ? "true" : "false");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        const double mcells = 1e3 / r.nsPerItem.median;
+        fmt::print(file,
+                   "    {{\"benchmark\": \"{}\", \"width\": {}, \"height\": {}, \"cells\": {}, \"bytes_per_cell\": {}, "
+                   "\"iterations\": {}, \"ns_per_cell\": {{\"min\": {}, \"median\": {}, \"mean\": {}, \"max\": {}, \"stddev\": {}}}, "
+                   "\"mcells_per_s\": {}, \"gb_per_s\": {}}}{}\n",
+                   r.name, r.width, r.height, r.items, r.bytesPerItem, r.iterations, r.nsPerItem.min, r.nsPerItem.median,
+                   r.nsPerItem.mean, r.nsPerItem.max, r.nsPerItem.stddev, mcells, mcells * r.bytesPerItem / 1e3,
+                   i + 1 < results.size() ? "," : "");
+    }
+    fmt::print(file, "  ]\n}}\n");
+    return fclose(file) == 0;
+}
+
+std::vector<int64_t>
+parseSizes(const std::string& list)
+{
+    std::vector<int64_t> sizes;
+    size_t start = 0;
+    while (start < list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        sizes.push_back(std::stoll(list.substr(start, end - start)));
+        start = end + 1;
+    }
+    return sizes;
+}
+
+void
+helpMessage()
+{
+    fmt::print("Usage:\n");
+    fmt::print("DiffusionBench.exe [*Options*]\n");
+    fmt::print("* Options:\n");
+    fmt::print("\t- sizes: Comma separated grid edges, Default: 32,64,128,256,512,1024,2048\n");
+    fmt::print("\t- reps: Number of timed samples, Default: 15\n");
+    fmt::print("\t- sampleMs: Minimum length of a sample, Default: 20\n");
+    fmt::print("\t- warmupMs: Warm-up length, Default: 100\n");
+    fmt::print("\t- filter: Only run benchmarks whose name contains this, Default: None\n");
+    fmt::print("\t- json: Path of the JSON report, Default: None\n");
+    fmt::print("\t- upload: 0/1, include the texture upload (needs an OpenGL context), Default: 1\n");
+}
+
+int main(int argc, const char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--help")
+        {
+            helpMessage();
+            return 0;
+        }
+        if (i + 1 >= argc)
+        {
+            helpMessage();
+            return 1;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--sizes")
+            options.sizes = parseSizes(value);
+        else if (arg == "--reps")
+            options.reps = std::max(1, std::stoi(value));
+        else if (arg == "--sampleMs")
+            options.minSampleMs = std::stod(value);
+        else if (arg == "--warmupMs")
+            options.warmupMs = std::stod(value);
+        else if (arg == "--filter")
+            options.filter = value;
+        else if (arg == "--json")
+            options.json = value;
+        else if (arg == "--upload")
+            options.upload = std::stoi(value) != 0;
+        else
+        {
+            helpMessage();
+            return 1;
+        }
+    }
+
+    std::unique_ptr<sf::Context> context;
+    if (options.upload && selected(options, "upload"))
+        context = std::make_unique<sf::Context>();
+
+    std::vector<Result> results;
+    const Diffusion::Parameters params;
+    Diffusion::Colormap colormap;
+    for (int64_t size : options.sizes)
+    {
+        if (size < 3)
+            continue;
+        Diffusion::Field grid, next;
+        grid.Create(size, size, 1, 0);
+        seed(grid);
+        next = grid;
+        const int64_t interior = (size - 2) * (size - 2);
+
+        // Reads and writes both planes
+        if (selected(options, "step"))
+            results.push_back(measure(options, "step", size, size, interior, 4 * sizeof(Diffusion::Real), [&] {
+                Diffusion::StepRegion(grid, next, params, 1, 1, size - 1, size - 1);
+            }));
+
+        // Same traffic plus the copies of each row into the rolling buffers
+        if (selected(options, "inplace"))
+        {
+            Diffusion::ThreadPool pool(1);
+            Diffusion::InPlaceStepper stepper;
+            results.push_back(measure(options, "inplace", size, size, interior, 4 * sizeof(Diffusion::Real), [&] {
+                stepper.Step(grid, params, pool);
+            }));
+        }
+
+        // Reads both planes, writes a pixel
+        Diffusion::PixelBuffer pixels;
+        pixels.Create(size, size);
+        if (selected(options, "colorize"))
+            results.push_back(measure(options, "colorize", size, size, grid.Size(), 2 * sizeof(Diffusion::Real) + 4, [&] {
+                colormap.Colorize(grid.A(), grid.B(), pixels.Pixels(), grid.Size());
+            }));
+
+        // One animation frame from its palette positions, quantized and compressed
+        std::vector<float> positions(grid.Size());
+        for (int64_t i = 0; i < grid.Size(); i++)
+            positions[i] = (float)colormap.Position(colormap.Value(grid.A()[i], grid.B()[i]));
+        std::vector<uint8_t> encoded;
+        if (selected(options, "gif"))
+            results.push_back(measure(options, "gif", size, size, grid.Size(), sizeof(float), [&] {
+                encoded.clear();
+                Diffusion::EncodeGifFrame(positions.data(), size, size, Diffusion::Dither::Ordered, 3, encoded);
+            }));
+        if (selected(options, "apng"))
+            results.push_back(measure(options, "apng", size, size, grid.Size(), sizeof(float), [&] {
+                encoded.clear();
+                Diffusion::EncodeApngFrame(positions.data(), size, size, colormap.Table(), 1, 30, 16, encoded);
+            }));
+
+        // The outer ring of both planes, read and written
+        const int64_t border = 4 * size - 4;
+        if (selected(options, "halo"))
+            results.push_back(measure(options, "halo", size, size, border, 4 * sizeof(Diffusion::Real), [&] {
+                next.CopyBorder(grid);
+            }));
+
+        if (context && selected(options, "upload"))
+        {
+            sf::Texture texture;
+            if (size <= sf::Texture::getMaximumSize() && texture.create((unsigned)size, (unsigned)size))
+                results.push_back(measure(options, "upload", size, size, grid.Size(), 4, [&] {
+                    texture.update(pixels.Data());
+                }));
+        }
+    }
+
+    if (!options.json.empty() && !writeJson(options.json, results))
+        return 1;
+    return 0;
+}
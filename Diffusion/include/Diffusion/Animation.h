@@ -0,0 +1,139 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Diffusion/Colormap.h"
+#include "Diffusion/Field.h"
+
+namespace Diffusion
+{
+    enum class AnimationFormat
+    {
+        Gif, // 256 colours of the palette, every frame a full image
+        Apng // Truecolor, the colours the viewer shows
+    };
+
+    // How GIF frames spread the palette positions between two of its 256 colours
+    enum class Dither
+    {
+        None,          // Nearest below, exactly the grey levels of the viewer
+        Ordered,       // 8x8 Bayer matrix, stable between frames
+        FloydSteinberg // Error diffusion, smoother but flickers where the field moves
+    };
+
+    struct AnimationOptions
+    {
+        int fps = 30;
+        int every = 1;     // Keeps one frame of every `every` pushed
+        int scale = 1;     // Cells per pixel along each axis, averaged
+        Dither dither = Dither::Ordered;
+        int threads = 0;   // Encoder threads, 0 uses every core
+        int window = 0;    // Frames copied, encoding or waiting to be written, 0 is twice the encoders
+        bool block = false; // Wait for a free slot of the window instead of dropping the frame
+        int effort = 16;   // Deflate hash chain of APNG frames, see Util::ZlibCompress
+    };
+
+    struct AnimationStats
+    {
+        uint64_t pushed = 0;       // Frames handed to Push
+        uint64_t skipped = 0;      // Left out by `every`
+        uint64_t written = 0;      // Frames in the file
+        uint64_t dropped = 0;      // Discarded because the window was full
+        uint64_t backPressured = 0; // Pushes that had to wait for a free slot
+        double waitMs = 0.0;       // Total time Push spent waiting
+        double encodeMs = 0.0;     // Summed over the encoder threads
+        uint64_t bytes = 0;        // Of the file so far
+    };
+
+    // Writes an animated GIF or APNG of the pushed fields, coloured like the viewer.
+    //
+    // Push reduces the field to one palette position per output pixel in a free
+    // slot of a bounded window; quantizing, dithering and compressing happen on
+    // the writer's encoder threads, several frames at a time, and a writer thread
+    // appends the finished frames in order. A full window drops the frame, or with
+    // `block` the caller waits for a slot.
+    class AnimationWriter
+    {
+    public:
+        AnimationWriter() = default;
+        ~AnimationWriter();
+
+        AnimationWriter(const AnimationWriter&) = delete;
+        AnimationWriter& operator=(const AnimationWriter&) = delete;
+
+        // `width` x `height` cells, the frames are that divided by options.scale, rounded up
+        bool Open(const std::string& path, AnimationFormat format, int64_t width, int64_t height,
+                  const AnimationOptions& options = {});
+        // Returns false when the frame was dropped, true when skipped by `every`
+        bool Push(const Field& field);
+        // Writes the frames still in the window and finishes the file, false when
+        // any of it failed to be written
+        bool Close();
+        // The writer keeps its own copy, set it before Open
+        void SetColormap(const Colormap& colormap);
+
+        AnimationStats GetStats();
+        inline bool IsOpen() const { return m_File != nullptr; }
+        inline int64_t FrameWidth() const { return m_FrameWidth; }
+        inline int64_t FrameHeight() const { return m_FrameHeight; }
+
+    private:
+        struct Slot
+        {
+            std::vector<float> positions; // Colormap::Position of every pixel
+            uint64_t frame = 0;
+            bool encoded = false;
+            std::vector<uint8_t> data;    // What goes in the file for the frame
+        };
+
+        void encoderLoop();
+        void writerLoop();
+        void reduce(const Field& field, float* out) const;
+
+        FILE* m_File = nullptr;
+        AnimationFormat m_Format = AnimationFormat::Gif;
+        AnimationOptions m_Options;
+        int64_t m_Width = 0;
+        int64_t m_Height = 0;
+        int64_t m_FrameWidth = 0;
+        int64_t m_FrameHeight = 0;
+        long m_FrameCountOffset = 0; // Of the APNG acTL frame count, patched by Close
+
+        std::vector<Slot> m_Slots;
+        std::deque<int> m_Free;
+        std::deque<int> m_Queued; // Pushed, waiting for an encoder
+        std::deque<int> m_Order;  // Every frame of the window, in frame order
+        uint64_t m_NextFrame = 0; // Given to the next frame kept
+        std::mutex m_Mutex;
+        std::condition_variable m_QueuedCv;
+        std::condition_variable m_EncodedCv;
+        std::condition_variable m_FreeCv;
+        bool m_Stop = false;
+        bool m_Failed = false;
+        AnimationStats m_Stats;
+
+        Colormap m_Colormap;
+        std::vector<std::thread> m_Encoders;
+        std::thread m_Writer;
+    };
+
+    // One full frame of palette positions as GIF blocks: graphic control extension
+    // with `delayCs` hundredths of a second, image descriptor and LZW coded indices
+    // of the 256 colour table Table()[16 * i]
+    void EncodeGifFrame(const float* positions, int64_t width, int64_t height, Dither dither, int delayCs,
+                        std::vector<uint8_t>& out);
+    // Frame `frame` (from 0) of an APNG at `fps`, coloured through `lut`: the fcTL
+    // chunk and the image data as IDAT for the first frame, fdAT after
+    void EncodeApngFrame(const float* positions, int64_t width, int64_t height, const uint32_t* lut, uint64_t frame,
+                         int fps, int effort, std::vector<uint8_t>& out);
+
+    bool ParseAnimationFormat(const std::string& name, AnimationFormat& format);
+    bool ParseDither(const std::string& name, Dither& dither);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "Diffusion/Field.h"
+
+namespace Diffusion
+{
+    // A copy of a live field as it was at one step, taken without stopping the
+    // simulation. The field is split in TILE x TILE tiles: a background thread
+    // copies them one after the other straight from the live planes, and whoever is
+    // about to overwrite a tile that hasn't been copied yet (a worker, a boundary
+    // update) copies it first. Each tile is copied once, the simulation only pays
+    // for the tiles it reaches before the background thread does.
+    //
+    // Simulation::RequestCapture makes them, see there.
+    class Capture
+    {
+    public:
+        static constexpr int64_t TILE = 64;
+
+        // Runs on the capture thread once the copy is complete
+        using Callback = std::function<void(const Capture& capture)>;
+
+        // The result is allocated, not touched: requesting costs no more for a large field
+        Capture(const Field& source, uint64_t step, Callback done);
+
+        Capture(const Capture&) = delete;
+        Capture& operator=(const Capture&) = delete;
+
+        // Before cells [x0, x1) x [y0, y1) of the source are written
+        void Protect(int64_t x0, int64_t y0, int64_t x1, int64_t y1);
+        // Copies every tile left on the calling thread, then runs the callback
+        void Complete();
+        // Every tile has been copied, the source may be written freely
+        inline bool Copied() const { return m_Remaining.load(std::memory_order_acquire) == 0; }
+
+        // Copied and the callback has run
+        bool Done() const;
+        void Wait() const;
+
+        // Complete once Done
+        inline const Field& Result() const { return m_Result; }
+        inline uint64_t Step() const { return m_Step; }
+        inline const Real* Source() const { return m_SourceA; }
+        // Tiles copied ahead of a write instead of by the background thread
+        inline uint64_t TilesProtected() const { return m_Protected.load(std::memory_order_relaxed); }
+        inline int64_t Tiles() const { return m_TilesX * m_TilesY; }
+
+    private:
+        enum TileState : uint8_t
+        {
+            PENDING,
+            COPYING,
+            COPIED
+        };
+
+        void claim(int64_t tile, bool protect);
+        void copyTile(int64_t tile);
+
+        const Real* m_SourceA;
+        const Real* m_SourceB;
+        Field m_Result;
+        uint64_t m_Step;
+        int64_t m_TilesX;
+        int64_t m_TilesY;
+        std::unique_ptr<std::atomic<uint8_t>[]> m_States;
+        std::atomic<int64_t> m_Remaining;
+        std::atomic<uint64_t> m_Protected{0};
+
+        Callback m_Callback;
+        mutable std::mutex m_Mutex;
+        mutable std::condition_variable m_DoneCv;
+        bool m_Done = false;
+    };
+}
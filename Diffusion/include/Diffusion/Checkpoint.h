@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Diffusion/Field.h"
+
+namespace Diffusion
+{
+    // On-disk layout (little endian):
+    //   CheckpointHeader, zero padded to CheckpointHeader::headerSize (a multiple of 4096)
+    //   A plane, Width * Height values of `precision` bytes, row-major
+    //   B plane, same layout
+    // The planes are page aligned so a restored field can point straight into the mapping.
+    struct CheckpointHeader
+    {
+        char magic[4];       // "RDCK"
+        uint32_t version;
+        uint32_t headerSize; // Offset of the A plane
+        uint32_t precision;  // Bytes per value
+        int64_t width;
+        int64_t height;
+        uint64_t step;
+        double dA;
+        double dB;
+        double feed;
+        double kill;
+        uint32_t crcA;
+        uint32_t crcB;
+        uint32_t crcHeader;  // CRC of every field above
+        uint32_t reserved;
+    };
+    static_assert(sizeof(CheckpointHeader) == 88, "CheckpointHeader is part of the file format");
+
+    constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+    struct CheckpointInfo
+    {
+        uint64_t step = 0;
+        double dA = 0.0;
+        double dB = 0.0;
+        double feed = 0.0;
+        double kill = 0.0;
+    };
+
+    // Writes to `path`.tmp, syncs it and renames it over `path`, so an interrupted
+    // save never clobbers the previous checkpoint.
+    bool SaveCheckpoint(const std::string& path, const Field& field, const CheckpointInfo& info);
+
+    // Maps the checkpoint copy-on-write and makes `field` use the mapped planes.
+    // With `verify` the plane checksums are checked, which reads the whole file once;
+    // without it only the header is validated and the planes are paged in lazily.
+    bool LoadCheckpoint(const std::string& path, Field& field, CheckpointInfo& info, bool verify = true);
+
+    // SIGUSR1 requests a checkpoint, SIGTERM requests a checkpoint and then a shutdown.
+    // The requests are only flags, the render loop serves them at the next step boundary.
+    void InstallCheckpointSignals();
+    void RequestCheckpoint();
+    bool ConsumeCheckpointRequest();
+    bool TerminateRequested();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Diffusion/Field.h"
+
+namespace Diffusion
+{
+    enum class ColorSource
+    {
+        Difference, // A - B, the original look
+        A,
+        B
+    };
+
+    // Turns cells into packed RGBA pixels (PixelBuffer byte order) through a palette
+    // baked into a lookup table. The source value is mapped from [Min, Max] onto the
+    // table; the default grey palette with A - B over [0, 1] gives exactly the
+    // original floor((a - b) * 255) grey levels.
+    class Colormap
+    {
+    public:
+        // Table entries minus one. A multiple of 255, so the grey ramp lands exactly
+        // on the original levels: floor(floor(v * 4080) / 16) == floor(v * 255).
+        static constexpr int LUT_STEPS = 255 * 16;
+
+        struct Stop
+        {
+            float position;
+            uint8_t r, g, b;
+        };
+
+        Colormap();
+
+        // grey, viridis, magma, inferno, plasma
+        bool SetPalette(const std::string& name);
+        // One stop per line: position in [0, 1] then r g b in [0, 255], # starts a comment
+        bool LoadGradient(const std::string& path);
+        void SetGradient(const std::vector<Stop>& stops);
+        void SetSource(ColorSource source) { m_Source = source; }
+        void SetRange(double min, double max);
+
+        void Colorize(const Real* a, const Real* b, uint32_t* out, int64_t count) const;
+
+        // The value a cell is coloured by
+        inline double Value(Real a, Real b) const
+        {
+            return m_Source == ColorSource::Difference ? a - b : (m_Source == ColorSource::A ? a : b);
+        }
+        // Where `value` falls on the table, in [0, LUT_STEPS]; Table()[(int)position] is its colour.
+        // NaN falls on 0, like the AVX2 path.
+        inline double Position(double value) const
+        {
+            double t = (value - m_Min) * m_Scale;
+            return !(t > 0.0) ? 0.0 : (t > LUT_STEPS ? LUT_STEPS : t);
+        }
+
+        inline ColorSource Source() const { return m_Source; }
+        inline const uint32_t* Table() const { return m_Lut.data(); }
+
+        static const std::vector<std::string>& PaletteNames();
+
+    private:
+        std::vector<uint32_t> m_Lut;
+        ColorSource m_Source = ColorSource::Difference;
+        double m_Min = 0.0;
+        double m_Scale = LUT_STEPS;
+    };
+
+    bool ParseColorSource(const std::string& name, ColorSource& source);
+
+    // AVX2 gather version of Colormap::Colorize, only call it when CpuHasAVX2().
+    // Returns false without touching `out` when the file was built without AVX2.
+    bool ColorizeAVX2(const uint32_t* lut, ColorSource source, double min, double scale,
+                      const Real* a, const Real* b, uint32_t* out, int64_t count);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Diffusion/Kernel.h"
+
+namespace Diffusion
+{
+    struct ConvergenceOptions
+    {
+        double tolerance = 1e-7; // Largest change of a cell in one step that still counts as steady
+        uint64_t every = 0;      // Steps between measurements, 0 disables the monitor
+        int window = 3;          // Measurements in a row below the tolerance before the run stops
+        int regions = 8;         // Regions per axis that convergence is reported for
+    };
+
+    // Watches the change between steps and says when the field stopped changing.
+    //
+    // Every `every` steps one step is measured: the stepper calls StepRowMeasured
+    // with Splits() and the changes of the band it is stepping, so the measurement
+    // rides along the step instead of reading both fields again. EndStep folds the
+    // band partials in band order, the result doesn't depend on the thread count.
+    class ConvergenceMonitor
+    {
+    public:
+        // `bandRows` is the height of the bands the stepper hands out, regions are
+        // whole bands so there are never more region rows than bands.
+        void Configure(const ConvergenceOptions& options, int64_t width, int64_t height, int64_t bandRows);
+
+        inline bool Enabled() const { return m_Options.every > 0; }
+        // Whether the step that ends at `step` should be measured
+        inline bool Due(uint64_t step) const { return Enabled() && step % m_Options.every == 0; }
+
+        // Before a measured step
+        void BeginStep();
+        inline StepChange* BandChanges(uint32_t band) { return m_BandChanges.data() + band * m_Options.regions; }
+        inline const int64_t* Splits() const { return m_Splits.data(); }
+        inline int Segments() const { return m_Options.regions; }
+        // After the measured step, returns true once the whole field is steady
+        bool EndStep(uint64_t step);
+
+        // The change of the last measured step
+        inline const StepChange& Last() const { return m_Last; }
+        // sqrt of the sum of squared changes of the last measured step
+        double LastL2() const;
+        inline bool Converged() const { return m_ConvergedAt != 0; }
+        // First step of the run of steady measurements that ended the run
+        inline uint64_t ConvergedAt() const { return m_ConvergedAt; }
+        inline int Regions() const { return m_Options.regions; }
+        // Same for region (x, y) of the Regions() x Regions() grid, 0 while it still changes
+        inline uint64_t RegionConvergedAt(int x, int y) const { return m_Regions[y * m_Options.regions + x].convergedAt; }
+
+    private:
+        struct Region
+        {
+            uint64_t steadySince = 0; // First step of the current steady run, 0 if the last measurement wasn't
+            int steadyCount = 0;
+            uint64_t convergedAt = 0;
+        };
+
+        static void update(Region& region, bool steady, uint64_t step, int window);
+
+        ConvergenceOptions m_Options;
+        std::vector<int64_t> m_Splits;
+        std::vector<StepChange> m_BandChanges;
+        std::vector<StepChange> m_RegionChanges;
+        uint32_t m_Bands = 0;
+        std::vector<Region> m_Regions;
+        Region m_Field;
+        StepChange m_Last;
+        uint64_t m_ConvergedAt = 0;
+    };
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+namespace Diffusion
+{
+    // Runtime checks for the instruction sets the optional SIMD paths are built for,
+    // so one binary runs everywhere and uses them where available.
+    bool CpuHasAVX2();
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Utils/MappedFile.h"
+
+namespace Diffusion
+{
+    using Real = double;
+
+    // Leaves the elements a resize adds uninitialized, so a large plane costs no
+    // more than its address space until its pages are written.
+    template <class T>
+    struct DefaultInitAllocator : std::allocator<T>
+    {
+        template <class U>
+        struct rebind
+        {
+            using other = DefaultInitAllocator<U>;
+        };
+
+        using std::allocator<T>::allocator;
+
+        template <class U>
+        void construct(U* p) { ::new ((void*)p) U; }
+        template <class U, class... Args>
+        void construct(U* p, Args&&... args) { ::new ((void*)p) U(std::forward<Args>(args)...); }
+    };
+
+    // The simulation state: two row-major planes (A and B) of Width x Height cells.
+    // The planes either live in memory owned by the field or inside a file mapping
+    // (a restored checkpoint), in which case the pages are only read on first touch.
+    class Field
+    {
+    public:
+        Field() = default;
+        // Copies always own their planes, even when `other` is mapped
+        Field(const Field& other);
+        Field& operator=(const Field& other);
+        Field(Field&& other) noexcept = default;
+        Field& operator=(Field&& other) noexcept = default;
+
+        void Create(int64_t width, int64_t height, Real a, Real b);
+        // Planes with unspecified values, for a field that is about to be written whole
+        void Allocate(int64_t width, int64_t height);
+        void Adopt(std::shared_ptr<Util::MappedFile> mapping, Real* a, Real* b, int64_t width, int64_t height);
+        // Copies the outer ring of cells, the only cells a step never writes.
+        void CopyBorder(const Field& other);
+        void Swap(Field& other);
+        // CRC-32 of both planes in fixed size chunks, the same for any thread count.
+        uint32_t Digest(int threads = 0) const;
+
+        inline Real* A() { return m_A; }
+        inline Real* B() { return m_B; }
+        inline const Real* A() const { return m_A; }
+        inline const Real* B() const { return m_B; }
+
+        inline int64_t Width() const { return m_Width; }
+        inline int64_t Height() const { return m_Height; }
+        inline int64_t Size() const { return m_Width * m_Height; }
+        inline int64_t Index(int64_t x, int64_t y) const { return y * m_Width + x; }
+
+    private:
+        std::vector<Real, DefaultInitAllocator<Real>> m_StorageA;
+        std::vector<Real, DefaultInitAllocator<Real>> m_StorageB;
+        std::shared_ptr<Util::MappedFile> m_Mapping;
+        Real* m_A = nullptr;
+        Real* m_B = nullptr;
+        int64_t m_Width = 0;
+        int64_t m_Height = 0;
+    };
+}
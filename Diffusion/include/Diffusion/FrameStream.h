@@ -0,0 +1,90 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Diffusion/Colormap.h"
+#include "Diffusion/Field.h"
+
+namespace Diffusion
+{
+    enum class FrameFormat
+    {
+        Raw, // Bare RGBA frames, e.g. ffmpeg -f rawvideo -pixel_format rgba -video_size WxH -i -
+        Y4M  // YUV4MPEG2 4:4:4, self describing, e.g. ffmpeg -i -
+    };
+
+    struct FrameStreamStats
+    {
+        uint64_t pushed = 0;       // Frames handed to Push
+        uint64_t written = 0;      // Frames written to the output
+        uint64_t dropped = 0;      // Frames discarded because the queue was full
+        uint64_t backPressured = 0; // Pushes that had to wait for a free slot
+        double waitMs = 0.0;       // Total time Push spent waiting
+    };
+
+    // Streams colorized frames to a file or stdout ("-").
+    // Push only copies the planes into a free slot of a bounded queue, colorizing,
+    // converting and writing happen on the stream's own thread. When the queue is
+    // full the frame is dropped, or with `block` the caller waits for a slot.
+    class FrameStream
+    {
+    public:
+        FrameStream() = default;
+        ~FrameStream();
+
+        FrameStream(const FrameStream&) = delete;
+        FrameStream& operator=(const FrameStream&) = delete;
+
+        bool Open(const std::string& path, FrameFormat format, int64_t width, int64_t height,
+                  int fps = 30, int queueDepth = 4, bool block = false);
+        // Returns false when the frame was dropped.
+        bool Push(const Field& field);
+        // Drains the queue, then closes the output.
+        void Close();
+        // The stream keeps its own copy, set it before the first Push.
+        void SetColormap(const Colormap& colormap);
+
+        FrameStreamStats GetStats();
+        inline bool IsOpen() const { return m_File != nullptr; }
+
+    private:
+        struct Slot
+        {
+            std::vector<Real> a;
+            std::vector<Real> b;
+        };
+
+        void writerLoop();
+        bool writeFrame(const Slot& slot);
+
+        FILE* m_File = nullptr;
+        FrameFormat m_Format = FrameFormat::Raw;
+        int64_t m_Width = 0;
+        int64_t m_Height = 0;
+        bool m_Block = false;
+
+        std::vector<Slot> m_Slots;
+        std::deque<int> m_Free;
+        std::deque<int> m_Ready;
+        std::mutex m_Mutex;
+        std::condition_variable m_ReadyCv;
+        std::condition_variable m_FreeCv;
+        bool m_Stop = false;
+        bool m_Failed = false;
+        FrameStreamStats m_Stats;
+
+        Colormap m_Colormap;
+        std::vector<uint32_t> m_Pixels;
+        std::vector<uint8_t> m_Yuv;
+        std::thread m_Writer;
+    };
+
+    bool ParseFrameFormat(const std::string& name, FrameFormat& format);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "Diffusion/Simulation.h"
+#include "Diffusion/Viewer.h"
+
+namespace Diffusion
+{
+    // Fixed size history for ImGui::PlotLines, oldest value at Offset().
+    class RollingPlot
+    {
+    public:
+        static constexpr int SIZE = 240;
+
+        void Push(float value);
+        inline const float* Values() const { return m_Values; }
+        inline int Offset() const { return m_Offset; }
+        inline float Last() const { return m_Values[(m_Offset + SIZE - 1) % SIZE]; }
+
+    private:
+        float m_Values[SIZE] = {};
+        int m_Offset = 0;
+    };
+
+    // ImGui overlay with throughput, per-worker timings, frame latency, memory use
+    // and a per-block cost heatmap drawn over the field. F1 toggles it.
+    class Hud
+    {
+    public:
+        void Init(sf::RenderWindow& window, int64_t cellsPerStep, bool visible);
+        void Shutdown();
+
+        // Returns true when ImGui consumed the event and the viewer shouldn't see it.
+        bool ProcessEvent(const sf::Event& event);
+
+        // Called when a step has been advanced, before the next one begins.
+        void RecordStep(const std::vector<WorkerTiming>& timings);
+        // Steps between frames and the step time the pacing works with
+        void RecordPacing(int stepsPerFrame, double stepMs);
+        // The newest step's pixels were uploaded, they show up at the next display.
+        void MarkStepUploaded();
+
+        void Update(sf::RenderWindow& window, sf::Time dt, const Viewer& viewer);
+        void Render(sf::RenderWindow& window);
+        // After window.display(), closes the latency measurement of the uploaded step.
+        void FramePresented();
+
+        inline bool Visible() const { return m_Visible; }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        void drawStats();
+        void drawHeatmap(const Viewer& viewer);
+
+        bool m_Initialized = false;
+        bool m_Visible = false;
+        bool m_ShowHeatmap = true;
+        bool m_ShowLog = false;
+        int64_t m_CellsPerStep = 0;
+
+        std::vector<WorkerTiming> m_Timings;
+        uint64_t m_Steps = 0;
+        uint64_t m_StepsInWindow = 0;
+        Clock::time_point m_WindowStart = Clock::now();
+        Clock::time_point m_LastStep = Clock::now();
+        Clock::time_point m_UploadedAt;
+        bool m_LatencyPending = false;
+
+        double m_StepsPerSecond = 0.0;
+        double m_Imbalance = 0.0;
+        double m_LatencyMs = 0.0;
+        int m_StepsPerFrame = 1;
+        double m_PacedStepMs = 0.0;
+        uint64_t m_Memory = 0;
+
+        RollingPlot m_StepsPlot;
+        RollingPlot m_StepMsPlot;
+        RollingPlot m_FrameMsPlot;
+        RollingPlot m_LatencyPlot;
+    };
+}
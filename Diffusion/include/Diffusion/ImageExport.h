@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Diffusion/Colormap.h"
+#include "Diffusion/Field.h"
+
+namespace Diffusion
+{
+    enum class ImageFormat
+    {
+        Png,
+        Tiff // Deflate strips with the horizontal predictor, BigTIFF past 4 GiB
+    };
+
+    struct ImageExportOptions
+    {
+        ImageFormat format = ImageFormat::Png;
+        int bandRows = 64; // Rows coloured and compressed together
+        int threads = 0;   // 0 uses every core
+        int window = 0;    // Bands in memory at a time, 0 is twice the threads
+        int effort = 16;   // Deflate hash chain, see Util::ZlibCompress
+    };
+
+    struct ImageExportStats
+    {
+        int64_t bands = 0;
+        uint64_t bytes = 0; // Of the file
+        double seconds = 0.0;
+        uint64_t bufferBytes = 0; // Allocated for bands, the memory the export needed besides the field
+    };
+
+    // Writes the field as an 8 bit RGB image coloured through `colormap`, without
+    // ever holding the whole image: the rows are cut into bands, workers colour,
+    // filter and compress bands independently (PNG: pieces of one deflate stream,
+    // TIFF: one strip each) and the calling thread writes them in order. At most
+    // `window` bands are in memory, whatever the size of the grid.
+    bool ExportImage(const std::string& path, const Field& field, const Colormap& colormap,
+                     const ImageExportOptions& options = {}, ImageExportStats* stats = nullptr);
+
+    bool ParseImageFormat(const std::string& name, ImageFormat& format);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Diffusion/Convergence.h"
+#include "Diffusion/Statistics.h"
+#include "Diffusion/Field.h"
+#include "Diffusion/Kernel.h"
+#include "Diffusion/Parallel.h"
+
+namespace Diffusion
+{
+    // Steps a field in place instead of into a second field.
+    //
+    // The interior rows are cut into bands that are swept top to bottom in parallel.
+    // Before any band writes, the old rows just outside every band (its halo) are
+    // saved. A band then copies each row before overwriting it, so the old values of
+    // the row above are always at hand in one of two rolling row buffers, and the row
+    // below is either still untouched or the saved halo. That's 8 rows of memory per
+    // band instead of a whole second field, with results identical to StepRegion.
+    class InPlaceStepper
+    {
+    public:
+        explicit InPlaceStepper(int64_t bandRows = 64);
+
+        // With a monitor or a collector the step is measured into their band slots,
+        // which they must have been configured for with BandRows()
+        void Step(Field& field, const Parameters& params, ThreadPool& pool,
+                  ConvergenceMonitor* monitor = nullptr, StatsCollector* stats = nullptr);
+
+        inline int64_t BandRows() const { return m_BandRows; }
+
+        // Bytes of the halo and row buffers
+        inline uint64_t BufferBytes() const { return (m_Halos.capacity() + m_Rows.capacity()) * sizeof(Real); }
+
+    private:
+        int64_t m_BandRows;
+        // Per band, each w values: A above, A below, B above, B below
+        std::vector<Real> m_Halos;
+        // Per band, each w values: two rolling rows of A, then of B
+        std::vector<Real> m_Rows;
+    };
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Diffusion/Field.h"
+
+namespace Diffusion
+{
+    struct Parameters
+    {
+        double dA = 1.0;
+        double dB = 0.5;
+        double feed = 0.055;
+        double kill = 0.062;
+    };
+
+    // How much a step changed a set of cells, over both planes.
+    struct StepChange
+    {
+        Real maxAbs = 0;
+        double sumSquares = 0.0;
+
+        inline void Merge(const StepChange& other)
+        {
+            maxAbs = maxAbs > other.maxAbs ? maxAbs : other.maxAbs;
+            sumSquares += other.sumSquares;
+        }
+    };
+
+    // Statistics of the values a step wrote. The values are clamped to [0, 1].
+    struct FieldStats
+    {
+        uint64_t cells = 0;
+        double sumA = 0.0;
+        double sumB = 0.0; // The total mass of B
+        Real minA = 1, maxA = 0;
+        Real minB = 1, maxB = 0;
+        uint64_t on = 0; // Cells with B above the "on" threshold
+
+        inline void Merge(const FieldStats& other)
+        {
+            cells += other.cells;
+            sumA += other.sumA;
+            sumB += other.sumB;
+            minA = minA < other.minA ? minA : other.minA;
+            maxA = maxA > other.maxA ? maxA : other.maxA;
+            minB = minB < other.minB ? minB : other.minB;
+            maxB = maxB > other.maxB ? maxB : other.maxB;
+            on += other.on;
+        }
+    };
+
+    // What StepRowMeasured collects, the sinks left null aren't measured.
+    struct RowMeasures
+    {
+        const int64_t* splits = nullptr; // Column segment i covers [splits[i], splits[i + 1])
+        int segments = 0;
+        StepChange* changes = nullptr;   // One per segment
+        FieldStats* stats = nullptr;     // Of the whole row
+        Real onThreshold = 0.5;
+    };
+
+    // What the outer ring of cells holds. The step never writes it, ApplyBoundary
+    // refreshes it from the interior after every step.
+    enum class Boundary
+    {
+        Fixed,    // Keeps its initial values
+        Periodic, // The opposite interior edge, the interior wraps around
+        Reflect   // The neighbouring interior cell, no flux across the edge
+    };
+
+    // One Gray-Scott Euler step of the cells [startX, endX) x [startY, endY) of `next`
+    // from `grid`, with the same 3x3 Laplacian and clamping as the original per cell
+    // code, in the same operation order. The region must not include the outer ring.
+    void StepRegion(const Field& grid, Field& next, const Parameters& params,
+                    int64_t startX, int64_t startY, int64_t endX, int64_t endY);
+
+    // The step of cells [startX, endX) of one row, from the old values of the row
+    // (mid) and of the rows above and below it, which may live anywhere. StepRegion
+    // is this for every row, the in place sweep feeds it saved copies.
+    void StepRow(const Real* upA, const Real* midA, const Real* downA,
+                 const Real* upB, const Real* midB, const Real* downB,
+                 Real* outA, Real* outB, const Parameters& params, int64_t startX, int64_t endX);
+    // StepRow over the segments of `measures`, gathering the change of every cell
+    // and statistics of the new values while they are still in registers.
+    void StepRowMeasured(const Real* upA, const Real* midA, const Real* downA,
+                         const Real* upB, const Real* midB, const Real* downB,
+                         Real* outA, Real* outB, const Parameters& params, const RowMeasures& measures);
+
+    void ApplyBoundary(Field& field, Boundary boundary);
+    bool ParseBoundary(const std::string& name, Boundary& boundary);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "Diffusion/Field.h"
+#include "Diffusion/Kernel.h"
+#include "Utils/MappedFile.h"
+
+namespace Diffusion
+{
+    // Simulation on fields that don't fit in memory.
+    //
+    // Both fields (current and next) live in sparse files mapped into the address
+    // space, planar and row-major with 64-bit offsets, so the rest of the code sees
+    // them as ordinary Fields. A step walks the grid in bands of rows sized from the
+    // memory budget: while a band is computed, the next one (plus its halo rows) is
+    // paged in on a background thread, and finished rows are scheduled for write back
+    // and dropped from the working set. Only the band, the halo rows and the band
+    // being prefetched are resident at a time.
+    class OutOfCoreSimulation
+    {
+    public:
+        OutOfCoreSimulation() = default;
+        ~OutOfCoreSimulation();
+
+        OutOfCoreSimulation(const OutOfCoreSimulation&) = delete;
+        OutOfCoreSimulation& operator=(const OutOfCoreSimulation&) = delete;
+
+        // Creates the two backing files in `directory`, initialized to A = 1, B = 0.
+        bool Create(const std::string& directory, int64_t width, int64_t height, uint64_t memoryBudget, int threads = 0);
+        // Unmaps and deletes the backing files.
+        void Close();
+
+        void Step(const Parameters& params);
+
+        inline Field& Current() { return m_Fields[m_Current]; }
+        inline int64_t BandRows() const { return m_BandRows; }
+
+    private:
+        // Plane offsets (in bytes) of rows [y0, y1) of either file
+        uint64_t rowOffset(int64_t y) const;
+        uint64_t planeBytes() const;
+        void advise(int file, int64_t y0, int64_t y1, Util::MappedFile::Advice advice);
+        void prefetch(int file, int64_t y0, int64_t y1);
+        void release(int file, int64_t y0, int64_t y1, bool written);
+
+        Field m_Fields[2];
+        std::shared_ptr<Util::MappedFile> m_Files[2];
+        std::string m_Paths[2];
+        int m_Current = 0;
+        int64_t m_BandRows = 0;
+        int m_Threads = 0;
+    };
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Diffusion
+{
+    // Runs f(0) .. f(count - 1) on up to `threads` threads (0 uses every core),
+    // the calling thread included. Items are handed out one at a time.
+    template <class F>
+    void ParallelFor(uint32_t count, int threads, F&& f)
+    {
+        if (threads <= 0)
+            threads = (int)std::max(1u, std::thread::hardware_concurrency());
+        threads = (int)std::min<uint32_t>((uint32_t)threads, count);
+        std::atomic<uint32_t> nextIndex{0};
+        auto work = [&]() {
+            for (uint32_t i = nextIndex++; i < count; i = nextIndex++)
+                f(i);
+        };
+        std::vector<std::thread> pool;
+        for (int t = 1; t < threads; t++)
+            pool.emplace_back(work);
+        work();
+        for (auto& thread : pool)
+            thread.join();
+    }
+
+    // Computes map(i) for every item in parallel, then folds the results in index
+    // order, so the result never depends on the thread count or the scheduling.
+    template <class T, class Map, class Combine>
+    T ParallelReduce(uint32_t count, int threads, T init, Map&& map, Combine&& combine)
+    {
+        std::vector<T> partials(count);
+        ParallelFor(count, threads, [&](uint32_t i) { partials[i] = map(i); });
+        for (const T& partial : partials)
+            init = combine(init, partial);
+        return init;
+    }
+
+    // ParallelFor on threads that stay alive between calls, for callers that run many
+    // short loops (every step of a batch of scenarios) and shouldn't pay for thread
+    // creation each time. One loop at a time, from one thread at a time.
+    class ThreadPool
+    {
+    public:
+        // `threads` counts the calling thread, 0 uses every core
+        explicit ThreadPool(int threads = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // Same contract as ParallelFor
+        void For(uint32_t count, const std::function<void(uint32_t)>& f);
+        inline int Threads() const { return (int)m_Threads.size() + 1; }
+
+    private:
+        void workerLoop();
+        void runItems();
+
+        std::vector<std::thread> m_Threads;
+        std::mutex m_Mutex;
+        std::condition_variable m_WakeCv;
+        std::condition_variable m_DoneCv;
+        const std::function<void(uint32_t)>* m_Job = nullptr;
+        uint32_t m_Count = 0;
+        std::atomic<uint32_t> m_NextIndex{0};
+        uint64_t m_Generation = 0;
+        int m_Busy = 0;
+        bool m_Stop = false;
+    };
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+namespace Diffusion
+{
+    // Packs a pixel the way sf::Texture::update(const Uint8*) reads it: bytes R, G, B, A.
+    inline uint32_t PackRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255)
+    {
+        return (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16) | ((uint32_t)a << 24);
+    }
+
+    // Row-major RGBA image aligned to a cache line, uploaded to the GPU as is.
+    // Pixels are addressed as uint32_t in PackRGBA's byte order (little endian).
+    class PixelBuffer
+    {
+    public:
+        void Create(int64_t width, int64_t height)
+        {
+            m_Pixels.reset((uint32_t*)::operator new(width * height * sizeof(uint32_t), std::align_val_t(ALIGNMENT)));
+            m_Width = width;
+            m_Height = height;
+            std::fill_n(m_Pixels.get(), width * height, PackRGBA(0, 0, 0));
+        }
+
+        inline uint32_t* Pixels() { return m_Pixels.get(); }
+        inline const uint32_t* Pixels() const { return m_Pixels.get(); }
+        inline uint32_t* Row(int64_t y) { return m_Pixels.get() + y * m_Width; }
+        inline const uint8_t* Data() const { return (const uint8_t*)m_Pixels.get(); }
+
+        inline int64_t Width() const { return m_Width; }
+        inline int64_t Height() const { return m_Height; }
+
+    private:
+        static constexpr size_t ALIGNMENT = 64;
+
+        struct AlignedDelete
+        {
+            void operator()(uint32_t* p) const { ::operator delete(p, std::align_val_t(ALIGNMENT)); }
+        };
+
+        std::unique_ptr<uint32_t[], AlignedDelete> m_Pixels;
+        int64_t m_Width = 0;
+        int64_t m_Height = 0;
+    };
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Diffusion
+{
+    // The pieces of a PNG file the image and animation writers share. The image
+    // data itself is deflate compressed with Util::ZlibCompress or Util::Deflate.
+    inline constexpr uint8_t PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+    void PutBE32(std::vector<uint8_t>& out, uint32_t value);
+    // Length, type, `data` and the CRC of type and data
+    void PutPngChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size);
+    // The IHDR of 8 bit RGB
+    void PutPngHeader(std::vector<uint8_t>& out, int64_t width, int64_t height);
+    // Filters a row of `bytes` bytes of RGB against the row above (nullptr for
+    // the first), writing the filter type and the filtered bytes to `out`
+    void FilterPngRow(const uint8_t* row, const uint8_t* above, int64_t bytes, uint8_t* out, std::vector<uint8_t>& scratch);
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Diffusion/Colormap.h"
+#include "Diffusion/Convergence.h"
+#include "Diffusion/Field.h"
+#include "Diffusion/FrameStream.h"
+#include "Diffusion/ImageExport.h"
+#include "Diffusion/InPlace.h"
+#include "Diffusion/Kernel.h"
+#include "Diffusion/Parallel.h"
+#include "Diffusion/Snapshot.h"
+#include "Diffusion/Statistics.h"
+
+namespace Diffusion
+{
+    // Parameters from `step` on, interpolated linearly towards the next key.
+    struct ParameterKey
+    {
+        uint64_t step = 0;
+        Parameters params;
+    };
+
+    // A square of B = 1, A = 0 with half side `length`, like --popX/--popY/--length.
+    struct Seed
+    {
+        int64_t x = 0;
+        int64_t y = 0;
+        int64_t length = 25;
+    };
+
+    struct ScenarioOutput
+    {
+        std::string path;
+        uint64_t every = 0; // Steps between outputs, 0 disables the output
+    };
+
+    // One job of a batch, read from a text file with one setting per line and
+    // # comments:
+    //
+    //   name      spots
+    //   size      512 512
+    //   precision double                   # The only precision this build steps in
+    //   boundary  periodic                 # fixed, periodic or reflect
+    //   params    0     1.0 0.5 0.055 0.062 # step dA dB feed kill, one line per key
+    //   params    20000 1.0 0.5 0.030 0.057
+    //   seed      256 256 25               # x y length, one line per seed
+    //   steps     40000
+    //   snapshot  out/spots-{}.rds 1000    # path pattern, every
+    //   frames    out/spots.y4m 20 y4m     # path, every, raw or y4m
+    //   image     out/spots.png png        # path of the last step as an image, png or tiff
+    //   stats     out/spots.csv 100 csv 0.5 # path, every [csv|binary] [B above which a cell is on]
+    //   converge  1e-7 100 3               # tolerance, every, window [regions per axis]
+    //
+    // Without params lines the defaults are used, without seed lines a single seed
+    // sits in the centre.
+    struct Scenario
+    {
+        std::string name;
+        int64_t width = 200;
+        int64_t height = 200;
+        Boundary boundary = Boundary::Fixed;
+        std::vector<ParameterKey> parameters; // Sorted by step
+        std::vector<Seed> seeds;
+        uint64_t steps = 1000;
+        ScenarioOutput snapshot;
+        ScenarioOutput frames;
+        FrameFormat frameFormat = FrameFormat::Y4M;
+        std::string image; // Empty for none
+        ImageFormat imageFormat = ImageFormat::Png;
+        ScenarioOutput stats;
+        StatsFormat statsFormat = StatsFormat::Csv;
+        Real onThreshold = 0.5;
+        ConvergenceOptions convergence; // Stops the run early once the field is steady
+
+        // Parameters of the step from `step` to `step` + 1
+        Parameters ParametersAt(uint64_t step) const;
+    };
+
+    bool LoadScenario(const std::string& path, Scenario& scenario);
+
+    struct ScenarioResult
+    {
+        uint64_t steps = 0;
+        double seconds = 0.0;
+        bool completed = false; // False when a termination request stopped the run early
+        uint64_t convergedAt = 0; // Step the field became steady when convergence stopped the run, else 0
+    };
+
+    // Runs scenarios one after the other. The fields, the snapshot buffers and the
+    // thread pool are kept between runs, so a batch of short jobs only pays for
+    // them once.
+    class ScenarioRunner
+    {
+    public:
+        struct Options
+        {
+            int threads = 0; // 0 uses every core
+            SnapshotOptions snapshot;
+            int fps = 30;
+            int frameQueue = 4;
+            bool inPlace = false; // Step without the second field, see InPlaceStepper
+        };
+
+        explicit ScenarioRunner(const Options& options);
+
+        // The frames of every scenario are coloured with `colormap`
+        inline void SetColormap(const Colormap& colormap) { m_Colormap = colormap; }
+
+        bool Run(const Scenario& scenario, ScenarioResult& result);
+        // The field after the last step of the last run
+        inline const Field& Current() const { return m_Grid; }
+        // Convergence of the last run, per region too
+        inline const ConvergenceMonitor& Convergence() const { return m_Convergence; }
+
+    private:
+        void seed(const Scenario& scenario);
+        void advance(const Parameters& params, Boundary boundary, ConvergenceMonitor* monitor, StatsCollector* stats);
+
+        Options m_Options;
+        ThreadPool m_Pool;
+        Field m_Grid;
+        Field m_Next;
+        SnapshotWriter m_Snapshots;
+        FrameStream m_Frames;
+        Colormap m_Colormap;
+        InPlaceStepper m_InPlace;
+        ConvergenceMonitor m_Convergence;
+        StatsCollector m_Stats;
+        StatsWriter m_StatsWriter;
+    };
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Diffusion/Capture.h"
+#include "Diffusion/Field.h"
+#include "Diffusion/Kernel.h"
+#include "Diffusion/Span.h"
+#include "Diffusion/Statistics.h"
+
+namespace Diffusion
+{
+    // What a worker reports at the end of each step.
+    struct WorkerTiming
+    {
+        int64_t x0 = 0, y0 = 0, x1 = 0, y1 = 0; // Cells the worker owns
+        double computeMs = 0.0; // Stepping the block, row callbacks included
+        double waitMs = 0.0;    // Idle between finishing the previous step and starting this one
+    };
+
+    // The in-memory simulation: the current and next fields, the parameters and a
+    // worker per block of the grid that stays alive between steps. It has no
+    // window, the viewer is one client of it, a service embedding the engine is
+    // another.
+    //
+    // Step(n) runs whole steps and returns. Callers with a loop of their own
+    // (the viewer draws while a step runs) use Begin, Ready and Advance instead:
+    // Begin starts a step from the current field, Advance makes it the current
+    // field once Ready. The current field is only read during a step, so A(), B()
+    // and Current() can be read at any time between Advance and the next Advance,
+    // and are only written while no step is running.
+    //
+    // RequestCapture copies the current field while the simulation keeps running,
+    // for checkpoints, screenshots or analysis; see Capture.
+    //
+    // One thread drives the simulation, Pause and Resume may come from any.
+    class Simulation
+    {
+    public:
+        // Called by the workers for every row they stepped, `field` is the new field
+        // and [x0, x1) the columns of row y the worker wrote. Colouring the row
+        // here uses it while it's still in cache.
+        using RowCallback = std::function<void(const Field& field, int64_t y, int64_t x0, int64_t x1)>;
+
+        Simulation() = default;
+        ~Simulation();
+
+        Simulation(const Simulation&) = delete;
+        Simulation& operator=(const Simulation&) = delete;
+
+        // A width x height grid at A = 1, B = 0 stepped by `threads` workers, 0 uses every core
+        bool Create(int64_t width, int64_t height, int threads = 0);
+        // Continues from `field` (a restored checkpoint), the step count from `step`
+        bool Create(Field field, uint64_t step, int threads = 0);
+        // Finishes the step in flight and the captures, stops the workers and frees the fields
+        void Destroy();
+
+        // Set A = 0, B = 1 on the square of cells [x - radius, x + radius) in both directions
+        void Seed(int64_t x, int64_t y, int64_t radius);
+        // Taken by the next step begun
+        void SetParameters(const Parameters& params);
+        void SetBoundary(Boundary boundary);
+        // FieldStats of every `every`-th step, gathered by the workers while they
+        // write it. 0 turns them off.
+        void SetStatsEvery(int every);
+        // Only while no step is running
+        void SetRowCallback(RowCallback callback);
+
+        // Keeps the cells both sizes share, the new ones start at A = 1, B = 0. A step
+        // in flight is finished and advanced first, the captures are completed.
+        bool Resize(int64_t width, int64_t height);
+
+        // Runs `count` steps and returns how many ran, fewer when paused meanwhile
+        uint64_t Step(uint64_t count = 1);
+
+        // False while paused or when a step has begun and not been advanced.
+        // With `rows` false the step doesn't call the row callback, for steps
+        // nobody will look at.
+        bool Begin(bool rows = true);
+        // The step begun is done
+        bool Ready();
+        // Blocks until Ready
+        void Wait();
+        // Blocks until Ready or `deadline`, returns Ready. Without a step begun it
+        // sleeps until `deadline`.
+        bool WaitUntil(std::chrono::steady_clock::time_point deadline);
+        // Makes the finished step the current field. True when it gathered statistics.
+        bool Advance();
+
+        // Lets the step in flight finish, Begin refuses until Resume
+        void Pause();
+        void Resume();
+        bool Paused();
+
+        // A copy of the current field at the current step, made in the background:
+        // returns at once, `done` runs on the capture thread when the copy is
+        // complete. Captures complete one at a time in the order requested. Writing
+        // the planes through A(), B() or Current() while one is pending isn't
+        // seen by it.
+        std::shared_ptr<const Capture> RequestCapture(Capture::Callback done = {});
+        // Blocks until every capture requested is done
+        void WaitCaptures();
+
+        inline const Parameters& GetParameters() const { return m_Params; }
+        inline int64_t Width() const { return m_Grid.Width(); }
+        inline int64_t Height() const { return m_Grid.Height(); }
+        inline uint64_t StepCount() const { return m_Step; }
+        inline int Workers() const { return (int)m_Threads.size(); }
+
+        // The current planes, row-major Width() x Height(), no copies
+        inline Span<const Real> A() const { return {m_Grid.A(), (size_t)m_Grid.Size()}; }
+        inline Span<const Real> B() const { return {m_Grid.B(), (size_t)m_Grid.Size()}; }
+        inline Span<Real> A() { return {m_Grid.A(), (size_t)m_Grid.Size()}; }
+        inline Span<Real> B() { return {m_Grid.B(), (size_t)m_Grid.Size()}; }
+        inline const Field& Current() const { return m_Grid; }
+        inline Field& Current() { return m_Grid; }
+
+        // Of the last step advanced
+        inline const std::vector<WorkerTiming>& Timings() const { return m_Timings; }
+        inline const FieldStats& Stats() const { return m_Stats; }
+
+    private:
+        void start(int threads);
+        void stop();
+        void workerLoop(int index);
+        void waitIdle(std::unique_lock<std::mutex>& lk);
+        void captureLoop();
+        // Before the current field's cells [x0, x1) x [y0, y1) are written outside a step
+        void protect(int64_t x0, int64_t y0, int64_t x1, int64_t y1);
+        void stopCaptures();
+
+        Field m_Grid;
+        Field m_Next;
+        Parameters m_Params;
+        Parameters m_StepParams; // What the workers use, copied by Begin
+        bool m_StepRows = true;  // Whether the workers call m_RowCallback, set by Begin
+        Boundary m_Boundary = Boundary::Fixed;
+        uint64_t m_Step = 0;
+        int m_ThreadCount = 0;
+
+        StatsCollector m_Collector;
+        FieldStats m_Stats;
+        int m_StatsEvery = 0;
+        bool m_Sample = false;
+        RowCallback m_RowCallback;
+
+        std::vector<std::thread> m_Threads;
+        std::vector<WorkerTiming> m_Timings;
+        std::mutex m_Mutex;
+        std::condition_variable m_WakeCv;
+        std::condition_variable m_DoneCv;
+        uint64_t m_Generation = 0;
+        int m_Busy = 0;
+        bool m_Pending = false; // Begun and not advanced
+        bool m_Paused = false;
+        bool m_Stop = false;
+
+        // Requested and not done, oldest first. The capture thread completes the front.
+        std::deque<std::shared_ptr<Capture>> m_Captures;
+        std::thread m_CaptureThread;
+        std::mutex m_CaptureMutex;
+        std::condition_variable m_CaptureCv;
+        bool m_CaptureStop = false;
+        // The captures whose source the step in flight writes, set by Begin
+        std::vector<std::shared_ptr<Capture>> m_Protect;
+    };
+}
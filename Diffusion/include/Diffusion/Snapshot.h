@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Diffusion/Field.h"
+#include "Utils/MappedFile.h"
+
+namespace Diffusion
+{
+    // Compressed, lossy snapshot of a field.
+    //
+    // Values are quantized to multiples of `precision`, the field is cut into square
+    // tiles and every tile is coded on its own: the quantized values are replaced by
+    // their difference to a prediction (the previous row, or the same cell in the
+    // previous snapshot) and the residuals are Rice coded in blocks of 32 with a
+    // per-block parameter. Tiles are encoded and decoded in parallel and any tile
+    // can be decoded without touching the others.
+    //
+    // File layout: SnapshotHeader, SnapshotTile[tileCount], tile payloads.
+    struct SnapshotHeader
+    {
+        char magic[4];          // "RDSN"
+        uint32_t version;
+        uint32_t tileSize;
+        uint32_t tileCount;
+        int64_t width;
+        int64_t height;
+        uint64_t step;
+        uint64_t referenceStep; // Step of the snapshot temporal tiles were predicted from
+        double precision;
+        uint32_t flags;
+        uint32_t crcHeader;
+    };
+    static_assert(sizeof(SnapshotHeader) == 64, "SnapshotHeader is part of the file format");
+
+    struct SnapshotTile
+    {
+        uint64_t offset; // From the start of the file
+        uint32_t size;
+        uint32_t crc;
+    };
+
+    constexpr uint32_t SNAPSHOT_VERSION = 1;
+    constexpr uint32_t SNAPSHOT_TEMPORAL = 1; // Some tiles need the reference snapshot to decode
+
+    struct SnapshotOptions
+    {
+        double precision = 1e-4;
+        int tileSize = 256;
+        int threads = 0;      // 0 uses every core
+        int keyframeEvery = 0; // Snapshots between self contained ones, 0 never predicts from the previous snapshot
+    };
+
+    class SnapshotWriter
+    {
+    public:
+        void Configure(const SnapshotOptions& options);
+        bool Write(const std::string& path, const Field& field, uint64_t step);
+
+        // Bytes of the last snapshot written, for reporting the compression ratio.
+        inline uint64_t LastSize() const { return m_LastSize; }
+
+    private:
+        SnapshotOptions m_Options;
+        std::vector<int32_t> m_RefA;
+        std::vector<int32_t> m_RefB;
+        uint64_t m_RefStep = 0;
+        int m_SinceKeyframe = -1;
+        uint64_t m_LastSize = 0;
+    };
+
+    // Snapshot paths are fmt patterns of the step, e.g. "out/spots-{:06}.rds". True
+    // when `pattern` formats and names a different file for every step.
+    bool ValidSnapshotPattern(const std::string& pattern);
+
+    class SnapshotReader
+    {
+    public:
+        bool Open(const std::string& path);
+        void Close();
+
+        inline const SnapshotHeader& Header() const { return m_Header; }
+        inline bool NeedsReference() const { return (m_Header.flags & SNAPSHOT_TEMPORAL) != 0; }
+
+        // Decodes one tile into `field`, which must have the snapshot's dimensions.
+        // `reference` is the decoded snapshot at Header().referenceStep, only needed
+        // when NeedsReference().
+        bool DecodeTile(uint32_t tile, Field& field, const Field* reference = nullptr) const;
+        // Decodes every tile in parallel, creating `field` if needed.
+        bool Decode(Field& field, const Field* reference = nullptr, int threads = 0) const;
+
+    private:
+        Util::MappedFile m_File;
+        SnapshotHeader m_Header{};
+        const SnapshotTile* m_Tiles = nullptr;
+    };
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+
+namespace Diffusion
+{
+    // A pointer and a length, the part of C++20's std::span the API hands out.
+    // It doesn't own the elements, they stay valid as long as their owner says.
+    template <class T>
+    class Span
+    {
+    public:
+        constexpr Span() = default;
+        constexpr Span(T* data, size_t size) : m_Data(data), m_Size(size) {}
+
+        constexpr T* data() const { return m_Data; }
+        constexpr size_t size() const { return m_Size; }
+        constexpr bool empty() const { return m_Size == 0; }
+        constexpr T& operator[](size_t i) const { return m_Data[i]; }
+        constexpr T* begin() const { return m_Data; }
+        constexpr T* end() const { return m_Data + m_Size; }
+
+        // Elements [offset, offset + count)
+        constexpr Span subspan(size_t offset, size_t count) const { return Span(m_Data + offset, count); }
+
+    private:
+        T* m_Data = nullptr;
+        size_t m_Size = 0;
+    };
+}
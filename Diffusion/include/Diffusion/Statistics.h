@@ -0,0 +1,106 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Diffusion/Convergence.h"
+#include "Diffusion/Kernel.h"
+
+namespace Diffusion
+{
+    // Rows of a band: enough to amortize handing it out, few enough to balance
+    constexpr int64_t BAND_ROWS = 16;
+
+    // Gathers FieldStats during a step: each band of rows accumulates into its own
+    // slot while it writes the new values, EndStep folds the slots in order. The
+    // bands must not depend on the thread count, or the sums would.
+    class StatsCollector
+    {
+    public:
+        void Configure(uint32_t bands, Real onThreshold);
+
+        // Before a measured step, clears every slot
+        void BeginStep();
+        inline uint32_t Bands() const { return (uint32_t)m_Bands.size(); }
+        inline FieldStats* BandStats(uint32_t band) { return &m_Bands[band]; }
+        inline Real OnThreshold() const { return m_OnThreshold; }
+        FieldStats EndStep() const;
+
+    private:
+        std::vector<FieldStats> m_Bands;
+        Real m_OnThreshold = 0.5;
+    };
+
+    // The measures of one band of a step, either sink may be null. `whole` is the
+    // segment used without a monitor, the interior columns {1, width - 1}.
+    RowMeasures BandMeasures(ConvergenceMonitor* monitor, StatsCollector* stats, uint32_t band, const int64_t* whole);
+
+    enum class StatsFormat
+    {
+        Csv,
+        Binary // StatsFileHeader followed by one StatsFileRecord per sample
+    };
+
+    struct StatsFileHeader
+    {
+        char magic[4]; // "RDST"
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t reserved;
+    };
+    static_assert(sizeof(StatsFileHeader) == 16, "StatsFileHeader is part of the file format");
+
+    struct StatsFileRecord
+    {
+        uint64_t step;
+        double seconds;
+        uint64_t cells;
+        uint64_t on;
+        double sumA, sumB;
+        double minA, maxA;
+        double minB, maxB;
+    };
+    static_assert(sizeof(StatsFileRecord) == 80, "StatsFileRecord is part of the file format");
+
+    constexpr uint32_t STATS_VERSION = 1;
+
+    // Writes the statistics time series on its own thread, Push only queues the
+    // sample so the step never waits for the disk.
+    class StatsWriter
+    {
+    public:
+        StatsWriter() = default;
+        ~StatsWriter();
+
+        StatsWriter(const StatsWriter&) = delete;
+        StatsWriter& operator=(const StatsWriter&) = delete;
+
+        bool Open(const std::string& path, StatsFormat format);
+        void Push(uint64_t step, double seconds, const FieldStats& stats);
+        // Drains the queue, then closes the file. False if anything failed to write.
+        bool Close();
+        inline bool IsOpen() const { return m_File != nullptr; }
+
+    private:
+        void writerLoop();
+        bool writeRecord(const StatsFileRecord& record);
+
+        FILE* m_File = nullptr;
+        std::string m_Path;
+        StatsFormat m_Format = StatsFormat::Csv;
+        std::deque<StatsFileRecord> m_Queue;
+        std::mutex m_Mutex;
+        std::condition_variable m_QueueCv;
+        bool m_Stop = false;
+        bool m_Failed = false;
+        std::thread m_Writer;
+    };
+
+    bool ParseStatsFormat(const std::string& name, StatsFormat& format);
+}
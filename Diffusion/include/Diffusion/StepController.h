@@ -0,0 +1,76 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace Diffusion
+{
+    enum class PacingMode
+    {
+        FrameRate,    // As many steps between frames as fit in the frame budget
+        StepRate,     // A fixed number of steps per second, frames at the display rate
+        MaxThroughput // Steps never wait, a frame now and then
+    };
+
+    // Decides how many steps run between presented frames. The render loop asks it
+    // after every step whether to present, and between steps whether a frame is due
+    // anyway so panning stays smooth while a step is slow.
+    //
+    // In FrameRate mode the step time (as the slowest worker measured it) and the
+    // time a frame takes (upload, draw, display) are tracked as moving averages, and
+    // the steps per frame are what fits in the frame budget once the frame is paid for.
+    class StepController
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        // `target` is frames per second for FrameRate, steps per second for StepRate
+        void Configure(PacingMode mode, double target);
+
+        // May the finished step be swapped in now, false while StepRate is ahead
+        bool MayStep(Clock::time_point now);
+        // Before a step begins: whether StepDone is expected to present it, from the
+        // steps per frame, the step time and the frame deadline. Only a step expected
+        // to be presented needs colouring.
+        bool WillPresent(Clock::time_point now) const;
+        // When the render loop has something to do again if no step finishes: the
+        // frame deadline, or sooner when StepRate earns the credit for the next step
+        Clock::time_point WakeAt(Clock::time_point now) const;
+        // A step that took `stepMs` was swapped in, returns true when it should be presented
+        bool StepDone(Clock::time_point now, double stepMs);
+        // No step finished, returns true when a frame is due regardless
+        bool FrameDue(Clock::time_point now);
+        // After display, closes the frame decided on by StepDone or FrameDue
+        void FramePresented(Clock::time_point now);
+
+        inline int StepsPerFrame() const { return m_StepsPerFrame; }
+        inline double StepMs() const { return m_StepMs; }
+        inline double FrameMs() const { return m_FrameMs; }
+        inline PacingMode Mode() const { return m_Mode; }
+
+    private:
+        double msSince(Clock::time_point then, Clock::time_point now) const;
+        // Steps StepRate may run at `now`
+        double creditAt(Clock::time_point now) const;
+        // Until StepRate may run the next step
+        double msUntilCredit(Clock::time_point now) const;
+        bool present(Clock::time_point now);
+        void updateStepsPerFrame();
+
+        PacingMode m_Mode = PacingMode::FrameRate;
+        double m_Target = 60.0;
+        double m_FrameBudgetMs = 1000.0 / 60.0;
+
+        Clock::time_point m_FrameStart = Clock::now();  // Last present
+        Clock::time_point m_PresentStart = Clock::now(); // When the current frame was decided on
+        int m_StepsThisFrame = 0;
+        int m_StepsPerFrame = 1;
+        double m_StepMs = 0.0;
+        double m_FrameMs = 0.0;
+        double m_Credit = 0.0; // Steps StepRate may still run
+        Clock::time_point m_CreditAt = Clock::now();
+    };
+
+    bool ParsePacingMode(const std::string& name, PacingMode& mode);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "Diffusion/PixelBuffer.h"
+
+namespace Diffusion
+{
+    // Shows a window sized view of a colorized field of any size.
+    // Level 0 of the mip pyramid is the PixelBuffer the workers colour into, every
+    // further level halves the previous one. Workers mark the tiles they touched and
+    // Refresh only rebuilds those. Upload sends just the visible part of the level
+    // closest to screen resolution, so the display cost follows the window size.
+    //
+    // Controls: mouse wheel or +/- zooms, left drag or the arrow keys pan, Home fits.
+    class Viewer
+    {
+    public:
+        static constexpr int TILE_SIZE = 256;
+
+        void Create(const PixelBuffer& pixels, sf::Vector2u screen, int threads);
+
+        // Thread safe, called by the workers after colouring the rectangle.
+        void MarkDirty(int64_t x0, int64_t y0, int64_t x1, int64_t y1);
+        // Downsamples the dirty tiles. Level 0 must not be written meanwhile.
+        void Refresh();
+        // With `pixelsStable` false level 0 may be being written, a zoomed in view is
+        // then shown from level 1 until the next stable upload.
+        void Upload(bool pixelsStable);
+
+        // Returns true when the event changed the view.
+        bool HandleEvent(const sf::Event& event, sf::RenderWindow& window);
+        void Draw(sf::RenderTarget& target);
+        void Fit();
+        // Window position of the corner of cell (x, y)
+        sf::Vector2f CellToScreen(double x, double y) const;
+
+        inline bool NeedsUpload() const { return m_NeedsUpload; }
+        inline int Level() const { return m_Level; }
+        inline double Zoom() const { return m_Zoom; }
+        inline int LevelCount() const { return (int)m_Levels.size() + 1; }
+
+    private:
+        struct MipLevel
+        {
+            int64_t width = 0;
+            int64_t height = 0;
+            std::vector<uint32_t> pixels;
+        };
+
+        inline int64_t levelWidth(int level) const { return level == 0 ? m_Pixels->Width() : m_Levels[level - 1].width; }
+        inline int64_t levelHeight(int level) const { return level == 0 ? m_Pixels->Height() : m_Levels[level - 1].height; }
+        const uint32_t* levelPixels(int level) const;
+        void downsample(int level, int64_t x0, int64_t y0, int64_t x1, int64_t y1);
+        void clampView();
+
+        const PixelBuffer* m_Pixels = nullptr;
+        std::vector<MipLevel> m_Levels; // Levels 1 and up
+        int m_Threads = 0;
+
+        int64_t m_TilesX = 0;
+        int64_t m_TilesY = 0;
+        std::unique_ptr<std::atomic<uint8_t>[]> m_Dirty;
+        bool m_CoarseDirty = false; // Levels coarser than a tile need a full rebuild
+
+        // View: the cell at the window centre and window pixels per cell
+        double m_CenterX = 0.0;
+        double m_CenterY = 0.0;
+        double m_Zoom = 1.0;
+        sf::Vector2u m_Screen;
+        bool m_Dragging = false;
+        sf::Vector2i m_DragFrom;
+
+        bool m_NeedsUpload = true;
+        int m_Level = 0;
+        int64_t m_RegionX = 0; // Uploaded region, in pixels of m_Level
+        int64_t m_RegionY = 0;
+        int64_t m_RegionW = 0;
+        int64_t m_RegionH = 0;
+        std::vector<uint32_t> m_Staging;
+        sf::Texture m_Texture;
+        sf::Sprite m_Sprite;
+    };
+}
@@ -0,0 +1,621 @@
+#include "Diffusion/Animation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "Diffusion/Png.h"
+#include "Utils/Checksum.h"
+#include "Utils/Deflate.h"
+#include "Utils/Logger.h"
+#include "Utils/Trace.h"
+
+namespace Diffusion
+{
+    // Table entries between two GIF colours
+    static constexpr int GIF_STEP = Colormap::LUT_STEPS / 255;
+    static_assert(GIF_STEP * 255 == Colormap::LUT_STEPS, "The 256 GIF colours are table entries");
+
+    // A single frame chunk has to stay below the PNG chunk limit of 2^31 - 1 bytes
+    static constexpr int64_t MAX_APNG_FRAME = int64_t(1) << 30;
+
+    static const uint8_t BAYER[8][8] = {
+        {0, 32, 8, 40, 2, 34, 10, 42},  {48, 16, 56, 24, 50, 18, 58, 26}, {12, 44, 4, 36, 14, 46, 6, 38},
+        {60, 28, 52, 20, 62, 30, 54, 22}, {3, 35, 11, 43, 1, 33, 9, 41},  {51, 19, 59, 27, 49, 17, 57, 25},
+        {15, 47, 7, 39, 13, 45, 5, 37},  {63, 31, 55, 23, 61, 29, 53, 21}};
+
+    static void putLE16(std::vector<uint8_t>& out, uint32_t value)
+    {
+        out.push_back((uint8_t)value);
+        out.push_back((uint8_t)(value >> 8));
+    }
+
+    // The GIF colour index of every pixel
+    static void quantize(const float* positions, int64_t width, int64_t height, Dither dither, std::vector<uint8_t>& indices)
+    {
+        indices.resize(width * height);
+        if (dither == Dither::None)
+        {
+            // Table()[(int)position], as the viewer colours it, in the 256 colour table
+            for (int64_t i = 0; i < width * height; i++)
+                indices[i] = (uint8_t)((int)positions[i] / GIF_STEP);
+        }
+        else if (dither == Dither::Ordered)
+        {
+            // Rounds up with a probability of the fraction past the colour below
+            for (int64_t y = 0; y < height; y++)
+            {
+                for (int64_t x = 0; x < width; x++)
+                {
+                    const float threshold = (BAYER[y & 7][x & 7] + 0.5f) / 64.0f;
+                    const int index = (int)(positions[y * width + x] / GIF_STEP + threshold);
+                    indices[y * width + x] = (uint8_t)std::min(index, 255);
+                }
+            }
+        }
+        else
+        {
+            // Error of this row and the next, one cell of margin on each side
+            std::vector<float> error(width + 2, 0.0f), below(width + 2, 0.0f);
+            for (int64_t y = 0; y < height; y++)
+            {
+                for (int64_t x = 0; x < width; x++)
+                {
+                    const float value = positions[y * width + x] / GIF_STEP + error[x + 1];
+                    const int index = std::clamp((int)std::floor(value + 0.5f), 0, 255);
+                    indices[y * width + x] = (uint8_t)index;
+                    const float e = value - index;
+                    error[x + 2] += e * (7.0f / 16.0f);
+                    below[x] += e * (3.0f / 16.0f);
+                    below[x + 1] += e * (5.0f / 16.0f);
+                    below[x + 2] += e * (1.0f / 16.0f);
+                }
+                error.swap(below);
+                std::fill(below.begin(), below.end(), 0.0f);
+            }
+        }
+    }
+
+    // GIF LZW codes are packed from the least significant bit and stored in
+    // sub-blocks of at most 255 bytes, each behind its length
+    class GifCodeWriter
+    {
+    public:
+        explicit GifCodeWriter(std::vector<uint8_t>& out) : m_Out(out) {}
+
+        inline void Put(uint32_t code, int bits)
+        {
+            m_Bits |= code << m_Count;
+            m_Count += bits;
+            while (m_Count >= 8)
+            {
+                put((uint8_t)m_Bits);
+                m_Bits >>= 8;
+                m_Count -= 8;
+            }
+        }
+
+        // Flushes the last bits and ends the sub-blocks
+        void Finish()
+        {
+            if (m_Count > 0)
+                put((uint8_t)m_Bits);
+            if (m_Used > 0)
+                flush();
+            m_Out.push_back(0);
+        }
+
+    private:
+        inline void put(uint8_t byte)
+        {
+            m_Block[m_Used++] = byte;
+            if (m_Used == 255)
+                flush();
+        }
+
+        void flush()
+        {
+            m_Out.push_back((uint8_t)m_Used);
+            m_Out.insert(m_Out.end(), m_Block, m_Block + m_Used);
+            m_Used = 0;
+        }
+
+        std::vector<uint8_t>& m_Out;
+        uint32_t m_Bits = 0;
+        int m_Count = 0;
+        uint8_t m_Block[255];
+        int m_Used = 0;
+    };
+
+    // The LZW string table: (prefix code, next index) -> code. Entries of an older
+    // generation are empty, so clearing the table is one increment.
+    class LzwTable
+    {
+    public:
+        static constexpr int BITS = 13; // At most 4096 - 258 entries, under half full
+
+        LzwTable() : m_Entries(1 << BITS) {}
+
+        void Clear()
+        {
+            if (++m_Generation == 0)
+            {
+                std::fill(m_Entries.begin(), m_Entries.end(), Entry{});
+                m_Generation = 1;
+            }
+        }
+
+        // The code of the string, or -1 with `slot` where to insert it
+        inline int Find(uint32_t key, uint32_t& slot) const
+        {
+            slot = (key * 2654435761u) >> (32 - BITS);
+            while (m_Entries[slot].generation == m_Generation)
+            {
+                if (m_Entries[slot].key == key)
+                    return m_Entries[slot].code;
+                slot = (slot + 1) & ((1u << BITS) - 1);
+            }
+            return -1;
+        }
+
+        inline void Insert(uint32_t slot, uint32_t key, int code)
+        {
+            m_Entries[slot] = {key, (uint16_t)code, m_Generation};
+        }
+
+    private:
+        struct Entry
+        {
+            uint32_t key = 0;
+            uint16_t code = 0;
+            uint16_t generation = 0;
+        };
+
+        std::vector<Entry> m_Entries;
+        uint16_t m_Generation = 1;
+    };
+
+    void EncodeGifFrame(const float* positions, int64_t width, int64_t height, Dither dither, int delayCs,
+                        std::vector<uint8_t>& out)
+    {
+        std::vector<uint8_t> indices;
+        quantize(positions, width, height, dither, indices);
+
+        // Graphic control extension: keep the frame, no transparency
+        out.insert(out.end(), {0x21, 0xF9, 0x04, 0x04});
+        putLE16(out, (uint32_t)delayCs);
+        out.insert(out.end(), {0x00, 0x00});
+        // Image descriptor: the whole screen, the global colour table
+        out.push_back(0x2C);
+        putLE16(out, 0);
+        putLE16(out, 0);
+        putLE16(out, (uint32_t)width);
+        putLE16(out, (uint32_t)height);
+        out.push_back(0x00);
+
+        // LZW with 8 bit indices: codes start at 9 bits and the table is cleared
+        // when it reaches 4096 codes
+        constexpr int MIN_CODE_SIZE = 8;
+        constexpr int CLEAR = 1 << MIN_CODE_SIZE;
+        constexpr int END = CLEAR + 1;
+        out.push_back(MIN_CODE_SIZE);
+        GifCodeWriter codes(out);
+        LzwTable table;
+        int codeSize = MIN_CODE_SIZE + 1;
+        int lastCode = END; // The last code given to a string
+        codes.Put(CLEAR, codeSize);
+
+        const int64_t count = width * height;
+        int prefix = count > 0 ? indices[0] : -1;
+        for (int64_t i = 1; i < count; i++)
+        {
+            const uint8_t next = indices[i];
+            const uint32_t key = ((uint32_t)prefix << 8) | next;
+            uint32_t slot;
+            const int code = table.Find(key, slot);
+            if (code >= 0)
+            {
+                prefix = code;
+                continue;
+            }
+            codes.Put(prefix, codeSize);
+            table.Insert(slot, key, ++lastCode);
+            // The decoder adds the same string one code later, then widens
+            if (lastCode >= (1 << codeSize))
+                codeSize++;
+            if (lastCode == 4095)
+            {
+                codes.Put(CLEAR, codeSize);
+                table.Clear();
+                codeSize = MIN_CODE_SIZE + 1;
+                lastCode = END;
+            }
+            prefix = next;
+        }
+        if (prefix >= 0)
+        {
+            codes.Put(prefix, codeSize);
+            if (lastCode + 1 >= (1 << codeSize) && codeSize < 12)
+                codeSize++;
+        }
+        codes.Put(END, codeSize);
+        codes.Finish();
+    }
+
+    void EncodeApngFrame(const float* positions, int64_t width, int64_t height, const uint32_t* lut, uint64_t frame,
+                         int fps, int effort, std::vector<uint8_t>& out)
+    {
+        const int64_t rowBytes = 3 * width;
+        std::vector<uint8_t> rgb(2 * rowBytes), filtered((rowBytes + 1) * height), scratch;
+        for (int64_t y = 0; y < height; y++)
+        {
+            uint8_t* row = rgb.data() + (y & 1) * rowBytes;
+            const uint8_t* above = y > 0 ? rgb.data() + ((y - 1) & 1) * rowBytes : nullptr;
+            for (int64_t x = 0; x < width; x++)
+            {
+                const uint32_t pixel = lut[(int)positions[y * width + x]];
+                row[3 * x] = (uint8_t)pixel;
+                row[3 * x + 1] = (uint8_t)(pixel >> 8);
+                row[3 * x + 2] = (uint8_t)(pixel >> 16);
+            }
+            FilterPngRow(row, above, rowBytes, filtered.data() + y * (rowBytes + 1), scratch);
+        }
+
+        // Sequence numbers count the fcTL and fdAT chunks, one of each per frame
+        // and the first frame's image in IDAT
+        std::vector<uint8_t> control;
+        PutBE32(control, frame == 0 ? 0 : (uint32_t)(2 * frame - 1));
+        PutBE32(control, (uint32_t)width);
+        PutBE32(control, (uint32_t)height);
+        PutBE32(control, 0);
+        PutBE32(control, 0);
+        control.insert(control.end(), {0x00, 0x01, (uint8_t)(fps >> 8), (uint8_t)fps});
+        control.insert(control.end(), {0x00, 0x00}); // Dispose none, blend source
+        PutPngChunk(out, "fcTL", control.data(), control.size());
+
+        std::vector<uint8_t> data;
+        if (frame > 0)
+            PutBE32(data, (uint32_t)(2 * frame));
+        Util::ZlibCompress(filtered.data(), filtered.size(), data, effort);
+        PutPngChunk(out, frame == 0 ? "IDAT" : "fdAT", data.data(), data.size());
+    }
+
+    AnimationWriter::~AnimationWriter()
+    {
+        Close();
+    }
+
+    bool AnimationWriter::Open(const std::string& path, AnimationFormat format, int64_t width, int64_t height,
+                               const AnimationOptions& options)
+    {
+        Close();
+        m_Options = options;
+        m_Options.fps = std::clamp(options.fps, 1, 65535);
+        m_Options.every = std::max(1, options.every);
+        m_Options.scale = std::max(1, options.scale);
+        m_Options.threads = options.threads > 0 ? options.threads : (int)std::max(1u, std::thread::hardware_concurrency());
+        m_Options.window = options.window > 0 ? options.window : 2 * m_Options.threads;
+        m_FrameWidth = (width + m_Options.scale - 1) / m_Options.scale;
+        m_FrameHeight = (height + m_Options.scale - 1) / m_Options.scale;
+        if (width < 1 || height < 1 ||
+            (format == AnimationFormat::Gif && (m_FrameWidth > 65535 || m_FrameHeight > 65535)) ||
+            (format == AnimationFormat::Apng && (3 * m_FrameWidth + 1) * m_FrameHeight > MAX_APNG_FRAME))
+        {
+            LOG_ERROR("Animation frames of {}x{} are too large, scale them down", m_FrameWidth, m_FrameHeight);
+            return false;
+        }
+        // APNG gets its frame count at the end
+        m_File = fopen(path.c_str(), "w+b");
+        if (!m_File)
+        {
+            LOG_ERROR("Could not open animation {}", path);
+            return false;
+        }
+
+        m_Format = format;
+        m_Width = width;
+        m_Height = height;
+        m_Stop = false;
+        m_Failed = false;
+        m_NextFrame = 0;
+        m_Stats = AnimationStats{};
+
+        std::vector<uint8_t> header;
+        if (format == AnimationFormat::Gif)
+        {
+            // Logical screen with a global table of 256 colours, looping forever
+            header.insert(header.end(), {'G', 'I', 'F', '8', '9', 'a'});
+            putLE16(header, (uint32_t)m_FrameWidth);
+            putLE16(header, (uint32_t)m_FrameHeight);
+            header.insert(header.end(), {0xF7, 0x00, 0x00});
+            for (int i = 0; i < 256; i++)
+            {
+                const uint32_t color = m_Colormap.Table()[i * GIF_STEP];
+                header.insert(header.end(), {(uint8_t)color, (uint8_t)(color >> 8), (uint8_t)(color >> 16)});
+            }
+            header.insert(header.end(), {0x21, 0xFF, 0x0B});
+            header.insert(header.end(), {'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0'});
+            header.insert(header.end(), {0x03, 0x01, 0x00, 0x00, 0x00});
+        }
+        else
+        {
+            // 8 bit RGB, then the frame count (patched by Close) and 0 for looping forever
+            header.insert(header.end(), PNG_SIGNATURE, PNG_SIGNATURE + 8);
+            PutPngHeader(header, m_FrameWidth, m_FrameHeight);
+            std::vector<uint8_t> chunk(8, 0);
+            m_FrameCountOffset = (long)header.size() + 8;
+            PutPngChunk(header, "acTL", chunk.data(), chunk.size());
+        }
+        m_Stats.bytes = header.size();
+        if (fwrite(header.data(), 1, header.size(), m_File) != header.size())
+        {
+            LOG_ERROR("Could not write animation {}", path);
+            fclose(m_File);
+            m_File = nullptr;
+            return false;
+        }
+
+        m_Slots.assign(m_Options.window, Slot{});
+        m_Free.clear();
+        m_Queued.clear();
+        m_Order.clear();
+        for (int i = 0; i < m_Options.window; i++)
+        {
+            m_Slots[i].positions.resize(m_FrameWidth * m_FrameHeight);
+            m_Free.push_back(i);
+        }
+        for (int i = 0; i < m_Options.threads; i++)
+            m_Encoders.emplace_back(&AnimationWriter::encoderLoop, this);
+        m_Writer = std::thread(&AnimationWriter::writerLoop, this);
+        return true;
+    }
+
+    bool AnimationWriter::Push(const Field& field)
+    {
+        TRACE_SCOPE("animation push");
+        if (!m_File)
+            return false;
+        int slot = -1;
+        {
+            std::unique_lock<std::mutex> lk(m_Mutex);
+            if (m_Stats.pushed++ % m_Options.every != 0)
+            {
+                m_Stats.skipped++;
+                return true;
+            }
+            if (m_Failed)
+                return false;
+            if (m_Free.empty())
+            {
+                if (!m_Options.block)
+                {
+                    if (m_Stats.dropped++ == 0)
+                        LOG_WARNING("Animation encoders can't keep up, dropping frames");
+                    return false;
+                }
+                auto start = std::chrono::steady_clock::now();
+                m_Stats.backPressured++;
+                m_FreeCv.wait(lk, [this] { return !m_Free.empty() || m_Failed; });
+                m_Stats.waitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                if (m_Failed)
+                    return false;
+            }
+            slot = m_Free.front();
+            m_Free.pop_front();
+            m_Slots[slot].frame = m_NextFrame++;
+            m_Slots[slot].encoded = false;
+            m_Order.push_back(slot);
+        }
+
+        // The slot is ours until it is queued
+        reduce(field, m_Slots[slot].positions.data());
+
+        {
+            std::lock_guard<std::mutex> lk(m_Mutex);
+            m_Queued.push_back(slot);
+        }
+        m_QueuedCv.notify_one();
+        return true;
+    }
+
+    void AnimationWriter::reduce(const Field& field, float* out) const
+    {
+        const int scale = m_Options.scale;
+        if (scale == 1)
+        {
+            for (int64_t y = 0; y < m_Height; y++)
+            {
+                const Real* a = field.A() + field.Index(0, y);
+                const Real* b = field.B() + field.Index(0, y);
+                for (int64_t x = 0; x < m_Width; x++)
+                    out[y * m_Width + x] = (float)m_Colormap.Position(m_Colormap.Value(a[x], b[x]));
+            }
+            return;
+        }
+
+        // Box average of the values, the boxes of the last row and column may be cut short
+        std::vector<double> sums(m_FrameWidth);
+        for (int64_t py = 0; py < m_FrameHeight; py++)
+        {
+            std::fill(sums.begin(), sums.end(), 0.0);
+            const int64_t y0 = py * scale, y1 = std::min(m_Height, y0 + scale);
+            for (int64_t y = y0; y < y1; y++)
+            {
+                const Real* a = field.A() + field.Index(0, y);
+                const Real* b = field.B() + field.Index(0, y);
+                for (int64_t x = 0; x < m_Width; x++)
+                    sums[x / scale] += m_Colormap.Value(a[x], b[x]);
+            }
+            for (int64_t px = 0; px < m_FrameWidth; px++)
+            {
+                const int64_t cells = (std::min(m_Width, (px + 1) * scale) - px * scale) * (y1 - y0);
+                out[py * m_FrameWidth + px] = (float)m_Colormap.Position(sums[px] / cells);
+            }
+        }
+    }
+
+    void AnimationWriter::encoderLoop()
+    {
+        Util::Trace::SetThreadName("animation encoder");
+        const int delayCs = std::max(2, (int)std::lround(100.0 / m_Options.fps));
+        while (true)
+        {
+            int slot = -1;
+            {
+                std::unique_lock<std::mutex> lk(m_Mutex);
+                m_QueuedCv.wait(lk, [this] { return !m_Queued.empty() || m_Stop; });
+                if (m_Queued.empty())
+                    break;
+                slot = m_Queued.front();
+                m_Queued.pop_front();
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            Slot& s = m_Slots[slot];
+            s.data.clear();
+            {
+                TRACE_SCOPE("encode frame");
+                if (m_Format == AnimationFormat::Gif)
+                    EncodeGifFrame(s.positions.data(), m_FrameWidth, m_FrameHeight, m_Options.dither, delayCs, s.data);
+                else
+                    EncodeApngFrame(s.positions.data(), m_FrameWidth, m_FrameHeight, m_Colormap.Table(), s.frame,
+                                    m_Options.fps, m_Options.effort, s.data);
+            }
+
+            {
+                std::lock_guard<std::mutex> lk(m_Mutex);
+                s.encoded = true;
+                m_Stats.encodeMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            }
+            m_EncodedCv.notify_one();
+        }
+    }
+
+    void AnimationWriter::writerLoop()
+    {
+        Util::Trace::SetThreadName("animation writer");
+        while (true)
+        {
+            int slot = -1;
+            {
+                std::unique_lock<std::mutex> lk(m_Mutex);
+                m_EncodedCv.wait(lk, [this] {
+                    return (!m_Order.empty() && m_Slots[m_Order.front()].encoded) || (m_Stop && m_Order.empty());
+                });
+                if (m_Order.empty())
+                    break;
+                slot = m_Order.front();
+                m_Order.pop_front();
+            }
+
+            // After a failure the frames are only let go
+            const std::vector<uint8_t>& data = m_Slots[slot].data;
+            bool ok = m_Failed;
+            if (!m_Failed)
+            {
+                TRACE_SCOPE("write animation frame");
+                ok = fwrite(data.data(), 1, data.size(), m_File) == data.size();
+            }
+
+            {
+                std::lock_guard<std::mutex> lk(m_Mutex);
+                m_Free.push_back(slot);
+                if (!ok)
+                {
+                    m_Failed = true;
+                    LOG_ERROR("Animation write failed, stopping the animation");
+                }
+                else if (!m_Failed)
+                {
+                    m_Stats.written++;
+                    m_Stats.bytes += data.size();
+                }
+            }
+            m_FreeCv.notify_all();
+        }
+    }
+
+    bool AnimationWriter::Close()
+    {
+        if (!m_File)
+            return !m_Failed;
+        {
+            std::lock_guard<std::mutex> lk(m_Mutex);
+            m_Stop = true;
+        }
+        m_QueuedCv.notify_all();
+        m_EncodedCv.notify_all();
+        for (auto& encoder : m_Encoders)
+            encoder.join();
+        m_Encoders.clear();
+        if (m_Writer.joinable())
+            m_Writer.join();
+
+        std::vector<uint8_t> trailer;
+        if (m_Format == AnimationFormat::Gif)
+            trailer.push_back(0x3B);
+        else
+        {
+            if (m_Stats.written == 0)
+                LOG_WARNING("Animation closed without frames, the APNG is not valid");
+            PutPngChunk(trailer, "IEND", nullptr, 0);
+        }
+        bool ok = !m_Failed && fwrite(trailer.data(), 1, trailer.size(), m_File) == trailer.size();
+        if (ok && m_Format == AnimationFormat::Apng)
+        {
+            std::vector<uint8_t> count;
+            PutBE32(count, (uint32_t)m_Stats.written);
+            PutBE32(count, 0);
+            const uint32_t crc = Util::Crc32(count.data(), count.size(), Util::Crc32("acTL", 4));
+            PutBE32(count, crc);
+            ok = fseek(m_File, m_FrameCountOffset, SEEK_SET) == 0 &&
+                 fwrite(count.data(), 1, count.size(), m_File) == count.size();
+        }
+        if (ok)
+            m_Stats.bytes += trailer.size();
+
+        // Buffered writes can still fail here
+        ok = fclose(m_File) == 0 && ok;
+        if (!ok && !m_Failed)
+            LOG_ERROR("Could not finish the animation, the file is incomplete");
+        m_Failed |= !ok;
+        m_File = nullptr;
+        m_Slots.clear();
+        return !m_Failed;
+    }
+
+    void AnimationWriter::SetColormap(const Colormap& colormap)
+    {
+        m_Colormap = colormap;
+    }
+
+    AnimationStats AnimationWriter::GetStats()
+    {
+        std::lock_guard<std::mutex> lk(m_Mutex);
+        return m_Stats;
+    }
+
+    bool ParseAnimationFormat(const std::string& name, AnimationFormat& format)
+    {
+        if (name == "gif")
+            format = AnimationFormat::Gif;
+        else if (name == "apng" || name == "png")
+            format = AnimationFormat::Apng;
+        else
+            return false;
+        return true;
+    }
+
+    bool ParseDither(const std::string& name, Dither& dither)
+    {
+        if (name == "none")
+            dither = Dither::None;
+        else if (name == "ordered" || name == "bayer")
+            dither = Dither::Ordered;
+        else if (name == "fs" || name == "floyd")
+            dither = Dither::FloydSteinberg;
+        else
+            return false;
+        return true;
+    }
+}
@@ -0,0 +1,90 @@
+#include "Diffusion/Capture.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "Utils/Trace.h"
+
+namespace Diffusion
+{
+    Capture::Capture(const Field& source, uint64_t step, Callback done)
+        : m_SourceA(source.A()), m_SourceB(source.B()), m_Step(step),
+          m_TilesX((source.Width() + TILE - 1) / TILE), m_TilesY((source.Height() + TILE - 1) / TILE),
+          m_States(new std::atomic<uint8_t>[m_TilesX * m_TilesY]), m_Remaining(m_TilesX * m_TilesY),
+          m_Callback(std::move(done))
+    {
+        m_Result.Allocate(source.Width(), source.Height());
+        for (int64_t i = 0; i < m_TilesX * m_TilesY; i++)
+            m_States[i].store(PENDING, std::memory_order_relaxed);
+    }
+
+    void Capture::Protect(int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+    {
+        if (Copied() || x1 <= x0 || y1 <= y0)
+            return;
+        for (int64_t ty = y0 / TILE; ty <= (y1 - 1) / TILE; ty++)
+            for (int64_t tx = x0 / TILE; tx <= (x1 - 1) / TILE; tx++)
+                claim(ty * m_TilesX + tx, true);
+    }
+
+    void Capture::Complete()
+    {
+        {
+            TRACE_SCOPE("capture");
+            for (int64_t tile = 0; tile < m_TilesX * m_TilesY; tile++)
+                claim(tile, false);
+        }
+        if (m_Callback)
+            m_Callback(*this);
+        {
+            std::lock_guard<std::mutex> lk(m_Mutex);
+            m_Done = true;
+        }
+        m_DoneCv.notify_all();
+    }
+
+    bool Capture::Done() const
+    {
+        std::lock_guard<std::mutex> lk(m_Mutex);
+        return m_Done;
+    }
+
+    void Capture::Wait() const
+    {
+        std::unique_lock<std::mutex> lk(m_Mutex);
+        m_DoneCv.wait(lk, [this]() { return m_Done; });
+    }
+
+    void Capture::claim(int64_t tile, bool protect)
+    {
+        std::atomic<uint8_t>& state = m_States[tile];
+        if (state.load(std::memory_order_acquire) == COPIED)
+            return;
+        uint8_t expected = PENDING;
+        if (state.compare_exchange_strong(expected, COPYING, std::memory_order_acquire))
+        {
+            copyTile(tile);
+            state.store(COPIED, std::memory_order_release);
+            if (protect)
+                m_Protected.fetch_add(1, std::memory_order_relaxed);
+            m_Remaining.fetch_sub(1, std::memory_order_acq_rel);
+            return;
+        }
+        // The other side is copying it, a tile takes microseconds
+        while (state.load(std::memory_order_acquire) != COPIED)
+            std::this_thread::yield();
+    }
+
+    void Capture::copyTile(int64_t tile)
+    {
+        const int64_t x0 = (tile % m_TilesX) * TILE;
+        const int64_t y0 = (tile / m_TilesX) * TILE;
+        const int64_t columns = std::min(TILE, m_Result.Width() - x0);
+        for (int64_t y = y0; y < std::min(y0 + TILE, m_Result.Height()); y++)
+        {
+            const int64_t index = m_Result.Index(x0, y);
+            std::copy_n(m_SourceA + index, columns, m_Result.A() + index);
+            std::copy_n(m_SourceB + index, columns, m_Result.B() + index);
+        }
+    }
+}
@@ -0,0 +1,211 @@
+#include "Diffusion/Checkpoint.h"
+
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#include "Utils/Checksum.h"
+#include "Utils/Logger.h"
+#include "Utils/Trace.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define SYNC_FILE(F) _commit(_fileno(F))
+#else
+#include <unistd.h>
+#define SYNC_FILE(F) fsync(fileno(F))
+#endif
+
+namespace Diffusion
+{
+    static constexpr uint32_t HEADER_SIZE = 4096;
+    static constexpr size_t WRITE_CHUNK = 1 << 20;
+
+    static volatile std::sig_atomic_t s_CheckpointRequested = 0;
+    static volatile std::sig_atomic_t s_TerminateRequested = 0;
+
+    static void onSignal(int sig)
+    {
+        if (sig == SIGTERM)
+            s_TerminateRequested = 1;
+        s_CheckpointRequested = 1;
+    }
+
+    static uint32_t headerCrc(const CheckpointHeader& header)
+    {
+        return Util::Crc32(&header, offsetof(CheckpointHeader, crcHeader));
+    }
+
+    static bool writePlane(FILE* file, const Real* data, int64_t count, uint32_t& crc)
+    {
+        const uint8_t* bytes = (const uint8_t*)data;
+        uint64_t remaining = (uint64_t)count * sizeof(Real);
+        crc = 0;
+        while (remaining > 0)
+        {
+            size_t chunk = remaining < WRITE_CHUNK ? (size_t)remaining : WRITE_CHUNK;
+            crc = Util::Crc32(bytes, chunk, crc);
+            if (fwrite(bytes, 1, chunk, file) != chunk)
+                return false;
+            bytes += chunk;
+            remaining -= chunk;
+        }
+        return true;
+    }
+
+    bool SaveCheckpoint(const std::string& path, const Field& field, const CheckpointInfo& info)
+    {
+        TRACE_SCOPE("checkpoint");
+        const std::string tmpPath = path + ".tmp";
+        FILE* file = fopen(tmpPath.c_str(), "wb");
+        if (!file)
+        {
+            LOG_ERROR("Could not create checkpoint {}", tmpPath);
+            return false;
+        }
+
+        CheckpointHeader header{};
+        std::memcpy(header.magic, "RDCK", 4);
+        header.version = CHECKPOINT_VERSION;
+        header.headerSize = HEADER_SIZE;
+        header.precision = sizeof(Real);
+        header.width = field.Width();
+        header.height = field.Height();
+        header.step = info.step;
+        header.dA = info.dA;
+        header.dB = info.dB;
+        header.feed = info.feed;
+        header.kill = info.kill;
+
+        // The header goes in last, once the plane checksums are known. Until then the
+        // file has no valid magic, so a crash here leaves an unreadable .tmp behind.
+        std::vector<uint8_t> padding(HEADER_SIZE, 0);
+        bool ok = fwrite(padding.data(), 1, padding.size(), file) == padding.size();
+        ok = ok && writePlane(file, field.A(), field.Size(), header.crcA);
+        ok = ok && writePlane(file, field.B(), field.Size(), header.crcB);
+
+        header.crcHeader = headerCrc(header);
+        ok = ok && fseek(file, 0, SEEK_SET) == 0;
+        ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && fflush(file) == 0;
+        ok = ok && SYNC_FILE(file) == 0;
+        ok = (fclose(file) == 0) && ok;
+
+        if (!ok)
+        {
+            LOG_ERROR("Could not write checkpoint {}", tmpPath);
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        if (ec)
+        {
+            LOG_ERROR("Could not move {} to {}: {}", tmpPath, path, ec.message());
+            return false;
+        }
+        return true;
+    }
+
+    bool LoadCheckpoint(const std::string& path, Field& field, CheckpointInfo& info, bool verify)
+    {
+        auto mapping = std::make_shared<Util::MappedFile>();
+        if (!mapping->Open(path, Util::MappedFile::Access::CopyOnWrite))
+            return false;
+
+        if (mapping->Size() < sizeof(CheckpointHeader))
+        {
+            LOG_ERROR("{} is too small to be a checkpoint", path);
+            return false;
+        }
+
+        CheckpointHeader header;
+        std::memcpy(&header, mapping->Data(), sizeof(header));
+        if (std::memcmp(header.magic, "RDCK", 4) != 0)
+        {
+            LOG_ERROR("{} is not a checkpoint", path);
+            return false;
+        }
+        if (header.crcHeader != headerCrc(header))
+        {
+            LOG_ERROR("{} has a corrupted header", path);
+            return false;
+        }
+        if (header.version != CHECKPOINT_VERSION)
+        {
+            LOG_ERROR("{} has version {}, expected {}", path, header.version, CHECKPOINT_VERSION);
+            return false;
+        }
+        if (header.precision != sizeof(Real))
+        {
+            LOG_ERROR("{} stores {} byte values, this build uses {}", path, header.precision, sizeof(Real));
+            return false;
+        }
+        if (header.width <= 0 || header.height <= 0 || header.headerSize % alignof(Real) != 0)
+        {
+            LOG_ERROR("{} has invalid dimensions {}x{}", path, header.width, header.height);
+            return false;
+        }
+        if (header.headerSize < sizeof(CheckpointHeader))
+        {
+            LOG_ERROR("{} has a {} byte header, too small to hold it", path, header.headerSize);
+            return false;
+        }
+
+        const uint64_t planeBytes = (uint64_t)header.width * (uint64_t)header.height * sizeof(Real);
+        if (mapping->Size() < header.headerSize + 2 * planeBytes)
+        {
+            LOG_ERROR("{} is truncated: {} bytes, expected {}", path, mapping->Size(), header.headerSize + 2 * planeBytes);
+            return false;
+        }
+
+        uint8_t* planeA = mapping->Data() + header.headerSize;
+        uint8_t* planeB = planeA + planeBytes;
+        if (verify)
+        {
+            if (Util::Crc32(planeA, (size_t)planeBytes) != header.crcA || Util::Crc32(planeB, (size_t)planeBytes) != header.crcB)
+            {
+                LOG_ERROR("{} failed the checksum, the file was not completely written", path);
+                return false;
+            }
+        }
+
+        info.step = header.step;
+        info.dA = header.dA;
+        info.dB = header.dB;
+        info.feed = header.feed;
+        info.kill = header.kill;
+        field.Adopt(std::move(mapping), (Real*)planeA, (Real*)planeB, header.width, header.height);
+        return true;
+    }
+
+    void InstallCheckpointSignals()
+    {
+        std::signal(SIGTERM, onSignal);
+#ifdef SIGUSR1
+        std::signal(SIGUSR1, onSignal);
+#endif
+    }
+
+    void RequestCheckpoint()
+    {
+        s_CheckpointRequested = 1;
+    }
+
+    bool ConsumeCheckpointRequest()
+    {
+        if (!s_CheckpointRequested)
+            return false;
+        s_CheckpointRequested = 0;
+        return true;
+    }
+
+    bool TerminateRequested()
+    {
+        return s_TerminateRequested != 0;
+    }
+}
@@ -0,0 +1,166 @@
+#include "Diffusion/Colormap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+#include "Diffusion/Cpu.h"
+#include "Diffusion/PixelBuffer.h"
+#include "Utils/Logger.h"
+
+namespace Diffusion
+{
+    // Nine evenly spaced samples of the matplotlib colormaps, interpolated linearly
+    struct NamedPalette
+    {
+        const char* name;
+        std::vector<Colormap::Stop> stops;
+    };
+
+    static const std::vector<NamedPalette>& builtinPalettes()
+    {
+        static const std::vector<NamedPalette> palettes = {
+            {"grey", {{0.0f, 0, 0, 0}, {1.0f, 255, 255, 255}}},
+            {"viridis", {{0.0f, 68, 1, 84}, {0.125f, 71, 44, 122}, {0.25f, 59, 82, 139}, {0.375f, 44, 114, 142}, {0.5f, 33, 145, 140},
+                         {0.625f, 39, 173, 129}, {0.75f, 92, 200, 99}, {0.875f, 170, 220, 50}, {1.0f, 253, 231, 37}}},
+            {"magma", {{0.0f, 0, 0, 4}, {0.125f, 28, 16, 68}, {0.25f, 79, 18, 123}, {0.375f, 129, 37, 129}, {0.5f, 181, 54, 122},
+                       {0.625f, 229, 80, 100}, {0.75f, 251, 135, 97}, {0.875f, 254, 194, 135}, {1.0f, 252, 253, 191}}},
+            {"inferno", {{0.0f, 0, 0, 4}, {0.125f, 31, 12, 72}, {0.25f, 85, 15, 109}, {0.375f, 136, 34, 106}, {0.5f, 186, 54, 85},
+                         {0.625f, 227, 89, 51}, {0.75f, 249, 140, 10}, {0.875f, 249, 201, 50}, {1.0f, 252, 255, 164}}},
+            {"plasma", {{0.0f, 13, 8, 135}, {0.125f, 75, 3, 161}, {0.25f, 125, 3, 168}, {0.375f, 168, 34, 150}, {0.5f, 203, 70, 121},
+                        {0.625f, 229, 107, 93}, {0.75f, 248, 148, 65}, {0.875f, 253, 195, 40}, {1.0f, 240, 249, 33}}},
+        };
+        return palettes;
+    }
+
+    Colormap::Colormap()
+    {
+        SetPalette("grey");
+    }
+
+    const std::vector<std::string>& Colormap::PaletteNames()
+    {
+        static const std::vector<std::string> names = [] {
+            std::vector<std::string> result;
+            for (const auto& palette : builtinPalettes())
+                result.push_back(palette.name);
+            return result;
+        }();
+        return names;
+    }
+
+    bool Colormap::SetPalette(const std::string& name)
+    {
+        if (name == "grey")
+        {
+            // Exact original levels rather than an interpolated ramp
+            m_Lut.resize(LUT_STEPS + 1);
+            for (int i = 0; i <= LUT_STEPS; i++)
+            {
+                uint8_t c = (uint8_t)(i / 16);
+                m_Lut[i] = PackRGBA(c, c, c);
+            }
+            return true;
+        }
+        for (const auto& palette : builtinPalettes())
+        {
+            if (name == palette.name)
+            {
+                SetGradient(palette.stops);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Colormap::SetGradient(const std::vector<Stop>& stops)
+    {
+        m_Lut.resize(LUT_STEPS + 1);
+        size_t s = 0;
+        for (int i = 0; i <= LUT_STEPS; i++)
+        {
+            const float t = (float)i / LUT_STEPS;
+            while (s + 1 < stops.size() && stops[s + 1].position < t)
+                s++;
+            const Stop& lo = stops[s];
+            const Stop& hi = stops[std::min(s + 1, stops.size() - 1)];
+            float f = hi.position > lo.position ? (t - lo.position) / (hi.position - lo.position) : 0.0f;
+            f = std::clamp(f, 0.0f, 1.0f);
+            auto mix = [f](uint8_t x, uint8_t y) { return (uint8_t)std::lround(x + (y - x) * f); };
+            m_Lut[i] = PackRGBA(mix(lo.r, hi.r), mix(lo.g, hi.g), mix(lo.b, hi.b));
+        }
+    }
+
+    bool Colormap::LoadGradient(const std::string& path)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            LOG_ERROR("Could not open gradient {}", path);
+            return false;
+        }
+
+        std::vector<Stop> stops;
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line))
+        {
+            lineNumber++;
+            line = line.substr(0, line.find('#'));
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+
+            std::istringstream in(line);
+            float position;
+            int r, g, b;
+            if (!(in >> position >> r >> g >> b) || position < 0.0f || position > 1.0f ||
+                r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255)
+            {
+                LOG_ERROR("{}:{}: expected \"position r g b\"", path, lineNumber);
+                return false;
+            }
+            stops.push_back({position, (uint8_t)r, (uint8_t)g, (uint8_t)b});
+        }
+        if (stops.empty())
+        {
+            LOG_ERROR("{} has no gradient stops", path);
+            return false;
+        }
+
+        std::stable_sort(stops.begin(), stops.end(), [](const Stop& x, const Stop& y) { return x.position < y.position; });
+        SetGradient(stops);
+        return true;
+    }
+
+    void Colormap::SetRange(double min, double max)
+    {
+        if (max <= min)
+            max = min + 1e-9;
+        m_Min = min;
+        m_Scale = LUT_STEPS / (max - min);
+    }
+
+    void Colormap::Colorize(const Real* a, const Real* b, uint32_t* out, int64_t count) const
+    {
+        if (CpuHasAVX2() && ColorizeAVX2(m_Lut.data(), m_Source, m_Min, m_Scale, a, b, out, count))
+            return;
+
+        const uint32_t* lut = m_Lut.data();
+        for (int64_t i = 0; i < count; i++)
+            out[i] = lut[(int)Position(Value(a[i], b[i]))];
+    }
+
+    bool ParseColorSource(const std::string& name, ColorSource& source)
+    {
+        if (name == "diff")
+            source = ColorSource::Difference;
+        else if (name == "a")
+            source = ColorSource::A;
+        else if (name == "b")
+            source = ColorSource::B;
+        else
+            return false;
+        return true;
+    }
+}
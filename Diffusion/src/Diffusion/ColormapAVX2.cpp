@@ -0,0 +1,67 @@
+// Built with AVX2 enabled (see CMakeLists.txt), only reached through Colormap::Colorize
+// after a runtime check.
+#include "Diffusion/Colormap.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace Diffusion
+{
+#if defined(__AVX2__)
+    template <ColorSource SOURCE>
+    static void colorize(const uint32_t* lut, double min, double scale, const Real* a, const Real* b, uint32_t* out, int64_t count)
+    {
+        const __m256d vMin = _mm256_set1_pd(min);
+        const __m256d vScale = _mm256_set1_pd(scale);
+        const __m256d vZero = _mm256_setzero_pd();
+        const __m256d vMax = _mm256_set1_pd(Colormap::LUT_STEPS);
+
+        auto indices = [&](int64_t i) {
+            __m256d v;
+            if (SOURCE == ColorSource::Difference)
+                v = _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+            else if (SOURCE == ColorSource::A)
+                v = _mm256_loadu_pd(a + i);
+            else
+                v = _mm256_loadu_pd(b + i);
+            __m256d t = _mm256_mul_pd(_mm256_sub_pd(v, vMin), vScale);
+            t = _mm256_min_pd(_mm256_max_pd(t, vZero), vMax);
+            // Truncation is floor here, t is never negative
+            return _mm256_cvttpd_epi32(t);
+        };
+
+        int64_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i idx = _mm256_set_m128i(indices(i + 4), indices(i));
+            __m256i rgba = _mm256_i32gather_epi32((const int*)lut, idx, 4);
+            _mm256_storeu_si256((__m256i*)(out + i), rgba);
+        }
+        for (; i < count; i++)
+        {
+            Real v = SOURCE == ColorSource::Difference ? a[i] - b[i] : (SOURCE == ColorSource::A ? a[i] : b[i]);
+            double t = (v - min) * scale;
+            t = !(t > 0.0) ? 0.0 : (t > Colormap::LUT_STEPS ? Colormap::LUT_STEPS : t);
+            out[i] = lut[(int)t];
+        }
+    }
+#endif
+
+    bool ColorizeAVX2(const uint32_t* lut, ColorSource source, double min, double scale,
+                      const Real* a, const Real* b, uint32_t* out, int64_t count)
+    {
+#if defined(__AVX2__)
+        switch (source)
+        {
+            case ColorSource::Difference: colorize<ColorSource::Difference>(lut, min, scale, a, b, out, count); break;
+            case ColorSource::A: colorize<ColorSource::A>(lut, min, scale, a, b, out, count); break;
+            case ColorSource::B: colorize<ColorSource::B>(lut, min, scale, a, b, out, count); break;
+        }
+        return true;
+#else
+        (void)lut; (void)source; (void)min; (void)scale; (void)a; (void)b; (void)out; (void)count;
+        return false;
+#endif
+    }
+}
@@ -0,0 +1,74 @@
+#include "Diffusion/Convergence.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Diffusion
+{
+    void ConvergenceMonitor::Configure(const ConvergenceOptions& options, int64_t width, int64_t height, int64_t bandRows)
+    {
+        m_Bands = (uint32_t)((height - 2 + bandRows - 1) / bandRows);
+        m_Options = options;
+        m_Options.regions = (int)std::clamp<int64_t>(options.regions, 1, std::min<int64_t>(width - 2, m_Bands));
+        m_Options.window = std::max(1, options.window);
+
+        // Region columns over the interior cells [1, width - 1)
+        const int regions = m_Options.regions;
+        m_Splits.resize(regions + 1);
+        for (int i = 0; i <= regions; i++)
+            m_Splits[i] = 1 + (width - 2) * i / regions;
+
+        m_Regions.assign(regions * regions, Region{});
+        m_RegionChanges.resize(regions * regions);
+        m_Field = Region{};
+        m_Last = StepChange{};
+        m_ConvergedAt = 0;
+    }
+
+    void ConvergenceMonitor::BeginStep()
+    {
+        m_BandChanges.assign(m_Bands * m_Options.regions, StepChange{});
+    }
+
+    void ConvergenceMonitor::update(Region& region, bool steady, uint64_t step, int window)
+    {
+        if (!steady)
+        {
+            region = Region{};
+            return;
+        }
+        if (region.steadyCount++ == 0)
+            region.steadySince = step;
+        if (region.steadyCount >= window && region.convergedAt == 0)
+            region.convergedAt = region.steadySince;
+    }
+
+    bool ConvergenceMonitor::EndStep(uint64_t step)
+    {
+        // Consecutive bands make up a region row
+        const int regions = m_Options.regions;
+        std::fill(m_RegionChanges.begin(), m_RegionChanges.end(), StepChange{});
+        m_Last = StepChange{};
+        for (uint32_t band = 0; band < m_Bands; band++)
+        {
+            const int regionY = (int)((uint64_t)band * regions / m_Bands);
+            const StepChange* changes = BandChanges(band);
+            for (int x = 0; x < regions; x++)
+            {
+                m_RegionChanges[regionY * regions + x].Merge(changes[x]);
+                m_Last.Merge(changes[x]);
+            }
+        }
+
+        for (size_t i = 0; i < m_Regions.size(); i++)
+            update(m_Regions[i], m_RegionChanges[i].maxAbs < m_Options.tolerance, step, m_Options.window);
+        update(m_Field, m_Last.maxAbs < m_Options.tolerance, step, m_Options.window);
+        m_ConvergedAt = m_Field.convergedAt;
+        return Converged();
+    }
+
+    double ConvergenceMonitor::LastL2() const
+    {
+        return std::sqrt(m_Last.sumSquares);
+    }
+}
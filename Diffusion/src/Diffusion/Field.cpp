@@ -0,0 +1,112 @@
+#include "Diffusion/Field.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "Diffusion/Parallel.h"
+#include "Utils/Checksum.h"
+
+namespace Diffusion
+{
+    Field::Field(const Field& other)
+    {
+        *this = other;
+    }
+
+    Field& Field::operator=(const Field& other)
+    {
+        if (this == &other)
+            return *this;
+        m_Mapping.reset();
+        m_StorageA.assign(other.m_A, other.m_A + other.Size());
+        m_StorageB.assign(other.m_B, other.m_B + other.Size());
+        m_A = m_StorageA.data();
+        m_B = m_StorageB.data();
+        m_Width = other.m_Width;
+        m_Height = other.m_Height;
+        return *this;
+    }
+
+    void Field::Create(int64_t width, int64_t height, Real a, Real b)
+    {
+        m_Mapping.reset();
+        m_StorageA.assign(width * height, a);
+        m_StorageB.assign(width * height, b);
+        m_A = m_StorageA.data();
+        m_B = m_StorageB.data();
+        m_Width = width;
+        m_Height = height;
+    }
+
+    void Field::Allocate(int64_t width, int64_t height)
+    {
+        m_Mapping.reset();
+        m_StorageA.clear();
+        m_StorageB.clear();
+        m_StorageA.resize(width * height);
+        m_StorageB.resize(width * height);
+        m_A = m_StorageA.data();
+        m_B = m_StorageB.data();
+        m_Width = width;
+        m_Height = height;
+    }
+
+    void Field::Adopt(std::shared_ptr<Util::MappedFile> mapping, Real* a, Real* b, int64_t width, int64_t height)
+    {
+        m_StorageA.clear();
+        m_StorageA.shrink_to_fit();
+        m_StorageB.clear();
+        m_StorageB.shrink_to_fit();
+        m_Mapping = std::move(mapping);
+        m_A = a;
+        m_B = b;
+        m_Width = width;
+        m_Height = height;
+    }
+
+    void Field::CopyBorder(const Field& other)
+    {
+        if (m_Width == 0 || m_Height == 0)
+            return;
+
+        const int64_t last = m_Height - 1;
+        std::copy_n(other.m_A, m_Width, m_A);
+        std::copy_n(other.m_B, m_Width, m_B);
+        std::copy_n(other.m_A + Index(0, last), m_Width, m_A + Index(0, last));
+        std::copy_n(other.m_B + Index(0, last), m_Width, m_B + Index(0, last));
+
+        for (int64_t y = 1; y < last; y++)
+        {
+            m_A[Index(0, y)] = other.m_A[Index(0, y)];
+            m_B[Index(0, y)] = other.m_B[Index(0, y)];
+            m_A[Index(m_Width - 1, y)] = other.m_A[Index(m_Width - 1, y)];
+            m_B[Index(m_Width - 1, y)] = other.m_B[Index(m_Width - 1, y)];
+        }
+    }
+
+    uint32_t Field::Digest(int threads) const
+    {
+        // Fixed chunking, the thread count only decides who computes which chunk
+        const int64_t chunk = int64_t(1) << 16;
+        const int64_t chunksPerPlane = (Size() + chunk - 1) / chunk;
+        return ParallelReduce<uint32_t>(
+            (uint32_t)(2 * chunksPerPlane), threads, 0u,
+            [&](uint32_t i) {
+                const Real* plane = i < chunksPerPlane ? m_A : m_B;
+                const int64_t start = (i % chunksPerPlane) * chunk;
+                return Util::Crc32(plane + start, (size_t)std::min(chunk, Size() - start) * sizeof(Real));
+            },
+            [](uint32_t crc, uint32_t partial) { return Util::Crc32(&partial, sizeof(partial), crc); });
+    }
+
+    void Field::Swap(Field& other)
+    {
+        std::swap(m_StorageA, other.m_StorageA);
+        std::swap(m_StorageB, other.m_StorageB);
+        std::swap(m_Mapping, other.m_Mapping);
+        std::swap(m_A, other.m_A);
+        std::swap(m_B, other.m_B);
+        std::swap(m_Width, other.m_Width);
+        std::swap(m_Height, other.m_Height);
+    }
+}
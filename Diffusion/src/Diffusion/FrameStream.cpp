@@ -0,0 +1,235 @@
+#include "Diffusion/FrameStream.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <fmt/core.h>
+
+#include "Utils/Logger.h"
+#include "Utils/Trace.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define DUP _dup
+#define DUP2 _dup2
+#define FDOPEN _fdopen
+#else
+#include <unistd.h>
+#define DUP dup
+#define DUP2 dup2
+#define FDOPEN fdopen
+#endif
+
+namespace Diffusion
+{
+    // Takes over the process' stdout for the stream and points fd 1 at stderr,
+    // so status prints can't end up in the middle of the video data.
+    static FILE* takeStdout()
+    {
+        fflush(stdout);
+        int fd = DUP(1);
+        if (fd < 0)
+            return nullptr;
+        DUP2(2, 1);
+#ifdef _WIN32
+        _setmode(fd, _O_BINARY);
+#endif
+        return FDOPEN(fd, "wb");
+    }
+
+    FrameStream::~FrameStream()
+    {
+        Close();
+    }
+
+    bool FrameStream::Open(const std::string& path, FrameFormat format, int64_t width, int64_t height,
+                           int fps, int queueDepth, bool block)
+    {
+        Close();
+        m_File = path == "-" ? takeStdout() : fopen(path.c_str(), "wb");
+        if (!m_File)
+        {
+            LOG_ERROR("Could not open frame stream {}", path);
+            return false;
+        }
+
+        m_Format = format;
+        m_Width = width;
+        m_Height = height;
+        m_Block = block;
+        m_Stop = false;
+        m_Failed = false;
+        m_Stats = FrameStreamStats{};
+
+        if (queueDepth < 1)
+            queueDepth = 1;
+        m_Slots.assign(queueDepth, Slot{});
+        m_Free.clear();
+        m_Ready.clear();
+        for (int i = 0; i < queueDepth; i++)
+        {
+            m_Slots[i].a.resize(width * height);
+            m_Slots[i].b.resize(width * height);
+            m_Free.push_back(i);
+        }
+        m_Pixels.resize(width * height);
+        if (format == FrameFormat::Y4M)
+        {
+            m_Yuv.resize(width * height * 3);
+            std::string header = fmt::format("YUV4MPEG2 W{} H{} F{}:1 Ip A1:1 C444 XCOLORRANGE=LIMITED\n", width, height, fps);
+            if (fwrite(header.data(), 1, header.size(), m_File) != header.size())
+            {
+                LOG_ERROR("Could not write the stream header to {}", path);
+                fclose(m_File);
+                m_File = nullptr;
+                return false;
+            }
+        }
+
+        m_Writer = std::thread(&FrameStream::writerLoop, this);
+        return true;
+    }
+
+    bool FrameStream::Push(const Field& field)
+    {
+        TRACE_SCOPE("stream push");
+        int slot = -1;
+        {
+            std::unique_lock<std::mutex> lk(m_Mutex);
+            m_Stats.pushed++;
+            if (m_Failed)
+                return false;
+            if (m_Free.empty())
+            {
+                if (!m_Block)
+                {
+                    if (m_Stats.dropped++ == 0)
+                        LOG_WARNING("Frame stream can't keep up, dropping frames");
+                    return false;
+                }
+                auto start = std::chrono::steady_clock::now();
+                m_Stats.backPressured++;
+                m_FreeCv.wait(lk, [this] { return !m_Free.empty() || m_Failed; });
+                m_Stats.waitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                if (m_Failed)
+                    return false;
+            }
+            slot = m_Free.front();
+            m_Free.pop_front();
+        }
+
+        // The slot is ours until it is queued, copy without holding the lock
+        std::copy_n(field.A(), field.Size(), m_Slots[slot].a.data());
+        std::copy_n(field.B(), field.Size(), m_Slots[slot].b.data());
+
+        {
+            std::lock_guard<std::mutex> lk(m_Mutex);
+            m_Ready.push_back(slot);
+        }
+        m_ReadyCv.notify_one();
+        return true;
+    }
+
+    void FrameStream::writerLoop()
+    {
+        Util::Trace::SetThreadName("frame stream");
+        while (true)
+        {
+            int slot = -1;
+            {
+                std::unique_lock<std::mutex> lk(m_Mutex);
+                m_ReadyCv.wait(lk, [this] { return !m_Ready.empty() || m_Stop; });
+                if (m_Ready.empty())
+                    break;
+                slot = m_Ready.front();
+                m_Ready.pop_front();
+            }
+
+            bool ok = writeFrame(m_Slots[slot]);
+
+            {
+                std::lock_guard<std::mutex> lk(m_Mutex);
+                m_Free.push_back(slot);
+                if (ok)
+                    m_Stats.written++;
+                else if (!m_Failed)
+                {
+                    // Most likely the reading end of a pipe went away
+                    m_Failed = true;
+                    LOG_ERROR("Frame stream write failed, stopping the stream");
+                }
+            }
+            m_FreeCv.notify_all();
+        }
+    }
+
+    bool FrameStream::writeFrame(const Slot& slot)
+    {
+        TRACE_SCOPE("write frame");
+        const int64_t count = m_Width * m_Height;
+        m_Colormap.Colorize(slot.a.data(), slot.b.data(), m_Pixels.data(), count);
+
+        if (m_Format == FrameFormat::Raw)
+            return fwrite(m_Pixels.data(), sizeof(uint32_t), m_Pixels.size(), m_File) == m_Pixels.size();
+
+        // BT.601 limited range, planar Y, Cb, Cr
+        uint8_t* y = m_Yuv.data();
+        uint8_t* u = y + count;
+        uint8_t* v = u + count;
+        for (int64_t i = 0; i < count; i++)
+        {
+            int r = m_Pixels[i] & 0xFF;
+            int g = (m_Pixels[i] >> 8) & 0xFF;
+            int b = (m_Pixels[i] >> 16) & 0xFF;
+            y[i] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            u[i] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            v[i] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+        static const char frameTag[] = "FRAME\n";
+        return fwrite(frameTag, 1, sizeof(frameTag) - 1, m_File) == sizeof(frameTag) - 1 &&
+               fwrite(m_Yuv.data(), 1, m_Yuv.size(), m_File) == m_Yuv.size();
+    }
+
+    void FrameStream::Close()
+    {
+        if (!m_File)
+            return;
+        {
+            std::lock_guard<std::mutex> lk(m_Mutex);
+            m_Stop = true;
+        }
+        m_ReadyCv.notify_all();
+        if (m_Writer.joinable())
+            m_Writer.join();
+
+        fflush(m_File);
+        fclose(m_File);
+        m_File = nullptr;
+        m_Slots.clear();
+        m_Pixels.clear();
+        m_Yuv.clear();
+    }
+
+    void FrameStream::SetColormap(const Colormap& colormap)
+    {
+        m_Colormap = colormap;
+    }
+
+    FrameStreamStats FrameStream::GetStats()
+    {
+        std::lock_guard<std::mutex> lk(m_Mutex);
+        return m_Stats;
+    }
+
+    bool ParseFrameFormat(const std::string& name, FrameFormat& format)
+    {
+        if (name == "raw" || name == "rgba")
+            format = FrameFormat::Raw;
+        else if (name == "y4m")
+            format = FrameFormat::Y4M;
+        else
+            return false;
+        return true;
+    }
+}
@@ -0,0 +1,230 @@
+#include "Diffusion/Hud.h"
+
+#include <algorithm>
+
+#include <fmt/core.h>
+#include "imgui.h"
+#include "imgui-SFML.h"
+
+#include "Utils/Functions.h"
+#include "Utils/Logger.h"
+
+namespace Diffusion
+{
+    // How often the rates and the memory use are sampled
+    static constexpr double RATE_INTERVAL = 0.5;
+
+    void RollingPlot::Push(float value)
+    {
+        m_Values[m_Offset] = value;
+        m_Offset = (m_Offset + 1) % SIZE;
+    }
+
+    void Hud::Init(sf::RenderWindow& window, int64_t cellsPerStep, bool visible)
+    {
+        ImGui::SFML::Init(window);
+        m_Initialized = true;
+        m_Visible = visible;
+        m_CellsPerStep = cellsPerStep;
+        m_WindowStart = m_LastStep = Clock::now();
+    }
+
+    void Hud::Shutdown()
+    {
+        if (m_Initialized)
+            ImGui::SFML::Shutdown();
+        m_Initialized = false;
+    }
+
+    bool Hud::ProcessEvent(const sf::Event& event)
+    {
+        ImGui::SFML::ProcessEvent(event);
+        if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F1)
+        {
+            m_Visible = !m_Visible;
+            return true;
+        }
+        if (!m_Visible)
+            return false;
+
+        const ImGuiIO& io = ImGui::GetIO();
+        switch (event.type)
+        {
+            case sf::Event::MouseWheelScrolled:
+            case sf::Event::MouseButtonPressed:
+            case sf::Event::MouseMoved:
+                return io.WantCaptureMouse;
+            case sf::Event::KeyPressed:
+                return io.WantCaptureKeyboard;
+            default:
+                return false;
+        }
+    }
+
+    void Hud::RecordStep(const std::vector<WorkerTiming>& timings)
+    {
+        auto now = Clock::now();
+        m_StepMsPlot.Push((float)std::chrono::duration<double, std::milli>(now - m_LastStep).count());
+        m_LastStep = now;
+        m_Steps++;
+        m_StepsInWindow++;
+        m_Timings = timings;
+
+        // How much longer the slowest worker took than the average one, everybody waits for it
+        double total = 0.0, slowest = 0.0;
+        for (const auto& timing : timings)
+        {
+            total += timing.computeMs;
+            slowest = std::max(slowest, timing.computeMs);
+        }
+        const double mean = timings.empty() ? 0.0 : total / timings.size();
+        m_Imbalance = mean > 0.0 ? slowest / mean - 1.0 : 0.0;
+    }
+
+    void Hud::RecordPacing(int stepsPerFrame, double stepMs)
+    {
+        m_StepsPerFrame = stepsPerFrame;
+        m_PacedStepMs = stepMs;
+    }
+
+    void Hud::MarkStepUploaded()
+    {
+        m_UploadedAt = Clock::now();
+        m_LatencyPending = true;
+    }
+
+    void Hud::FramePresented()
+    {
+        if (!m_LatencyPending)
+            return;
+        m_LatencyMs = std::chrono::duration<double, std::milli>(Clock::now() - m_UploadedAt).count();
+        m_LatencyPlot.Push((float)m_LatencyMs);
+        m_LatencyPending = false;
+    }
+
+    void Hud::Update(sf::RenderWindow& window, sf::Time dt, const Viewer& viewer)
+    {
+        // ImGui refuses a zero time step
+        if (dt <= sf::Time::Zero)
+            dt = sf::microseconds(1);
+        ImGui::SFML::Update(window, dt);
+        m_FrameMsPlot.Push(dt.asSeconds() * 1000.0f);
+
+        auto now = Clock::now();
+        const double elapsed = std::chrono::duration<double>(now - m_WindowStart).count();
+        if (elapsed >= RATE_INTERVAL)
+        {
+            m_StepsPerSecond = m_StepsInWindow / elapsed;
+            m_StepsPlot.Push((float)m_StepsPerSecond);
+            m_StepsInWindow = 0;
+            m_WindowStart = now;
+            m_Memory = Util::GetResidentMemory();
+        }
+
+        if (!m_Visible)
+            return;
+
+        drawStats();
+        if (m_ShowHeatmap)
+            drawHeatmap(viewer);
+        if (m_ShowLog)
+            Util::Logger::Draw("Log", &m_ShowLog);
+    }
+
+    void Hud::Render(sf::RenderWindow& window)
+    {
+        ImGui::SFML::Render(window);
+    }
+
+    void Hud::drawStats()
+    {
+        ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f), ImGuiCond_FirstUseEver);
+        if (!ImGui::Begin("Performance", &m_Visible, ImGuiWindowFlags_AlwaysAutoResize))
+        {
+            ImGui::End();
+            return;
+        }
+
+        const ImVec2 plotSize(260.0f, 40.0f);
+
+        Util::BeginGroupPanel("Throughput");
+        ImGui::Text("Steps: %llu", (unsigned long long)m_Steps);
+        ImGui::Text("%.1f steps/s, %.1f Mcells/s", m_StepsPerSecond, m_StepsPerSecond * m_CellsPerStep / 1e6);
+        ImGui::Text("%d steps per frame, %.2f ms per step", m_StepsPerFrame, m_PacedStepMs);
+        ImGui::PlotLines("##steps", m_StepsPlot.Values(), RollingPlot::SIZE, m_StepsPlot.Offset(), "steps/s", 0.0f, FLT_MAX, plotSize);
+        ImGui::PlotLines("##stepMs", m_StepMsPlot.Values(), RollingPlot::SIZE, m_StepMsPlot.Offset(),
+                         fmt::format("step {:.2f} ms", m_StepMsPlot.Last()).c_str(), 0.0f, FLT_MAX, plotSize);
+        Util::EndGroupPanel();
+
+        Util::BeginGroupPanel("Frame");
+        ImGui::Text("Frame: %.2f ms, latency: %.2f ms", m_FrameMsPlot.Last(), m_LatencyMs);
+        ImGui::PlotLines("##frameMs", m_FrameMsPlot.Values(), RollingPlot::SIZE, m_FrameMsPlot.Offset(), "frame ms", 0.0f, FLT_MAX, plotSize);
+        ImGui::PlotLines("##latency", m_LatencyPlot.Values(), RollingPlot::SIZE, m_LatencyPlot.Offset(), "latency ms", 0.0f, FLT_MAX, plotSize);
+        ImGui::Text("Memory: %.1f MiB", m_Memory / (1024.0 * 1024.0));
+        Util::EndGroupPanel();
+
+        Util::BeginGroupPanel("Workers");
+        ImGui::Text("Barrier imbalance: %.1f%%", m_Imbalance * 100.0);
+        if (ImGui::BeginTable("workers", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY,
+                              ImVec2(260.0f, std::min(10, (int)m_Timings.size() + 1) * ImGui::GetTextLineHeightWithSpacing())))
+        {
+            ImGui::TableSetupScrollFreeze(0, 1);
+            ImGui::TableSetupColumn("#");
+            ImGui::TableSetupColumn("step ms");
+            ImGui::TableSetupColumn("wait ms");
+            ImGui::TableSetupColumn("Mcells/s");
+            ImGui::TableHeadersRow();
+            for (size_t i = 0; i < m_Timings.size(); i++)
+            {
+                const auto& timing = m_Timings[i];
+                const double cells = double(timing.x1 - timing.x0) * double(timing.y1 - timing.y0);
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("%zu", i);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f", timing.computeMs);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f", timing.waitMs);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", timing.computeMs > 0.0 ? cells / (timing.computeMs * 1e3) : 0.0);
+            }
+            ImGui::EndTable();
+        }
+        Util::EndGroupPanel();
+
+        ImGui::Checkbox("Cost heatmap", &m_ShowHeatmap);
+        ImGui::SameLine();
+        ImGui::Checkbox("Log", &m_ShowLog);
+        ImGui::End();
+    }
+
+    void Hud::drawHeatmap(const Viewer& viewer)
+    {
+        // Time per cell of each block, relative to the most expensive one
+        double highest = 0.0;
+        for (const auto& timing : m_Timings)
+        {
+            const double cells = double(timing.x1 - timing.x0) * double(timing.y1 - timing.y0);
+            if (cells > 0.0)
+                highest = std::max(highest, timing.computeMs / cells);
+        }
+        if (highest <= 0.0)
+            return;
+
+        ImDrawList* drawList = ImGui::GetBackgroundDrawList();
+        for (const auto& timing : m_Timings)
+        {
+            const double cells = double(timing.x1 - timing.x0) * double(timing.y1 - timing.y0);
+            if (cells <= 0.0)
+                continue;
+            const float heat = float(timing.computeMs / cells / highest);
+            sf::Vector2f min = viewer.CellToScreen((double)timing.x0, (double)timing.y0);
+            sf::Vector2f max = viewer.CellToScreen((double)timing.x1, (double)timing.y1);
+            drawList->AddRectFilled(ImVec2(min.x, min.y), ImVec2(max.x, max.y),
+                                    ImGui::GetColorU32(ImVec4(heat, 0.2f, 1.0f - heat, 0.35f)));
+            drawList->AddRect(ImVec2(min.x, min.y), ImVec2(max.x, max.y), IM_COL32(255, 255, 255, 60));
+            drawList->AddText(ImVec2(min.x + 4.0f, min.y + 4.0f), IM_COL32(255, 255, 255, 220),
+                              fmt::format("{:.2f} ms", timing.computeMs).c_str());
+        }
+    }
+}
@@ -0,0 +1,370 @@
+#include "Diffusion/ImageExport.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Diffusion/Png.h"
+#include "Utils/Deflate.h"
+#include "Utils/Logger.h"
+#include "Utils/Trace.h"
+
+namespace Diffusion
+{
+    // Keeps a band well inside PNG's chunk limit and its buffers small
+    static constexpr int64_t MAX_BAND_BYTES = int64_t(1) << 28;
+    // Reserved at the start of a TIFF for either header, patched once the directory is written
+    static constexpr uint64_t TIFF_HEADER = 16;
+
+    struct Band
+    {
+        std::vector<uint8_t> data; // What goes in the file
+        uint32_t adler = 1;        // PNG: of the filtered rows, combined into the stream's
+        uint64_t rawSize = 0;
+        bool ready = false;
+    };
+
+    // What a worker keeps between bands
+    struct BandScratch
+    {
+        std::vector<uint32_t> pixels;
+        std::vector<uint8_t> rows[2];
+        std::vector<uint8_t> raw;
+        std::vector<uint8_t> filter;
+        std::vector<uint8_t> payload;
+
+        uint64_t Bytes() const
+        {
+            return pixels.capacity() * sizeof(uint32_t) + rows[0].capacity() + rows[1].capacity() + raw.capacity() +
+                   filter.capacity() + payload.capacity();
+        }
+    };
+
+    static void colourRow(const Field& field, const Colormap& colormap, int64_t y, BandScratch& scratch, uint8_t* rgb)
+    {
+        const int64_t width = field.Width();
+        const int64_t rowStart = field.Index(0, y);
+        colormap.Colorize(field.A() + rowStart, field.B() + rowStart, scratch.pixels.data(), width);
+        for (int64_t x = 0; x < width; x++)
+        {
+            const uint32_t pixel = scratch.pixels[x];
+            rgb[3 * x] = (uint8_t)pixel;
+            rgb[3 * x + 1] = (uint8_t)(pixel >> 8);
+            rgb[3 * x + 2] = (uint8_t)(pixel >> 16);
+        }
+    }
+
+    // Rows [y0, y1) as the next piece of the PNG deflate stream, in an IDAT chunk.
+    // The first row is filtered against the last row of the band before, coloured again here.
+    static void encodePngBand(const Field& field, const Colormap& colormap, int64_t y0, int64_t y1, bool last,
+                              int effort, BandScratch& scratch, Band& band)
+    {
+        const int64_t rowBytes = 3 * field.Width();
+        scratch.raw.resize((y1 - y0) * (rowBytes + 1));
+        uint8_t* above = scratch.rows[0].data();
+        uint8_t* row = scratch.rows[1].data();
+        if (y0 > 0)
+            colourRow(field, colormap, y0 - 1, scratch, above);
+        for (int64_t y = y0; y < y1; y++)
+        {
+            colourRow(field, colormap, y, scratch, row);
+            FilterPngRow(row, y > 0 ? above : nullptr, rowBytes, scratch.raw.data() + (y - y0) * (rowBytes + 1), scratch.filter);
+            std::swap(row, above);
+        }
+
+        scratch.payload.clear();
+        if (y0 == 0)
+            scratch.payload.insert(scratch.payload.end(), {0x78, 0x9C});
+        Util::Deflate(scratch.raw.data(), scratch.raw.size(), scratch.payload, last, effort);
+        band.adler = Util::Adler32(scratch.raw.data(), scratch.raw.size());
+        band.rawSize = scratch.raw.size();
+        band.data.clear();
+        PutPngChunk(band.data, "IDAT", scratch.payload.data(), scratch.payload.size());
+    }
+
+    // Rows [y0, y1) as one TIFF strip: each sample minus the one to its left, zlib compressed
+    static void encodeTiffBand(const Field& field, const Colormap& colormap, int64_t y0, int64_t y1, int effort,
+                               BandScratch& scratch, Band& band)
+    {
+        const int64_t rowBytes = 3 * field.Width();
+        scratch.raw.resize((y1 - y0) * rowBytes);
+        for (int64_t y = y0; y < y1; y++)
+        {
+            uint8_t* row = scratch.raw.data() + (y - y0) * rowBytes;
+            colourRow(field, colormap, y, scratch, row);
+            for (int64_t i = rowBytes - 1; i >= 3; i--)
+                row[i] = (uint8_t)(row[i] - row[i - 3]);
+        }
+        band.rawSize = scratch.raw.size();
+        band.data.clear();
+        Util::ZlibCompress(scratch.raw.data(), scratch.raw.size(), band.data, effort);
+    }
+
+    static void putLE(std::vector<uint8_t>& out, uint64_t value, int bytes)
+    {
+        for (int i = 0; i < bytes; i++)
+            out.push_back((uint8_t)(value >> (8 * i)));
+    }
+
+    // A TIFF directory entry, the value little endian
+    struct TiffEntry
+    {
+        uint16_t tag;
+        uint16_t type;
+        uint64_t count;
+        std::vector<uint8_t> value;
+    };
+
+    enum TiffType : uint16_t
+    {
+        TIFF_SHORT = 3,
+        TIFF_LONG = 4,
+        TIFF_LONG8 = 16
+    };
+
+    static TiffEntry tiffEntry(uint16_t tag, TiffType type, const std::vector<uint64_t>& values)
+    {
+        const int size = type == TIFF_SHORT ? 2 : (type == TIFF_LONG ? 4 : 8);
+        TiffEntry entry{tag, type, values.size(), {}};
+        for (uint64_t value : values)
+            putLE(entry.value, value, size);
+        return entry;
+    }
+
+    // The directory at `offset` (even), values that don't fit an entry before it.
+    // Returns the bytes to append and sets `directory` to where the directory starts.
+    static std::vector<uint8_t> tiffDirectory(const std::vector<TiffEntry>& entries, uint64_t offset, bool big,
+                                              uint64_t& directory)
+    {
+        const size_t inlineBytes = big ? 8 : 4;
+        std::vector<uint8_t> out;
+        std::vector<uint64_t> valueOffsets(entries.size(), 0);
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (entries[i].value.size() <= inlineBytes)
+                continue;
+            valueOffsets[i] = offset + out.size();
+            out.insert(out.end(), entries[i].value.begin(), entries[i].value.end());
+            if (out.size() & 1)
+                out.push_back(0);
+        }
+        directory = offset + out.size();
+        putLE(out, entries.size(), big ? 8 : 2);
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            const TiffEntry& entry = entries[i];
+            putLE(out, entry.tag, 2);
+            putLE(out, entry.type, 2);
+            putLE(out, entry.count, big ? 8 : 4);
+            if (entry.value.size() <= inlineBytes)
+            {
+                out.insert(out.end(), entry.value.begin(), entry.value.end());
+                out.insert(out.end(), inlineBytes - entry.value.size(), 0);
+            }
+            else
+                putLE(out, valueOffsets[i], (int)inlineBytes);
+        }
+        putLE(out, 0, big ? 8 : 4); // No next directory
+        return out;
+    }
+
+    bool ExportImage(const std::string& path, const Field& field, const Colormap& colormap,
+                     const ImageExportOptions& options, ImageExportStats* stats)
+    {
+        TRACE_SCOPE("export image");
+        const auto start = std::chrono::steady_clock::now();
+        const int64_t width = field.Width();
+        const int64_t height = field.Height();
+        if (width < 1 || height < 1 || width > INT32_MAX || height > INT32_MAX)
+        {
+            LOG_ERROR("Can't export a {}x{} image", width, height);
+            return false;
+        }
+
+        const bool png = options.format == ImageFormat::Png;
+        const int threads = options.threads > 0 ? options.threads : (int)std::max(1u, std::thread::hardware_concurrency());
+        const int64_t window = options.window > 0 ? options.window : 2 * threads;
+        const int64_t bandRows = std::clamp<int64_t>(options.bandRows, 1, std::max<int64_t>(1, MAX_BAND_BYTES / (3 * width + 1)));
+        const int64_t bandCount = (height + bandRows - 1) / bandRows;
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            LOG_ERROR("Could not open image {}", path);
+            return false;
+        }
+        std::vector<uint8_t> header;
+        if (png)
+        {
+            header.insert(header.end(), PNG_SIGNATURE, PNG_SIGNATURE + 8);
+            PutPngHeader(header, width, height);
+        }
+        else
+            header.assign(TIFF_HEADER, 0);
+        bool ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+        uint64_t offset = header.size();
+
+        // Band i is encoded into slot i % window, once band i - window is written
+        std::vector<Band> slots(window);
+        std::mutex mutex;
+        std::condition_variable cv;
+        int64_t nextBand = 0, written = 0;
+        bool failed = !ok;
+        uint64_t scratchBytes = 0;
+
+        auto worker = [&]() {
+            Util::Trace::SetThreadName("image export");
+            BandScratch scratch;
+            scratch.pixels.resize(width);
+            scratch.rows[0].resize(3 * width);
+            scratch.rows[1].resize(3 * width);
+            while (true)
+            {
+                int64_t band;
+                {
+                    std::unique_lock<std::mutex> lk(mutex);
+                    cv.wait(lk, [&] { return failed || nextBand >= bandCount || nextBand < written + window; });
+                    if (failed || nextBand >= bandCount)
+                        break;
+                    band = nextBand++;
+                }
+
+                Band& slot = slots[band % window];
+                const int64_t y0 = band * bandRows, y1 = std::min(height, y0 + bandRows);
+                {
+                    TRACE_SCOPE("encode band");
+                    if (png)
+                        encodePngBand(field, colormap, y0, y1, band == bandCount - 1, options.effort, scratch, slot);
+                    else
+                        encodeTiffBand(field, colormap, y0, y1, options.effort, scratch, slot);
+                }
+
+                {
+                    std::lock_guard<std::mutex> lk(mutex);
+                    slot.ready = true;
+                }
+                cv.notify_all();
+            }
+            std::lock_guard<std::mutex> lk(mutex);
+            scratchBytes += scratch.Bytes();
+        };
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++)
+            workers.emplace_back(worker);
+
+        // This thread writes the bands in order
+        uint32_t adler = 1;
+        std::vector<uint64_t> stripOffsets, stripSizes;
+        for (int64_t band = 0; band < bandCount && !failed; band++)
+        {
+            Band& slot = slots[band % window];
+            {
+                std::unique_lock<std::mutex> lk(mutex);
+                cv.wait(lk, [&] { return slot.ready; });
+            }
+            {
+                TRACE_SCOPE("write band");
+                ok = fwrite(slot.data.data(), 1, slot.data.size(), file) == slot.data.size();
+            }
+            adler = Util::Adler32Combine(adler, slot.adler, slot.rawSize);
+            stripOffsets.push_back(offset);
+            stripSizes.push_back(slot.data.size());
+            offset += slot.data.size();
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                slot.ready = false;
+                written++;
+                failed = !ok;
+            }
+            cv.notify_all();
+        }
+        for (auto& thread : workers)
+            thread.join();
+
+        std::vector<uint8_t> tail;
+        if (png)
+        {
+            // The stream's checksum in an IDAT of its own, then the end
+            std::vector<uint8_t> checksum;
+            PutBE32(checksum, adler);
+            PutPngChunk(tail, "IDAT", checksum.data(), checksum.size());
+            PutPngChunk(tail, "IEND", nullptr, 0);
+        }
+        else
+        {
+            // The directory goes after the strips, on a word boundary, so the header
+            // can say where; BigTIFF when the offsets outgrow 32 bits
+            if (offset & 1)
+                tail.push_back(0);
+            const bool big = offset + 16 * (uint64_t)bandCount + 4096 > UINT32_MAX;
+            const TiffType offsetType = big ? TIFF_LONG8 : TIFF_LONG;
+            const std::vector<TiffEntry> entries = {
+                tiffEntry(256, TIFF_LONG, {(uint64_t)width}),
+                tiffEntry(257, TIFF_LONG, {(uint64_t)height}),
+                tiffEntry(258, TIFF_SHORT, {8, 8, 8}),       // Bits per sample
+                tiffEntry(259, TIFF_SHORT, {8}),             // Deflate
+                tiffEntry(262, TIFF_SHORT, {2}),             // RGB
+                tiffEntry(273, offsetType, stripOffsets),
+                tiffEntry(277, TIFF_SHORT, {3}),             // Samples per pixel
+                tiffEntry(278, TIFF_LONG, {(uint64_t)bandRows}),
+                tiffEntry(279, offsetType, stripSizes),
+                tiffEntry(284, TIFF_SHORT, {1}),             // Interleaved
+                tiffEntry(317, TIFF_SHORT, {2}),             // Horizontal differencing
+            };
+            uint64_t directory = 0;
+            const std::vector<uint8_t> ifd = tiffDirectory(entries, offset + tail.size(), big, directory);
+            tail.insert(tail.end(), ifd.begin(), ifd.end());
+
+            header.clear();
+            header.insert(header.end(), {'I', 'I'});
+            if (big)
+            {
+                putLE(header, 43, 2);
+                putLE(header, 8, 2); // Offset size
+                putLE(header, 0, 2);
+                putLE(header, directory, 8);
+            }
+            else
+            {
+                putLE(header, 42, 2);
+                putLE(header, directory, 4);
+            }
+        }
+        if (!failed)
+            ok = fwrite(tail.data(), 1, tail.size(), file) == tail.size();
+        if (ok && !failed && !png)
+            ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(header.data(), 1, header.size(), file) == header.size();
+        ok = fclose(file) == 0 && ok && !failed;
+        if (!ok)
+        {
+            LOG_ERROR("Could not write image {}", path);
+            return false;
+        }
+
+        if (stats)
+        {
+            stats->bands = bandCount;
+            stats->bytes = offset + tail.size();
+            stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            stats->bufferBytes = scratchBytes;
+            for (const Band& slot : slots)
+                stats->bufferBytes += slot.data.capacity();
+        }
+        return true;
+    }
+
+    bool ParseImageFormat(const std::string& name, ImageFormat& format)
+    {
+        if (name == "png")
+            format = ImageFormat::Png;
+        else if (name == "tiff" || name == "tif")
+            format = ImageFormat::Tiff;
+        else
+            return false;
+        return true;
+    }
+}
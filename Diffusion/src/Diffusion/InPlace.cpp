@@ -0,0 +1,79 @@
+#include "Diffusion/InPlace.h"
+
+#include <algorithm>
+
+#include "Utils/Trace.h"
+
+namespace Diffusion
+{
+    InPlaceStepper::InPlaceStepper(int64_t bandRows)
+        : m_BandRows(std::max<int64_t>(1, bandRows))
+    {
+    }
+
+    void InPlaceStepper::Step(Field& field, const Parameters& params, ThreadPool& pool,
+                              ConvergenceMonitor* monitor, StatsCollector* stats)
+    {
+        if (monitor)
+            monitor->BeginStep();
+        if (stats)
+            stats->BeginStep();
+        const int64_t w = field.Width();
+        const int64_t h = field.Height();
+        const uint32_t bands = (uint32_t)((h - 2 + m_BandRows - 1) / m_BandRows);
+        m_Halos.resize(bands * 4 * w);
+        m_Rows.resize(bands * 4 * w);
+        Real* fieldA = field.A();
+        Real* fieldB = field.B();
+        const int64_t whole[2] = {1, w - 1};
+
+        auto bandRange = [&](uint32_t band, int64_t& y0, int64_t& y1) {
+            y0 = 1 + band * m_BandRows;
+            y1 = std::min(y0 + m_BandRows, h - 1);
+        };
+
+        // Every halo is saved before any band writes, the neighbours overwrite those rows
+        pool.For(bands, [&](uint32_t band) {
+            int64_t y0, y1;
+            bandRange(band, y0, y1);
+            Real* halo = m_Halos.data() + band * 4 * w;
+            std::copy_n(fieldA + (y0 - 1) * w, w, halo);
+            std::copy_n(fieldA + y1 * w, w, halo + w);
+            std::copy_n(fieldB + (y0 - 1) * w, w, halo + 2 * w);
+            std::copy_n(fieldB + y1 * w, w, halo + 3 * w);
+        });
+
+        pool.For(bands, [&](uint32_t band) {
+            TRACE_SCOPE("in place band");
+            int64_t y0, y1;
+            bandRange(band, y0, y1);
+            const Real* halo = m_Halos.data() + band * 4 * w;
+            Real* rows = m_Rows.data() + band * 4 * w;
+            const bool measure = monitor || stats;
+            const RowMeasures measures = BandMeasures(monitor, stats, band, whole);
+
+            const Real* upA = halo;
+            const Real* upB = halo + 2 * w;
+            for (int64_t y = y0; y < y1; y++)
+            {
+                // Alternates between the two buffers, the other one holds the row above
+                Real* midA = rows + ((y - y0) & 1) * w;
+                Real* midB = midA + 2 * w;
+                Real* outA = fieldA + y * w;
+                Real* outB = fieldB + y * w;
+                std::copy_n(outA, w, midA);
+                std::copy_n(outB, w, midB);
+
+                const bool last = y + 1 == y1;
+                const Real* downA = last ? halo + w : outA + w;
+                const Real* downB = last ? halo + 3 * w : outB + w;
+                if (measure)
+                    StepRowMeasured(upA, midA, downA, upB, midB, downB, outA, outB, params, measures);
+                else
+                    StepRow(upA, midA, downA, upB, midB, downB, outA, outB, params, 1, w - 1);
+                upA = midA;
+                upB = midB;
+            }
+        });
+    }
+}
@@ -0,0 +1,160 @@
+#include "Diffusion/Kernel.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Diffusion
+{
+    // The 3x3 Laplacian of column x, in the order of the original per cell code
+    static inline Real laplace(const Real* up, const Real* mid, const Real* down, int64_t x)
+    {
+        Real sum = 0;
+        sum += mid[x] * -1.0;
+        sum += mid[x - 1] * 0.2;
+        sum += mid[x + 1] * 0.2;
+        sum += down[x] * 0.2;
+        sum += up[x] * 0.2;
+        sum += up[x - 1] * 0.05;
+        sum += up[x + 1] * 0.05;
+        sum += down[x + 1] * 0.05;
+        sum += down[x - 1] * 0.05;
+        return sum;
+    }
+
+    // The measuring variants are separate instantiations, stepping without them pays nothing
+    template <bool CHANGE, bool STATS>
+    static inline void stepRow(const Real* upA, const Real* midA, const Real* downA,
+                               const Real* upB, const Real* midB, const Real* downB,
+                               Real* outA, Real* outB, const Parameters& params,
+                               int64_t startX, int64_t endX, StepChange* change, FieldStats* stats, Real onThreshold)
+    {
+        Real maxChange = 0;
+        double sumSquares = 0.0;
+        FieldStats row;
+        for (int64_t x = startX; x < endX; x++)
+        {
+            const Real a = midA[x];
+            const Real b = midB[x];
+            Real na = a + ((params.dA * laplace(upA, midA, downA, x)) - (a * b * b) + (params.feed * (1 - a)));
+            Real nb = b + ((params.dB * laplace(upB, midB, downB, x)) + (a * b * b) - ((params.kill + params.feed) * b));
+
+            if (na > 1)
+                na = 1;
+            if (nb > 1)
+                nb = 1;
+            if (na < 0)
+                na = 0;
+            if (nb < 0)
+                nb = 0;
+
+            outA[x] = na;
+            outB[x] = nb;
+
+            if (CHANGE)
+            {
+                const Real changeA = std::abs(na - a);
+                const Real changeB = std::abs(nb - b);
+                maxChange = std::max(maxChange, std::max(changeA, changeB));
+                sumSquares += changeA * changeA + changeB * changeB;
+            }
+            if (STATS)
+            {
+                row.sumA += na;
+                row.sumB += nb;
+                row.minA = std::min(row.minA, na);
+                row.maxA = std::max(row.maxA, na);
+                row.minB = std::min(row.minB, nb);
+                row.maxB = std::max(row.maxB, nb);
+                row.on += nb > onThreshold;
+            }
+        }
+        if (CHANGE)
+            change->Merge({maxChange, sumSquares});
+        if (STATS)
+        {
+            row.cells = (uint64_t)std::max<int64_t>(0, endX - startX);
+            stats->Merge(row);
+        }
+    }
+
+    void StepRow(const Real* upA, const Real* midA, const Real* downA,
+                 const Real* upB, const Real* midB, const Real* downB,
+                 Real* outA, Real* outB, const Parameters& params, int64_t startX, int64_t endX)
+    {
+        stepRow<false, false>(upA, midA, downA, upB, midB, downB, outA, outB, params, startX, endX, nullptr, nullptr, 0);
+    }
+
+    void StepRowMeasured(const Real* upA, const Real* midA, const Real* downA,
+                         const Real* upB, const Real* midB, const Real* downB,
+                         Real* outA, Real* outB, const Parameters& params, const RowMeasures& measures)
+    {
+        for (int i = 0; i < measures.segments; i++)
+        {
+            const int64_t startX = measures.splits[i], endX = measures.splits[i + 1];
+            StepChange* change = measures.changes ? &measures.changes[i] : nullptr;
+            if (change && measures.stats)
+                stepRow<true, true>(upA, midA, downA, upB, midB, downB, outA, outB, params, startX, endX, change, measures.stats, measures.onThreshold);
+            else if (change)
+                stepRow<true, false>(upA, midA, downA, upB, midB, downB, outA, outB, params, startX, endX, change, nullptr, 0);
+            else if (measures.stats)
+                stepRow<false, true>(upA, midA, downA, upB, midB, downB, outA, outB, params, startX, endX, nullptr, measures.stats, measures.onThreshold);
+            else
+                stepRow<false, false>(upA, midA, downA, upB, midB, downB, outA, outB, params, startX, endX, nullptr, nullptr, 0);
+        }
+    }
+
+    void StepRegion(const Field& grid, Field& next, const Parameters& params,
+                    int64_t startX, int64_t startY, int64_t endX, int64_t endY)
+    {
+        const Real* gridA = grid.A();
+        const Real* gridB = grid.B();
+        const int64_t w = grid.Width();
+
+        for (int64_t y = startY; y < endY; y++)
+        {
+            const int64_t row = y * w;
+            StepRow(gridA + row - w, gridA + row, gridA + row + w, gridB + row - w, gridB + row, gridB + row + w,
+                    next.A() + row, next.B() + row, params, startX, endX);
+        }
+    }
+
+    void ApplyBoundary(Field& field, Boundary boundary)
+    {
+        if (boundary == Boundary::Fixed)
+            return;
+
+        const int64_t w = field.Width();
+        const int64_t h = field.Height();
+        // Source of each ring row and column: the far interior edge when wrapping, the near one when reflecting
+        const bool periodic = boundary == Boundary::Periodic;
+        const int64_t top = periodic ? h - 2 : 1;
+        const int64_t bottom = periodic ? 1 : h - 2;
+        const int64_t left = periodic ? w - 2 : 1;
+        const int64_t right = periodic ? 1 : w - 2;
+
+        for (Real* plane : {field.A(), field.B()})
+        {
+            // Columns after rows, so the corners take the diagonal cell
+            std::copy_n(plane + top * w, w, plane);
+            std::copy_n(plane + bottom * w, w, plane + (h - 1) * w);
+            for (int64_t y = 0; y < h; y++)
+            {
+                plane[y * w] = plane[y * w + left];
+                plane[y * w + w - 1] = plane[y * w + right];
+            }
+        }
+    }
+
+    bool ParseBoundary(const std::string& name, Boundary& boundary)
+    {
+        if (name == "fixed")
+            boundary = Boundary::Fixed;
+        else if (name == "periodic")
+            boundary = Boundary::Periodic;
+        else if (name == "reflect")
+            boundary = Boundary::Reflect;
+        else
+            return false;
+        return true;
+    }
+}
@@ -0,0 +1,186 @@
+#include "Diffusion/OutOfCore.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <future>
+
+#include "Diffusion/Parallel.h"
+#include "Utils/Logger.h"
+#include "Utils/Trace.h"
+
+namespace Diffusion
+{
+    static constexpr uint64_t TOUCH_STRIDE = 4096;
+
+    OutOfCoreSimulation::~OutOfCoreSimulation()
+    {
+        Close();
+    }
+
+    bool OutOfCoreSimulation::Create(const std::string& directory, int64_t width, int64_t height, uint64_t memoryBudget, int threads)
+    {
+        Close();
+        if (width < 3 || height < 3)
+        {
+            LOG_ERROR("Out of core grids need at least 3x3 cells");
+            return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+
+        const uint64_t fileSize = 2 * (uint64_t)width * (uint64_t)height * sizeof(Real);
+        for (int i = 0; i < 2; i++)
+        {
+            m_Paths[i] = (std::filesystem::path(directory) / ("field" + std::to_string(i) + ".bin")).string();
+            m_Files[i] = std::make_shared<Util::MappedFile>();
+            if (!m_Files[i]->Create(m_Paths[i], fileSize))
+            {
+                Close();
+                return false;
+            }
+            Real* a = (Real*)m_Files[i]->Data();
+            m_Fields[i].Adopt(m_Files[i], a, a + width * height, width, height);
+        }
+
+        // Resident per row: A and B of both fields, for the band being computed and the one being prefetched
+        const uint64_t rowBytes = 2 * 4 * (uint64_t)width * sizeof(Real);
+        m_BandRows = std::clamp<int64_t>((int64_t)(memoryBudget / rowBytes), 2, std::max<int64_t>(2, height - 2));
+        m_Threads = threads;
+        m_Current = 0;
+
+        // The files start out as zeros, which is already right for B. A is 1 everywhere
+        // in the current field, the next field only needs its border: the step writes
+        // every other cell.
+        const uint32_t bands = (uint32_t)((height + m_BandRows - 1) / m_BandRows);
+        ParallelFor(bands, m_Threads, [&](uint32_t band) {
+            const int64_t y0 = band * m_BandRows;
+            const int64_t y1 = std::min(y0 + m_BandRows, height);
+            std::fill(m_Fields[0].A() + m_Fields[0].Index(0, y0), m_Fields[0].A() + m_Fields[0].Index(0, y1), Real(1));
+            release(0, y0, y1, true);
+        });
+
+        Field& next = m_Fields[1];
+        std::fill_n(next.A(), width, Real(1));
+        std::fill_n(next.A() + next.Index(0, height - 1), width, Real(1));
+        for (int64_t y = 1; y < height - 1; y++)
+        {
+            next.A()[next.Index(0, y)] = 1;
+            next.A()[next.Index(width - 1, y)] = 1;
+        }
+        m_Files[1]->Flush(0, 0, false);
+        return true;
+    }
+
+    void OutOfCoreSimulation::Close()
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            m_Fields[i] = Field();
+            m_Files[i].reset();
+            if (!m_Paths[i].empty())
+                std::remove(m_Paths[i].c_str());
+            m_Paths[i].clear();
+        }
+    }
+
+    uint64_t OutOfCoreSimulation::rowOffset(int64_t y) const
+    {
+        return (uint64_t)y * (uint64_t)m_Fields[0].Width() * sizeof(Real);
+    }
+
+    uint64_t OutOfCoreSimulation::planeBytes() const
+    {
+        return (uint64_t)m_Fields[0].Size() * sizeof(Real);
+    }
+
+    void OutOfCoreSimulation::advise(int file, int64_t y0, int64_t y1, Util::MappedFile::Advice advice)
+    {
+        const uint64_t offset = rowOffset(y0);
+        const uint64_t length = rowOffset(y1) - offset;
+        m_Files[file]->Advise(offset, length, advice);
+        m_Files[file]->Advise(planeBytes() + offset, length, advice);
+    }
+
+    void OutOfCoreSimulation::prefetch(int file, int64_t y0, int64_t y1)
+    {
+        advise(file, y0, y1, Util::MappedFile::Advice::WillNeed);
+
+        // The hint is only a hint, touching a byte per page makes sure the band is
+        // resident before the workers get to it
+        const uint8_t* data = m_Files[file]->Data();
+        const uint64_t begin = rowOffset(y0);
+        const uint64_t end = rowOffset(y1);
+        uint8_t sink = 0;
+        for (uint64_t plane = 0; plane < 2; plane++)
+            for (uint64_t offset = begin; offset < end; offset += TOUCH_STRIDE)
+                sink ^= ((volatile const uint8_t*)data)[plane * planeBytes() + offset];
+        (void)sink;
+    }
+
+    void OutOfCoreSimulation::release(int file, int64_t y0, int64_t y1, bool written)
+    {
+        if (y1 <= y0)
+            return;
+        if (written)
+        {
+            const uint64_t offset = rowOffset(y0);
+            const uint64_t length = rowOffset(y1) - offset;
+            m_Files[file]->Flush(offset, length, false);
+            m_Files[file]->Flush(planeBytes() + offset, length, false);
+        }
+        advise(file, y0, y1, Util::MappedFile::Advice::DontNeed);
+    }
+
+    void OutOfCoreSimulation::Step(const Parameters& params)
+    {
+        const int cur = m_Current;
+        const int nxt = 1 - m_Current;
+        const Field& grid = m_Fields[cur];
+        Field& next = m_Fields[nxt];
+        const int64_t width = grid.Width();
+        const int64_t last = grid.Height() - 1;
+
+        auto prefetchBand = [this, cur, nxt, last](int64_t y0, int64_t y1) {
+            TRACE_SCOPE("prefetch band");
+            // The band's rows plus one halo row above and below
+            prefetch(cur, y0 - 1, std::min(y1 + 1, last + 1));
+            prefetch(nxt, y0, y1);
+        };
+
+        int threads = m_Threads > 0 ? m_Threads : (int)std::max(1u, std::thread::hardware_concurrency());
+        std::future<void> pending = std::async(std::launch::async, prefetchBand, 1, std::min<int64_t>(1 + m_BandRows, last));
+
+        for (int64_t y0 = 1; y0 < last; y0 += m_BandRows)
+        {
+            const int64_t y1 = std::min(y0 + m_BandRows, last);
+            {
+                TRACE_SCOPE("prefetch wait");
+                pending.wait();
+            }
+            if (y1 < last)
+                pending = std::async(std::launch::async, prefetchBand, y1, std::min(y1 + m_BandRows, last));
+
+            // A few chunks per thread to even out the load
+            const int64_t rows = y1 - y0;
+            const uint32_t chunks = (uint32_t)std::min<int64_t>(rows, (int64_t)threads * 4);
+            ParallelFor(chunks, threads, [&](uint32_t chunk) {
+                TRACE_SCOPE("band chunk");
+                const int64_t start = y0 + rows * chunk / chunks;
+                const int64_t end = y0 + rows * (chunk + 1) / chunks;
+                StepRegion(grid, next, params, 1, start, width - 1, end);
+            });
+
+            TRACE_SCOPE("release band");
+            // Row y1 - 1 stays resident, it is the upper halo of the next band
+            release(cur, y0 - 1, y1 - 1, false);
+            release(nxt, y0, y1, true);
+        }
+        if (pending.valid())
+            pending.wait();
+        release(cur, last - 1, last + 1, false);
+
+        m_Current = nxt;
+    }
+}
@@ -0,0 +1,78 @@
+#include "Diffusion/Parallel.h"
+
+namespace Diffusion
+{
+    ThreadPool::ThreadPool(int threads)
+    {
+        if (threads <= 0)
+            threads = (int)std::max(1u, std::thread::hardware_concurrency());
+        for (int t = 1; t < threads; t++)
+            m_Threads.emplace_back(&ThreadPool::workerLoop, this);
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_Mutex);
+            m_Stop = true;
+        }
+        m_WakeCv.notify_all();
+        for (auto& thread : m_Threads)
+            thread.join();
+    }
+
+    void ThreadPool::For(uint32_t count, const std::function<void(uint32_t)>& f)
+    {
+        if (count == 0)
+            return;
+        if (m_Threads.empty() || count == 1)
+        {
+            for (uint32_t i = 0; i < count; i++)
+                f(i);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(m_Mutex);
+            m_Job = &f;
+            m_Count = count;
+            m_NextIndex = 0;
+            m_Busy = (int)m_Threads.size();
+            m_Generation++;
+        }
+        m_WakeCv.notify_all();
+        runItems();
+
+        // `f` lives on our stack, wait until no worker can touch it anymore
+        std::unique_lock<std::mutex> lk(m_Mutex);
+        m_DoneCv.wait(lk, [this]() { return m_Busy == 0; });
+        m_Job = nullptr;
+    }
+
+    void ThreadPool::runItems()
+    {
+        for (uint32_t i = m_NextIndex++; i < m_Count; i = m_NextIndex++)
+            (*m_Job)(i);
+    }
+
+    void ThreadPool::workerLoop()
+    {
+        uint64_t seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lk(m_Mutex);
+                m_WakeCv.wait(lk, [&]() { return m_Stop || m_Generation != seen; });
+                if (m_Stop)
+                    return;
+                seen = m_Generation;
+            }
+            runItems();
+            {
+                std::lock_guard<std::mutex> lk(m_Mutex);
+                if (--m_Busy == 0)
+                    m_DoneCv.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#include "Diffusion/Png.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "Utils/Checksum.h"
+
+namespace Diffusion
+{
+    void PutBE32(std::vector<uint8_t>& out, uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back((uint8_t)(value >> shift));
+    }
+
+    void PutPngChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size)
+    {
+        PutBE32(out, (uint32_t)size);
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data, data + size);
+        PutBE32(out, Util::Crc32(data, size, Util::Crc32(type, 4)));
+    }
+
+    void PutPngHeader(std::vector<uint8_t>& out, int64_t width, int64_t height)
+    {
+        std::vector<uint8_t> chunk;
+        PutBE32(chunk, (uint32_t)width);
+        PutBE32(chunk, (uint32_t)height);
+        chunk.insert(chunk.end(), {8, 2, 0, 0, 0});
+        PutPngChunk(out, "IHDR", chunk.data(), chunk.size());
+    }
+
+    // Minimum sum of absolute differences, the usual heuristic for picking a PNG filter per row
+    void FilterPngRow(const uint8_t* row, const uint8_t* above, int64_t bytes, uint8_t* out, std::vector<uint8_t>& scratch)
+    {
+        constexpr int BPP = 3;
+        scratch.resize(5 * bytes);
+        uint64_t bestCost = UINT64_MAX;
+        int best = 0;
+        for (int filter = 0; filter < 5; filter++)
+        {
+            uint8_t* candidate = scratch.data() + filter * bytes;
+            uint64_t cost = 0;
+            for (int64_t i = 0; i < bytes; i++)
+            {
+                const int a = i >= BPP ? row[i - BPP] : 0;
+                const int b = above ? above[i] : 0;
+                const int c = i >= BPP && above ? above[i - BPP] : 0;
+                int predicted = 0;
+                if (filter == 1)
+                    predicted = a;
+                else if (filter == 2)
+                    predicted = b;
+                else if (filter == 3)
+                    predicted = (a + b) / 2;
+                else if (filter == 4)
+                {
+                    const int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                    predicted = pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+                }
+                candidate[i] = (uint8_t)(row[i] - predicted);
+                cost += std::abs((int)(int8_t)candidate[i]);
+            }
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                best = filter;
+            }
+        }
+        out[0] = (uint8_t)best;
+        std::memcpy(out + 1, scratch.data() + best * bytes, bytes);
+    }
+}
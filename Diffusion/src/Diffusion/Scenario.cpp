@@ -0,0 +1,302 @@
+#include "Diffusion/Scenario.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <fmt/core.h>
+
+#include "Diffusion/Checkpoint.h"
+#include "Utils/Logger.h"
+#include "Utils/Trace.h"
+
+namespace Diffusion
+{
+    static bool readOutput(std::istringstream& in, ScenarioOutput& output)
+    {
+        int64_t every;
+        if (!(in >> output.path >> every) || every < 0)
+            return false;
+        output.every = (uint64_t)every;
+        return true;
+    }
+
+    bool LoadScenario(const std::string& path, Scenario& scenario)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            LOG_ERROR("Could not open scenario {}", path);
+            return false;
+        }
+
+        scenario = Scenario{};
+        scenario.name = path;
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line))
+        {
+            lineNumber++;
+            line = line.substr(0, line.find('#'));
+            std::istringstream in(line);
+            std::string key;
+            if (!(in >> key))
+                continue;
+
+            bool valid = true;
+            std::string expected;
+            if (key == "name")
+            {
+                valid = static_cast<bool>(in >> scenario.name);
+                expected = "name <text>";
+            }
+            else if (key == "size")
+            {
+                valid = (in >> scenario.width >> scenario.height) && scenario.width >= 3 && scenario.height >= 3;
+                expected = "size <width> <height>, both at least 3";
+            }
+            else if (key == "precision")
+            {
+                std::string precision;
+                valid = (in >> precision) && precision == (sizeof(Real) == sizeof(double) ? "double" : "float");
+                expected = sizeof(Real) == sizeof(double) ? "precision double, the precision of this build" : "precision float, the precision of this build";
+            }
+            else if (key == "boundary")
+            {
+                std::string name;
+                valid = (in >> name) && ParseBoundary(name, scenario.boundary);
+                expected = "boundary fixed|periodic|reflect";
+            }
+            else if (key == "params")
+            {
+                ParameterKey parameterKey;
+                int64_t step;
+                valid = (in >> step >> parameterKey.params.dA >> parameterKey.params.dB >> parameterKey.params.feed >> parameterKey.params.kill) && step >= 0;
+                parameterKey.step = (uint64_t)step;
+                scenario.parameters.push_back(parameterKey);
+                expected = "params <step> <dA> <dB> <feed> <kill>";
+            }
+            else if (key == "seed")
+            {
+                Seed seed;
+                valid = (in >> seed.x >> seed.y >> seed.length) && seed.length > 0;
+                scenario.seeds.push_back(seed);
+                expected = "seed <x> <y> <length>";
+            }
+            else if (key == "steps")
+            {
+                int64_t steps;
+                valid = (in >> steps) && steps > 0;
+                scenario.steps = (uint64_t)steps;
+                expected = "steps <count>, at least 1";
+            }
+            else if (key == "snapshot")
+            {
+                valid = readOutput(in, scenario.snapshot) && ValidSnapshotPattern(scenario.snapshot.path);
+                expected = "snapshot <path pattern> <every>, the pattern with a {} for the step";
+            }
+            else if (key == "frames")
+            {
+                std::string format;
+                valid = readOutput(in, scenario.frames) && (!(in >> format) || ParseFrameFormat(format, scenario.frameFormat));
+                expected = "frames <path> <every> [raw|y4m]";
+            }
+            else if (key == "image")
+            {
+                std::string format;
+                valid = (in >> scenario.image) && (!(in >> format) || ParseImageFormat(format, scenario.imageFormat));
+                expected = "image <path> [png|tiff]";
+            }
+            else if (key == "stats")
+            {
+                std::string format;
+                valid = readOutput(in, scenario.stats) && (!(in >> format) || ParseStatsFormat(format, scenario.statsFormat));
+                if (valid && (in >> scenario.onThreshold))
+                    valid = scenario.onThreshold >= 0 && scenario.onThreshold <= 1;
+                expected = "stats <path> <every> [csv|binary] [on threshold]";
+            }
+            else if (key == "converge")
+            {
+                ConvergenceOptions& convergence = scenario.convergence;
+                int64_t every;
+                valid = (in >> convergence.tolerance >> every >> convergence.window) && convergence.tolerance > 0.0 &&
+                        every > 0 && convergence.window > 0 && (!(in >> convergence.regions) || convergence.regions > 0);
+                convergence.every = (uint64_t)every;
+                expected = "converge <tolerance> <every> <window> [regions]";
+            }
+            else
+            {
+                LOG_ERROR("{}:{}: unknown setting {}", path, lineNumber, key);
+                return false;
+            }
+
+            std::string rest;
+            if (!valid || (in >> rest))
+            {
+                LOG_ERROR("{}:{}: expected \"{}\"", path, lineNumber, expected);
+                return false;
+            }
+        }
+
+        if (scenario.seeds.empty())
+            scenario.seeds.push_back({scenario.width / 2, scenario.height / 2, 25});
+        for (const Seed& seed : scenario.seeds)
+        {
+            if (seed.x < 0 || seed.y < 0 || seed.x >= scenario.width || seed.y >= scenario.height)
+            {
+                LOG_ERROR("{}: seed ({}, {}) is outside the {}x{} grid", path, seed.x, seed.y, scenario.width, scenario.height);
+                return false;
+            }
+        }
+        std::stable_sort(scenario.parameters.begin(), scenario.parameters.end(),
+                         [](const ParameterKey& x, const ParameterKey& y) { return x.step < y.step; });
+        return true;
+    }
+
+    Parameters Scenario::ParametersAt(uint64_t step) const
+    {
+        if (parameters.empty())
+            return Parameters{};
+        if (step <= parameters.front().step)
+            return parameters.front().params;
+        if (step >= parameters.back().step)
+            return parameters.back().params;
+
+        auto after = std::upper_bound(parameters.begin(), parameters.end(), step,
+                                      [](uint64_t s, const ParameterKey& key) { return s < key.step; });
+        const ParameterKey& from = *(after - 1);
+        const ParameterKey& to = *after;
+        const double t = double(step - from.step) / double(to.step - from.step);
+        auto lerp = [t](double x, double y) { return x + (y - x) * t; };
+        return {lerp(from.params.dA, to.params.dA), lerp(from.params.dB, to.params.dB),
+                lerp(from.params.feed, to.params.feed), lerp(from.params.kill, to.params.kill)};
+    }
+
+    ScenarioRunner::ScenarioRunner(const Options& options)
+        : m_Options(options), m_Pool(options.threads)
+    {
+    }
+
+    void ScenarioRunner::seed(const Scenario& scenario)
+    {
+        // Create keeps the capacity of the planes, same sized jobs allocate nothing
+        m_Grid.Create(scenario.width, scenario.height, 1, 0);
+        const int64_t w = scenario.width, h = scenario.height;
+        for (const Seed& seed : scenario.seeds)
+        {
+            for (int64_t j = std::max<int64_t>(1, seed.y - seed.length); j < std::min(h - 1, seed.y + seed.length); ++j) {
+                for (int64_t i = std::max<int64_t>(1, seed.x - seed.length); i < std::min(w - 1, seed.x + seed.length); ++i) {
+                    m_Grid.A()[m_Grid.Index(i, j)] = 0;
+                    m_Grid.B()[m_Grid.Index(i, j)] = 1;
+                }
+            }
+        }
+        ApplyBoundary(m_Grid, scenario.boundary);
+
+        if (m_Options.inPlace)
+            return;
+        m_Next.Create(w, h, 1, 0);
+        m_Next.CopyBorder(m_Grid);
+    }
+
+    void ScenarioRunner::advance(const Parameters& params, Boundary boundary, ConvergenceMonitor* monitor, StatsCollector* stats)
+    {
+        if (m_Options.inPlace)
+        {
+            m_InPlace.Step(m_Grid, params, m_Pool, monitor, stats);
+            ApplyBoundary(m_Grid, boundary);
+            return;
+        }
+
+        const int64_t w = m_Grid.Width(), h = m_Grid.Height();
+        const uint32_t bands = (uint32_t)((h - 2 + BAND_ROWS - 1) / BAND_ROWS);
+        const int64_t whole[2] = {1, w - 1};
+        if (monitor)
+            monitor->BeginStep();
+        if (stats)
+            stats->BeginStep();
+        m_Pool.For(bands, [&](uint32_t band) {
+            const int64_t y0 = 1 + band * BAND_ROWS;
+            const int64_t y1 = std::min(y0 + BAND_ROWS, h - 1);
+            if (!monitor && !stats)
+            {
+                StepRegion(m_Grid, m_Next, params, 1, y0, w - 1, y1);
+                return;
+            }
+            const RowMeasures measures = BandMeasures(monitor, stats, band, whole);
+            const Real* a = m_Grid.A();
+            const Real* b = m_Grid.B();
+            for (int64_t row = y0 * w; row < y1 * w; row += w)
+                StepRowMeasured(a + row - w, a + row, a + row + w, b + row - w, b + row, b + row + w,
+                                m_Next.A() + row, m_Next.B() + row, params, measures);
+        });
+        ApplyBoundary(m_Next, boundary);
+        m_Grid.Swap(m_Next);
+    }
+
+    bool ScenarioRunner::Run(const Scenario& scenario, ScenarioResult& result)
+    {
+        TRACE_SCOPE("scenario");
+        result = ScenarioResult{};
+        seed(scenario);
+        m_Snapshots.Configure(m_Options.snapshot);
+        const int64_t bandRows = m_Options.inPlace ? m_InPlace.BandRows() : BAND_ROWS;
+        m_Convergence.Configure(scenario.convergence, scenario.width, scenario.height, bandRows);
+        m_Stats.Configure((uint32_t)((scenario.height - 2 + bandRows - 1) / bandRows), scenario.onThreshold);
+
+        if (scenario.frames.every > 0)
+        {
+            // A batch job wants every frame, wait for the writer instead of dropping
+            m_Frames.SetColormap(m_Colormap);
+            if (!m_Frames.Open(scenario.frames.path, scenario.frameFormat, scenario.width, scenario.height,
+                               m_Options.fps, m_Options.frameQueue, true))
+                return false;
+        }
+
+        if (scenario.stats.every > 0 && !m_StatsWriter.Open(scenario.stats.path, scenario.statsFormat))
+        {
+            m_Frames.Close();
+            return false;
+        }
+
+        bool ok = true;
+        const auto start = std::chrono::steady_clock::now();
+        auto elapsed = [&]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+        uint64_t step = 0;
+        bool converged = false;
+        while (ok && !converged && step < scenario.steps && !TerminateRequested())
+        {
+            // Both are measured while stepping, the step they are due at
+            const bool measure = m_Convergence.Due(step + 1);
+            const bool sample = scenario.stats.every > 0 && (step + 1) % scenario.stats.every == 0;
+            advance(scenario.ParametersAt(step), scenario.boundary, measure ? &m_Convergence : nullptr, sample ? &m_Stats : nullptr);
+            step++;
+            converged = measure && m_Convergence.EndStep(step);
+            if (sample)
+                m_StatsWriter.Push(step, elapsed(), m_Stats.EndStep());
+
+            if (scenario.snapshot.every > 0 && step % scenario.snapshot.every == 0)
+                ok = m_Snapshots.Write(fmt::format(fmt::runtime(scenario.snapshot.path), step), m_Grid, step);
+            if (scenario.frames.every > 0 && step % scenario.frames.every == 0)
+                m_Frames.Push(m_Grid);
+        }
+
+        m_Frames.Close();
+        ok &= m_StatsWriter.Close();
+        if (ok && !scenario.image.empty())
+        {
+            ImageExportOptions image;
+            image.format = scenario.imageFormat;
+            image.threads = m_Options.threads;
+            ok = ExportImage(scenario.image, m_Grid, m_Colormap, image);
+        }
+
+        result.steps = step;
+        result.seconds = elapsed();
+        result.completed = step == scenario.steps || converged;
+        result.convergedAt = m_Convergence.ConvergedAt();
+        return ok;
+    }
+}
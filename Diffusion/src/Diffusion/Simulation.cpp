@@ -0,0 +1,431 @@
+#include "Diffusion/Simulation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <fmt/core.h>
+
+#include "Utils/Logger.h"
+#include "Utils/Trace.h"
+
+namespace Diffusion
+{
+    namespace
+    {
+        // The step needs a ring of border cells around at least one interior cell
+        bool validSize(int64_t width, int64_t height)
+        {
+            if (width >= 3 && height >= 3)
+                return true;
+            LOG_ERROR("A simulation needs at least 3x3 cells, got {}x{}", width, height);
+            return false;
+        }
+    }
+
+    Simulation::~Simulation()
+    {
+        stop();
+        stopCaptures();
+    }
+
+    bool Simulation::Create(int64_t width, int64_t height, int threads)
+    {
+        if (!validSize(width, height))
+            return false;
+        Field field;
+        field.Create(width, height, 1, 0);
+        return Create(std::move(field), 0, threads);
+    }
+
+    bool Simulation::Create(Field field, uint64_t step, int threads)
+    {
+        Destroy();
+        if (!validSize(field.Width(), field.Height()))
+            return false;
+        m_Grid = std::move(field);
+        // The step never writes the outer ring, so next only needs the border of grid
+        m_Next.Create(m_Grid.Width(), m_Grid.Height(), 1, 0);
+        m_Next.CopyBorder(m_Grid);
+        m_Step = step;
+        start(threads);
+        return true;
+    }
+
+    void Simulation::Destroy()
+    {
+        stop();
+        stopCaptures();
+        m_Grid = Field();
+        m_Next = Field();
+        m_Step = 0;
+        m_Pending = false;
+        m_Paused = false;
+    }
+
+    void Simulation::Seed(int64_t x, int64_t y, int64_t radius)
+    {
+        protect(x - radius, y - radius, x + radius, y + radius);
+        for (int64_t j = std::max<int64_t>(0, y - radius); j < std::min(Height(), y + radius); j++)
+        {
+            for (int64_t i = std::max<int64_t>(0, x - radius); i < std::min(Width(), x + radius); i++)
+            {
+                m_Grid.A()[m_Grid.Index(i, j)] = 0;
+                m_Grid.B()[m_Grid.Index(i, j)] = 1;
+            }
+        }
+    }
+
+    void Simulation::SetParameters(const Parameters& params)
+    {
+        m_Params = params;
+    }
+
+    void Simulation::SetBoundary(Boundary boundary)
+    {
+        m_Boundary = boundary;
+    }
+
+    void Simulation::SetStatsEvery(int every)
+    {
+        m_StatsEvery = std::max(0, every);
+    }
+
+    void Simulation::SetRowCallback(RowCallback callback)
+    {
+        m_RowCallback = std::move(callback);
+    }
+
+    bool Simulation::Resize(int64_t width, int64_t height)
+    {
+        if (!validSize(width, height))
+            return false;
+        {
+            std::unique_lock<std::mutex> lk(m_Mutex);
+            waitIdle(lk);
+        }
+        if (m_Pending)
+            Advance();
+        stop();
+        // They read the planes about to be freed
+        WaitCaptures();
+
+        Field field;
+        field.Create(width, height, 1, 0);
+        const int64_t columns = std::min(width, Width());
+        for (int64_t j = 0; j < std::min(height, Height()); j++)
+        {
+            std::copy_n(m_Grid.A() + m_Grid.Index(0, j), columns, field.A() + field.Index(0, j));
+            std::copy_n(m_Grid.B() + m_Grid.Index(0, j), columns, field.B() + field.Index(0, j));
+        }
+        m_Grid = std::move(field);
+        m_Next.Create(width, height, 1, 0);
+        m_Next.CopyBorder(m_Grid);
+        start(m_ThreadCount);
+        return true;
+    }
+
+    uint64_t Simulation::Step(uint64_t count)
+    {
+        uint64_t done = 0;
+        for (; done < count && Begin(); done++)
+        {
+            Wait();
+            Advance();
+        }
+        return done;
+    }
+
+    bool Simulation::Begin(bool rows)
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_Mutex);
+            if (m_Paused || m_Pending || m_Threads.empty())
+                return false;
+            m_StepParams = m_Params;
+            m_StepRows = rows;
+            m_Sample = m_StatsEvery > 0 && (m_Step + 1) % m_StatsEvery == 0;
+            m_Protect.clear();
+            std::lock_guard<std::mutex> captureLk(m_CaptureMutex);
+            for (const auto& capture : m_Captures)
+                if (capture->Source() == m_Next.A() && !capture->Copied())
+                    m_Protect.push_back(capture);
+            m_Busy = (int)m_Threads.size();
+            m_Pending = true;
+            m_Generation++;
+        }
+        m_WakeCv.notify_all();
+        return true;
+    }
+
+    bool Simulation::Ready()
+    {
+        TRACE_SCOPE("lock wait");
+        std::lock_guard<std::mutex> lk(m_Mutex);
+        return m_Pending && m_Busy == 0;
+    }
+
+    void Simulation::Wait()
+    {
+        std::unique_lock<std::mutex> lk(m_Mutex);
+        waitIdle(lk);
+    }
+
+    bool Simulation::WaitUntil(std::chrono::steady_clock::time_point deadline)
+    {
+        std::unique_lock<std::mutex> lk(m_Mutex);
+        return m_DoneCv.wait_until(lk, deadline, [this]() { return m_Pending && m_Busy == 0; });
+    }
+
+    bool Simulation::Advance()
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_Mutex);
+            if (!m_Pending || m_Busy > 0)
+                return false;
+            m_Pending = false;
+        }
+        {
+            TRACE_SCOPE("swap");
+            m_Grid.Swap(m_Next);
+        }
+        m_Step += 1;
+        if (m_Boundary != Boundary::Fixed)
+        {
+            // The outer ring, the step never writes it
+            protect(0, 0, Width(), 1);
+            protect(0, Height() - 1, Width(), Height());
+            protect(0, 0, 1, Height());
+            protect(Width() - 1, 0, Width(), Height());
+            ApplyBoundary(m_Grid, m_Boundary);
+        }
+        // The bands' slots, folded in band order
+        if (m_Sample)
+            m_Stats = m_Collector.EndStep();
+        return m_Sample;
+    }
+
+    void Simulation::Pause()
+    {
+        std::unique_lock<std::mutex> lk(m_Mutex);
+        m_Paused = true;
+        waitIdle(lk);
+    }
+
+    void Simulation::Resume()
+    {
+        std::lock_guard<std::mutex> lk(m_Mutex);
+        m_Paused = false;
+    }
+
+    bool Simulation::Paused()
+    {
+        std::lock_guard<std::mutex> lk(m_Mutex);
+        return m_Paused;
+    }
+
+    std::shared_ptr<const Capture> Simulation::RequestCapture(Capture::Callback done)
+    {
+        auto capture = std::make_shared<Capture>(m_Grid, m_Step, std::move(done));
+        {
+            std::lock_guard<std::mutex> lk(m_CaptureMutex);
+            m_Captures.push_back(capture);
+            if (!m_CaptureThread.joinable())
+            {
+                m_CaptureStop = false;
+                m_CaptureThread = std::thread(&Simulation::captureLoop, this);
+            }
+        }
+        m_CaptureCv.notify_all();
+        return capture;
+    }
+
+    void Simulation::WaitCaptures()
+    {
+        std::unique_lock<std::mutex> lk(m_CaptureMutex);
+        m_CaptureCv.wait(lk, [this]() { return m_Captures.empty(); });
+    }
+
+    void Simulation::captureLoop()
+    {
+        Util::Trace::SetThreadName("capture");
+        while (true)
+        {
+            std::shared_ptr<Capture> capture;
+            {
+                std::unique_lock<std::mutex> lk(m_CaptureMutex);
+                m_CaptureCv.wait(lk, [this]() { return m_CaptureStop || !m_Captures.empty(); });
+                if (m_Captures.empty())
+                    return;
+                capture = m_Captures.front();
+            }
+            // Stays in the queue meanwhile, so the steps begun keep protecting it
+            capture->Complete();
+            {
+                std::lock_guard<std::mutex> lk(m_CaptureMutex);
+                m_Captures.pop_front();
+            }
+            m_CaptureCv.notify_all();
+        }
+    }
+
+    void Simulation::stopCaptures()
+    {
+        WaitCaptures();
+        {
+            std::lock_guard<std::mutex> lk(m_CaptureMutex);
+            m_CaptureStop = true;
+        }
+        m_CaptureCv.notify_all();
+        if (m_CaptureThread.joinable())
+            m_CaptureThread.join();
+    }
+
+    void Simulation::protect(int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+    {
+        std::lock_guard<std::mutex> lk(m_CaptureMutex);
+        for (const auto& capture : m_Captures)
+            if (capture->Source() == m_Grid.A())
+                capture->Protect(std::max<int64_t>(x0, 0), std::max<int64_t>(y0, 0), std::min(x1, Width()), std::min(y1, Height()));
+    }
+
+    void Simulation::waitIdle(std::unique_lock<std::mutex>& lk)
+    {
+        m_DoneCv.wait(lk, [this]() { return m_Busy == 0; });
+    }
+
+    void Simulation::start(int threads)
+    {
+        if (threads <= 0)
+            threads = (int)std::max(1u, std::thread::hardware_concurrency());
+        m_ThreadCount = threads;
+
+        const int64_t width = Width(), height = Height();
+        const int rowCount = std::max(1, int(std::sqrt(threads)));
+        const int colCount = std::max(1, threads / rowCount);
+        const int64_t blockSizeX = width / rowCount;
+        const int64_t blockSizeY = height / colCount;
+
+        m_Timings.assign(rowCount * colCount, WorkerTiming{});
+        for (int i = 0; i < rowCount; ++i)
+        {
+            for (int j = 0; j < colCount; ++j)
+            {
+                // The last blocks take the remainder, otherwise those cells would never step
+                WorkerTiming& block = m_Timings[i * colCount + j];
+                block.x0 = blockSizeX * i;
+                block.x1 = i == rowCount - 1 ? width : block.x0 + blockSizeX;
+                block.y0 = blockSizeY * j;
+                block.y1 = j == colCount - 1 ? height : block.y0 + blockSizeY;
+            }
+        }
+        m_Collector.Configure((uint32_t)std::max<int64_t>(0, (height - 2 + BAND_ROWS - 1) / BAND_ROWS), 0.5);
+
+        m_Stop = false;
+        m_Generation = 0;
+        m_Busy = 0;
+        for (int idx = 0; idx < (int)m_Timings.size(); idx++)
+            m_Threads.emplace_back(&Simulation::workerLoop, this, idx);
+    }
+
+    void Simulation::stop()
+    {
+        {
+            std::unique_lock<std::mutex> lk(m_Mutex);
+            waitIdle(lk);
+            m_Stop = true;
+        }
+        m_WakeCv.notify_all();
+        for (auto& thread : m_Threads)
+            thread.join();
+        m_Threads.clear();
+    }
+
+    void Simulation::workerLoop(int idx)
+    {
+        // The outer ring is never stepped
+        const WorkerTiming block = m_Timings[idx];
+        const int64_t startX = std::max<int64_t>(block.x0, 1), endX = std::min(block.x1, Width() - 1);
+        const int64_t startY = std::max<int64_t>(block.y0, 1), endY = std::min(block.y1, Height() - 1);
+
+        Util::Trace::SetThreadName(fmt::format("worker {}", idx));
+        auto finishedAt = std::chrono::steady_clock::now();
+        uint64_t idleSince = Util::Trace::Enabled() ? Util::Trace::Now() : 0;
+        uint64_t seen = 0;
+        while (true)
+        {
+            bool sample = false;
+            {
+                std::unique_lock<std::mutex> lk(m_Mutex);
+                m_WakeCv.wait(lk, [&]() { return m_Stop || m_Generation != seen; });
+                if (m_Stop)
+                    return;
+                seen = m_Generation;
+                sample = m_Sample;
+            }
+            auto startedAt = std::chrono::steady_clock::now();
+            uint64_t traceStart = 0;
+            if (Util::Trace::Enabled())
+            {
+                traceStart = Util::Trace::Now();
+                Util::Trace::Record("wait", idleSince, traceStart);
+            }
+
+            // Row by row so the callback sees each row while it's still in cache.
+            // StepRegion is the one kernel, every cell comes out the same whatever the blocks are.
+            const Parameters& params = m_StepParams;
+            const bool rows = m_StepRows && m_RowCallback;
+            const int64_t width = Width();
+            auto stepRow = [&](int64_t j, int64_t x0, int64_t x1, const RowMeasures* measures) {
+                const int64_t row = m_Grid.Index(0, j);
+                for (const auto& capture : m_Protect)
+                    capture->Protect(x0, j, x1, j + 1);
+                if (measures)
+                    StepRowMeasured(m_Grid.A() + row - width, m_Grid.A() + row, m_Grid.A() + row + width,
+                                    m_Grid.B() + row - width, m_Grid.B() + row, m_Grid.B() + row + width,
+                                    m_Next.A() + row, m_Next.B() + row, params, *measures);
+                else
+                    StepRegion(m_Grid, m_Next, params, x0, j, x1, j + 1);
+                if (rows)
+                    m_RowCallback(m_Next, j, x0, x1);
+            };
+            if (sample)
+            {
+                // Whole rows in bands instead of the blocks: each band is summed in
+                // row order by one worker, so the statistics are the same for any
+                // number of workers
+                const int64_t whole[2] = {1, width - 1};
+                const uint32_t bands = m_Collector.Bands();
+                for (uint32_t band = idx; band < bands; band += (uint32_t)m_Timings.size())
+                {
+                    const RowMeasures measures = BandMeasures(nullptr, &m_Collector, band, whole);
+                    *measures.stats = FieldStats{};
+                    const int64_t y0 = 1 + band * BAND_ROWS;
+                    const int64_t y1 = std::min(y0 + BAND_ROWS, Height() - 1);
+                    for (int64_t j = y0; j < y1; j++)
+                        stepRow(j, whole[0], whole[1], &measures);
+                }
+            }
+            else
+            {
+                for (int64_t j = startY; j < endY; j++)
+                    stepRow(j, startX, endX, nullptr);
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (Util::Trace::Enabled())
+            {
+                idleSince = Util::Trace::Now();
+                Util::Trace::Record("step", traceStart, idleSince);
+            }
+            {
+                std::lock_guard<std::mutex> lk(m_Mutex);
+                m_Timings[idx].computeMs = std::chrono::duration<double, std::milli>(now - startedAt).count();
+                m_Timings[idx].waitMs = std::chrono::duration<double, std::milli>(startedAt - finishedAt).count();
+                if (--m_Busy == 0)
+                    m_DoneCv.notify_all();
+            }
+            finishedAt = now;
+        }
+    }
+}
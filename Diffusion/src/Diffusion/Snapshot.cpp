@@ -0,0 +1,576 @@
+#include "Diffusion/Snapshot.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include <fmt/core.h>
+
+#include "Diffusion/Parallel.h"
+#include "Utils/Checksum.h"
+#include "Utils/Logger.h"
+#include "Utils/Trace.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Diffusion
+{
+    static constexpr int BLOCK = 32;
+    static constexpr uint32_t ZERO_BLOCK = 31; // Block code for 32 zero residuals, other codes are the Rice parameter
+
+    enum Predictor : uint8_t
+    {
+        PREDICT_SPATIAL = 0,
+        PREDICT_TEMPORAL = 1
+    };
+
+    static inline int countTrailingZeros(uint64_t v)
+    {
+#ifdef _MSC_VER
+        unsigned long idx;
+        _BitScanForward64(&idx, v);
+        return (int)idx;
+#else
+        return __builtin_ctzll(v);
+#endif
+    }
+
+    static inline uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+    static inline int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& out) : m_Out(out) {}
+
+        inline void Put(uint32_t value, int bits)
+        {
+            m_Acc |= (uint64_t)value << m_Bits;
+            m_Bits += bits;
+            while (m_Bits >= 8)
+            {
+                m_Out.push_back((uint8_t)m_Acc);
+                m_Acc >>= 8;
+                m_Bits -= 8;
+            }
+        }
+
+        // q zero bits followed by a one
+        inline void Unary(uint32_t q)
+        {
+            while (q >= 32)
+            {
+                Put(0, 32);
+                q -= 32;
+            }
+            Put(1u << q, q + 1);
+        }
+
+        inline void Finish()
+        {
+            if (m_Bits > 0)
+                m_Out.push_back((uint8_t)m_Acc);
+            m_Acc = 0;
+            m_Bits = 0;
+        }
+
+    private:
+        std::vector<uint8_t>& m_Out;
+        uint64_t m_Acc = 0;
+        int m_Bits = 0;
+    };
+
+    class BitReader
+    {
+    public:
+        BitReader(const uint8_t* data, size_t size) : m_Ptr(data), m_End(data + size) {}
+
+        inline uint32_t Get(int bits)
+        {
+            refill();
+            if (m_Bits < bits)
+            {
+                m_Overrun = true;
+                return 0;
+            }
+            uint32_t value = (uint32_t)(m_Acc & ((1ull << bits) - 1));
+            m_Acc >>= bits;
+            m_Bits -= bits;
+            return value;
+        }
+
+        inline uint32_t Unary()
+        {
+            uint32_t q = 0;
+            while (true)
+            {
+                refill();
+                if (m_Bits == 0)
+                {
+                    m_Overrun = true;
+                    return 0;
+                }
+                if (m_Acc == 0)
+                {
+                    q += m_Bits;
+                    m_Bits = 0;
+                    continue;
+                }
+                int zeros = countTrailingZeros(m_Acc);
+                m_Acc >>= zeros + 1;
+                m_Bits -= zeros + 1;
+                return q + zeros;
+            }
+        }
+
+        inline bool Overrun() const { return m_Overrun; }
+
+    private:
+        inline void refill()
+        {
+            while (m_Bits <= 56 && m_Ptr < m_End)
+            {
+                m_Acc |= (uint64_t)(*m_Ptr++) << m_Bits;
+                m_Bits += 8;
+            }
+        }
+
+        const uint8_t* m_Ptr;
+        const uint8_t* m_End;
+        uint64_t m_Acc = 0;
+        int m_Bits = 0;
+        bool m_Overrun = false;
+    };
+
+    // Rice codes the residuals in blocks of 32, each block starts with a 5 bit code:
+    // the Rice parameter k, or ZERO_BLOCK when every residual of the block is 0.
+    static void encodeResiduals(const uint32_t* residuals, size_t count, BitWriter& writer)
+    {
+        for (size_t start = 0; start < count; start += BLOCK)
+        {
+            const size_t n = std::min<size_t>(BLOCK, count - start);
+            const uint32_t* r = residuals + start;
+
+            uint64_t sum = 0;
+            for (size_t i = 0; i < n; i++)
+                sum += r[i];
+            if (sum == 0 && n == BLOCK)
+            {
+                writer.Put(ZERO_BLOCK, 5);
+                continue;
+            }
+
+            // The optimal k is close to log2 of the mean, pick the cheapest neighbour
+            int guess = 0;
+            for (uint64_t mean = sum / n; mean > 1 && guess < 30; mean >>= 1)
+                guess++;
+            int k = guess;
+            uint64_t best = UINT64_MAX;
+            for (int candidate = std::max(0, guess - 1); candidate <= std::min(30, guess + 1); candidate++)
+            {
+                uint64_t bits = (uint64_t)n * (candidate + 1);
+                for (size_t i = 0; i < n; i++)
+                    bits += r[i] >> candidate;
+                if (bits < best)
+                {
+                    best = bits;
+                    k = candidate;
+                }
+            }
+
+            writer.Put((uint32_t)k, 5);
+            for (size_t i = 0; i < n; i++)
+            {
+                writer.Unary(r[i] >> k);
+                if (k > 0)
+                    writer.Put(r[i] & ((1u << k) - 1), k);
+            }
+        }
+    }
+
+    static bool decodeResiduals(BitReader& reader, uint32_t* residuals, size_t count)
+    {
+        for (size_t start = 0; start < count; start += BLOCK)
+        {
+            const size_t n = std::min<size_t>(BLOCK, count - start);
+            uint32_t k = reader.Get(5);
+            if (k == ZERO_BLOCK)
+            {
+                std::fill_n(residuals + start, n, 0u);
+                continue;
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                uint32_t q = reader.Unary();
+                uint32_t rest = k > 0 ? reader.Get((int)k) : 0;
+                residuals[start + i] = (q << k) | rest;
+            }
+            if (reader.Overrun())
+                return false;
+        }
+        return !reader.Overrun();
+    }
+
+    // Residuals against the gradient predictor up + left - upLeft. The first row is
+    // predicted from the left neighbour and the first column from the row above.
+    static void spatialResiduals(const int32_t* q, int w, int h, uint32_t* out)
+    {
+        for (int y = 0; y < h; y++)
+        {
+            const int32_t* row = q + (size_t)y * w;
+            const int32_t* up = row - w;
+            for (int x = 0; x < w; x++)
+            {
+                int32_t pred;
+                if (y == 0)
+                    pred = x > 0 ? row[x - 1] : 0;
+                else if (x == 0)
+                    pred = up[0];
+                else
+                    pred = up[x] + row[x - 1] - up[x - 1];
+                out[(size_t)y * w + x] = zigzag(row[x] - pred);
+            }
+        }
+    }
+
+    static void spatialReconstruct(const uint32_t* residuals, int w, int h, int32_t* q)
+    {
+        for (int y = 0; y < h; y++)
+        {
+            int32_t* row = q + (size_t)y * w;
+            const int32_t* up = row - w;
+            for (int x = 0; x < w; x++)
+            {
+                int32_t pred;
+                if (y == 0)
+                    pred = x > 0 ? row[x - 1] : 0;
+                else if (x == 0)
+                    pred = up[0];
+                else
+                    pred = up[x] + row[x - 1] - up[x - 1];
+                row[x] = pred + unzigzag(residuals[(size_t)y * w + x]);
+            }
+        }
+    }
+
+    struct TileRect
+    {
+        int64_t x, y;
+        int w, h;
+    };
+
+    static TileRect tileRect(const SnapshotHeader& header, uint32_t tile)
+    {
+        const int64_t tilesX = (header.width + header.tileSize - 1) / header.tileSize;
+        TileRect rect;
+        rect.x = (tile % tilesX) * header.tileSize;
+        rect.y = (tile / tilesX) * header.tileSize;
+        rect.w = (int)std::min<int64_t>(header.tileSize, header.width - rect.x);
+        rect.h = (int)std::min<int64_t>(header.tileSize, header.height - rect.y);
+        return rect;
+    }
+
+    static uint32_t headerCrc(const SnapshotHeader& header)
+    {
+        return Util::Crc32(&header, offsetof(SnapshotHeader, crcHeader));
+    }
+
+    static inline int32_t quantize(Real v, double scale)
+    {
+        return (int32_t)std::llround(v * scale);
+    }
+
+    void SnapshotWriter::Configure(const SnapshotOptions& options)
+    {
+        m_Options = options;
+        m_RefA.clear();
+        m_RefB.clear();
+        m_SinceKeyframe = -1;
+    }
+
+    bool SnapshotWriter::Write(const std::string& path, const Field& field, uint64_t step)
+    {
+        TRACE_SCOPE("snapshot");
+        const double scale = 1.0 / m_Options.precision;
+        if (!(m_Options.precision > 0.0) || scale > (double)(1 << 29))
+        {
+            LOG_ERROR("Snapshot precision {} is out of range", m_Options.precision);
+            return false;
+        }
+
+        SnapshotHeader header{};
+        std::memcpy(header.magic, "RDSN", 4);
+        header.version = SNAPSHOT_VERSION;
+        header.tileSize = (uint32_t)std::max(8, m_Options.tileSize);
+        header.width = field.Width();
+        header.height = field.Height();
+        header.step = step;
+        header.precision = m_Options.precision;
+
+        const int64_t tilesX = (header.width + header.tileSize - 1) / header.tileSize;
+        const int64_t tilesY = (header.height + header.tileSize - 1) / header.tileSize;
+        header.tileCount = (uint32_t)(tilesX * tilesY);
+
+        const bool temporal = m_Options.keyframeEvery > 0;
+        const bool hasReference = temporal && m_SinceKeyframe >= 0 && m_SinceKeyframe < m_Options.keyframeEvery &&
+                                  (int64_t)m_RefA.size() == field.Size();
+        if (hasReference)
+        {
+            header.referenceStep = m_RefStep;
+            m_SinceKeyframe++;
+        }
+        else
+            m_SinceKeyframe = 0;
+
+        std::vector<int32_t> newRefA;
+        std::vector<int32_t> newRefB;
+        if (temporal)
+        {
+            newRefA.resize(field.Size());
+            newRefB.resize(field.Size());
+        }
+
+        std::vector<std::vector<uint8_t>> payloads(header.tileCount);
+        std::atomic<bool> anyTemporal{false};
+
+        ParallelFor(header.tileCount, m_Options.threads, [&](uint32_t tile) {
+            TRACE_SCOPE("encode tile");
+            const TileRect rect = tileRect(header, tile);
+            const size_t cells = (size_t)rect.w * rect.h;
+            std::vector<int32_t> q(cells);
+            std::vector<int32_t> ref(hasReference ? cells : 0);
+            std::vector<uint32_t> residuals(cells);
+            std::vector<uint8_t> spatial;
+            std::vector<uint8_t> fromReference;
+
+            // Both planes share the tile's predictor
+            const Real* planes[2] = {field.A(), field.B()};
+            std::vector<int32_t>* refs[2] = {&m_RefA, &m_RefB};
+            std::vector<int32_t>* newRefs[2] = {&newRefA, &newRefB};
+
+            spatial.push_back(PREDICT_SPATIAL);
+            fromReference.push_back(PREDICT_TEMPORAL);
+            BitWriter spatialWriter(spatial);
+            BitWriter referenceWriter(fromReference);
+
+            for (int p = 0; p < 2; p++)
+            {
+                for (int y = 0; y < rect.h; y++)
+                {
+                    const int64_t base = field.Index(rect.x, rect.y + y);
+                    for (int x = 0; x < rect.w; x++)
+                    {
+                        const int32_t value = quantize(planes[p][base + x], scale);
+                        q[(size_t)y * rect.w + x] = value;
+                        if (temporal)
+                            (*newRefs[p])[base + x] = value;
+                        if (hasReference)
+                            ref[(size_t)y * rect.w + x] = (*refs[p])[base + x];
+                    }
+                }
+
+                spatialResiduals(q.data(), rect.w, rect.h, residuals.data());
+                encodeResiduals(residuals.data(), cells, spatialWriter);
+
+                if (hasReference)
+                {
+                    for (size_t i = 0; i < cells; i++)
+                        residuals[i] = zigzag(q[i] - ref[i]);
+                    encodeResiduals(residuals.data(), cells, referenceWriter);
+                }
+            }
+            spatialWriter.Finish();
+            referenceWriter.Finish();
+
+            if (hasReference && fromReference.size() < spatial.size())
+            {
+                payloads[tile] = std::move(fromReference);
+                anyTemporal = true;
+            }
+            else
+                payloads[tile] = std::move(spatial);
+        });
+
+        if (anyTemporal)
+            header.flags |= SNAPSHOT_TEMPORAL;
+
+        std::vector<SnapshotTile> tiles(header.tileCount);
+        uint64_t offset = sizeof(SnapshotHeader) + tiles.size() * sizeof(SnapshotTile);
+        for (uint32_t t = 0; t < header.tileCount; t++)
+        {
+            tiles[t].offset = offset;
+            tiles[t].size = (uint32_t)payloads[t].size();
+            tiles[t].crc = Util::Crc32(payloads[t].data(), payloads[t].size());
+            offset += payloads[t].size();
+        }
+        header.crcHeader = headerCrc(header);
+
+        const std::string tmpPath = path + ".tmp";
+        FILE* file = fopen(tmpPath.c_str(), "wb");
+        if (!file)
+        {
+            LOG_ERROR("Could not create snapshot {}", tmpPath);
+            return false;
+        }
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && fwrite(tiles.data(), sizeof(SnapshotTile), tiles.size(), file) == tiles.size();
+        for (uint32_t t = 0; ok && t < header.tileCount; t++)
+            ok = fwrite(payloads[t].data(), 1, payloads[t].size(), file) == payloads[t].size();
+        ok = (fclose(file) == 0) && ok;
+        if (!ok)
+        {
+            LOG_ERROR("Could not write snapshot {}", tmpPath);
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        if (ec)
+        {
+            LOG_ERROR("Could not move {} to {}: {}", tmpPath, path, ec.message());
+            return false;
+        }
+
+        if (temporal)
+        {
+            m_RefA.swap(newRefA);
+            m_RefB.swap(newRefB);
+            m_RefStep = step;
+        }
+        m_LastSize = offset;
+        return true;
+    }
+
+    bool SnapshotReader::Open(const std::string& path)
+    {
+        Close();
+        if (!m_File.Open(path, Util::MappedFile::Access::ReadOnly))
+            return false;
+
+        if (m_File.Size() < sizeof(SnapshotHeader))
+        {
+            LOG_ERROR("{} is too small to be a snapshot", path);
+            Close();
+            return false;
+        }
+        std::memcpy(&m_Header, m_File.Data(), sizeof(m_Header));
+        if (std::memcmp(m_Header.magic, "RDSN", 4) != 0 || m_Header.crcHeader != headerCrc(m_Header))
+        {
+            LOG_ERROR("{} is not a snapshot or its header is corrupted", path);
+            Close();
+            return false;
+        }
+        if (m_Header.version != SNAPSHOT_VERSION)
+        {
+            LOG_ERROR("{} has version {}, expected {}", path, m_Header.version, SNAPSHOT_VERSION);
+            Close();
+            return false;
+        }
+        if (m_File.Size() < sizeof(SnapshotHeader) + (uint64_t)m_Header.tileCount * sizeof(SnapshotTile))
+        {
+            LOG_ERROR("{} is truncated", path);
+            Close();
+            return false;
+        }
+        m_Tiles = (const SnapshotTile*)(m_File.Data() + sizeof(SnapshotHeader));
+        return true;
+    }
+
+    void SnapshotReader::Close()
+    {
+        m_File.Close();
+        m_Header = SnapshotHeader{};
+        m_Tiles = nullptr;
+    }
+
+    bool SnapshotReader::DecodeTile(uint32_t tile, Field& field, const Field* reference) const
+    {
+        if (!m_Tiles || tile >= m_Header.tileCount)
+            return false;
+        const SnapshotTile& entry = m_Tiles[tile];
+        if (entry.size == 0 || entry.offset + entry.size > m_File.Size())
+        {
+            LOG_ERROR("Snapshot tile {} is out of the file", tile);
+            return false;
+        }
+        const uint8_t* payload = m_File.Data() + entry.offset;
+        if (Util::Crc32(payload, entry.size) != entry.crc)
+        {
+            LOG_ERROR("Snapshot tile {} failed the checksum", tile);
+            return false;
+        }
+
+        const bool temporal = payload[0] == PREDICT_TEMPORAL;
+        if (temporal && (!reference || reference->Width() != m_Header.width || reference->Height() != m_Header.height))
+        {
+            LOG_ERROR("Snapshot tile {} needs the snapshot of step {}", tile, m_Header.referenceStep);
+            return false;
+        }
+
+        const TileRect rect = tileRect(m_Header, tile);
+        const size_t cells = (size_t)rect.w * rect.h;
+        const double scale = 1.0 / m_Header.precision;
+        std::vector<uint32_t> residuals(cells);
+        std::vector<int32_t> q(cells);
+        BitReader reader(payload + 1, entry.size - 1);
+
+        Real* planes[2] = {field.A(), field.B()};
+        const Real* refPlanes[2] = {reference ? reference->A() : nullptr, reference ? reference->B() : nullptr};
+        for (int p = 0; p < 2; p++)
+        {
+            if (!decodeResiduals(reader, residuals.data(), cells))
+            {
+                LOG_ERROR("Snapshot tile {} is corrupted", tile);
+                return false;
+            }
+            if (!temporal)
+                spatialReconstruct(residuals.data(), rect.w, rect.h, q.data());
+
+            for (int y = 0; y < rect.h; y++)
+            {
+                const int64_t base = field.Index(rect.x, rect.y + y);
+                for (int x = 0; x < rect.w; x++)
+                {
+                    const size_t i = (size_t)y * rect.w + x;
+                    int32_t value = temporal ? quantize(refPlanes[p][base + x], scale) + unzigzag(residuals[i]) : q[i];
+                    planes[p][base + x] = value * m_Header.precision;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool SnapshotReader::Decode(Field& field, const Field* reference, int threads) const
+    {
+        if (!m_Tiles)
+            return false;
+        if (field.Width() != m_Header.width || field.Height() != m_Header.height)
+            field.Create(m_Header.width, m_Header.height, 0, 0);
+
+        std::atomic<bool> ok{true};
+        ParallelFor(m_Header.tileCount, threads, [&](uint32_t tile) {
+            if (!DecodeTile(tile, field, reference))
+                ok = false;
+        });
+        return ok;
+    }
+
+    bool ValidSnapshotPattern(const std::string& pattern)
+    {
+        try
+        {
+            return fmt::format(fmt::runtime(pattern), 1) != fmt::format(fmt::runtime(pattern), 2);
+        }
+        catch (const fmt::format_error&)
+        {
+            return false;
+        }
+    }
+}
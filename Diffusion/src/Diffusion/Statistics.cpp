@@ -0,0 +1,159 @@
+#include "Diffusion/Statistics.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fmt/core.h>
+
+#include "Utils/Logger.h"
+#include "Utils/Trace.h"
+
+namespace Diffusion
+{
+    void StatsCollector::Configure(uint32_t bands, Real onThreshold)
+    {
+        m_Bands.assign(bands, FieldStats{});
+        m_OnThreshold = onThreshold;
+    }
+
+    void StatsCollector::BeginStep()
+    {
+        std::fill(m_Bands.begin(), m_Bands.end(), FieldStats{});
+    }
+
+    FieldStats StatsCollector::EndStep() const
+    {
+        FieldStats total;
+        for (const FieldStats& band : m_Bands)
+            total.Merge(band);
+        return total;
+    }
+
+    RowMeasures BandMeasures(ConvergenceMonitor* monitor, StatsCollector* stats, uint32_t band, const int64_t* whole)
+    {
+        RowMeasures measures;
+        measures.splits = whole;
+        measures.segments = 1;
+        if (monitor)
+        {
+            measures.splits = monitor->Splits();
+            measures.segments = monitor->Segments();
+            measures.changes = monitor->BandChanges(band);
+        }
+        if (stats)
+        {
+            measures.stats = stats->BandStats(band);
+            measures.onThreshold = stats->OnThreshold();
+        }
+        return measures;
+    }
+
+    StatsWriter::~StatsWriter()
+    {
+        Close();
+    }
+
+    bool StatsWriter::Open(const std::string& path, StatsFormat format)
+    {
+        Close();
+        m_File = fopen(path.c_str(), format == StatsFormat::Binary ? "wb" : "w");
+        if (!m_File)
+        {
+            LOG_ERROR("Could not open the statistics file {}", path);
+            return false;
+        }
+        m_Path = path;
+        m_Format = format;
+        m_Stop = false;
+        m_Failed = false;
+        m_Queue.clear();
+
+        if (format == StatsFormat::Binary)
+        {
+            StatsFileHeader header{};
+            std::memcpy(header.magic, "RDST", 4);
+            header.version = STATS_VERSION;
+            header.recordSize = sizeof(StatsFileRecord);
+            m_Failed = fwrite(&header, sizeof(header), 1, m_File) != 1;
+        }
+        else
+            m_Failed = fputs("step,seconds,cells,meanA,minA,maxA,meanB,minB,maxB,massB,onFraction\n", m_File) < 0;
+
+        m_Writer = std::thread(&StatsWriter::writerLoop, this);
+        return true;
+    }
+
+    void StatsWriter::Push(uint64_t step, double seconds, const FieldStats& stats)
+    {
+        if (!m_File)
+            return;
+        {
+            std::lock_guard<std::mutex> lk(m_Mutex);
+            m_Queue.push_back({step, seconds, stats.cells, stats.on, stats.sumA, stats.sumB,
+                               stats.minA, stats.maxA, stats.minB, stats.maxB});
+        }
+        m_QueueCv.notify_one();
+    }
+
+    bool StatsWriter::Close()
+    {
+        if (!m_File)
+            return true;
+        {
+            std::lock_guard<std::mutex> lk(m_Mutex);
+            m_Stop = true;
+        }
+        m_QueueCv.notify_all();
+        m_Writer.join();
+
+        bool ok = !m_Failed;
+        ok &= fclose(m_File) == 0;
+        m_File = nullptr;
+        if (!ok)
+            LOG_ERROR("Could not write the statistics file {}", m_Path);
+        return ok;
+    }
+
+    void StatsWriter::writerLoop()
+    {
+        Util::Trace::SetThreadName("statistics writer");
+        std::unique_lock<std::mutex> lk(m_Mutex);
+        while (true)
+        {
+            m_QueueCv.wait(lk, [this]() { return m_Stop || !m_Queue.empty(); });
+            if (m_Queue.empty())
+                return;
+            StatsFileRecord record = m_Queue.front();
+            m_Queue.pop_front();
+
+            lk.unlock();
+            const bool ok = writeRecord(record);
+            lk.lock();
+            m_Failed |= !ok;
+        }
+    }
+
+    bool StatsWriter::writeRecord(const StatsFileRecord& record)
+    {
+        TRACE_SCOPE("write statistics");
+        if (m_Format == StatsFormat::Binary)
+            return fwrite(&record, sizeof(record), 1, m_File) == 1;
+
+        const double cells = record.cells ? double(record.cells) : 1.0;
+        fmt::print(m_File, "{},{:.3f},{},{:.9g},{:.9g},{:.9g},{:.9g},{:.9g},{:.9g},{:.9g},{:.9g}\n",
+                   record.step, record.seconds, record.cells, record.sumA / cells, record.minA, record.maxA,
+                   record.sumB / cells, record.minB, record.maxB, record.sumB, record.on / cells);
+        return !ferror(m_File);
+    }
+
+    bool ParseStatsFormat(const std::string& name, StatsFormat& format)
+    {
+        if (name == "csv")
+            format = StatsFormat::Csv;
+        else if (name == "binary" || name == "bin")
+            format = StatsFormat::Binary;
+        else
+            return false;
+        return true;
+    }
+}
@@ -0,0 +1,138 @@
+#include "Diffusion/StepController.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Diffusion
+{
+    // Frame rate StepRate presents at, and the rate MaxThroughput settles for
+    static constexpr double DISPLAY_FPS = 60.0;
+    static constexpr double THROUGHPUT_FPS = 10.0;
+    // Weight of the newest sample in the moving averages
+    static constexpr double SMOOTHING = 0.1;
+    static constexpr int MAX_STEPS_PER_FRAME = 10000;
+
+    void StepController::Configure(PacingMode mode, double target)
+    {
+        m_Mode = mode;
+        m_Target = target > 0.0 ? target : 60.0;
+        switch (mode)
+        {
+            case PacingMode::FrameRate:
+                m_FrameBudgetMs = 1000.0 / m_Target;
+                break;
+            case PacingMode::StepRate:
+                m_FrameBudgetMs = 1000.0 / DISPLAY_FPS;
+                break;
+            case PacingMode::MaxThroughput:
+                m_FrameBudgetMs = 1000.0 / THROUGHPUT_FPS;
+                break;
+        }
+        m_StepsPerFrame = 1;
+        m_FrameStart = m_PresentStart = m_CreditAt = Clock::now();
+        m_Credit = 1.0;
+    }
+
+    double StepController::msSince(Clock::time_point then, Clock::time_point now) const
+    {
+        return std::chrono::duration<double, std::milli>(now - then).count();
+    }
+
+    double StepController::creditAt(Clock::time_point now) const
+    {
+        // At most a frame's worth of steps banked, a stall isn't made up in a burst
+        return std::min(m_Credit + msSince(m_CreditAt, now) * m_Target / 1000.0,
+                        std::max(1.0, m_Target * m_FrameBudgetMs / 1000.0));
+    }
+
+    double StepController::msUntilCredit(Clock::time_point now) const
+    {
+        if (m_Mode != PacingMode::StepRate)
+            return 0.0;
+        return std::max(0.0, 1.0 - creditAt(now)) * 1000.0 / m_Target;
+    }
+
+    bool StepController::MayStep(Clock::time_point now)
+    {
+        if (m_Mode != PacingMode::StepRate)
+            return true;
+        m_Credit = creditAt(now);
+        m_CreditAt = now;
+        return m_Credit >= 1.0;
+    }
+
+    bool StepController::WillPresent(Clock::time_point now) const
+    {
+        if (m_Mode == PacingMode::FrameRate && m_StepsThisFrame + 1 >= m_StepsPerFrame)
+            return true;
+        // The step is swapped in once computed, and for StepRate once it has the credit
+        const double swapMs = std::max(m_StepMs, msUntilCredit(now));
+        return msSince(m_FrameStart, now) + swapMs >= m_FrameBudgetMs;
+    }
+
+    StepController::Clock::time_point StepController::WakeAt(Clock::time_point now) const
+    {
+        const auto toClock = [](double ms) {
+            return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(ms));
+        };
+        Clock::time_point wake = m_FrameStart + toClock(m_FrameBudgetMs);
+        if (m_Mode == PacingMode::StepRate)
+            wake = std::min(wake, now + toClock(msUntilCredit(now)));
+        return wake;
+    }
+
+    bool StepController::StepDone(Clock::time_point now, double stepMs)
+    {
+        if (m_Mode == PacingMode::StepRate)
+            m_Credit -= 1.0;
+        m_StepMs = m_StepMs > 0.0 ? m_StepMs + SMOOTHING * (stepMs - m_StepMs) : stepMs;
+        m_StepsThisFrame++;
+
+        if (m_Mode == PacingMode::FrameRate)
+            return m_StepsThisFrame >= m_StepsPerFrame || msSince(m_FrameStart, now) >= m_FrameBudgetMs ? present(now) : false;
+        return FrameDue(now);
+    }
+
+    bool StepController::FrameDue(Clock::time_point now)
+    {
+        return msSince(m_FrameStart, now) >= m_FrameBudgetMs ? present(now) : false;
+    }
+
+    bool StepController::present(Clock::time_point now)
+    {
+        m_PresentStart = now;
+        return true;
+    }
+
+    void StepController::FramePresented(Clock::time_point now)
+    {
+        const double ms = msSince(m_PresentStart, now);
+        m_FrameMs = m_FrameMs > 0.0 ? m_FrameMs + SMOOTHING * (ms - m_FrameMs) : ms;
+        m_FrameStart = now;
+        m_StepsThisFrame = 0;
+        updateStepsPerFrame();
+    }
+
+    void StepController::updateStepsPerFrame()
+    {
+        if (m_Mode != PacingMode::FrameRate || m_StepMs <= 0.0)
+            return;
+        // What's left of the budget once the frame is drawn, at least one step so the field moves
+        const double available = m_FrameBudgetMs - m_FrameMs;
+        const double steps = std::floor(available / m_StepMs);
+        m_StepsPerFrame = (int)std::clamp(steps, 1.0, (double)MAX_STEPS_PER_FRAME);
+    }
+
+    bool ParsePacingMode(const std::string& name, PacingMode& mode)
+    {
+        if (name == "fps")
+            mode = PacingMode::FrameRate;
+        else if (name == "steps")
+            mode = PacingMode::StepRate;
+        else if (name == "max")
+            mode = PacingMode::MaxThroughput;
+        else
+            return false;
+        return true;
+    }
+}
@@ -0,0 +1,261 @@
+#include "Diffusion/Viewer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Diffusion/Parallel.h"
+#include "Utils/Trace.h"
+
+namespace Diffusion
+{
+    // A level 0 tile maps onto whole pixels of the first log2(TILE_SIZE) levels,
+    // so those can be rebuilt tile by tile. Coarser levels are rebuilt entirely.
+    static constexpr int TILE_LEVELS = 8;
+    static_assert((1 << TILE_LEVELS) == Viewer::TILE_SIZE, "TILE_LEVELS must match TILE_SIZE");
+
+    static constexpr double MAX_ZOOM = 64.0;
+
+    // Rounded average of four RGBA pixels, two channels at a time in 16 bit lanes
+    static inline uint32_t average4(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+    {
+        const uint32_t mask = 0x00FF00FF;
+        uint32_t even = (a & mask) + (b & mask) + (c & mask) + (d & mask) + 0x00020002;
+        uint32_t odd = ((a >> 8) & mask) + ((b >> 8) & mask) + ((c >> 8) & mask) + ((d >> 8) & mask) + 0x00020002;
+        return ((even >> 2) & mask) | (((odd >> 2) & mask) << 8);
+    }
+
+    void Viewer::Create(const PixelBuffer& pixels, sf::Vector2u screen, int threads)
+    {
+        m_Pixels = &pixels;
+        m_Screen = screen;
+        m_Threads = threads;
+
+        m_Levels.clear();
+        int64_t w = pixels.Width();
+        int64_t h = pixels.Height();
+        while (std::max(w, h) > TILE_SIZE)
+        {
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+            m_Levels.push_back({w, h, std::vector<uint32_t>(w * h, PackRGBA(0, 0, 0))});
+        }
+
+        m_TilesX = (pixels.Width() + TILE_SIZE - 1) / TILE_SIZE;
+        m_TilesY = (pixels.Height() + TILE_SIZE - 1) / TILE_SIZE;
+        m_Dirty.reset(new std::atomic<uint8_t>[m_TilesX * m_TilesY]);
+        for (int64_t i = 0; i < m_TilesX * m_TilesY; i++)
+            m_Dirty[i].store(1, std::memory_order_relaxed);
+        m_CoarseDirty = true;
+
+        m_Texture.create(screen.x + 2, screen.y + 2);
+        Fit();
+    }
+
+    void Viewer::MarkDirty(int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+    {
+        if (!m_Dirty || x1 <= x0 || y1 <= y0)
+            return;
+        for (int64_t ty = y0 / TILE_SIZE; ty <= (y1 - 1) / TILE_SIZE; ty++)
+            for (int64_t tx = x0 / TILE_SIZE; tx <= (x1 - 1) / TILE_SIZE; tx++)
+                m_Dirty[ty * m_TilesX + tx].store(1, std::memory_order_relaxed);
+    }
+
+    const uint32_t* Viewer::levelPixels(int level) const
+    {
+        return level == 0 ? m_Pixels->Pixels() : m_Levels[level - 1].pixels.data();
+    }
+
+    void Viewer::downsample(int level, int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+    {
+        const uint32_t* src = levelPixels(level - 1);
+        const int64_t srcWidth = levelWidth(level - 1);
+        const int64_t srcHeight = levelHeight(level - 1);
+        MipLevel& dst = m_Levels[level - 1];
+
+        for (int64_t y = y0; y < y1; y++)
+        {
+            const uint32_t* row0 = src + 2 * y * srcWidth;
+            const uint32_t* row1 = src + std::min(2 * y + 1, srcHeight - 1) * srcWidth;
+            uint32_t* out = dst.pixels.data() + y * dst.width;
+            for (int64_t x = x0; x < x1; x++)
+            {
+                const int64_t left = 2 * x;
+                const int64_t right = std::min(left + 1, srcWidth - 1);
+                out[x] = average4(row0[left], row0[right], row1[left], row1[right]);
+            }
+        }
+    }
+
+    void Viewer::Refresh()
+    {
+        TRACE_SCOPE("pyramid refresh");
+        std::vector<uint32_t> dirty;
+        for (int64_t i = 0; i < m_TilesX * m_TilesY; i++)
+            if (m_Dirty[i].exchange(0, std::memory_order_relaxed))
+                dirty.push_back((uint32_t)i);
+        if (dirty.empty() && !m_CoarseDirty)
+            return;
+
+        const int tileLevels = std::min(TILE_LEVELS, (int)m_Levels.size());
+        ParallelFor((uint32_t)dirty.size(), m_Threads, [&](uint32_t i) {
+            const int64_t x0 = (dirty[i] % m_TilesX) * TILE_SIZE;
+            const int64_t y0 = (dirty[i] / m_TilesX) * TILE_SIZE;
+            const int64_t x1 = x0 + TILE_SIZE;
+            const int64_t y1 = y0 + TILE_SIZE;
+            for (int level = 1; level <= tileLevels; level++)
+                downsample(level, x0 >> level, y0 >> level,
+                           std::min(x1 >> level, levelWidth(level)), std::min(y1 >> level, levelHeight(level)));
+        });
+        for (int level = tileLevels + 1; level < LevelCount(); level++)
+            downsample(level, 0, 0, levelWidth(level), levelHeight(level));
+
+        m_CoarseDirty = false;
+        m_NeedsUpload = true;
+    }
+
+    void Viewer::Upload(bool pixelsStable)
+    {
+        TRACE_SCOPE("texture upload");
+        int level = m_Zoom >= 1.0 ? 0 : (int)std::floor(std::log2(1.0 / m_Zoom));
+        level = std::min(level, LevelCount() - 1);
+        if (level == 0 && !pixelsStable)
+        {
+            // Better a coarser picture now than waiting for the step to finish
+            if (LevelCount() == 1)
+                return;
+            level = 1;
+        }
+
+        const double scale = double(int64_t(1) << level);
+        const double left = m_CenterX - m_Screen.x / (2.0 * m_Zoom);
+        const double top = m_CenterY - m_Screen.y / (2.0 * m_Zoom);
+        const double right = m_CenterX + m_Screen.x / (2.0 * m_Zoom);
+        const double bottom = m_CenterY + m_Screen.y / (2.0 * m_Zoom);
+
+        const int64_t width = levelWidth(level);
+        const int64_t height = levelHeight(level);
+        m_RegionX = std::clamp((int64_t)std::floor(left / scale), int64_t(0), width);
+        m_RegionY = std::clamp((int64_t)std::floor(top / scale), int64_t(0), height);
+        m_RegionW = std::clamp((int64_t)std::ceil(right / scale), int64_t(0), width) - m_RegionX;
+        m_RegionH = std::clamp((int64_t)std::ceil(bottom / scale), int64_t(0), height) - m_RegionY;
+        m_Level = level;
+        m_NeedsUpload = false;
+        if (m_RegionW <= 0 || m_RegionH <= 0)
+            return;
+
+        const uint32_t* src = levelPixels(level);
+        m_Staging.resize(m_RegionW * m_RegionH);
+        for (int64_t y = 0; y < m_RegionH; y++)
+            std::copy_n(src + (m_RegionY + y) * width + m_RegionX, m_RegionW, m_Staging.data() + y * m_RegionW);
+
+        sf::Vector2u size = m_Texture.getSize();
+        if (size.x < m_RegionW || size.y < m_RegionH)
+            m_Texture.create(std::max<unsigned>(size.x, (unsigned)m_RegionW), std::max<unsigned>(size.y, (unsigned)m_RegionH));
+        m_Texture.update((const sf::Uint8*)m_Staging.data(), (unsigned)m_RegionW, (unsigned)m_RegionH, 0, 0);
+        // Filter when the GPU shrinks the level, show crisp cells when it enlarges it
+        m_Texture.setSmooth(m_Zoom * scale < 1.0);
+    }
+
+    void Viewer::Draw(sf::RenderTarget& target)
+    {
+        if (m_RegionW <= 0 || m_RegionH <= 0)
+            return;
+
+        const double scale = double(int64_t(1) << m_Level);
+        const double left = m_CenterX - m_Screen.x / (2.0 * m_Zoom);
+        const double top = m_CenterY - m_Screen.y / (2.0 * m_Zoom);
+        m_Sprite.setTexture(m_Texture);
+        m_Sprite.setTextureRect(sf::IntRect(0, 0, (int)m_RegionW, (int)m_RegionH));
+        m_Sprite.setPosition(float((m_RegionX * scale - left) * m_Zoom), float((m_RegionY * scale - top) * m_Zoom));
+        m_Sprite.setScale(float(scale * m_Zoom), float(scale * m_Zoom));
+        target.draw(m_Sprite);
+    }
+
+    void Viewer::Fit()
+    {
+        m_CenterX = m_Pixels->Width() / 2.0;
+        m_CenterY = m_Pixels->Height() / 2.0;
+        m_Zoom = std::min(double(m_Screen.x) / m_Pixels->Width(), double(m_Screen.y) / m_Pixels->Height());
+        m_NeedsUpload = true;
+    }
+
+    sf::Vector2f Viewer::CellToScreen(double x, double y) const
+    {
+        return {float((x - m_CenterX) * m_Zoom + m_Screen.x / 2.0), float((y - m_CenterY) * m_Zoom + m_Screen.y / 2.0)};
+    }
+
+    void Viewer::clampView()
+    {
+        const double fit = std::min(double(m_Screen.x) / m_Pixels->Width(), double(m_Screen.y) / m_Pixels->Height());
+        m_Zoom = std::clamp(m_Zoom, std::min(fit * 0.5, 1.0), MAX_ZOOM);
+        m_CenterX = std::clamp(m_CenterX, 0.0, double(m_Pixels->Width()));
+        m_CenterY = std::clamp(m_CenterY, 0.0, double(m_Pixels->Height()));
+        m_NeedsUpload = true;
+    }
+
+    bool Viewer::HandleEvent(const sf::Event& event, sf::RenderWindow& window)
+    {
+        // Zooms by `factor` keeping the cell under window pixel (x, y) in place
+        auto zoomAt = [this](double factor, double x, double y) {
+            const double cellX = m_CenterX + (x - m_Screen.x / 2.0) / m_Zoom;
+            const double cellY = m_CenterY + (y - m_Screen.y / 2.0) / m_Zoom;
+            m_Zoom *= factor;
+            clampView();
+            m_CenterX = cellX - (x - m_Screen.x / 2.0) / m_Zoom;
+            m_CenterY = cellY - (y - m_Screen.y / 2.0) / m_Zoom;
+            clampView();
+        };
+
+        switch (event.type)
+        {
+            case sf::Event::Resized:
+                m_Screen = {event.size.width, event.size.height};
+                window.setView(sf::View(sf::FloatRect(0, 0, (float)event.size.width, (float)event.size.height)));
+                clampView();
+                return true;
+            case sf::Event::MouseWheelScrolled:
+                zoomAt(std::pow(1.25, event.mouseWheelScroll.delta), event.mouseWheelScroll.x, event.mouseWheelScroll.y);
+                return true;
+            case sf::Event::MouseButtonPressed:
+                if (event.mouseButton.button == sf::Mouse::Left)
+                {
+                    m_Dragging = true;
+                    m_DragFrom = {event.mouseButton.x, event.mouseButton.y};
+                }
+                return false;
+            case sf::Event::MouseButtonReleased:
+                if (event.mouseButton.button == sf::Mouse::Left)
+                    m_Dragging = false;
+                return false;
+            case sf::Event::MouseMoved:
+                if (!m_Dragging)
+                    return false;
+                m_CenterX -= (event.mouseMove.x - m_DragFrom.x) / m_Zoom;
+                m_CenterY -= (event.mouseMove.y - m_DragFrom.y) / m_Zoom;
+                m_DragFrom = {event.mouseMove.x, event.mouseMove.y};
+                clampView();
+                return true;
+            case sf::Event::KeyPressed:
+            {
+                const double step = std::min(m_Screen.x, m_Screen.y) / (8.0 * m_Zoom);
+                switch (event.key.code)
+                {
+                    case sf::Keyboard::Add:
+                    case sf::Keyboard::Equal: zoomAt(2.0, m_Screen.x / 2.0, m_Screen.y / 2.0); return true;
+                    case sf::Keyboard::Subtract:
+                    case sf::Keyboard::Hyphen: zoomAt(0.5, m_Screen.x / 2.0, m_Screen.y / 2.0); return true;
+                    case sf::Keyboard::Left: m_CenterX -= step; break;
+                    case sf::Keyboard::Right: m_CenterX += step; break;
+                    case sf::Keyboard::Up: m_CenterY -= step; break;
+                    case sf::Keyboard::Down: m_CenterY += step; break;
+                    case sf::Keyboard::Home: Fit(); return true;
+                    default: return false;
+                }
+                clampView();
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+}
@@ -3,151 +3,31 @@
 #include <string>
 #include <vector>
 #include <thread>
-#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
 
 #include <fmt/core.h>
 
-#define LOCK_GUARD(X) const std::lock_guard<std::mutex> lk_##X(X);
-
-sf::Image mainImage;
-sf::Image nextImage;
-
-int WIDTH{};
-int HEIGHT{};
-
-double dA = 1.0f;
-double dB = 0.5f;
-double feed = 0.055f;
-double kill = 0.062f;
-
-void
-setPixel(const int& x, const int& y, const sf::Uint8& r, const sf::Uint8& g, const sf::Uint8& b, const sf::Uint8& a = 255) {
-    nextImage.setPixel(x, y, sf::Color{r, g, b, a});
-}
-
-void
-setPixel(const int& x, const int& y, const sf::Color& clr) {
-    setPixel(x, y, clr.r, clr.g, clr.b, clr.a);
-}
-
-sf::Color getPixel(int x, int y) { return nextImage.getPixel(x , y); }
-
-sf::Vector2f vec(sf::Vector2u v) { return {(float)v.x, (float)v.y}; }
-sf::Vector2f vec(sf::Vector2i v) { return {(float)v.x, (float)v.y}; }
-
-struct Cell {
-    double a, b;
-};
-
-std::vector<std::vector<Cell>> grid;
-std::vector<std::vector<Cell>> next;
-
-double laplaceA(int x, int y)
-{
-    double sum = 0;
-    sum += grid[x][y].a * -1.0;
-    sum += grid[x - 1][y].a * 0.2;
-    sum += grid[x + 1][y].a * 0.2;
-    sum += grid[x][y + 1].a * 0.2;
-    sum += grid[x][y - 1].a * 0.2;
-    sum += grid[x - 1][y - 1].a * 0.05;
-    sum += grid[x + 1][y - 1].a * 0.05;
-    sum += grid[x + 1][y + 1].a * 0.05;
-    sum += grid[x - 1][y + 1].a * 0.05;
-    return sum;
-}
-
-double laplaceB(int x, int y)
-{
-    double sum = 0;
-    sum += grid[x][y].b * -1.0;
-    sum += grid[x - 1][y].b * 0.2;
-    sum += grid[x + 1][y].b * 0.2;
-    sum += grid[x][y + 1].b * 0.2;
-    sum += grid[x][y - 1].b * 0.2;
-    sum += grid[x - 1][y - 1].b * 0.05;
-    sum += grid[x + 1][y - 1].b * 0.05;
-    sum += grid[x + 1][y + 1].b * 0.05;
-    sum += grid[x - 1][y + 1].b * 0.05;
-    return sum;
-}
-
-std::mutex mtx;
-std::vector<bool> threadFinished;
-
-bool isWorking = true;
-
-inline void
-doWork(int idx, int startX, int startY, int endX, int endY)
-{
-    if (startX == 0)
-        startX += 1;
-    if (endX == WIDTH)
-        endX = WIDTH - 1;
-
-    if (startY == 0)
-        startY += 1;
-    if (endY == HEIGHT)
-        endY = HEIGHT - 1;
-
-    while (true)
-    {
-        {
-            LOCK_GUARD(mtx);
-            if (!isWorking)
-                break;
-
-            if (threadFinished[idx])
-                continue;
-            threadFinished[idx] = false;
-        }
-
-        // Processing
-        for (int i = startX; i < endX; i++)
-        {
-            for (int j = startY; j < endY; j++)
-            {
-                double& a = grid[i][j].a;
-                double& b = grid[i][j].b;
-                next[i][j].a =  a +
-                                ((dA * laplaceA(i, j)) -
-                                (a * b * b) +
-                                (feed * (1 - a)));
-                next[i][j].b =  b +
-                                ((dB * laplaceB(i, j)) +
-                                (a * b * b) -
-                                ((kill + feed) * b));
-
-                if (next[i][j].a > 1)
-                    next[i][j].a = 1;
-                if (next[i][j].b > 1)
-                    next[i][j].b = 1;
-
-                if (next[i][j].a < 0)
-                    next[i][j].a = 0;
-                if (next[i][j].b < 0)
-                    next[i][j].b = 0;
-
-                // set the image pixel color
-                double a2 = (double)(next[i][j].a);
-                double b2 = (double)(next[i][j].b);
-
-                int c = (int)floor((a2 - b2) * 255);
-                if (c > 255)
-                    c = 255;
-                else if (c < 0)
-                    c = 0;
-
-                setPixel(i, j, c, c, c, 255);
-            }
-        }
-
-        {
-            LOCK_GUARD(mtx);
-            threadFinished[idx] = true;
-        }
-    }
-}
+#include "Diffusion/Animation.h"
+#include "Diffusion/Checkpoint.h"
+#include "Diffusion/Colormap.h"
+#include "Diffusion/FrameStream.h"
+#include "Diffusion/ImageExport.h"
+#include "Diffusion/Kernel.h"
+#include "Diffusion/Snapshot.h"
+#include "Diffusion/Statistics.h"
+#include "Diffusion/StepController.h"
+#include "Diffusion/OutOfCore.h"
+#include "Diffusion/Parallel.h"
+#include "Diffusion/PixelBuffer.h"
+#include "Diffusion/Scenario.h"
+#include "Diffusion/Simulation.h"
+#include "Diffusion/Viewer.h"
+#include "Diffusion/Hud.h"
+#include "Utils/LogFile.h"
+#include "Utils/Trace.h"
 
 #define ARG_OPTION_DEF(X, VAL, D) fmt::print("\t- {}: {}, Default: {}\n", X, VAL, D)
 
@@ -168,6 +48,52 @@ helpMessage()
     ARG_OPTION_DEF("dB", "Decimal", 0.5f);
     ARG_OPTION_DEF("feed", "Decimal", 0.055f);
     ARG_OPTION_DEF("kill", "Decimal", 0.062f);
+    ARG_OPTION_DEF("checkpoint", "Path", "checkpoint.rdck");
+    ARG_OPTION_DEF("checkpointEvery", "Number of steps, 0 to only save on SIGUSR1/SIGTERM", 0);
+    ARG_OPTION_DEF("restore", "Path of a checkpoint to resume from", "None");
+    ARG_OPTION_DEF("verify", "0/1, check the checkpoint checksums when restoring", 1);
+    ARG_OPTION_DEF("headless", "0/1, run without a window", 0);
+    ARG_OPTION_DEF("steps", "Number of steps to run, 0 to run until closed", 0);
+    ARG_OPTION_DEF("stream", "Path to stream frames to, - for stdout", "None");
+    ARG_OPTION_DEF("streamFormat", "raw/y4m", "y4m");
+    ARG_OPTION_DEF("streamEvery", "Number of steps between frames", 1);
+    ARG_OPTION_DEF("streamFps", "Number, frame rate written in the y4m header", 30);
+    ARG_OPTION_DEF("streamQueue", "Number of frames buffered for the writer", 4);
+    ARG_OPTION_DEF("streamBlock", "0/1, wait for the writer instead of dropping frames", 0);
+    ARG_OPTION_DEF("anim", "Path of an animated GIF or APNG of the run", "None");
+    ARG_OPTION_DEF("animFormat", "gif/apng", "gif");
+    ARG_OPTION_DEF("animEvery", "Number of steps between frames", 1);
+    ARG_OPTION_DEF("animScale", "Number of cells per pixel along each axis, averaged", 1);
+    ARG_OPTION_DEF("animFps", "Number, frame rate of the animation", 30);
+    ARG_OPTION_DEF("animDither", "none/ordered/fs, how GIF frames spread the palette over 256 colours", "ordered");
+    ARG_OPTION_DEF("animThreads", "Number of encoder threads", "Maximum number of cores in your CPU");
+    ARG_OPTION_DEF("animBlock", "0/1, wait for the encoders instead of dropping frames", 0);
+    ARG_OPTION_DEF("exportImage", "Path of a PNG or TIFF of the last step, written band by band", "None");
+    ARG_OPTION_DEF("exportFormat", "png/tiff", "png");
+    ARG_OPTION_DEF("exportBand", "Number of rows compressed together", 64);
+    ARG_OPTION_DEF("snapshot", "Path pattern of compressed snapshots, {} is replaced by the step", "None");
+    ARG_OPTION_DEF("snapshotEvery", "Number of steps between snapshots", 500);
+    ARG_OPTION_DEF("snapshotPrecision", "Decimal, quantization step of the stored values", 1e-4);
+    ARG_OPTION_DEF("snapshotTile", "Number, tile size in cells", 256);
+    ARG_OPTION_DEF("outOfCore", "Directory for the field files, runs headless with fields larger than memory", "None");
+    ARG_OPTION_DEF("outOfCoreMemory", "Number of MiB the out of core bands may use", 4096);
+    ARG_OPTION_DEF("snapshotKeyframe", "Number of snapshots coded against the previous one between self contained ones", 0);
+    ARG_OPTION_DEF("palette", "grey/viridis/magma/inferno/plasma or the path of a gradient file", "grey");
+    ARG_OPTION_DEF("colorSource", "diff/a/b, the value the palette is indexed with", "diff");
+    ARG_OPTION_DEF("colorMin", "Decimal, value mapped to the start of the palette", 0.0);
+    ARG_OPTION_DEF("colorMax", "Decimal, value mapped to the end of the palette", 1.0);
+    ARG_OPTION_DEF("hud", "0/1, show the performance overlay at start, F1 toggles it", 0);
+    ARG_OPTION_DEF("trace", "Path of a Chrome trace written at exit, F2 writes it on demand", "None");
+    ARG_OPTION_DEF("logFile", "Path of a structured binary log, LogDecode prints it", "None");
+    ARG_OPTION_DEF("logFileMB", "Size at which the log file rotates, the last 4 are kept", 64);
+    ARG_OPTION_DEF("pacing", "fps/steps/max, steps between frames to hit a frame rate, a step rate, or as many as possible", "fps");
+    ARG_OPTION_DEF("pacingTarget", "Decimal, frames per second for fps, steps per second for steps", 60);
+    ARG_OPTION_DEF("stats", "Path of the statistics time series, gathered during the step", "None");
+    ARG_OPTION_DEF("statsEvery", "Number of steps between statistics samples", 100);
+    ARG_OPTION_DEF("statsFormat", "csv/binary", "csv");
+    ARG_OPTION_DEF("scenario", "Comma separated scenario files, run one after the other without a window", "None");
+    ARG_OPTION_DEF("inPlace", "0/1, step scenarios in place with rolling row buffers, about half the memory", 0);
+    ARG_OPTION_DEF("deterministic", "0/1, print the field digest at checkpoints and exit to compare runs", 0);
 }
 
 bool
@@ -186,6 +112,12 @@ stepAndAssert(int& i, const int& steps, const int& argc)
     RES = std::stoi(argv[I]);\
 }
 
+#define CHECK_ARGV_S(RES, I) if (std::string(argv[I]) == std::string("--") + #RES) {\
+    if (!stepAndAssert(I, 1, argc))\
+        return 1;\
+    RES = argv[I];\
+}
+
 #define CHECK_ARGV_D(RES, I) if (std::string(argv[I]) == std::string("--") + #RES) {\
     if (!stepAndAssert(I, 1, argc))\
         return 1;\
@@ -196,9 +128,60 @@ int main(int argc, const char* argv[])
 {
     int width{200};
     int height{200};
+    double dA = 1.0f;
+    double dB = 0.5f;
+    double feed = 0.055f;
+    double kill = 0.062f;
+    uint64_t stepCount = 0;
     int popX{width / 2}, popY{height / 2}, length{25};
     bool debug = false;
     int cores = std::thread::hardware_concurrency();
+    std::string checkpoint = "checkpoint.rdck";
+    std::string restore;
+    int checkpointEvery = 0;
+    bool verify = true;
+    bool headless = false;
+    int steps = 0;
+    std::string stream;
+    std::string streamFormat = "y4m";
+    int streamEvery = 1;
+    int streamFps = 30;
+    int streamQueue = 4;
+    bool streamBlock = false;
+    std::string anim;
+    std::string animFormat = "gif";
+    int animEvery = 1;
+    int animScale = 1;
+    int animFps = 30;
+    std::string animDither = "ordered";
+    int animThreads = 0;
+    bool animBlock = false;
+    std::string exportImage;
+    std::string exportFormat = "png";
+    int exportBand = 64;
+    std::string snapshot;
+    int snapshotEvery = 500;
+    double snapshotPrecision = 1e-4;
+    int snapshotTile = 256;
+    int snapshotKeyframe = 0;
+    std::string outOfCore;
+    int outOfCoreMemory = 4096;
+    std::string palette = "grey";
+    std::string colorSource = "diff";
+    double colorMin = 0.0;
+    double colorMax = 1.0;
+    bool hud = false;
+    std::string trace;
+    std::string logFile;
+    int logFileMB = 64;
+    bool deterministic = false;
+    std::string scenario;
+    std::string pacing = "fps";
+    double pacingTarget = 60.0;
+    std::string stats;
+    int statsEvery = 100;
+    std::string statsFormat = "csv";
+    bool inPlace = false;
     for (auto i = 1; i < argc; ++i)
     {
         CHECK_ARGV(width, i)
@@ -212,149 +195,548 @@ int main(int argc, const char* argv[])
         else CHECK_ARGV_D(dB, i)
         else CHECK_ARGV_D(feed, i)
         else CHECK_ARGV_D(kill, i)
+        else CHECK_ARGV_S(checkpoint, i)
+        else CHECK_ARGV_S(restore, i)
+        else CHECK_ARGV(checkpointEvery, i)
+        else CHECK_ARGV(verify, i)
+        else CHECK_ARGV(headless, i)
+        else CHECK_ARGV(steps, i)
+        else CHECK_ARGV_S(stream, i)
+        else CHECK_ARGV_S(streamFormat, i)
+        else CHECK_ARGV(streamEvery, i)
+        else CHECK_ARGV(streamFps, i)
+        else CHECK_ARGV(streamQueue, i)
+        else CHECK_ARGV(streamBlock, i)
+        else CHECK_ARGV_S(anim, i)
+        else CHECK_ARGV_S(animFormat, i)
+        else CHECK_ARGV(animEvery, i)
+        else CHECK_ARGV(animScale, i)
+        else CHECK_ARGV(animFps, i)
+        else CHECK_ARGV_S(animDither, i)
+        else CHECK_ARGV(animThreads, i)
+        else CHECK_ARGV(animBlock, i)
+        else CHECK_ARGV_S(exportImage, i)
+        else CHECK_ARGV_S(exportFormat, i)
+        else CHECK_ARGV(exportBand, i)
+        else CHECK_ARGV_S(snapshot, i)
+        else CHECK_ARGV(snapshotEvery, i)
+        else CHECK_ARGV_D(snapshotPrecision, i)
+        else CHECK_ARGV(snapshotTile, i)
+        else CHECK_ARGV(snapshotKeyframe, i)
+        else CHECK_ARGV_S(outOfCore, i)
+        else CHECK_ARGV(outOfCoreMemory, i)
+        else CHECK_ARGV_S(palette, i)
+        else CHECK_ARGV_S(colorSource, i)
+        else CHECK_ARGV_D(colorMin, i)
+        else CHECK_ARGV_D(colorMax, i)
+        else CHECK_ARGV(hud, i)
+        else CHECK_ARGV_S(trace, i)
+        else CHECK_ARGV_S(logFile, i)
+        else CHECK_ARGV(logFileMB, i)
+        else CHECK_ARGV(deterministic, i)
+        else CHECK_ARGV_S(scenario, i)
+        else CHECK_ARGV_S(pacing, i)
+        else CHECK_ARGV_D(pacingTarget, i)
+        else CHECK_ARGV_S(stats, i)
+        else CHECK_ARGV(statsEvery, i)
+        else CHECK_ARGV_S(statsFormat, i)
+        else CHECK_ARGV(inPlace, i)
         else if (std::string(argv[i]) == "--help") {
             helpMessage();
             return 0;
         }
 
     }
-    WIDTH = width;
-    HEIGHT = height;
+    if (!logFile.empty())
+    {
+        Util::LogFileOptions options;
+        options.rotateBytes = (uint64_t)std::max(1, logFileMB) << 20;
+        if (!Util::Logger::OpenFile(logFile, options))
+            return 1;
+    }
+    if (!snapshot.empty() && !Diffusion::ValidSnapshotPattern(snapshot))
+    {
+        fmt::print("Invalid snapshot pattern {}, it needs a {{}} for the step\n", snapshot);
+        return 1;
+    }
+    // Stays mapped, the simulation takes it over as it is
+    Diffusion::Field restored;
+    if (!restore.empty())
+    {
+        Diffusion::CheckpointInfo info;
+        if (!Diffusion::LoadCheckpoint(restore, restored, info, verify))
+            return 1;
+        width = (int)restored.Width();
+        height = (int)restored.Height();
+        stepCount = info.step;
+        dA = info.dA;
+        dB = info.dB;
+        feed = info.feed;
+        kill = info.kill;
+        fmt::print("Restored step {} from {}\n", stepCount, restore);
+    }
+
+    if (!trace.empty())
+    {
+        Util::Trace::Enable(true);
+        Util::Trace::SetThreadName("main");
+    }
+
+    Diffusion::ColorSource source;
+    if (!Diffusion::ParseColorSource(colorSource, source))
+    {
+        fmt::print("Unknown color source: {}\n", colorSource);
+        return 1;
+    }
+    Diffusion::Colormap colormap;
+    if (!colormap.SetPalette(palette) && !colormap.LoadGradient(palette))
+        return 1;
+    colormap.SetSource(source);
+    colormap.SetRange(colorMin, colorMax);
+
+    // The last step as an image, without an image of the whole grid in memory
+    Diffusion::ImageExportOptions exportOptions;
+    exportOptions.bandRows = exportBand;
+    exportOptions.threads = cores;
+    if (!Diffusion::ParseImageFormat(exportFormat, exportOptions.format))
+    {
+        fmt::print("Unknown export format: {}\n", exportFormat);
+        return 1;
+    }
+    auto exportField = [&](const Diffusion::Field& field) {
+        if (exportImage.empty())
+            return true;
+        Diffusion::ImageExportStats exportStats;
+        if (!Diffusion::ExportImage(exportImage, field, colormap, exportOptions, &exportStats))
+            return false;
+        fmt::print("\nExported {}x{} to {}: {:.1f} MiB in {:.2f} s, {} bands, {:.1f} MiB of band buffers\n", field.Width(),
+                   field.Height(), exportImage, exportStats.bytes / 1048576.0, exportStats.seconds, exportStats.bands,
+                   exportStats.bufferBytes / 1048576.0);
+        return true;
+    };
+
+    if (!scenario.empty())
+    {
+        Diffusion::ScenarioRunner::Options options;
+        options.threads = cores;
+        options.snapshot = {snapshotPrecision, snapshotTile, cores, snapshotKeyframe};
+        options.fps = streamFps;
+        options.frameQueue = streamQueue;
+        options.inPlace = inPlace;
+        Diffusion::ScenarioRunner runner(options);
+        runner.SetColormap(colormap);
+        Diffusion::InstallCheckpointSignals();
+
+        int failed = 0;
+        std::istringstream paths(scenario);
+        std::string path;
+        while (std::getline(paths, path, ',') && !Diffusion::TerminateRequested())
+        {
+            Diffusion::Scenario job;
+            Diffusion::ScenarioResult result;
+            if (!Diffusion::LoadScenario(path, job) || !runner.Run(job, result))
+            {
+                fmt::print("Scenario {} failed\n", path);
+                failed++;
+                continue;
+            }
+            fmt::print("Scenario {}: {} of {} steps of {}x{} in {:.3f} s, {:.1f} Mcells/s\n", job.name, result.steps, job.steps,
+                       job.width, job.height, result.seconds, result.steps * double(job.width - 2) * (job.height - 2) / (std::max(result.seconds, 1e-9) * 1e6));
+            const Diffusion::ConvergenceMonitor& convergence = runner.Convergence();
+            if (convergence.Converged())
+            {
+                fmt::print("Scenario {}: steady since step {}, last change {:.3g} (L2 {:.3g}), regions steady since:\n",
+                           job.name, result.convergedAt, convergence.Last().maxAbs, convergence.LastL2());
+                for (int y = 0; y < convergence.Regions(); y++)
+                {
+                    for (int x = 0; x < convergence.Regions(); x++)
+                        fmt::print(" {:>9}", convergence.RegionConvergedAt(x, y));
+                    fmt::print("\n");
+                }
+            }
+            if (deterministic)
+                fmt::print("Scenario {}: digest {:08x}\n", job.name, runner.Current().Digest(cores));
+        }
+        if (!trace.empty())
+            Util::Trace::Write(trace);
+        return failed > 0 ? 1 : 0;
+    }
 
-    if (popY > HEIGHT || popX > WIDTH || popX < 0 || popY < 0)
+    if (restore.empty() && (popY > height || popX > width || popX < 0 || popY < 0))
     {
         fmt::print("Invalid parameters");
         return 1;
     }
 
-    sf::ContextSettings settings;
-    settings.antialiasingLevel = 8;
+    if (!outOfCore.empty())
+    {
+        if (!restore.empty() || !stream.empty() || !anim.empty())
+        {
+            fmt::print("outOfCore can't be combined with restore, stream or anim\n");
+            return 1;
+        }
 
-    sf::RenderWindow window(sf::VideoMode(WIDTH, HEIGHT), "App", sf::Style::Default, settings);
+        Diffusion::OutOfCoreSimulation simulation;
+        if (!simulation.Create(outOfCore, width, height, (uint64_t)outOfCoreMemory << 20, cores))
+            return 1;
 
-    mainImage.create(WIDTH, HEIGHT);
-    nextImage.create(WIDTH, HEIGHT);
+        Diffusion::Field& field = simulation.Current();
+        for (int j = std::max(1, popY - length); j < std::min(height - 1, popY + length); ++j) {
+            for (int i = std::max(1, popX - length); i < std::min(width - 1, popX + length); ++i) {
+                field.A()[field.Index(i, j)] = 0;
+                field.B()[field.Index(i, j)] = 1;
+            }
+        }
 
-    sf::Texture fullTexture;
-    fullTexture.loadFromImage(mainImage);
+        fmt::print("Out of core: {}x{} cells in {}, {} rows per band\n", width, height, outOfCore, simulation.BandRows());
+        Diffusion::InstallCheckpointSignals();
 
-    grid.resize(WIDTH);
-    next.resize(WIDTH);
+        Diffusion::SnapshotWriter snapshotWriter;
+        snapshotWriter.Configure({snapshotPrecision, snapshotTile, cores, snapshotKeyframe});
 
-    for (int i = 0; i< WIDTH; i++)
-    {
-        grid[i].resize(HEIGHT);
-        next[i].resize(HEIGHT);
-        for (int j = 0; j < HEIGHT; j++)
+        const uint64_t lastStep = steps > 0 ? stepCount + steps : 0;
+        sf::Clock stepClock;
+        while (!Diffusion::TerminateRequested() && (!lastStep || stepCount < lastStep))
+        {
+            stepClock.restart();
+            simulation.Step({dA, dB, feed, kill});
+            stepCount += 1;
+            if (debug)
+                fmt::print("\rstep {}: {:.3f} s", stepCount, stepClock.getElapsedTime().asSeconds());
+
+            if (checkpointEvery > 0 && stepCount % checkpointEvery == 0)
+                Diffusion::RequestCheckpoint();
+            if (Diffusion::ConsumeCheckpointRequest())
+            {
+                Diffusion::CheckpointInfo info{stepCount, dA, dB, feed, kill};
+                if (Diffusion::SaveCheckpoint(checkpoint, simulation.Current(), info))
+                    fmt::print("\nSaved step {} to {}\n", stepCount, checkpoint);
+                if (deterministic)
+                    fmt::print("Step {}: digest {:08x}\n", stepCount, simulation.Current().Digest(cores));
+            }
+            if (!snapshot.empty() && snapshotEvery > 0 && stepCount % snapshotEvery == 0)
+                snapshotWriter.Write(fmt::format(fmt::runtime(snapshot), stepCount), simulation.Current(), stepCount);
+        }
+        if (!trace.empty())
+            Util::Trace::Write(trace);
+        if (Diffusion::ConsumeCheckpointRequest())
         {
-            grid[i][j].a = 1;
-            grid[i][j].b = 0;
-            next[i][j].a = grid[i][j].a;
-            next[i][j].b = grid[i][j].b;
+            Diffusion::CheckpointInfo info{stepCount, dA, dB, feed, kill};
+            if (Diffusion::SaveCheckpoint(checkpoint, simulation.Current(), info))
+                fmt::print("\nSaved step {} to {}\n", stepCount, checkpoint);
         }
+        if (deterministic)
+            fmt::print("\nStep {}: digest {:08x}\n", stepCount, simulation.Current().Digest(cores));
+        return exportField(simulation.Current()) ? 0 : 1;
     }
 
-    for (int i = popX - length; i < popX + length; ++i) {
-        for (int j = popY - length; j < popY + length; ++j) {
-            grid[i][j].a = 0;
-            grid[i][j].b = 1;
-            next[i][j].a = grid[i][j].a;
-            next[i][j].b = grid[i][j].b;
-         }
-    }
 
-    sf::RectangleShape rect(vec(window.getSize()));
-    rect.setTexture(&fullTexture);
+    Diffusion::Simulation simulation;
+    if (restore.empty() ? !simulation.Create(width, height, cores) : !simulation.Create(std::move(restored), stepCount, cores))
+        return 1;
+    if (restore.empty())
+        simulation.Seed(popX, popY, length);
+    simulation.SetParameters({dA, dB, feed, kill});
 
-    sf::Clock clk;
+    sf::ContextSettings settings;
+    settings.antialiasingLevel = 8;
 
-    float d = 1000;
+    std::unique_ptr<sf::RenderWindow> window;
+    if (!headless)
+    {
+        // One cell per pixel when the grid fits on the desktop, the viewer zooms out otherwise
+        sf::VideoMode desktop = sf::VideoMode::getDesktopMode();
+        double fit = std::min({1.0, 0.9 * desktop.width / width, 0.9 * desktop.height / height});
+        sf::VideoMode mode(std::max(1u, unsigned(width * fit)), std::max(1u, unsigned(height * fit)));
+        window = std::make_unique<sf::RenderWindow>(mode, "App", sf::Style::Default, settings);
+    }
 
-    std::vector<std::thread> allThreads;
+    // What the workers colour into, level 0 of the viewer's pyramid
+    Diffusion::PixelBuffer pixels;
+    Diffusion::Viewer viewer;
+    Diffusion::Hud performanceHud;
+    if (window)
+    {
+        pixels.Create(width, height);
+        viewer.Create(pixels, window->getSize(), cores);
+        performanceHud.Init(*window, int64_t(width - 2) * (height - 2), hud);
+        // Each row segment is coloured by the worker that stepped it, while it's still in cache.
+        // Only steps begun with rows, the ones expected to be presented, call it.
+        simulation.SetRowCallback([&](const Diffusion::Field& field, int64_t y, int64_t x0, int64_t x1) {
+            const int64_t rowStart = field.Index(x0, y);
+            colormap.Colorize(field.A() + rowStart, field.B() + rowStart, pixels.Row(y) + x0, x1 - x0);
+            viewer.MarkDirty(x0, y, x1, y + 1);
+        });
+    }
 
-    int rowCount = int(sqrt(cores));
-    int colCount = int(cores / rowCount);
+    Diffusion::InstallCheckpointSignals();
 
-    int blockSizeX = WIDTH / rowCount;
-    int blockSizeY = HEIGHT / colCount;
+    Diffusion::FrameStream frameStream;
+    if (!stream.empty())
+    {
+        Diffusion::FrameFormat format;
+        if (!Diffusion::ParseFrameFormat(streamFormat, format) || streamEvery < 1)
+        {
+            fmt::print("Unknown stream format {} or streamEvery below 1\n", streamFormat);
+            return 1;
+        }
+        frameStream.SetColormap(colormap);
+        if (!frameStream.Open(stream, format, width, height, streamFps, streamQueue, streamBlock))
+            return 1;
+    }
 
-    fmt::print("Num of cores: {}\n", cores);
-    fmt::print("Width: {}, Height: {}\n", WIDTH, HEIGHT);
-    fmt::print("PopX: {}, PopY: {}, Length\n", popX, popY, length);
-    fmt::print("Row Count: {}, Col Count: {}\n", rowCount, colCount);
-    fmt::print("X size: {}, Y Size: {}\n", blockSizeX, blockSizeY);
+    Diffusion::AnimationWriter animation;
+    if (!anim.empty())
+    {
+        Diffusion::AnimationFormat format;
+        Diffusion::AnimationOptions options;
+        if (!Diffusion::ParseAnimationFormat(animFormat, format) || !Diffusion::ParseDither(animDither, options.dither))
+        {
+            fmt::print("Unknown animation format {} or dither {}\n", animFormat, animDither);
+            return 1;
+        }
+        options.fps = animFps;
+        options.every = animEvery;
+        options.scale = animScale;
+        options.threads = animThreads;
+        options.block = animBlock;
+        animation.SetColormap(colormap);
+        if (!animation.Open(anim, format, width, height, options))
+            return 1;
+    }
 
-    for (int i = 0; i < rowCount; ++i)
+    Diffusion::SnapshotWriter snapshotWriter;
+    snapshotWriter.Configure({snapshotPrecision, snapshotTile, cores, snapshotKeyframe});
+
+    Diffusion::StatsWriter statsWriter;
+    if (!stats.empty())
     {
-        for (int j = 0; j < colCount; ++j)
+        Diffusion::StatsFormat format;
+        if (!Diffusion::ParseStatsFormat(statsFormat, format) || statsEvery < 1)
         {
-            int startX{}, startY{}, endX{}, endY{};
-            startX = blockSizeX * i;
-            endX = startX + blockSizeX;
-            startY = blockSizeY * j;
-            endY = startY + blockSizeY;
-            int idx = i * colCount + j;
-            if (debug)
-                fmt::print("idx: ({})\n\t- X: ({}, {}), Y: ({}, {})\n", idx, startX, endX, startY, endY);
-            threadFinished.push_back(true);
-            allThreads.push_back(std::thread(doWork, idx, startX, startY, endX, endY));
+            fmt::print("Unknown statistics format {} or statsEvery below 1\n", statsFormat);
+            return 1;
         }
+        if (!statsWriter.Open(stats, format))
+            return 1;
+        simulation.SetStatsEvery(statsEvery);
+    }
+    sf::Clock runClock;
+
+    Diffusion::PacingMode pacingMode;
+    if (!Diffusion::ParsePacingMode(pacing, pacingMode))
+    {
+        fmt::print("Unknown pacing: {}\n", pacing);
+        return 1;
+    }
+    Diffusion::StepController stepController;
+    stepController.Configure(pacingMode, pacingTarget);
+
+    // Whether the step in flight colours the pixels. A step that doesn't and still
+    // gets presented (the frame deadline came sooner than expected) is coloured whole.
+    bool stepColoured = false;
+    auto beginStep = [&]() {
+        const bool colour = window && stepController.WillPresent(Diffusion::StepController::Clock::now());
+        if (simulation.Begin(colour))
+            stepColoured = colour;
+    };
+    auto colourField = [&](const Diffusion::Field& field) {
+        TRACE_SCOPE("colour");
+        Diffusion::ParallelFor((uint32_t)field.Height(), cores, [&](uint32_t y) {
+            const int64_t rowStart = field.Index(0, y);
+            colormap.Colorize(field.A() + rowStart, field.B() + rowStart, pixels.Row(y), field.Width());
+        });
+        viewer.MarkDirty(0, 0, field.Width(), field.Height());
+    };
+
+    sf::Clock clk;
+
+    fmt::print("Num of cores: {}\n", cores);
+    fmt::print("Width: {}, Height: {}\n", width, height);
+    fmt::print("PopX: {}, PopY: {}, Length\n", popX, popY, length);
+    fmt::print("Workers: {}\n", simulation.Workers());
+    if (debug)
+    {
+        const auto& blocks = simulation.Timings();
+        for (size_t idx = 0; idx < blocks.size(); idx++)
+            fmt::print("idx: ({})\n\t- X: ({}, {}), Y: ({}, {})\n", idx, blocks[idx].x0, blocks[idx].x1, blocks[idx].y0, blocks[idx].y1);
     }
 
-    int maxUpdates = 1;
-    int times = 0;
+    const uint64_t lastStep = steps > 0 ? stepCount + steps : 0;
+    bool running = true;
+    beginStep();
 
-    while (window.isOpen())
+    while (running)
     {
-        auto dt = clk.restart();
         sf::Event event;
-        while(window.pollEvent(event))
+        while(window && window->pollEvent(event))
         {
             switch(event.type)
             {
                 case sf::Event::Closed:
-                    isWorking = false;
-                    window.close();
+                    running = false;
+                    window->close();
+                break;
+                default:
+                    if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F2 && !trace.empty())
+                        Util::Trace::Write(trace);
+                    else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Space)
+                    {
+                        if (!simulation.Paused())
+                            simulation.Pause();
+                        else
+                        {
+                            simulation.Resume();
+                            beginStep();
+                        }
+                    }
+                    else if (!performanceHud.ProcessEvent(event))
+                        viewer.HandleEvent(event, *window);
                 break;
             }
         }
-
+        if (!running)
+            break;
+
+        // Without a window this thread has nothing to do until the step is done
+        if (!window)
+            simulation.Wait();
+
+        bool stepped = false;
+        bool present = false;
+        // Several steps may run between frames, the controller says when to show one
+        const auto now = Diffusion::StepController::Clock::now();
+        if (simulation.Ready() && (!window || stepController.MayStep(now)))
         {
-            bool done = true;
-            LOCK_GUARD(mtx);
-
-            for (size_t i = 0; i < threadFinished.size(); ++i)
+            const bool sampled = simulation.Advance();
+            stepCount = simulation.StepCount();
+            stepped = true;
+            if (window)
+                performanceHud.RecordStep(simulation.Timings());
+            if (sampled)
+                statsWriter.Push(stepCount, runClock.getElapsedTime().asSeconds(), simulation.Stats());
+
+            if (checkpointEvery > 0 && stepCount % checkpointEvery == 0)
+                Diffusion::RequestCheckpoint();
+
+            double slowestMs = 0.0;
+            for (const auto& timing : simulation.Timings())
+                slowestMs = std::max(slowestMs, timing.computeMs);
+            present = window && stepController.StepDone(now, slowestMs);
+
+            if (present)
             {
-                auto& finished = threadFinished[i];
-                done = done & finished;
+                // The workers colour the next step into the pixels, it can't begin before this
+                if (!stepColoured)
+                    colourField(simulation.Current());
+                viewer.Refresh();
+                viewer.Upload(true);
+                performanceHud.MarkStepUploaded();
+                if (debug)
+                    fmt::print("\rstep: {:.3f} ms, {} steps per frame", stepController.StepMs(), stepController.StepsPerFrame());
             }
 
-            if (done)
-            {
-                for (auto& finished : threadFinished)
-                    finished = false;
+            if (Diffusion::TerminateRequested() || (lastStep && stepCount >= lastStep))
+                running = false;
+            else
+                beginStep();
+        }
+        else if (window)
+            present = stepController.FrameDue(now);
 
-                grid.swap(next);
+        // Pan and zoom don't wait for the step, a coarser level stands in meanwhile
+        if (window && running && viewer.NeedsUpload())
+            viewer.Upload(false);
 
-                times += 1;
-                times = times % (maxUpdates + 1);
-            }
+        // Saved from a copy the capture thread takes while the workers go on stepping,
+        // in the order requested
+        if (stepped && Diffusion::ConsumeCheckpointRequest())
+        {
+            simulation.RequestCapture([&](const Diffusion::Capture& capture) {
+                Diffusion::CheckpointInfo info{capture.Step(), dA, dB, feed, kill};
+                if (Diffusion::SaveCheckpoint(checkpoint, capture.Result(), info))
+                    fmt::print("\nSaved step {} to {}\n", capture.Step(), checkpoint);
+                if (deterministic)
+                    fmt::print("Step {}: digest {:08x}\n", capture.Step(), capture.Result().Digest(cores));
+            });
+        }
 
-            if (done && times == maxUpdates)
+        if (stepped && frameStream.IsOpen() && stepCount % streamEvery == 0)
+            frameStream.Push(simulation.Current());
+        // Every step goes in, the writer keeps one of each animEvery
+        if (stepped && animation.IsOpen())
+            animation.Push(simulation.Current());
+
+        if (stepped && !snapshot.empty() && snapshotEvery > 0 && stepCount % snapshotEvery == 0)
+        {
+            simulation.RequestCapture([&](const Diffusion::Capture& capture) {
+                const Diffusion::Field& field = capture.Result();
+                std::string path = fmt::format(fmt::runtime(snapshot), capture.Step());
+                if (snapshotWriter.Write(path, field, capture.Step()) && debug)
+                    fmt::print("\nSnapshot {}: {} bytes, {:.1f}x smaller than the field, {} of {} tiles copied ahead of the workers\n",
+                               path, snapshotWriter.LastSize(), 2.0 * field.Size() * sizeof(Diffusion::Real) / snapshotWriter.LastSize(),
+                               capture.TilesProtected(), capture.Tiles());
+            });
+        }
+
+        if (!running && window)
+            window->close();
+
+        if (window && running && present)
+        {
             {
-                mainImage.copy(nextImage, 0 ,0);
-                fullTexture.update(nextImage);
-                if (debug)
-                    fmt::print("\rtime: {:.10f} ms", dt.asSeconds() * 1000.0f);
+                TRACE_SCOPE("draw");
+                performanceHud.RecordPacing(stepController.StepsPerFrame(), stepController.StepMs());
+                performanceHud.Update(*window, clk.restart(), viewer);
+                window->clear();
+                viewer.Draw(*window);
+                performanceHud.Render(*window);
+            }
+            {
+                TRACE_SCOPE("display");
+                window->display();
             }
+            performanceHud.FramePresented();
+            stepController.FramePresented(Diffusion::StepController::Clock::now());
+        }
+        else if (window && !stepped)
+        {
+            // Nothing to do until the step is done, StepRate allows the next one or a frame is due
+            TRACE_SCOPE("idle");
+            const auto wakeAt = stepController.WakeAt(Diffusion::StepController::Clock::now());
+            if (simulation.Ready())
+                std::this_thread::sleep_until(wakeAt);
+            else
+                simulation.WaitUntil(wakeAt);
         }
-
-        window.clear();
-        window.draw(rect);
-        window.display();
     }
 
-    for (auto& thread : allThreads)
-        thread.join();
-    return 0;
-}
\ No newline at end of file
+    // A step may still be in flight, it colours into the pixels and the viewer.
+    // The captures save through the writers below.
+    simulation.Pause();
+    simulation.WaitCaptures();
+    performanceHud.Shutdown();
+
+    if (frameStream.IsOpen())
+    {
+        frameStream.Close();
+        auto stats = frameStream.GetStats();
+        fmt::print("\nStream: {} frames written, {} dropped, {} back-pressured ({:.1f} ms waiting)\n",
+                   stats.written, stats.dropped, stats.backPressured, stats.waitMs);
+    }
+    bool animationOk = true;
+    if (animation.IsOpen())
+    {
+        animationOk = animation.Close();
+        auto stats = animation.GetStats();
+        fmt::print("Animation: {} frames written ({:.1f} MiB), {} dropped, {} back-pressured ({:.1f} ms waiting), {:.1f} ms encoding per frame\n",
+                   stats.written, stats.bytes / 1048576.0, stats.dropped, stats.backPressured, stats.waitMs,
+                   stats.encodeMs / std::max<uint64_t>(1, stats.written));
+    }
+    statsWriter.Close();
+    if (deterministic)
+        fmt::print("\nStep {}: digest {:08x}\n", stepCount, simulation.Current().Digest(cores));
+    if (!trace.empty())
+        Util::Trace::Write(trace);
+    return exportField(simulation.Current()) && animationOk ? 0 : 1;
+}
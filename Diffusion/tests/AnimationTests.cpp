@@ -0,0 +1,158 @@
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Diffusion/Animation.h"
+#include "Reference.h"
+
+// The LZW data of one GIF image, read the way decoders do
+static std::vector<uint8_t> decodeGifImage(const std::vector<uint8_t>& file, size_t& pos)
+{
+    const int minCodeSize = file[pos++];
+    std::vector<uint8_t> packed;
+    while (file[pos])
+    {
+        packed.insert(packed.end(), file.begin() + pos + 1, file.begin() + pos + 1 + file[pos]);
+        pos += file[pos] + 1;
+    }
+    pos++;
+
+    const int clear = 1 << minCodeSize, end = clear + 1;
+    std::vector<std::vector<uint8_t>> table;
+    std::vector<uint8_t> out;
+    int codeSize = minCodeSize + 1, previous = -1;
+    size_t bit = 0;
+    while (bit + codeSize <= packed.size() * 8)
+    {
+        int code = 0;
+        for (int i = 0; i < codeSize; i++, bit++)
+            code |= ((packed[bit >> 3] >> (bit & 7)) & 1) << i;
+        if (code == clear)
+        {
+            table.assign(clear + 2, {});
+            for (int i = 0; i < clear; i++)
+                table[i] = {(uint8_t)i};
+            codeSize = minCodeSize + 1;
+            previous = -1;
+            continue;
+        }
+        if (code == end)
+            break;
+        std::vector<uint8_t> entry;
+        if (previous < 0)
+            entry = table.at(code);
+        else
+        {
+            entry = code < (int)table.size() ? table[code] : table[previous];
+            std::vector<uint8_t> added = table[previous];
+            added.push_back(entry[0]);
+            if (code >= (int)table.size())
+                entry = added;
+            if (table.size() < 4096)
+                table.push_back(added);
+            if ((int)table.size() >= (1 << codeSize) && codeSize < 12)
+                codeSize++;
+        }
+        out.insert(out.end(), entry.begin(), entry.end());
+        previous = code;
+    }
+    return out;
+}
+
+TEST(Animation, GifFrameDecodesToViewerColours)
+{
+    // Noisy enough for the string table to fill and be cleared several times
+    const int64_t width = 301, height = 203;
+    std::vector<float> positions(width * height);
+    for (int64_t i = 0; i < width * height; i++)
+        positions[i] = (float)std::fmod(i * 0.37 + 900.0 * std::sin(i * 0.001), Diffusion::Colormap::LUT_STEPS + 1.0);
+
+    std::vector<uint8_t> frame;
+    Diffusion::EncodeGifFrame(positions.data(), width, height, Diffusion::Dither::None, 4, frame);
+    ASSERT_EQ(frame[0], 0x21);
+    ASSERT_EQ(frame[1], 0xF9);
+    EXPECT_EQ(frame[4] | frame[5] << 8, 4);
+    ASSERT_EQ(frame[8], 0x2C);
+    size_t pos = 18;
+    const std::vector<uint8_t> indices = decodeGifImage(frame, pos);
+    EXPECT_EQ(pos, frame.size());
+    ASSERT_EQ(indices.size(), positions.size());
+    // Colour i of the GIF is table entry 16 i, the colour the viewer shows for (int)position
+    for (size_t i = 0; i < indices.size(); i++)
+        ASSERT_EQ(indices[i], (int)positions[i] / 16) << "pixel " << i;
+}
+
+TEST(Animation, ApngKeepsEveryNthFrameInOrder)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "diffusion-tests.png").string();
+    Diffusion::AnimationOptions options;
+    options.every = 3;
+    options.scale = 4;
+    options.threads = 3;
+    options.block = true;
+
+    Diffusion::AnimationWriter writer;
+    ASSERT_TRUE(writer.Open(path, Diffusion::AnimationFormat::Apng, 67, 53, options));
+    EXPECT_EQ(writer.FrameWidth(), 17);
+    EXPECT_EQ(writer.FrameHeight(), 14);
+    Diffusion::Field field = Reference::InitialField(67, 53);
+    for (int i = 0; i < 10; i++)
+        ASSERT_TRUE(writer.Push(field));
+    EXPECT_TRUE(writer.Close());
+    const Diffusion::AnimationStats stats = writer.GetStats();
+    EXPECT_EQ(stats.written, 4u);
+    EXPECT_EQ(stats.skipped, 6u);
+    EXPECT_EQ(stats.dropped, 0u);
+
+    std::vector<uint8_t> file(stats.bytes);
+    FILE* f = fopen(path.c_str(), "rb");
+    ASSERT_NE(f, nullptr);
+    ASSERT_EQ(fread(file.data(), 1, file.size(), f), file.size());
+    EXPECT_EQ(fgetc(f), EOF);
+    fclose(f);
+
+    // The chunks, with the frame count patched in and the sequence numbers in order
+    auto be32 = [&](size_t at) { return uint32_t(file[at]) << 24 | file[at + 1] << 16 | file[at + 2] << 8 | file[at + 3]; };
+    std::vector<std::string> types;
+    uint32_t sequence = 0;
+    for (size_t pos = 8; pos < file.size();)
+    {
+        const uint32_t length = be32(pos);
+        const std::string type(file.begin() + pos + 4, file.begin() + pos + 8);
+        if (type == "acTL")
+        {
+            EXPECT_EQ(be32(pos + 8), 4u);
+        }
+        else if (type == "fcTL" || type == "fdAT")
+        {
+            EXPECT_EQ(be32(pos + 8), sequence++);
+        }
+        types.push_back(type);
+        pos += 12 + length;
+    }
+    const std::vector<std::string> expected = {"IHDR", "acTL", "fcTL", "IDAT", "fcTL", "fdAT",
+                                               "fcTL", "fdAT", "fcTL", "fdAT", "IEND"};
+    EXPECT_EQ(types, expected);
+    std::filesystem::remove(path);
+}
+
+#ifndef _WIN32
+TEST(Animation, CloseReportsFailedWrites)
+{
+    if (!std::filesystem::exists("/dev/full"))
+        GTEST_SKIP() << "no /dev/full";
+    // The frames fit in the stdio buffer, so the failure only shows when closing
+    Diffusion::AnimationOptions options;
+    options.scale = 4;
+    options.block = true;
+    Diffusion::AnimationWriter writer;
+    ASSERT_TRUE(writer.Open("/dev/full", Diffusion::AnimationFormat::Gif, 67, 53, options));
+    ASSERT_TRUE(writer.Push(Reference::InitialField(67, 53)));
+    EXPECT_FALSE(writer.Close());
+    EXPECT_FALSE(writer.IsOpen());
+}
+#endif
@@ -0,0 +1,124 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Diffusion/Checkpoint.h"
+#include "Diffusion/Simulation.h"
+#include "Reference.h"
+#include "Utils/Checksum.h"
+
+static const std::string PATH = (std::filesystem::temp_directory_path() / "diffusion-tests.ckpt").string();
+
+static std::vector<uint8_t> readFile(const std::string& path)
+{
+    std::vector<uint8_t> data(std::filesystem::file_size(path));
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f)
+    {
+        data.resize(fread(data.data(), 1, data.size(), f));
+        fclose(f);
+    }
+    return data;
+}
+
+static void writeFile(const std::string& path, const std::vector<uint8_t>& data)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    ASSERT_EQ(fwrite(data.data(), 1, data.size(), f), data.size());
+    fclose(f);
+}
+
+static Diffusion::CheckpointInfo infoAt(uint64_t step)
+{
+    const Diffusion::Parameters params;
+    Diffusion::CheckpointInfo info;
+    info.step = step;
+    info.dA = params.dA;
+    info.dB = params.dB;
+    info.feed = params.feed;
+    info.kill = params.kill;
+    return info;
+}
+
+TEST(Checkpoint, SaveThenLoad)
+{
+    const Diffusion::Field field = Reference::InitialField(67, 53);
+    ASSERT_TRUE(Diffusion::SaveCheckpoint(PATH, field, infoAt(42)));
+    EXPECT_FALSE(std::filesystem::exists(PATH + ".tmp"));
+
+    Diffusion::Field restored;
+    Diffusion::CheckpointInfo info;
+    ASSERT_TRUE(Diffusion::LoadCheckpoint(PATH, restored, info));
+    EXPECT_EQ(info.step, 42u);
+    EXPECT_EQ(info.feed, Diffusion::Parameters().feed);
+    ASSERT_EQ(restored.Width(), 67);
+    ASSERT_EQ(restored.Height(), 53);
+    EXPECT_EQ(restored.Digest(1), field.Digest(1));
+    restored = Diffusion::Field();
+    std::filesystem::remove(PATH);
+}
+
+TEST(Checkpoint, RejectsDamagedFiles)
+{
+    ASSERT_TRUE(Diffusion::SaveCheckpoint(PATH, Reference::InitialField(67, 53), infoAt(1)));
+    const std::vector<uint8_t> good = readFile(PATH);
+    Diffusion::Field field;
+    Diffusion::CheckpointInfo info;
+
+    std::vector<uint8_t> truncated(good.begin(), good.end() - 8);
+    writeFile(PATH, truncated);
+    EXPECT_FALSE(Diffusion::LoadCheckpoint(PATH, field, info, false));
+
+    // Only the plane checksums see this one, so only a verified load rejects it
+    std::vector<uint8_t> corrupted = good;
+    corrupted[corrupted.size() - 1000] ^= 0x10;
+    writeFile(PATH, corrupted);
+    EXPECT_FALSE(Diffusion::LoadCheckpoint(PATH, field, info, true));
+
+    // A header that claims to end before itself, with a valid header CRC
+    std::vector<uint8_t> overlapping = good;
+    Diffusion::CheckpointHeader header;
+    std::memcpy(&header, overlapping.data(), sizeof(header));
+    header.headerSize = 8;
+    header.crcHeader = Util::Crc32(&header, offsetof(Diffusion::CheckpointHeader, crcHeader));
+    std::memcpy(overlapping.data(), &header, sizeof(header));
+    writeFile(PATH, overlapping);
+    EXPECT_FALSE(Diffusion::LoadCheckpoint(PATH, field, info, false));
+
+    writeFile(PATH, good);
+    EXPECT_TRUE(Diffusion::LoadCheckpoint(PATH, field, info, true));
+    field = Diffusion::Field();
+    std::filesystem::remove(PATH);
+}
+
+TEST(Checkpoint, RestoredRunMatchesUninterruptedRun)
+{
+    Diffusion::Simulation uninterrupted;
+    ASSERT_TRUE(uninterrupted.Create(Reference::InitialField(67, 53), 0, 3));
+    ASSERT_EQ(uninterrupted.Step(40), 40u);
+
+    {
+        Diffusion::Simulation first;
+        ASSERT_TRUE(first.Create(Reference::InitialField(67, 53), 0, 3));
+        ASSERT_EQ(first.Step(25), 25u);
+        ASSERT_TRUE(Diffusion::SaveCheckpoint(PATH, first.Current(), infoAt(first.StepCount())));
+    }
+
+    Diffusion::Field field;
+    Diffusion::CheckpointInfo info;
+    ASSERT_TRUE(Diffusion::LoadCheckpoint(PATH, field, info));
+    Diffusion::Simulation resumed;
+    ASSERT_TRUE(resumed.Create(std::move(field), info.step, 2));
+    ASSERT_EQ(resumed.Step(15), 15u);
+    EXPECT_EQ(resumed.StepCount(), 40u);
+    EXPECT_EQ(Reference::Compare(uninterrupted.Current(), resumed.Current()).maxUlp, 0u);
+    EXPECT_EQ(resumed.Current().Digest(1), uninterrupted.Current().Digest(1));
+    resumed.Destroy();
+    std::filesystem::remove(PATH);
+}
@@ -0,0 +1,85 @@
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Diffusion/Colormap.h"
+#include "Diffusion/Cpu.h"
+#include "Diffusion/PixelBuffer.h"
+
+static void fillValues(std::vector<Diffusion::Real>& a, std::vector<Diffusion::Real>& b)
+{
+    // Sweeps past both ends of the range, odd count to exercise the SIMD tail
+    const size_t count = 4099;
+    a.resize(count);
+    b.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        a[i] = -0.1 + 1.2 * i / (count - 1);
+        b[i] = 0.3 * ((i * 7919) % 101) / 100.0;
+    }
+}
+
+TEST(Colormap, GreyMatchesOriginalLevels)
+{
+    std::vector<Diffusion::Real> a, b;
+    fillValues(a, b);
+    std::vector<uint32_t> pixels(a.size());
+    Diffusion::Colormap colormap;
+    colormap.Colorize(a.data(), b.data(), pixels.data(), (int64_t)a.size());
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        int c = (int)std::floor((a[i] - b[i]) * 255);
+        c = c > 255 ? 255 : (c < 0 ? 0 : c);
+        ASSERT_EQ(pixels[i], Diffusion::PackRGBA((uint8_t)c, (uint8_t)c, (uint8_t)c)) << "cell " << i;
+    }
+}
+
+TEST(Colormap, AVX2MatchesScalar)
+{
+    if (!Diffusion::CpuHasAVX2())
+        GTEST_SKIP() << "No AVX2 on this CPU";
+
+    std::vector<Diffusion::Real> a, b;
+    fillValues(a, b);
+    for (const auto& palette : Diffusion::Colormap::PaletteNames())
+    {
+        for (auto source : {Diffusion::ColorSource::Difference, Diffusion::ColorSource::A, Diffusion::ColorSource::B})
+        {
+            Diffusion::Colormap colormap;
+            ASSERT_TRUE(colormap.SetPalette(palette));
+            colormap.SetSource(source);
+            colormap.SetRange(-0.05, 0.9);
+
+            std::vector<uint32_t> pixels(a.size());
+            colormap.Colorize(a.data(), b.data(), pixels.data(), (int64_t)a.size());
+
+            // The scalar path, indexed exactly like Colormap does it
+            const double scale = Diffusion::Colormap::LUT_STEPS / (0.9 - -0.05);
+            for (size_t i = 0; i < a.size(); i++)
+            {
+                const double v = source == Diffusion::ColorSource::Difference ? a[i] - b[i]
+                               : source == Diffusion::ColorSource::A ? a[i] : b[i];
+                double t = (v - -0.05) * scale;
+                t = t < 0.0 ? 0.0 : (t > Diffusion::Colormap::LUT_STEPS ? Diffusion::Colormap::LUT_STEPS : t);
+                ASSERT_EQ(pixels[i], colormap.Table()[(int)t]) << palette << " cell " << i;
+            }
+        }
+    }
+}
+
+TEST(Colormap, NaNTakesTheFirstColour)
+{
+    std::vector<Diffusion::Real> a, b;
+    fillValues(a, b);
+    // In the vector body and in the tail
+    for (size_t i : {0, 5, 1000, 4097, 4098})
+        a[i] = std::nan("");
+    Diffusion::Colormap colormap;
+    ASSERT_TRUE(colormap.SetPalette("viridis"));
+    EXPECT_EQ(colormap.Position(std::nan("")), 0.0);
+    std::vector<uint32_t> pixels(a.size());
+    colormap.Colorize(a.data(), b.data(), pixels.data(), (int64_t)a.size());
+    for (size_t i : {0, 5, 1000, 4097, 4098})
+        EXPECT_EQ(pixels[i], colormap.Table()[0]) << "cell " << i;
+}
@@ -0,0 +1,103 @@
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Inflate.h"
+#include "Utils/Deflate.h"
+
+// Inputs that take every kind of block: nothing, too little to match, noise that
+// only stores, long runs and repeats that match up to the window, and a mix
+static std::vector<std::pair<std::string, std::vector<uint8_t>>> inputs()
+{
+    std::vector<std::pair<std::string, std::vector<uint8_t>>> inputs;
+    inputs.push_back({"empty", {}});
+    inputs.push_back({"one byte", {42}});
+    inputs.push_back({"three bytes", {7, 7, 7}});
+
+    std::mt19937 random(5);
+    std::vector<uint8_t> noise(200000);
+    for (uint8_t& byte : noise)
+        byte = (uint8_t)random();
+    inputs.push_back({"random", noise});
+
+    std::vector<uint8_t> runs;
+    while (runs.size() < 300000)
+        runs.insert(runs.end(), 1 + random() % 600, (uint8_t)(random() % 4));
+    inputs.push_back({"runs", runs});
+
+    // Rows of a gradient with a little noise, like filtered image rows
+    std::vector<uint8_t> rows;
+    for (int y = 0; y < 400; y++)
+        for (int x = 0; x < 700; x++)
+            rows.push_back((uint8_t)((x / 3 + y) % 251 + (random() % 16 == 0 ? random() % 8 : 0)));
+    inputs.push_back({"rows", rows});
+
+    // Repeats from near the far end of the 32 KiB window, then from beyond it
+    std::vector<uint8_t> far(noise.begin(), noise.begin() + 30000);
+    far.insert(far.end(), noise.begin(), noise.begin() + 30000);
+    far.insert(far.end(), noise.begin() + 1, noise.begin() + 2000);
+    inputs.push_back({"far", far});
+    return inputs;
+}
+
+TEST(Deflate, ZlibStreamsInflateToTheInput)
+{
+    for (const auto& [name, data] : inputs())
+    {
+        for (int effort : {1, 4, 32, 256})
+        {
+            std::vector<uint8_t> compressed, inflated;
+            Util::ZlibCompress(data.data(), data.size(), compressed, effort);
+            ASSERT_TRUE(Inflate::Zlib(compressed, inflated)) << name << " at effort " << effort;
+            ASSERT_EQ(inflated, data) << name << " at effort " << effort;
+
+            // Runs compress well, noise grows by no more than the stored block headers
+            if (name == "runs")
+            {
+                EXPECT_LT(compressed.size(), data.size() / 20) << effort;
+            }
+            else if (name == "random")
+            {
+                EXPECT_LT(compressed.size(), data.size() + data.size() / 1000 + 64) << effort;
+            }
+        }
+    }
+}
+
+TEST(Deflate, InflaterRejectsDamagedStreams)
+{
+    // The checks the round trip relies on: a stream that decodes to something else fails
+    const std::vector<uint8_t> data = inputs()[5].second;
+    std::vector<uint8_t> compressed, inflated;
+    Util::ZlibCompress(data.data(), data.size(), compressed);
+    for (size_t at : {(size_t)1, compressed.size() / 2, compressed.size() - 1})
+    {
+        std::vector<uint8_t> damaged = compressed;
+        damaged[at] ^= 0x04;
+        inflated.clear();
+        EXPECT_FALSE(Inflate::Zlib(damaged, inflated) && inflated == data) << "byte " << at;
+    }
+    inflated.clear();
+    EXPECT_FALSE(Inflate::Zlib(compressed.data(), compressed.size() - 3, inflated));
+}
+
+TEST(Deflate, Adler32)
+{
+    const char* text = "Wikipedia";
+    EXPECT_EQ(Util::Adler32(text, std::strlen(text)), 0x11E60398u);
+    EXPECT_EQ(Util::Adler32(nullptr, 0), 1u);
+
+    // In pieces, and combined from separate checksums
+    std::vector<uint8_t> data = inputs()[3].second;
+    const uint32_t whole = Util::Adler32(data.data(), data.size());
+    for (size_t split : {(size_t)0, (size_t)1, (size_t)5552, (size_t)100001, data.size()})
+    {
+        const uint32_t first = Util::Adler32(data.data(), split);
+        const uint32_t second = Util::Adler32(data.data() + split, data.size() - split);
+        EXPECT_EQ(Util::Adler32(data.data() + split, data.size() - split, first), whole) << split;
+        EXPECT_EQ(Util::Adler32Combine(first, second, data.size() - split), whole) << split;
+    }
+}
@@ -0,0 +1,147 @@
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+#include <fmt/core.h>
+#include <gtest/gtest.h>
+
+#include "Diffusion/FrameStream.h"
+#include "Reference.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+static constexpr int64_t WIDTH = 67;
+static constexpr int64_t HEIGHT = 53;
+
+static uint64_t y4mHeaderSize(int64_t width, int64_t height, int fps)
+{
+    return fmt::format("YUV4MPEG2 W{} H{} F{}:1 Ip A1:1 C444 XCOLORRANGE=LIMITED\n", width, height, fps).size();
+}
+
+TEST(FrameStream, OutputSizeMatchesFormat)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "diffusion-tests.y4m").string();
+    const Diffusion::Field field = Reference::InitialField(WIDTH, HEIGHT);
+    for (Diffusion::FrameFormat format : {Diffusion::FrameFormat::Raw, Diffusion::FrameFormat::Y4M})
+    {
+        Diffusion::FrameStream stream;
+        ASSERT_TRUE(stream.Open(path, format, WIDTH, HEIGHT, 25, 2, true));
+        for (int i = 0; i < 5; i++)
+            EXPECT_TRUE(stream.Push(field));
+        stream.Close();
+        const Diffusion::FrameStreamStats stats = stream.GetStats();
+        EXPECT_EQ(stats.pushed, 5u);
+        EXPECT_EQ(stats.written, 5u);
+        EXPECT_EQ(stats.dropped, 0u);
+
+        const uint64_t expected = format == Diffusion::FrameFormat::Raw
+                                      ? 5 * WIDTH * HEIGHT * 4
+                                      : y4mHeaderSize(WIDTH, HEIGHT, 25) + 5 * (6 + WIDTH * HEIGHT * 3);
+        EXPECT_EQ(std::filesystem::file_size(path), expected);
+    }
+    std::filesystem::remove(path);
+}
+
+#ifndef _WIN32
+// The stream writes into a pipe nobody reads until Drain, so the writer is
+// stuck on the first frame (bigger than the pipe buffer) and its slot stays taken.
+class BlockedPipe
+{
+public:
+    BlockedPipe()
+    {
+        if (pipe(m_Fds) == 0)
+            Path = "/dev/fd/" + std::to_string(m_Fds[1]);
+    }
+
+    ~BlockedPipe()
+    {
+        if (m_Reader.joinable())
+            m_Reader.join();
+        close(m_Fds[0]);
+    }
+
+    // Once the stream has opened its own end
+    void Release() { close(m_Fds[1]); }
+
+    void Drain()
+    {
+        if (m_Reader.joinable())
+            return;
+        m_Reader = std::thread([this] {
+            char buffer[1 << 16];
+            ssize_t n;
+            while ((n = read(m_Fds[0], buffer, sizeof(buffer))) > 0)
+                Bytes += n;
+        });
+    }
+
+    // After the stream is closed
+    uint64_t Join()
+    {
+        m_Reader.join();
+        return Bytes;
+    }
+
+    std::string Path;
+    uint64_t Bytes = 0;
+
+private:
+    int m_Fds[2] = {-1, -1};
+    std::thread m_Reader;
+};
+
+TEST(FrameStream, DropsWhenFull)
+{
+    BlockedPipe pipe;
+    ASSERT_FALSE(pipe.Path.empty());
+    const Diffusion::Field field = Reference::InitialField(WIDTH * 4, HEIGHT * 4);
+    Diffusion::FrameStream stream;
+    ASSERT_TRUE(stream.Open(pipe.Path, Diffusion::FrameFormat::Raw, field.Width(), field.Height(), 30, 1, false));
+    pipe.Release();
+
+    EXPECT_TRUE(stream.Push(field));
+    for (int i = 0; i < 3; i++)
+        EXPECT_FALSE(stream.Push(field));
+    pipe.Drain();
+    stream.Close();
+
+    const Diffusion::FrameStreamStats stats = stream.GetStats();
+    EXPECT_EQ(stats.pushed, 4u);
+    EXPECT_EQ(stats.dropped, 3u);
+    EXPECT_EQ(stats.written, 1u);
+    EXPECT_EQ(stats.backPressured, 0u);
+    EXPECT_EQ(pipe.Join(), (uint64_t)field.Size() * 4);
+}
+
+TEST(FrameStream, BlockWaitsForTheWriter)
+{
+    BlockedPipe pipe;
+    ASSERT_FALSE(pipe.Path.empty());
+    const Diffusion::Field field = Reference::InitialField(WIDTH * 4, HEIGHT * 4);
+    Diffusion::FrameStream stream;
+    ASSERT_TRUE(stream.Open(pipe.Path, Diffusion::FrameFormat::Y4M, field.Width(), field.Height(), 30, 1, true));
+    pipe.Release();
+
+    EXPECT_TRUE(stream.Push(field));
+    std::thread pusher([&] { EXPECT_TRUE(stream.Push(field)); });
+    // Only let the writer go once the second push is known to wait for it
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (stream.GetStats().backPressured == 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    pipe.Drain();
+    pusher.join();
+    stream.Close();
+
+    const Diffusion::FrameStreamStats stats = stream.GetStats();
+    EXPECT_EQ(stats.pushed, 2u);
+    EXPECT_EQ(stats.written, 2u);
+    EXPECT_EQ(stats.dropped, 0u);
+    EXPECT_EQ(stats.backPressured, 1u);
+    EXPECT_GT(stats.waitMs, 0.0);
+    EXPECT_EQ(pipe.Join(), y4mHeaderSize(field.Width(), field.Height(), 30) + 2 * (6 + (uint64_t)field.Size() * 3));
+}
+#endif
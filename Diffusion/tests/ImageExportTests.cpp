@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Diffusion/ImageExport.h"
+#include "Inflate.h"
+#include "Reference.h"
+#include "Utils/Checksum.h"
+
+static std::vector<uint8_t> readFile(const std::string& path)
+{
+    std::vector<uint8_t> data(std::filesystem::file_size(path));
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f)
+    {
+        data.resize(fread(data.data(), 1, data.size(), f));
+        fclose(f);
+    }
+    return data;
+}
+
+static uint32_t be32(const std::vector<uint8_t>& data, size_t at)
+{
+    return uint32_t(data[at]) << 24 | data[at + 1] << 16 | data[at + 2] << 8 | data[at + 3];
+}
+
+static uint32_t le32(const std::vector<uint8_t>& data, size_t at)
+{
+    return data[at] | data[at + 1] << 8 | data[at + 2] << 16 | uint32_t(data[at + 3]) << 24;
+}
+
+// The image ExportImage should have written, 8 bit RGB
+static std::vector<uint8_t> colouredField(const Diffusion::Field& field, const Diffusion::Colormap& colormap)
+{
+    std::vector<uint32_t> pixels(field.Size());
+    colormap.Colorize(field.A(), field.B(), pixels.data(), field.Size());
+    std::vector<uint8_t> rgb;
+    for (uint32_t pixel : pixels)
+        rgb.insert(rgb.end(), {(uint8_t)pixel, (uint8_t)(pixel >> 8), (uint8_t)(pixel >> 16)});
+    return rgb;
+}
+
+// The pixels of an 8 bit RGB PNG: its IDATs inflated as one zlib stream, the row filters undone
+static bool decodePng(const std::vector<uint8_t>& file, int64_t& width, int64_t& height, std::vector<uint8_t>& rgb)
+{
+    std::vector<uint8_t> stream, raw;
+    for (size_t pos = 8; pos + 12 <= file.size();)
+    {
+        const uint32_t length = be32(file, pos);
+        const std::string type(file.begin() + pos + 4, file.begin() + pos + 8);
+        if (type == "IHDR")
+        {
+            width = be32(file, pos + 8);
+            height = be32(file, pos + 12);
+            if (file[pos + 16] != 8 || file[pos + 17] != 2)
+                return false;
+        }
+        else if (type == "IDAT")
+            stream.insert(stream.end(), file.begin() + pos + 8, file.begin() + pos + 8 + length);
+        pos += 12 + length;
+    }
+    const int64_t rowBytes = 3 * width;
+    if (!Inflate::Zlib(stream, raw) || (int64_t)raw.size() != height * (rowBytes + 1))
+        return false;
+
+    rgb.assign(height * rowBytes, 0);
+    for (int64_t y = 0; y < height; y++)
+    {
+        const uint8_t filter = raw[y * (rowBytes + 1)];
+        const uint8_t* in = raw.data() + y * (rowBytes + 1) + 1;
+        uint8_t* row = rgb.data() + y * rowBytes;
+        const uint8_t* above = y > 0 ? row - rowBytes : nullptr;
+        for (int64_t i = 0; i < rowBytes; i++)
+        {
+            const int a = i >= 3 ? row[i - 3] : 0;
+            const int b = above ? above[i] : 0;
+            const int c = i >= 3 && above ? above[i - 3] : 0;
+            int predicted = 0;
+            if (filter == 1)
+                predicted = a;
+            else if (filter == 2)
+                predicted = b;
+            else if (filter == 3)
+                predicted = (a + b) / 2;
+            else if (filter == 4)
+            {
+                const int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                predicted = pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+            }
+            else if (filter != 0)
+                return false;
+            row[i] = (uint8_t)(in[i] + predicted);
+        }
+    }
+    return true;
+}
+
+struct TiffLayout
+{
+    uint32_t width = 0, height = 0, rowsPerStrip = 0;
+    uint32_t compression = 0, predictor = 0;
+    std::vector<uint32_t> offsets, sizes;
+};
+
+// The first directory of a little endian classic TIFF
+static bool readTiffLayout(const std::vector<uint8_t>& file, TiffLayout& layout, uint32_t& directory)
+{
+    if (file.size() < 16 || file[0] != 'I' || file[2] != 42)
+        return false;
+    directory = le32(file, 4);
+    if (directory + 2u >= file.size())
+        return false;
+    const int entries = file[directory] | file[directory + 1] << 8;
+    // Tag -> value, or where the values are when they don't fit the entry
+    for (int i = 0; i < entries; i++)
+    {
+        const size_t entry = directory + 2 + 12 * i;
+        const int tag = file[entry] | file[entry + 1] << 8;
+        const uint32_t count = le32(file, entry + 4);
+        const uint32_t value = le32(file, entry + 8);
+        if (tag == 256)
+            layout.width = value;
+        else if (tag == 257)
+            layout.height = value;
+        else if (tag == 259)
+            layout.compression = value & 0xFFFF;
+        else if (tag == 278)
+            layout.rowsPerStrip = value;
+        else if (tag == 317)
+            layout.predictor = value & 0xFFFF;
+        else if (tag == 273 || tag == 279)
+        {
+            std::vector<uint32_t>& values = tag == 273 ? layout.offsets : layout.sizes;
+            for (uint32_t k = 0; k < count; k++)
+                values.push_back(count == 1 ? value : le32(file, value + 4 * k));
+        }
+    }
+    return true;
+}
+
+// The pixels of a Deflate TIFF with the horizontal predictor, each strip inflated on its own
+static bool decodeTiff(const std::vector<uint8_t>& file, int64_t& width, int64_t& height, std::vector<uint8_t>& rgb)
+{
+    TiffLayout layout;
+    uint32_t directory;
+    if (!readTiffLayout(file, layout, directory) || layout.compression != 8 || layout.predictor != 2 ||
+        layout.offsets.size() != layout.sizes.size())
+        return false;
+    width = layout.width;
+    height = layout.height;
+    const int64_t rowBytes = 3 * width;
+    rgb.clear();
+    for (size_t k = 0; k < layout.offsets.size(); k++)
+    {
+        if ((uint64_t)layout.offsets[k] + layout.sizes[k] > file.size())
+            return false;
+        const size_t start = rgb.size();
+        if (!Inflate::Zlib(file.data() + layout.offsets[k], layout.sizes[k], rgb))
+            return false;
+        const int64_t rows = std::min<int64_t>(layout.rowsPerStrip, height - (int64_t)k * layout.rowsPerStrip);
+        if ((int64_t)(rgb.size() - start) != rows * rowBytes)
+            return false;
+        for (uint8_t* row = rgb.data() + start; row < rgb.data() + rgb.size(); row += rowBytes)
+            for (int64_t i = 3; i < rowBytes; i++)
+                row[i] = (uint8_t)(row[i] + row[i - 3]);
+    }
+    return (int64_t)rgb.size() == height * rowBytes;
+}
+
+TEST(ImageExport, PngIsTheSameForAnyThreadCount)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "diffusion-tests-export.png").string();
+    const Diffusion::Field field = Reference::InitialField(67, 53);
+    Diffusion::Colormap colormap;
+    ASSERT_TRUE(colormap.SetPalette("viridis"));
+
+    std::vector<uint8_t> first;
+    for (int threads : {1, 4})
+    {
+        Diffusion::ImageExportOptions options;
+        options.bandRows = 10;
+        options.threads = threads;
+        options.window = 2;
+        Diffusion::ImageExportStats stats;
+        ASSERT_TRUE(Diffusion::ExportImage(path, field, colormap, options, &stats));
+        EXPECT_EQ(stats.bands, 6);
+        const std::vector<uint8_t> file = readFile(path);
+        EXPECT_EQ(file.size(), stats.bytes);
+        if (first.empty())
+            first = file;
+        else
+            EXPECT_EQ(file, first);
+    }
+
+    // A band per IDAT, then the stream's checksum in one of its own
+    std::vector<std::string> types;
+    for (size_t pos = 8; pos < first.size();)
+    {
+        const uint32_t length = be32(first, pos);
+        types.emplace_back(first.begin() + pos + 4, first.begin() + pos + 8);
+        EXPECT_EQ(be32(first, pos + 8 + length), Util::Crc32(first.data() + pos + 4, length + 4)) << types.back();
+        pos += 12 + length;
+    }
+    const std::vector<std::string> expected = {"IHDR", "IDAT", "IDAT", "IDAT", "IDAT", "IDAT", "IDAT", "IDAT", "IEND"};
+    EXPECT_EQ(types, expected);
+    std::filesystem::remove(path);
+}
+
+TEST(ImageExport, TiffStripsFollowEachOther)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "diffusion-tests-export.tif").string();
+    const Diffusion::Field field = Reference::InitialField(67, 53);
+    Diffusion::ImageExportOptions options;
+    options.format = Diffusion::ImageFormat::Tiff;
+    options.bandRows = 16;
+    options.threads = 3;
+    ASSERT_TRUE(Diffusion::ExportImage(path, field, Diffusion::Colormap(), options));
+    const std::vector<uint8_t> file = readFile(path);
+    std::filesystem::remove(path);
+
+    TiffLayout layout;
+    uint32_t directory;
+    ASSERT_TRUE(readTiffLayout(file, layout, directory));
+    const std::vector<uint32_t>& offsets = layout.offsets;
+    const std::vector<uint32_t>& sizes = layout.sizes;
+    EXPECT_EQ(layout.width, 67u);
+    EXPECT_EQ(layout.height, 53u);
+    EXPECT_EQ(layout.rowsPerStrip, 16u);
+    ASSERT_EQ(offsets.size(), 4u);
+    ASSERT_EQ(sizes.size(), 4u);
+    // Strips in order from the end of the header, each a zlib stream
+    uint32_t next = 16;
+    for (size_t k = 0; k < offsets.size(); k++)
+    {
+        EXPECT_EQ(offsets[k], next);
+        EXPECT_EQ(file[offsets[k]], 0x78);
+        next += sizes[k];
+    }
+    EXPECT_LE(next, directory);
+}
+
+TEST(ImageExport, DecodesToTheColouredField)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "diffusion-tests-export.img").string();
+    Diffusion::Colormap colormap;
+    ASSERT_TRUE(colormap.SetPalette("viridis"));
+    // Bands that don't divide the rows, bands of one row, many bands, long rows
+    const int64_t sizes[][3] = {{67, 53, 10}, {3, 3, 1}, {1000, 777, 64}, {5000, 40, 7}};
+    for (const auto& size : sizes)
+    {
+        const Diffusion::Field field = Reference::InitialField(size[0], size[1]);
+        const std::vector<uint8_t> expected = colouredField(field, colormap);
+        for (Diffusion::ImageFormat format : {Diffusion::ImageFormat::Png, Diffusion::ImageFormat::Tiff})
+        {
+            const bool png = format == Diffusion::ImageFormat::Png;
+            Diffusion::ImageExportOptions options;
+            options.format = format;
+            options.bandRows = (int)size[2];
+            options.threads = 3;
+            ASSERT_TRUE(Diffusion::ExportImage(path, field, colormap, options));
+            const std::vector<uint8_t> file = readFile(path);
+
+            int64_t width = 0, height = 0;
+            std::vector<uint8_t> rgb;
+            ASSERT_TRUE(png ? decodePng(file, width, height, rgb) : decodeTiff(file, width, height, rgb))
+                << (png ? "PNG " : "TIFF ") << size[0] << "x" << size[1];
+            EXPECT_EQ(width, size[0]);
+            EXPECT_EQ(height, size[1]);
+            EXPECT_TRUE(rgb == expected) << (png ? "PNG " : "TIFF ") << size[0] << "x" << size[1];
+        }
+    }
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,285 @@
+#pragma once
+
+// A plain inflater (RFC 1950 / 1951) for checking what the encoders write: stored,
+// fixed and dynamic Huffman blocks, decoded bit by bit the way the RFC reads.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Utils/Deflate.h"
+
+namespace Inflate
+{
+    class Decoder
+    {
+    public:
+        Decoder(const uint8_t* data, size_t size) : m_Data(data), m_Size(size) {}
+
+        // Decodes blocks up to and including the one marked last, false on any malformed or truncated data
+        bool Blocks(std::vector<uint8_t>& out)
+        {
+            bool last = false;
+            while (!last)
+            {
+                uint32_t type;
+                if (!bits(1, m_Last) || !bits(2, type))
+                    return false;
+                last = m_Last != 0;
+                bool ok = false;
+                if (type == 0)
+                    ok = stored(out);
+                else if (type == 1)
+                    ok = fixed(out);
+                else if (type == 2)
+                    ok = dynamic(out);
+                if (!ok)
+                    return false;
+            }
+            return true;
+        }
+
+        // Matches may only reach back to here, the output before it isn't this stream's
+        inline void StartAt(size_t start) { m_Start = start; }
+        // The bytes read, the partly read one included: where a zlib trailer starts
+        inline size_t BytePosition() const { return m_Pos; }
+
+    private:
+        struct Huffman
+        {
+            uint16_t counts[16] = {};
+            std::vector<uint16_t> symbols;
+        };
+
+        bool bits(int count, uint32_t& value)
+        {
+            value = 0;
+            for (int i = 0; i < count; i++)
+            {
+                if (m_BitCount == 0)
+                {
+                    if (m_Pos >= m_Size)
+                        return false;
+                    m_Byte = m_Data[m_Pos++];
+                    m_BitCount = 8;
+                }
+                value |= uint32_t(m_Byte & 1) << i;
+                m_Byte >>= 1;
+                m_BitCount--;
+            }
+            return true;
+        }
+
+        // Canonical codes from the lengths, false when they oversubscribe
+        static bool build(const uint8_t* lengths, int count, Huffman& huffman)
+        {
+            huffman.symbols.assign(count, 0);
+            for (int i = 0; i < count; i++)
+                huffman.counts[lengths[i]]++;
+            huffman.counts[0] = 0;
+            int left = 1;
+            for (int length = 1; length < 16; length++)
+            {
+                left = left * 2 - huffman.counts[length];
+                if (left < 0)
+                    return false;
+            }
+            uint16_t offsets[16] = {};
+            for (int length = 1; length < 15; length++)
+                offsets[length + 1] = offsets[length] + huffman.counts[length];
+            for (int i = 0; i < count; i++)
+                if (lengths[i])
+                    huffman.symbols[offsets[lengths[i]]++] = (uint16_t)i;
+            return true;
+        }
+
+        bool decode(const Huffman& huffman, int& symbol)
+        {
+            int code = 0, first = 0, index = 0;
+            for (int length = 1; length < 16; length++)
+            {
+                uint32_t bit;
+                if (!bits(1, bit))
+                    return false;
+                code |= (int)bit;
+                const int count = huffman.counts[length];
+                if (code - first < count)
+                {
+                    symbol = huffman.symbols[index + code - first];
+                    return true;
+                }
+                index += count;
+                first = (first + count) << 1;
+                code <<= 1;
+            }
+            return false;
+        }
+
+        bool stored(std::vector<uint8_t>& out)
+        {
+            m_BitCount = 0;
+            if (m_Size - m_Pos < 4)
+                return false;
+            const uint32_t length = m_Data[m_Pos] | m_Data[m_Pos + 1] << 8;
+            const uint32_t inverse = m_Data[m_Pos + 2] | m_Data[m_Pos + 3] << 8;
+            m_Pos += 4;
+            if ((length ^ 0xFFFF) != inverse || m_Size - m_Pos < length)
+                return false;
+            out.insert(out.end(), m_Data + m_Pos, m_Data + m_Pos + length);
+            m_Pos += length;
+            return true;
+        }
+
+        bool codes(std::vector<uint8_t>& out, const Huffman& literals, const Huffman& distances)
+        {
+            static const uint16_t LENGTH_BASE[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                                     31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+            static const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                                     2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+            static const uint16_t DISTANCE_BASE[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,
+                                                       33,  49,  65,  97,  129, 193,  257,  385,  513,  769,
+                                                       1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+            static const uint8_t DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                                       6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+            while (true)
+            {
+                int symbol;
+                if (!decode(literals, symbol))
+                    return false;
+                if (symbol < 256)
+                {
+                    out.push_back((uint8_t)symbol);
+                    continue;
+                }
+                if (symbol == 256)
+                    return true;
+                symbol -= 257;
+                uint32_t extra;
+                if (symbol >= 29 || !bits(LENGTH_EXTRA[symbol], extra))
+                    return false;
+                const size_t length = LENGTH_BASE[symbol] + extra;
+                if (!decode(distances, symbol) || symbol >= 30 || !bits(DISTANCE_EXTRA[symbol], extra))
+                    return false;
+                const size_t distance = DISTANCE_BASE[symbol] + extra;
+                if (distance > out.size() - m_Start)
+                    return false;
+                for (size_t i = 0; i < length; i++)
+                    out.push_back(out[out.size() - distance]);
+            }
+        }
+
+        bool fixed(std::vector<uint8_t>& out)
+        {
+            uint8_t lengths[288 + 30];
+            for (int i = 0; i < 288; i++)
+                lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+            for (int i = 0; i < 30; i++)
+                lengths[288 + i] = 5;
+            Huffman literals, distances;
+            return build(lengths, 288, literals) && build(lengths + 288, 30, distances) &&
+                   codes(out, literals, distances);
+        }
+
+        bool dynamic(std::vector<uint8_t>& out)
+        {
+            static const uint8_t ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+            uint32_t literalCount, distanceCount, codeCount;
+            if (!bits(5, literalCount) || !bits(5, distanceCount) || !bits(4, codeCount))
+                return false;
+            literalCount += 257;
+            distanceCount += 1;
+            codeCount += 4;
+            if (literalCount > 286 || distanceCount > 30)
+                return false;
+
+            uint8_t lengths[286 + 30] = {};
+            for (uint32_t i = 0; i < codeCount; i++)
+            {
+                uint32_t length;
+                if (!bits(3, length))
+                    return false;
+                lengths[ORDER[i]] = (uint8_t)length;
+            }
+            Huffman lengthCodes;
+            if (!build(lengths, 19, lengthCodes))
+                return false;
+
+            uint32_t i = 0;
+            std::fill(lengths, lengths + 19, 0);
+            while (i < literalCount + distanceCount)
+            {
+                int symbol;
+                if (!decode(lengthCodes, symbol))
+                    return false;
+                if (symbol < 16)
+                {
+                    lengths[i++] = (uint8_t)symbol;
+                    continue;
+                }
+                uint8_t value = 0;
+                uint32_t repeat;
+                if (symbol == 16)
+                {
+                    if (i == 0 || !bits(2, repeat))
+                        return false;
+                    value = lengths[i - 1];
+                    repeat += 3;
+                }
+                else if (symbol == 17)
+                {
+                    if (!bits(3, repeat))
+                        return false;
+                    repeat += 3;
+                }
+                else
+                {
+                    if (!bits(7, repeat))
+                        return false;
+                    repeat += 11;
+                }
+                if (i + repeat > literalCount + distanceCount)
+                    return false;
+                while (repeat--)
+                    lengths[i++] = value;
+            }
+            if (lengths[256] == 0)
+                return false;
+            Huffman literals, distances;
+            return build(lengths, (int)literalCount, literals) &&
+                   build(lengths + literalCount, (int)distanceCount, distances) && codes(out, literals, distances);
+        }
+
+        const uint8_t* m_Data;
+        size_t m_Size;
+        size_t m_Pos = 0;
+        uint32_t m_Byte = 0;
+        int m_BitCount = 0;
+        uint32_t m_Last = 0;
+        size_t m_Start = 0;
+    };
+
+    // Appends the data of a whole zlib stream to `out`, false unless the header,
+    // the blocks and the Adler-32 trailer are all valid and nothing follows them
+    inline bool Zlib(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+    {
+        if (size < 6 || (data[0] & 0x0F) != 8 || (data[0] >> 4) > 7 || (data[0] << 8 | data[1]) % 31 != 0 ||
+            (data[1] & 0x20))
+            return false;
+        const size_t start = out.size();
+        Decoder decoder(data + 2, size - 2);
+        decoder.StartAt(start);
+        if (!decoder.Blocks(out))
+            return false;
+        const size_t trailer = 2 + decoder.BytePosition();
+        if (size - trailer != 4)
+            return false;
+        const uint32_t expected = uint32_t(data[trailer]) << 24 | data[trailer + 1] << 16 | data[trailer + 2] << 8 |
+                                  data[trailer + 3];
+        return Util::Adler32(out.data() + start, out.size() - start) == expected;
+    }
+
+    inline bool Zlib(const std::vector<uint8_t>& data, std::vector<uint8_t>& out)
+    {
+        return Zlib(data.data(), data.size(), out);
+    }
+}
@@ -0,0 +1,158 @@
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "Diffusion/InPlace.h"
+#include "Diffusion/Kernel.h"
+#include "Diffusion/OutOfCore.h"
+#include "Reference.h"
+
+// Every kernel variant runs STEPS steps from the same initial field and is compared
+// with the reference. Variants that keep the original operation order must match
+// bit for bit; reordered or reduced precision variants get their own tolerances.
+
+static constexpr int STEPS = 200;
+static constexpr int64_t WIDTH = 67;
+static constexpr int64_t HEIGHT = 53;
+
+struct Tolerance
+{
+    double maxAbs;
+    double l2;
+    uint64_t maxUlp;
+};
+
+struct KernelVariant
+{
+    std::string name;
+    Tolerance tolerance;
+    // Advances `field` by `steps` steps in place
+    std::function<void(Diffusion::Field& field, const Diffusion::Parameters& params, int steps)> run;
+};
+
+static constexpr Tolerance EXACT{0.0, 0.0, 0};
+
+static void stepWithRegions(Diffusion::Field& field, const Diffusion::Parameters& params, int steps, int64_t blockX, int64_t blockY)
+{
+    Diffusion::Field next = field;
+    for (int s = 0; s < steps; s++)
+    {
+        for (int64_t y = 1; y < field.Height() - 1; y += blockY)
+            for (int64_t x = 1; x < field.Width() - 1; x += blockX)
+                Diffusion::StepRegion(field, next, params, x, y, std::min(x + blockX, field.Width() - 1),
+                                      std::min(y + blockY, field.Height() - 1));
+        field.Swap(next);
+    }
+}
+
+static std::vector<KernelVariant> kernelVariants()
+{
+    return {
+        {"StepRegion", EXACT, [](Diffusion::Field& field, const Diffusion::Parameters& params, int steps) {
+             stepWithRegions(field, params, steps, field.Width(), field.Height());
+         }},
+        {"StepRegionBlocks", EXACT, [](Diffusion::Field& field, const Diffusion::Parameters& params, int steps) {
+             // Uneven blocks like the worker split, edges included
+             stepWithRegions(field, params, steps, 16, 11);
+         }},
+        {"StepRegionRows", EXACT, [](Diffusion::Field& field, const Diffusion::Parameters& params, int steps) {
+             // One row segment at a time, the way the workers step their blocks
+             stepWithRegions(field, params, steps, 29, 1);
+         }},
+        {"InPlace", EXACT, [](Diffusion::Field& field, const Diffusion::Parameters& params, int steps) {
+             // Bands that don't divide the rows, on more threads than the machine may have
+             Diffusion::ThreadPool pool(4);
+             Diffusion::InPlaceStepper stepper(7);
+             for (int s = 0; s < steps; s++)
+                 stepper.Step(field, params, pool);
+         }},
+        {"InPlaceSingleRowBands", EXACT, [](Diffusion::Field& field, const Diffusion::Parameters& params, int steps) {
+             Diffusion::ThreadPool pool(3);
+             Diffusion::InPlaceStepper stepper(1);
+             for (int s = 0; s < steps; s++)
+                 stepper.Step(field, params, pool);
+         }},
+        {"OutOfCore", EXACT, [](Diffusion::Field& field, const Diffusion::Parameters& params, int steps) {
+             const auto directory = std::filesystem::temp_directory_path() / "diffusion-tests-ooc";
+             std::filesystem::create_directories(directory);
+             Diffusion::OutOfCoreSimulation simulation;
+             // A budget of a few rows forces several bands per step
+             const uint64_t budget = 8 * field.Width() * sizeof(Diffusion::Real) * 4;
+             ASSERT_TRUE(simulation.Create(directory.string(), field.Width(), field.Height(), budget, 2));
+             std::copy_n(field.A(), field.Size(), simulation.Current().A());
+             std::copy_n(field.B(), field.Size(), simulation.Current().B());
+             for (int s = 0; s < steps; s++)
+                 simulation.Step(params);
+             field = simulation.Current();
+             simulation.Close();
+             std::filesystem::remove_all(directory);
+         }},
+    };
+}
+
+class KernelEquivalence : public testing::TestWithParam<KernelVariant>
+{
+};
+
+TEST_P(KernelEquivalence, MatchesReference)
+{
+    const KernelVariant& variant = GetParam();
+    const Diffusion::Parameters params;
+
+    Diffusion::Field expected = Reference::InitialField(WIDTH, HEIGHT);
+    Diffusion::Field scratch = expected;
+    for (int s = 0; s < STEPS; s++)
+    {
+        Reference::Step(expected, scratch, params);
+        expected.Swap(scratch);
+    }
+
+    Diffusion::Field actual = Reference::InitialField(WIDTH, HEIGHT);
+    variant.run(actual, params, STEPS);
+    ASSERT_EQ(actual.Width(), WIDTH);
+    ASSERT_EQ(actual.Height(), HEIGHT);
+
+    const Reference::Error error = Reference::Compare(expected, actual);
+    RecordProperty("max_abs", std::to_string(error.maxAbs));
+    RecordProperty("l2", std::to_string(error.l2));
+    RecordProperty("max_ulp", std::to_string(error.maxUlp));
+    EXPECT_LE(error.maxAbs, variant.tolerance.maxAbs) << variant.name << " max-abs error";
+    EXPECT_LE(error.l2, variant.tolerance.l2) << variant.name << " L2 error";
+    EXPECT_LE(error.maxUlp, variant.tolerance.maxUlp) << variant.name << " ULP error";
+}
+
+INSTANTIATE_TEST_SUITE_P(Variants, KernelEquivalence, testing::ValuesIn(kernelVariants()),
+                         [](const testing::TestParamInfo<KernelVariant>& info) { return info.param.name; });
+
+TEST(KernelReference, ReactionIsActive)
+{
+    // Guards the fixture: a field that stays constant would make every comparison pass
+    const Diffusion::Parameters params;
+    Diffusion::Field field = Reference::InitialField(WIDTH, HEIGHT);
+    Diffusion::Field next = field;
+    Reference::Step(field, next, params);
+    EXPECT_GT(Reference::Compare(field, next).maxAbs, 1e-3);
+}
+
+TEST(KernelReference, UlpDistance)
+{
+    EXPECT_EQ(Reference::UlpDistance(1.0, 1.0), 0u);
+    EXPECT_EQ(Reference::UlpDistance(1.0, std::nextafter(1.0, 2.0)), 1u);
+    EXPECT_EQ(Reference::UlpDistance(0.0, -0.0), 0u);
+    EXPECT_EQ(Reference::UlpDistance(-std::numeric_limits<double>::denorm_min(), std::numeric_limits<double>::denorm_min()), 2u);
+}
+
+TEST(FieldDigest, IndependentOfThreads)
+{
+    // Large enough for several chunks per plane
+    Diffusion::Field field = Reference::InitialField(300, 260);
+    const uint32_t digest = field.Digest(1);
+    EXPECT_EQ(field.Digest(3), digest);
+    EXPECT_EQ(field.Digest(8), digest);
+
+    field.B()[field.Index(150, 250)] = std::nextafter(field.B()[field.Index(150, 250)], 2.0);
+    EXPECT_NE(field.Digest(1), digest);
+}
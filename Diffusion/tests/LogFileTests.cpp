@@ -0,0 +1,94 @@
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Utils/LogFile.h"
+
+using Util::LogDetail::FieldType;
+using Util::LogDetail::LogField;
+
+TEST(LogFile, RoundTripsAndRotates)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "diffusion-tests.rdl").string();
+    Util::LogFileOptions options;
+    options.rotateBytes = 4096;
+    options.keep = 1;
+
+    std::vector<LogField> fields(2);
+    fields[0].name = "step";
+    fields[0].type = FieldType::UInt;
+    fields[0].u = 1234;
+    fields[1].type = FieldType::String;
+    fields[1].text = "spots";
+
+    Util::LogFile file;
+    ASSERT_TRUE(file.Open(path, options));
+    // More than a file holds, the first ones end up in path.1
+    const int count = 200;
+    for (int i = 0; i < count; i++)
+        ASSERT_TRUE(file.Write(1000 + i, i, 3, Util::Logger::Level::Warning, "step 1234 of spots", fields));
+    file.Close();
+
+    // Rotation dropped the oldest files, path.1 starts wherever they ended
+    uint64_t first = 0, next = 0;
+    bool started = false;
+    for (const std::string& part : {path + ".1", path})
+    {
+        Util::LogFileReader reader;
+        ASSERT_TRUE(reader.Open(part));
+        Util::LogEntry entry;
+        while (reader.Next(entry))
+        {
+            if (!started)
+                first = next = entry.sequence;
+            started = true;
+            EXPECT_EQ(entry.sequence, next);
+            EXPECT_EQ(entry.time, 1000 + (int64_t)next);
+            EXPECT_EQ(entry.thread, 3u);
+            EXPECT_EQ(entry.level, Util::Logger::Level::Warning);
+            EXPECT_EQ(entry.message, "step 1234 of spots");
+            ASSERT_EQ(entry.fields.size(), 2u);
+            EXPECT_EQ(entry.fields[0].name, "step");
+            EXPECT_EQ(entry.fields[0].u, 1234u);
+            EXPECT_EQ(entry.fields[1].type, FieldType::String);
+            EXPECT_EQ(entry.fields[1].text, "spots");
+            next++;
+        }
+        EXPECT_FALSE(reader.Corrupted());
+        std::filesystem::remove(part);
+    }
+    EXPECT_GT(first, 0u);
+    EXPECT_EQ(next, (uint64_t)count);
+}
+
+TEST(LogFile, ReopeningKeepsThePreviousLog)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "diffusion-tests-reopen.rdl").string();
+    Util::LogFileOptions options;
+    options.keep = 2;
+    const std::vector<LogField> fields;
+
+    // Three runs with the same path, the newest previous one is path.1
+    for (int run = 0; run < 3; run++)
+    {
+        Util::LogFile file;
+        ASSERT_TRUE(file.Open(path, options));
+        ASSERT_TRUE(file.Write(1000, run, 0, Util::Logger::Level::Info, "run " + std::to_string(run), fields));
+        file.Close();
+    }
+
+    const std::string parts[] = {path + ".2", path + ".1", path};
+    for (int run = 0; run < 3; run++)
+    {
+        Util::LogFileReader reader;
+        ASSERT_TRUE(reader.Open(parts[run]));
+        Util::LogEntry entry;
+        ASSERT_TRUE(reader.Next(entry));
+        EXPECT_EQ(entry.message, "run " + std::to_string(run));
+        EXPECT_FALSE(reader.Next(entry));
+        EXPECT_FALSE(reader.Corrupted());
+        std::filesystem::remove(parts[run]);
+    }
+}
@@ -0,0 +1,156 @@
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Utils/LogFile.h"
+#include "Utils/LogLines.h"
+#include "Utils/Logger.h"
+
+TEST(Logger, EveryLineOnceInThreadOrder)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "diffusion-tests-logger.rdl").string();
+    Util::LogFileOptions options;
+    options.rotateBytes = 1ull << 30;
+    ASSERT_TRUE(Util::Logger::OpenFile(path, options));
+    const bool console = Util::Logger::console;
+    Util::Logger::console = false;
+
+    // Each thread writes several rings' worth, so the rings wrap and fill up
+    constexpr int THREADS = 4;
+    constexpr int64_t LINES = 20000;
+    static_assert(LINES * 32 > (int64_t)Util::Logger::RING_BYTES * 4, "Not enough lines to wrap the rings");
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++)
+    {
+        threads.emplace_back([t] {
+            for (int64_t i = 0; i < LINES; i++)
+                LOG_WARNING("logger test {} {}", t, i);
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    // Too long for a ring, its caller writes it after the lines queued before
+    const std::string longText(Util::Logger::RING_BYTES / 2 + 100, 'x');
+    LOG_WARNING("logger test long {}", longText);
+    Util::Logger::Flush();
+    Util::Logger::console = console;
+    Util::Logger::CloseFile();
+
+    Util::LogFileReader reader;
+    ASSERT_TRUE(reader.Open(path));
+    std::vector<int64_t> next(THREADS, 0);
+    bool sawLong = false;
+    Util::LogEntry entry;
+    while (reader.Next(entry))
+    {
+        if (entry.message.substr(0, 12) != "logger test ")
+            continue;
+        EXPECT_FALSE(sawLong) << "a line after the long one";
+        if (entry.message.substr(12, 4) == "long")
+        {
+            // Written directly, the file has no ring for it
+            EXPECT_EQ(entry.message.size(), 17 + longText.size());
+            EXPECT_EQ(entry.thread, 0u);
+            sawLong = true;
+            continue;
+        }
+        ASSERT_EQ(entry.fields.size(), 2u);
+        const int64_t t = entry.fields[0].i, i = entry.fields[1].i;
+        ASSERT_TRUE(t >= 0 && t < THREADS);
+        EXPECT_EQ(i, next[t]) << "thread " << t;
+        next[t] = i + 1;
+    }
+    EXPECT_FALSE(reader.Corrupted());
+    EXPECT_TRUE(sawLong);
+    for (int t = 0; t < THREADS; t++)
+        EXPECT_EQ(next[t], LINES) << "thread " << t;
+    std::filesystem::remove(path);
+}
+
+using Util::LogDetail::FilterIndex;
+using Util::LogDetail::LineRing;
+
+// Line n of the tests, `size` bytes telling which line it is
+static std::string lineText(uint64_t n, size_t size)
+{
+    std::string text = std::to_string(n) + ":";
+    text.resize(size, (char)('a' + n % 26));
+    return text;
+}
+
+TEST(LogLines, EvictsAtTheLineLimit)
+{
+    LineRing ring;
+    for (uint64_t n = 0; n < LineRing::LINES + 100; n++)
+        ring.Push(lineText(n, 10), 0);
+    EXPECT_EQ(ring.First(), 100u);
+    EXPECT_EQ(ring.Next(), LineRing::LINES + 100);
+    for (uint64_t n : {ring.First(), ring.Next() - 1})
+        EXPECT_EQ(std::string(ring.Text(ring.At(n)), ring.At(n).size), lineText(n, 10));
+}
+
+TEST(LogLines, EvictsAtTheTextLimit)
+{
+    // Lines dividing the text exactly, then ones that leave a gap at its end
+    for (size_t size : {(size_t)LineRing::MAX_LINE, (size_t)3001})
+    {
+        LineRing ring;
+        for (uint64_t n = 0; n < 2000; n++)
+            ring.Push(lineText(n, size), 0);
+        const uint64_t kept = ring.Next() - ring.First();
+        EXPECT_LE(kept * size, LineRing::TEXT_BYTES) << size;
+        // Only a partial line's worth of text goes unused
+        EXPECT_GT((kept + 2) * size, LineRing::TEXT_BYTES) << size;
+        for (uint64_t n = ring.First(); n < ring.Next(); n++)
+            ASSERT_EQ(std::string(ring.Text(ring.At(n)), ring.At(n).size), lineText(n, size)) << size << " line " << n;
+    }
+
+    LineRing ring;
+    ring.Push(std::string(LineRing::MAX_LINE + 100, 'x'), 0);
+    EXPECT_EQ(ring.At(0).size, LineRing::MAX_LINE);
+}
+
+TEST(LogLines, FilterIndexFollowsEvictionsAndFilterChanges)
+{
+    static const char* TAGS[] = {"alpha", "beta", "gamma"};
+    LineRing ring;
+    FilterIndex index;
+    ImGuiTextFilter filter;
+    uint64_t n = 0;
+
+    auto check = [&](const char* text) {
+        std::snprintf(filter.InputBuf, sizeof(filter.InputBuf), "%s", text);
+        filter.Build();
+        index.Update(filter, ring);
+        std::vector<uint64_t> expected, actual;
+        for (uint64_t line = ring.First(); line < ring.Next(); line++)
+        {
+            const char* start = ring.Text(ring.At(line));
+            if (filter.PassFilter(start, start + ring.At(line).size))
+                expected.push_back(line);
+        }
+        for (size_t i = 0; i < index.Size(); i++)
+            actual.push_back(index[i]);
+        EXPECT_EQ(actual, expected) << "filter " << text << " at line " << n;
+    };
+
+    // Batches that evict part of what was indexed, then the whole of it
+    for (uint64_t batch : std::initializer_list<uint64_t>{5000, 9000, 3000, LineRing::LINES + 10, 7})
+    {
+        for (uint64_t end = n + batch; n < end; n++)
+            ring.Push(fmt::format("step {} {}", n, TAGS[(n * 7) % 3]), 0);
+        check("beta");
+    }
+    check("gamma");
+    check("-beta");
+    for (uint64_t end = n + 20000; n < end; n++)
+        ring.Push(fmt::format("step {} {}", n, TAGS[(n * 5) % 3]), 0);
+    check("-beta");
+    ring.Clear();
+    check("-beta");
+    EXPECT_EQ(index.Size(), 0u);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+// The original simulator step, kept verbatim in semantics (per cell laplaceA /
+// laplaceB, explicit Euler, clamping) as the ground truth for every optimized kernel.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+
+#include "Diffusion/Field.h"
+#include "Diffusion/Kernel.h"
+
+namespace Reference
+{
+    inline double laplace(const Diffusion::Real* v, const Diffusion::Field& grid, int x, int y)
+    {
+        double sum = 0;
+        sum += v[grid.Index(x, y)] * -1.0;
+        sum += v[grid.Index(x - 1, y)] * 0.2;
+        sum += v[grid.Index(x + 1, y)] * 0.2;
+        sum += v[grid.Index(x, y + 1)] * 0.2;
+        sum += v[grid.Index(x, y - 1)] * 0.2;
+        sum += v[grid.Index(x - 1, y - 1)] * 0.05;
+        sum += v[grid.Index(x + 1, y - 1)] * 0.05;
+        sum += v[grid.Index(x + 1, y + 1)] * 0.05;
+        sum += v[grid.Index(x - 1, y + 1)] * 0.05;
+        return sum;
+    }
+
+    inline void Step(const Diffusion::Field& grid, Diffusion::Field& next, const Diffusion::Parameters& p)
+    {
+        for (int j = 1; j < grid.Height() - 1; j++)
+        {
+            for (int i = 1; i < grid.Width() - 1; i++)
+            {
+                const double a = grid.A()[grid.Index(i, j)];
+                const double b = grid.B()[grid.Index(i, j)];
+                double& nextA = next.A()[grid.Index(i, j)];
+                double& nextB = next.B()[grid.Index(i, j)];
+                nextA = a + ((p.dA * laplace(grid.A(), grid, i, j)) - (a * b * b) + (p.feed * (1 - a)));
+                nextB = b + ((p.dB * laplace(grid.B(), grid, i, j)) + (a * b * b) - ((p.kill + p.feed) * b));
+                if (nextA > 1)
+                    nextA = 1;
+                if (nextB > 1)
+                    nextB = 1;
+                if (nextA < 0)
+                    nextA = 0;
+                if (nextB < 0)
+                    nextB = 0;
+            }
+        }
+    }
+
+    // Fixed initial conditions: the simulator's square of B plus seeded noise, so
+    // every cell takes part in the reaction.
+    inline Diffusion::Field InitialField(int64_t width, int64_t height)
+    {
+        Diffusion::Field field;
+        field.Create(width, height, 1, 0);
+        std::mt19937 random(12345);
+        for (int64_t y = 1; y < height - 1; y++)
+        {
+            for (int64_t x = 1; x < width - 1; x++)
+            {
+                const double noise = (random() >> 8) * (1.0 / (1 << 24));
+                const bool inside = std::abs(x - width / 2) < width / 5 && std::abs(y - height / 2) < height / 5;
+                field.A()[field.Index(x, y)] = inside ? 0.5 * noise : 1.0 - 0.1 * noise;
+                field.B()[field.Index(x, y)] = inside ? 1.0 - 0.5 * noise : 0.1 * noise;
+            }
+        }
+        return field;
+    }
+
+    // Distance in representable doubles, 0 for identical values
+    inline uint64_t UlpDistance(double a, double b)
+    {
+        if (a == b)
+            return 0;
+        int64_t ia, ib;
+        std::memcpy(&ia, &a, sizeof(a));
+        std::memcpy(&ib, &b, sizeof(b));
+        // Map the sign-magnitude encoding onto a monotonic integer line
+        if (ia < 0)
+            ia = INT64_MIN - ia;
+        if (ib < 0)
+            ib = INT64_MIN - ib;
+        return ia > ib ? uint64_t(ia) - uint64_t(ib) : uint64_t(ib) - uint64_t(ia);
+    }
+
+    struct Error
+    {
+        double maxAbs = 0.0;
+        double l2 = 0.0; // Root mean square over both planes
+        uint64_t maxUlp = 0;
+    };
+
+    inline Error Compare(const Diffusion::Field& expected, const Diffusion::Field& actual)
+    {
+        Error error;
+        const Diffusion::Real* planes[2][2] = {{expected.A(), actual.A()}, {expected.B(), actual.B()}};
+        for (auto& plane : planes)
+        {
+            for (int64_t i = 0; i < expected.Size(); i++)
+            {
+                const double diff = std::abs(plane[0][i] - plane[1][i]);
+                error.maxAbs = std::max(error.maxAbs, diff);
+                error.l2 += diff * diff;
+                error.maxUlp = std::max(error.maxUlp, UlpDistance(plane[0][i], plane[1][i]));
+            }
+        }
+        error.l2 = std::sqrt(error.l2 / (2.0 * expected.Size()));
+        return error;
+    }
+}
@@ -0,0 +1,258 @@
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Diffusion/Parallel.h"
+#include "Diffusion/Scenario.h"
+#include "Reference.h"
+
+static std::string writeScenario(const std::string& name, const std::string& text)
+{
+    const auto path = std::filesystem::temp_directory_path() / name;
+    std::ofstream(path) << text;
+    return path.string();
+}
+
+TEST(Scenario, Parses)
+{
+    const std::string path = writeScenario("diffusion-tests.scn",
+                                           "# comment\n"
+                                           "name spots\n"
+                                           "size 64 48\n"
+                                           "precision double\n"
+                                           "boundary periodic # trailing comment\n"
+                                           "params 100 1.0 0.5 0.030 0.057\n"
+                                           "params 0 1.0 0.5 0.050 0.061\n"
+                                           "seed 10 12 4\n"
+                                           "seed 40 30 6\n"
+                                           "steps 250\n"
+                                           "frames out.y4m 5 raw\n"
+                                           "stats out.csv 10\n");
+    Diffusion::Scenario scenario;
+    ASSERT_TRUE(Diffusion::LoadScenario(path, scenario));
+    std::filesystem::remove(path);
+
+    EXPECT_EQ(scenario.name, "spots");
+    EXPECT_EQ(scenario.width, 64);
+    EXPECT_EQ(scenario.height, 48);
+    EXPECT_EQ(scenario.boundary, Diffusion::Boundary::Periodic);
+    ASSERT_EQ(scenario.parameters.size(), 2u);
+    EXPECT_EQ(scenario.parameters[0].step, 0u);
+    ASSERT_EQ(scenario.seeds.size(), 2u);
+    EXPECT_EQ(scenario.seeds[1].length, 6);
+    EXPECT_EQ(scenario.steps, 250u);
+    EXPECT_EQ(scenario.frames.every, 5u);
+    EXPECT_EQ(scenario.frameFormat, Diffusion::FrameFormat::Raw);
+    EXPECT_EQ(scenario.stats.path, "out.csv");
+    EXPECT_EQ(scenario.snapshot.every, 0u);
+
+    EXPECT_DOUBLE_EQ(scenario.ParametersAt(0).feed, 0.050);
+    EXPECT_DOUBLE_EQ(scenario.ParametersAt(50).feed, 0.040);
+    EXPECT_DOUBLE_EQ(scenario.ParametersAt(500).kill, 0.057);
+}
+
+TEST(Scenario, RejectsInvalidLines)
+{
+    for (const char* text : {"size 2 100\n", "boundary wrap\n", "steps 0\n", "seed 10\n", "steps 10 20\n", "colour red\n",
+                             "size 10 10\nseed 20 5 2\n", "snapshot out/a.rds 10\n", "snapshot out/{.rds 10\n"})
+    {
+        const std::string path = writeScenario("diffusion-tests-invalid.scn", text);
+        Diffusion::Scenario scenario;
+        EXPECT_FALSE(Diffusion::LoadScenario(path, scenario)) << text;
+        std::filesystem::remove(path);
+    }
+}
+
+TEST(Scenario, RunnerMatchesReference)
+{
+    Diffusion::ScenarioRunner::Options options;
+    options.threads = 3;
+    Diffusion::ScenarioRunner runner(options);
+
+    Diffusion::Scenario scenario;
+    scenario.width = 70;
+    scenario.height = 41; // Not a multiple of the band height
+    scenario.seeds = {{20, 20, 5}, {50, 25, 8}};
+    scenario.steps = 120;
+
+    // Twice, the second run reuses the buffers of the first
+    for (int run = 0; run < 2; run++)
+    {
+        Diffusion::ScenarioResult result;
+        ASSERT_TRUE(runner.Run(scenario, result));
+        EXPECT_TRUE(result.completed);
+        EXPECT_EQ(result.steps, scenario.steps);
+    }
+
+    Diffusion::Field expected;
+    expected.Create(scenario.width, scenario.height, 1, 0);
+    for (const auto& seed : scenario.seeds)
+        for (int64_t j = seed.y - seed.length; j < seed.y + seed.length; j++)
+            for (int64_t i = seed.x - seed.length; i < seed.x + seed.length; i++)
+            {
+                expected.A()[expected.Index(i, j)] = 0;
+                expected.B()[expected.Index(i, j)] = 1;
+            }
+    Diffusion::Field scratch = expected;
+    for (uint64_t s = 0; s < scenario.steps; s++)
+    {
+        Reference::Step(expected, scratch, Diffusion::Parameters{});
+        expected.Swap(scratch);
+    }
+    EXPECT_EQ(Reference::Compare(expected, runner.Current()).maxUlp, 0u);
+}
+
+TEST(Boundary, PeriodicWraps)
+{
+    Diffusion::Field field = Reference::InitialField(9, 7);
+    Diffusion::ApplyBoundary(field, Diffusion::Boundary::Periodic);
+    const int64_t w = field.Width(), h = field.Height();
+    for (int64_t x = 1; x < w - 1; x++)
+    {
+        EXPECT_EQ(field.A()[field.Index(x, 0)], field.A()[field.Index(x, h - 2)]);
+        EXPECT_EQ(field.B()[field.Index(x, h - 1)], field.B()[field.Index(x, 1)]);
+    }
+    for (int64_t y = 1; y < h - 1; y++)
+        EXPECT_EQ(field.A()[field.Index(0, y)], field.A()[field.Index(w - 2, y)]);
+    EXPECT_EQ(field.A()[field.Index(0, 0)], field.A()[field.Index(w - 2, h - 2)]);
+    EXPECT_EQ(field.B()[field.Index(w - 1, h - 1)], field.B()[field.Index(1, 1)]);
+}
+
+TEST(ThreadPool, RunsEveryItemOnce)
+{
+    Diffusion::ThreadPool pool(4);
+    for (uint32_t count : {0u, 1u, 3u, 1000u})
+    {
+        std::vector<std::atomic<int>> hits(count);
+        pool.For(count, [&](uint32_t i) { hits[i]++; });
+        for (uint32_t i = 0; i < count; i++)
+            ASSERT_EQ(hits[i].load(), 1) << "item " << i << " of " << count;
+    }
+}
+
+TEST(Convergence, StopsWhenSteady)
+{
+    Diffusion::ScenarioRunner::Options options;
+    options.threads = 2;
+    Diffusion::ScenarioRunner runner(options);
+
+    // Nothing seeded, nothing ever changes
+    Diffusion::Scenario scenario;
+    scenario.width = 40;
+    scenario.height = 60;
+    scenario.steps = 1000;
+    scenario.convergence.every = 10;
+    scenario.convergence.window = 3;
+
+    Diffusion::ScenarioResult result;
+    ASSERT_TRUE(runner.Run(scenario, result));
+    EXPECT_TRUE(result.completed);
+    EXPECT_EQ(result.steps, 30u);
+    EXPECT_EQ(result.convergedAt, 10u);
+    EXPECT_EQ(runner.Convergence().RegionConvergedAt(0, 0), 10u);
+}
+
+TEST(Convergence, MeasuresTheStepChange)
+{
+    Diffusion::Scenario scenario;
+    scenario.width = 50;
+    scenario.height = 70;
+    scenario.seeds = {{25, 30, 6}};
+    scenario.steps = 5;
+    scenario.convergence.every = 1;
+    scenario.convergence.tolerance = 1e-300;
+
+    Diffusion::Field before;
+    before.Create(scenario.width, scenario.height, 1, 0);
+    for (int64_t j = 24; j < 36; j++)
+        for (int64_t i = 19; i < 31; i++)
+        {
+            before.A()[before.Index(i, j)] = 0;
+            before.B()[before.Index(i, j)] = 1;
+        }
+    Diffusion::Field after = before;
+    for (uint64_t s = 0; s < scenario.steps; s++)
+    {
+        before = after;
+        Reference::Step(before, after, Diffusion::Parameters{});
+    }
+    double maxAbs = 0.0, sumSquares = 0.0;
+    for (int64_t c = 0; c < before.Size(); c++)
+        for (double change : {after.A()[c] - before.A()[c], after.B()[c] - before.B()[c]})
+        {
+            maxAbs = std::max(maxAbs, std::abs(change));
+            sumSquares += change * change;
+        }
+
+    for (bool inPlace : {false, true})
+    {
+        Diffusion::ScenarioRunner::Options options;
+        options.threads = 3;
+        options.inPlace = inPlace;
+        Diffusion::ScenarioRunner runner(options);
+        Diffusion::ScenarioResult result;
+        ASSERT_TRUE(runner.Run(scenario, result));
+        EXPECT_EQ(result.steps, scenario.steps);
+        EXPECT_EQ(result.convergedAt, 0u);
+        EXPECT_EQ(runner.Convergence().Last().maxAbs, maxAbs) << "in place: " << inPlace;
+        EXPECT_NEAR(runner.Convergence().Last().sumSquares, sumSquares, 1e-12 * sumSquares) << "in place: " << inPlace;
+    }
+}
+
+TEST(Statistics, MatchSecondPass)
+{
+    Diffusion::Scenario scenario;
+    scenario.width = 61;
+    scenario.height = 45;
+    scenario.seeds = {{30, 20, 7}};
+    scenario.steps = 40;
+    scenario.stats.every = 20;
+    scenario.statsFormat = Diffusion::StatsFormat::Binary;
+    scenario.onThreshold = 0.25;
+
+    for (bool inPlace : {false, true})
+    {
+        scenario.stats.path = (std::filesystem::temp_directory_path() / "diffusion-tests-stats.bin").string();
+        Diffusion::ScenarioRunner::Options options;
+        options.threads = 3;
+        options.inPlace = inPlace;
+        Diffusion::ScenarioRunner runner(options);
+        Diffusion::ScenarioResult result;
+        ASSERT_TRUE(runner.Run(scenario, result));
+
+        std::ifstream file(scenario.stats.path, std::ios::binary);
+        Diffusion::StatsFileHeader header;
+        ASSERT_TRUE(file.read((char*)&header, sizeof(header)));
+        EXPECT_EQ(std::string(header.magic, 4), "RDST");
+        EXPECT_EQ(header.recordSize, sizeof(Diffusion::StatsFileRecord));
+        std::vector<Diffusion::StatsFileRecord> records(3);
+        file.read((char*)records.data(), records.size() * sizeof(Diffusion::StatsFileRecord));
+        ASSERT_EQ(file.gcount(), 2 * (std::streamsize)sizeof(Diffusion::StatsFileRecord));
+        file.close();
+        std::filesystem::remove(scenario.stats.path);
+
+        // The interior cells of the final field, gathered again the slow way
+        const Diffusion::Field& field = runner.Current();
+        const Diffusion::StatsFileRecord& last = records[1];
+        EXPECT_EQ(last.step, 40u);
+        double sumB = 0.0, maxA = 0.0;
+        uint64_t on = 0;
+        for (int64_t y = 1; y < field.Height() - 1; y++)
+            for (int64_t x = 1; x < field.Width() - 1; x++)
+            {
+                const int64_t c = field.Index(x, y);
+                sumB += field.B()[c];
+                maxA = std::max(maxA, field.A()[c]);
+                on += field.B()[c] > 0.25;
+            }
+        EXPECT_EQ(last.cells, uint64_t(scenario.width - 2) * (scenario.height - 2));
+        EXPECT_NEAR(last.sumB, sumB, 1e-9 * sumB) << "in place: " << inPlace;
+        EXPECT_EQ(last.maxA, maxA);
+        EXPECT_EQ(last.on, on);
+        EXPECT_GT(on, 0u);
+    }
+}
@@ -0,0 +1,183 @@
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Diffusion/Simulation.h"
+#include "Reference.h"
+
+static constexpr int STEPS = 50;
+static constexpr int64_t WIDTH = 67;
+static constexpr int64_t HEIGHT = 53;
+
+static Diffusion::Field referenceSteps(Diffusion::Field field, const Diffusion::Parameters& params, int steps)
+{
+    Diffusion::Field next = field;
+    for (int s = 0; s < steps; s++)
+    {
+        Reference::Step(field, next, params);
+        field.Swap(next);
+    }
+    return field;
+}
+
+TEST(Simulation, MatchesReferenceForAnyWorkerCount)
+{
+    const Diffusion::Parameters params;
+    const Diffusion::Field expected = referenceSteps(Reference::InitialField(WIDTH, HEIGHT), params, STEPS);
+    for (int threads : {1, 3, 4, 9})
+    {
+        Diffusion::Simulation simulation;
+        ASSERT_TRUE(simulation.Create(Reference::InitialField(WIDTH, HEIGHT), 0, threads));
+        simulation.SetParameters(params);
+        EXPECT_EQ(simulation.Step(STEPS), (uint64_t)STEPS);
+        EXPECT_EQ(simulation.StepCount(), (uint64_t)STEPS);
+        EXPECT_EQ(Reference::Compare(expected, simulation.Current()).maxUlp, 0u) << threads << " threads";
+        ASSERT_EQ(simulation.A().size(), (size_t)(WIDTH * HEIGHT));
+        EXPECT_EQ(simulation.A().data(), simulation.Current().A());
+    }
+}
+
+TEST(Simulation, StatsAreTheSameForAnyWorkerCount)
+{
+    // Enough rows for several bands, the workers' blocks split them differently
+    std::vector<Diffusion::FieldStats> stats;
+    for (int threads : {1, 3, 4, 9})
+    {
+        Diffusion::Simulation simulation;
+        ASSERT_TRUE(simulation.Create(Reference::InitialField(257, 193), 0, threads));
+        simulation.SetStatsEvery(10);
+        EXPECT_EQ(simulation.Step(STEPS), (uint64_t)STEPS);
+        stats.push_back(simulation.Stats());
+    }
+    EXPECT_EQ(stats[0].cells, 255u * 191u);
+    for (const Diffusion::FieldStats& other : stats)
+    {
+        EXPECT_EQ(other.cells, stats[0].cells);
+        EXPECT_EQ(other.on, stats[0].on);
+        // Bit for bit, the sums are folded in the same order
+        EXPECT_EQ(other.sumA, stats[0].sumA);
+        EXPECT_EQ(other.sumB, stats[0].sumB);
+        EXPECT_EQ(other.minA, stats[0].minA);
+        EXPECT_EQ(other.maxA, stats[0].maxA);
+        EXPECT_EQ(other.minB, stats[0].minB);
+        EXPECT_EQ(other.maxB, stats[0].maxB);
+    }
+}
+
+TEST(Simulation, BeginAdvanceAndPause)
+{
+    Diffusion::Simulation simulation;
+    ASSERT_TRUE(simulation.Create(Reference::InitialField(WIDTH, HEIGHT), 10, 4));
+    simulation.SetStatsEvery(2);
+
+    // Every interior row of the step is handed to the callback once
+    std::atomic<int64_t> cells{0};
+    simulation.SetRowCallback([&](const Diffusion::Field&, int64_t, int64_t x0, int64_t x1) { cells += x1 - x0; });
+    ASSERT_TRUE(simulation.Begin());
+    EXPECT_FALSE(simulation.Begin());
+    simulation.Wait();
+    EXPECT_TRUE(simulation.Ready());
+    EXPECT_FALSE(simulation.Advance()); // Step 11 isn't sampled
+    EXPECT_EQ(cells, (WIDTH - 2) * (HEIGHT - 2));
+    EXPECT_EQ(simulation.Step(1), 1u);
+    EXPECT_EQ(simulation.Stats().cells, uint64_t((WIDTH - 2) * (HEIGHT - 2)));
+
+    simulation.Pause();
+    EXPECT_EQ(simulation.Step(5), 0u);
+    // Nothing begun, it only sleeps
+    EXPECT_FALSE(simulation.WaitUntil(std::chrono::steady_clock::now() + std::chrono::milliseconds(5)));
+    simulation.Resume();
+    EXPECT_EQ(simulation.Step(5), 5u);
+    EXPECT_EQ(simulation.StepCount(), 17u);
+
+    // A step begun without rows doesn't call the callback
+    cells = 0;
+    ASSERT_TRUE(simulation.Begin(false));
+    EXPECT_TRUE(simulation.WaitUntil(std::chrono::steady_clock::now() + std::chrono::seconds(30)));
+    simulation.Advance();
+    EXPECT_EQ(simulation.StepCount(), 18u);
+    EXPECT_EQ(cells, 0);
+}
+
+TEST(Simulation, ResizeKeepsSharedCells)
+{
+    Diffusion::Simulation simulation;
+    ASSERT_TRUE(simulation.Create(WIDTH, HEIGHT, 2));
+    simulation.Seed(10, 10, 4);
+    simulation.Step(3);
+    const Diffusion::Field before = simulation.Current();
+
+    ASSERT_TRUE(simulation.Resize(40, 80));
+    EXPECT_EQ(simulation.Width(), 40);
+    EXPECT_EQ(simulation.Height(), 80);
+    const Diffusion::Field& after = simulation.Current();
+    for (int64_t y = 0; y < 80; y++)
+    {
+        for (int64_t x = 0; x < 40; x++)
+        {
+            const bool shared = y < HEIGHT;
+            EXPECT_EQ(after.A()[after.Index(x, y)], shared ? before.A()[before.Index(x, y)] : 1.0);
+            EXPECT_EQ(after.B()[after.Index(x, y)], shared ? before.B()[before.Index(x, y)] : 0.0);
+        }
+    }
+    EXPECT_EQ(simulation.Step(2), 2u);
+    EXPECT_FALSE(simulation.Resize(2, 80));
+}
+
+TEST(Simulation, CaptureIsTheFieldAtItsStep)
+{
+    // Tiles that don't divide the grid, the last column of tiles is border only
+    const int64_t width = 3 * Diffusion::Capture::TILE + 1, height = 2 * Diffusion::Capture::TILE + 17;
+    for (Diffusion::Boundary boundary : {Diffusion::Boundary::Fixed, Diffusion::Boundary::Periodic})
+    {
+        Diffusion::Simulation simulation;
+        ASSERT_TRUE(simulation.Create(Reference::InitialField(width, height), 0, 4));
+        simulation.SetBoundary(boundary);
+        simulation.Step(3);
+
+        std::vector<Diffusion::Field> expected;
+        std::vector<std::shared_ptr<const Diffusion::Capture>> captures;
+        std::atomic<uint64_t> calledAt{0};
+        for (int i = 0; i < 4; i++)
+        {
+            expected.push_back(simulation.Current());
+            captures.push_back(simulation.RequestCapture([&](const Diffusion::Capture& capture) { calledAt = capture.Step(); }));
+            // Written over right away, before the capture thread gets there
+            if (i == 3)
+                simulation.Seed(width / 2, height / 2, 20);
+            simulation.Step(i + 1);
+        }
+        simulation.WaitCaptures();
+        for (size_t i = 0; i < captures.size(); i++)
+        {
+            EXPECT_TRUE(captures[i]->Done());
+            EXPECT_EQ(captures[i]->Step(), 3u + i * (i + 1) / 2);
+            EXPECT_EQ(Reference::Compare(expected[i], captures[i]->Result()).maxUlp, 0u) << "capture " << i;
+        }
+        EXPECT_EQ(calledAt, captures.back()->Step());
+    }
+}
+
+TEST(Simulation, CaptureCopiesProtectedTilesFirst)
+{
+    Diffusion::Field field = Reference::InitialField(150, 100);
+    const Diffusion::Field expected = field;
+    Diffusion::Capture capture(field, 7, {});
+
+    // Tiles a write reaches are copied before it, the others are left to Complete
+    capture.Protect(60, 10, 70, 11);
+    EXPECT_EQ(capture.TilesProtected(), 2u);
+    for (int64_t x = 60; x < 70; x++)
+        field.A()[field.Index(x, 10)] = -1.0;
+    capture.Protect(60, 10, 70, 11);
+    EXPECT_EQ(capture.TilesProtected(), 2u);
+    EXPECT_FALSE(capture.Copied());
+
+    capture.Complete();
+    EXPECT_TRUE(capture.Copied());
+    EXPECT_TRUE(capture.Done());
+    EXPECT_EQ(capture.Tiles(), 3 * 2);
+    EXPECT_EQ(Reference::Compare(expected, capture.Result()).maxUlp, 0u);
+}
@@ -0,0 +1,164 @@
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Diffusion/Snapshot.h"
+#include "Reference.h"
+
+static constexpr int64_t WIDTH = 67;
+static constexpr int64_t HEIGHT = 53;
+static constexpr double PRECISION = 1e-4;
+
+static std::string tempPath(const char* name)
+{
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+// Largest difference over the cells [x0, x1) x [y0, y1) of both planes
+static double maxError(const Diffusion::Field& expected, const Diffusion::Field& actual, int64_t x0, int64_t y0,
+                       int64_t x1, int64_t y1)
+{
+    double error = 0.0;
+    for (int64_t y = y0; y < y1; y++)
+    {
+        for (int64_t x = x0; x < x1; x++)
+        {
+            const int64_t i = expected.Index(x, y);
+            error = std::max(error, std::abs(expected.A()[i] - actual.A()[i]));
+            error = std::max(error, std::abs(expected.B()[i] - actual.B()[i]));
+        }
+    }
+    return error;
+}
+
+TEST(Snapshot, RoundTripWithinPrecision)
+{
+    const std::string path = tempPath("diffusion-tests-0.rds");
+    const Diffusion::Field field = Reference::InitialField(WIDTH, HEIGHT);
+    Diffusion::SnapshotWriter writer;
+    writer.Configure({PRECISION, 16, 3, 0});
+    ASSERT_TRUE(writer.Write(path, field, 7));
+    EXPECT_EQ(writer.LastSize(), std::filesystem::file_size(path));
+
+    Diffusion::SnapshotReader reader;
+    ASSERT_TRUE(reader.Open(path));
+    EXPECT_EQ(reader.Header().step, 7u);
+    EXPECT_EQ(reader.Header().tileCount, 20u);
+    EXPECT_FALSE(reader.NeedsReference());
+    Diffusion::Field decoded;
+    ASSERT_TRUE(reader.Decode(decoded, nullptr, 2));
+    ASSERT_EQ(decoded.Width(), WIDTH);
+    ASSERT_EQ(decoded.Height(), HEIGHT);
+    // Rounded to the nearest multiple of the precision
+    EXPECT_LE(maxError(field, decoded, 0, 0, WIDTH, HEIGHT), PRECISION * 0.5 + 1e-12);
+    reader.Close();
+    std::filesystem::remove(path);
+}
+
+TEST(Snapshot, DecodesFromTemporalKeyframe)
+{
+    const std::string keyPath = tempPath("diffusion-tests-0.rds");
+    const std::string path = tempPath("diffusion-tests-1.rds");
+    const Diffusion::Field keyField = Reference::InitialField(WIDTH, HEIGHT);
+    Diffusion::Field field = keyField;
+    for (int64_t x = 10; x < 20; x++)
+        field.B()[field.Index(x, 30)] = 0.75;
+
+    Diffusion::SnapshotWriter writer;
+    writer.Configure({PRECISION, 16, 3, 2});
+    ASSERT_TRUE(writer.Write(keyPath, keyField, 100));
+    ASSERT_TRUE(writer.Write(path, field, 200));
+
+    Diffusion::SnapshotReader keyReader;
+    ASSERT_TRUE(keyReader.Open(keyPath));
+    EXPECT_FALSE(keyReader.NeedsReference());
+    Diffusion::Field reference;
+    ASSERT_TRUE(keyReader.Decode(reference));
+
+    Diffusion::SnapshotReader reader;
+    ASSERT_TRUE(reader.Open(path));
+    ASSERT_TRUE(reader.NeedsReference());
+    EXPECT_EQ(reader.Header().referenceStep, 100u);
+    EXPECT_LT(reader.Header().tileCount * sizeof(Diffusion::SnapshotTile) + sizeof(Diffusion::SnapshotHeader),
+              writer.LastSize());
+    Diffusion::Field decoded;
+    EXPECT_FALSE(reader.Decode(decoded));
+    ASSERT_TRUE(reader.Decode(decoded, &reference));
+    EXPECT_LE(maxError(field, decoded, 0, 0, WIDTH, HEIGHT), PRECISION * 0.5 + 1e-12);
+
+    reader.Close();
+    keyReader.Close();
+    std::filesystem::remove(keyPath);
+    std::filesystem::remove(path);
+}
+
+TEST(Snapshot, DecodesOneTile)
+{
+    const std::string path = tempPath("diffusion-tests-0.rds");
+    const Diffusion::Field field = Reference::InitialField(WIDTH, HEIGHT);
+    Diffusion::SnapshotWriter writer;
+    writer.Configure({PRECISION, 16, 1, 0});
+    ASSERT_TRUE(writer.Write(path, field, 1));
+
+    Diffusion::SnapshotReader reader;
+    ASSERT_TRUE(reader.Open(path));
+    Diffusion::Field decoded;
+    decoded.Create(WIDTH, HEIGHT, -1, -1);
+    // Tile 8 of 5 x 4 is the fourth of the second row: cells [48, 64) x [16, 32)
+    ASSERT_TRUE(reader.DecodeTile(8, decoded));
+    EXPECT_FALSE(reader.DecodeTile(20, decoded));
+    EXPECT_LE(maxError(field, decoded, 48, 16, 64, 32), PRECISION * 0.5 + 1e-12);
+    for (int64_t y = 0; y < HEIGHT; y++)
+    {
+        for (int64_t x = 0; x < WIDTH; x++)
+        {
+            const bool inside = x >= 48 && x < 64 && y >= 16 && y < 32;
+            ASSERT_TRUE(inside || decoded.A()[decoded.Index(x, y)] == -1) << x << ", " << y;
+        }
+    }
+    reader.Close();
+    std::filesystem::remove(path);
+}
+
+TEST(Snapshot, RejectsFlippedByte)
+{
+    const std::string path = tempPath("diffusion-tests-0.rds");
+    Diffusion::SnapshotWriter writer;
+    writer.Configure({PRECISION, 16, 1, 0});
+    ASSERT_TRUE(writer.Write(path, Reference::InitialField(WIDTH, HEIGHT), 1));
+    std::vector<uint8_t> good(std::filesystem::file_size(path));
+    FILE* f = fopen(path.c_str(), "rb");
+    ASSERT_NE(f, nullptr);
+    ASSERT_EQ(fread(good.data(), 1, good.size(), f), good.size());
+    fclose(f);
+
+    // In the last tile's payload, then in the header
+    for (size_t at : {good.size() - 5, (size_t)20})
+    {
+        std::vector<uint8_t> flipped = good;
+        flipped[at] ^= 0x01;
+        f = fopen(path.c_str(), "wb");
+        ASSERT_NE(f, nullptr);
+        ASSERT_EQ(fwrite(flipped.data(), 1, flipped.size(), f), flipped.size());
+        fclose(f);
+
+        Diffusion::SnapshotReader reader;
+        Diffusion::Field decoded;
+        EXPECT_FALSE(reader.Open(path) && reader.Decode(decoded)) << "byte " << at;
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(Snapshot, PathPattern)
+{
+    EXPECT_TRUE(Diffusion::ValidSnapshotPattern("out/spots-{}.rds"));
+    EXPECT_TRUE(Diffusion::ValidSnapshotPattern("out/spots-{:06}.rds"));
+    EXPECT_FALSE(Diffusion::ValidSnapshotPattern("out/spots.rds"));
+    EXPECT_FALSE(Diffusion::ValidSnapshotPattern("out/spots-{.rds"));
+    EXPECT_FALSE(Diffusion::ValidSnapshotPattern("out/spots-}.rds"));
+    EXPECT_FALSE(Diffusion::ValidSnapshotPattern("out/spots-{}-{}.rds"));
+}
@@ -0,0 +1,112 @@
+#include <chrono>
+
+#include <gtest/gtest.h>
+
+#include "Diffusion/StepController.h"
+
+using Clock = Diffusion::StepController::Clock;
+using std::chrono::milliseconds;
+
+// Configure starts the clocks at Clock::now(), a little before the tests' t0
+static double msBetween(Clock::time_point from, Clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+TEST(StepController, FrameRateFitsStepsInTheBudget)
+{
+    Diffusion::StepController controller;
+    controller.Configure(Diffusion::PacingMode::FrameRate, 50.0); // 20 ms frames
+    const Clock::time_point t0 = Clock::now();
+
+    // One step per frame until the step and frame times are known
+    EXPECT_TRUE(controller.MayStep(t0));
+    EXPECT_TRUE(controller.WillPresent(t0));
+    EXPECT_TRUE(controller.StepDone(t0 + milliseconds(2), 2.0));
+    controller.FramePresented(t0 + milliseconds(6));
+    EXPECT_DOUBLE_EQ(controller.FrameMs(), 4.0);
+    // (20 - 4) / 2
+    EXPECT_EQ(controller.StepsPerFrame(), 8);
+
+    for (int frame = 0; frame < 3; frame++)
+    {
+        const Clock::time_point start = t0 + milliseconds(6 + 20 * frame);
+        for (int step = 1; step <= 8; step++)
+        {
+            const bool last = step == 8;
+            EXPECT_EQ(controller.WillPresent(start + milliseconds(2 * (step - 1))), last) << step;
+            EXPECT_EQ(controller.StepDone(start + milliseconds(2 * step), 2.0), last) << step;
+        }
+        controller.FramePresented(start + milliseconds(20));
+        EXPECT_EQ(controller.StepsPerFrame(), 8);
+    }
+
+    // Steps slower than expected: the deadline presents a step WillPresent didn't
+    // expect, which the render loop then colours whole
+    const Clock::time_point start = t0 + milliseconds(66);
+    EXPECT_FALSE(controller.StepDone(start + milliseconds(10), 10.0));
+    EXPECT_FALSE(controller.WillPresent(start + milliseconds(10)));
+    EXPECT_TRUE(controller.StepDone(start + milliseconds(20), 10.0));
+    // With the slower steps averaged in, fewer fit in a frame
+    controller.FramePresented(start + milliseconds(24));
+    EXPECT_LT(controller.StepsPerFrame(), 8);
+}
+
+TEST(StepController, StepRateKeepsTheRate)
+{
+    Diffusion::StepController controller;
+    controller.Configure(Diffusion::PacingMode::StepRate, 100.0); // A step every 10 ms, 60 fps
+    const Clock::time_point t0 = Clock::now();
+
+    EXPECT_TRUE(controller.MayStep(t0));
+    EXPECT_FALSE(controller.StepDone(t0, 1.0));
+    EXPECT_FALSE(controller.MayStep(t0 + milliseconds(5)));
+    // The credit for the next step comes before the frame deadline
+    EXPECT_NEAR(msBetween(t0, controller.WakeAt(t0 + milliseconds(5))), 10.0, 0.5);
+    EXPECT_TRUE(controller.MayStep(t0 + milliseconds(10)));
+    EXPECT_FALSE(controller.StepDone(t0 + milliseconds(10), 1.0));
+    // The next step waits for its credit until 20 ms, past the 16.7 ms deadline
+    EXPECT_TRUE(controller.WillPresent(t0 + milliseconds(10)));
+    EXPECT_TRUE(controller.FrameDue(t0 + milliseconds(17)));
+    controller.FramePresented(t0 + milliseconds(17));
+
+    // A simulated second, polled every millisecond
+    int steps = 0;
+    for (int ms = 18; ms < 1018; ms++)
+    {
+        const Clock::time_point now = t0 + milliseconds(ms);
+        if (controller.MayStep(now))
+        {
+            steps++;
+            if (controller.StepDone(now, 1.0))
+                controller.FramePresented(now);
+        }
+        else if (controller.FrameDue(now))
+            controller.FramePresented(now);
+    }
+    EXPECT_NEAR(steps, 100, 1);
+}
+
+TEST(StepController, MaxThroughputPresentsAtTenFps)
+{
+    Diffusion::StepController controller;
+    controller.Configure(Diffusion::PacingMode::MaxThroughput, 0.0);
+    const Clock::time_point t0 = Clock::now();
+
+    int presented = 0;
+    for (int ms = 5; ms <= 1000; ms += 5)
+    {
+        const Clock::time_point now = t0 + milliseconds(ms);
+        EXPECT_TRUE(controller.MayStep(now));
+        // Steps of 5 ms, the one ending at or past the 100 ms deadline is shown
+        EXPECT_EQ(controller.WillPresent(now - milliseconds(5)), ms % 100 == 0) << ms;
+        if (controller.StepDone(now, 5.0))
+        {
+            presented++;
+            controller.FramePresented(now);
+        }
+        EXPECT_LE(controller.WakeAt(now), now + milliseconds(100));
+    }
+    EXPECT_EQ(presented, 10);
+    EXPECT_EQ(controller.StepsPerFrame(), 1);
+}
@@ -0,0 +1,159 @@
+// Cost of a log call on the calling thread and throughput of the log thread,
+// with one to many threads logging at once. A burst fits in the rings, so it
+// times the call alone; the sustained run overflows them and waits for the log
+// thread to format. The runtime case passes the format as a string, like
+// Logger::Info, instead of compiling it. The format case formats on the caller,
+// like logging did before the log thread.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "Utils/LogFile.h"
+#include "Utils/Logger.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	std::vector<int> threads = {1, 2, 4, 8};
+	int messages = 200000; // Per thread
+	int burst = 256;	   // Calls between flushes in the burst case
+	std::string file;	   // Structured log the log thread writes too
+};
+
+static double elapsedNs(Clock::time_point since)
+{
+	return std::chrono::duration<double, std::nano>(Clock::now() - since).count();
+}
+
+// Runs `body(thread, calls)` on `threads` threads at once, returns the ns the slowest took per call
+template <class Body>
+static double perCall(int threads, int calls, Body body)
+{
+	std::vector<double> ns(threads);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++)
+		workers.emplace_back([&, t] { ns[t] = body(t, calls) / calls; });
+	for (auto &worker : workers)
+		worker.join();
+	return *std::max_element(ns.begin(), ns.end());
+}
+
+static void logOne(int thread, int i)
+{
+	LOG_INFO("thread {} step {} residual {:.6f} in {}", thread, i, i * 1e-3, "bench");
+}
+
+static void logRuntime(int thread, int i)
+{
+	Util::Logger::Info("thread {} step {} residual {:.6f} in {}", thread, i, i * 1e-3, "bench");
+}
+
+// Calls `log` in bursts that fit the ring, the flushes between them aren't timed
+template <class Log>
+static double burstPerCall(int threads, const Options &options, Log log)
+{
+	const double ns = perCall(threads, options.messages, [&](int thread, int calls) {
+		double ns = 0.0;
+		for (int i = 0; i < calls; i += options.burst)
+		{
+			const int end = std::min(calls, i + options.burst);
+			const auto start = Clock::now();
+			for (int j = i; j < end; j++)
+				log(thread, j);
+			ns += elapsedNs(start);
+			Util::Logger::Flush();
+		}
+		return ns;
+	});
+	Util::Logger::ClearBuffer();
+	return ns;
+}
+
+static void helpMessage()
+{
+	fmt::print("Usage:\n");
+	fmt::print("LoggerBench.exe [*Options*]\n");
+	fmt::print("* Options:\n");
+	fmt::print("\t- threads: Comma separated thread counts, Default: 1,2,4,8\n");
+	fmt::print("\t- messages: Messages per thread, Default: 200000\n");
+	fmt::print("\t- burst: Calls between flushes in the burst case, Default: 256\n");
+	fmt::print("\t- file: Path of a structured log written as well, Default: None\n");
+}
+
+int main(int argc, const char *argv[])
+{
+	Options options;
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--help" || i + 1 >= argc)
+		{
+			helpMessage();
+			return arg == "--help" ? 0 : 1;
+		}
+		const std::string value = argv[++i];
+		if (arg == "--threads")
+		{
+			options.threads.clear();
+			for (size_t start = 0; start < value.size();)
+			{
+				size_t end = std::min(value.find(',', start), value.size());
+				options.threads.push_back(std::max(1, std::stoi(value.substr(start, end - start))));
+				start = end + 1;
+			}
+		}
+		else if (arg == "--messages")
+			options.messages = std::max(1, std::stoi(value));
+		else if (arg == "--burst")
+			options.burst = std::max(1, std::stoi(value));
+		else if (arg == "--file")
+			options.file = value;
+		else
+		{
+			helpMessage();
+			return 1;
+		}
+	}
+
+	// The console would time the terminal, the window buffer still takes every line
+	Util::Logger::console = false;
+	if (!options.file.empty() && !Util::Logger::OpenFile(options.file, Util::LogFileOptions{}))
+		return 1;
+	fmt::print("{:>7} {:>14} {:>15} {:>14} {:>14} {:>14}\n", "threads", "burst ns/call", "runtime ns/call", "format ns/call",
+			   "sustained ns", "lines/s");
+	for (int threads : options.threads)
+	{
+		const double burst = burstPerCall(threads, options, logOne);
+		const double runtime = burstPerCall(threads, options, logRuntime);
+
+		const double format = perCall(threads, options.messages, [&](int thread, int calls) {
+			size_t bytes = 0;
+			const auto start = Clock::now();
+			for (int i = 0; i < calls; i++)
+				bytes += fmt::format("[Info] thread {} step {} residual {:.6f} in {}\n", thread, i, i * 1e-3, "bench").size();
+			const double ns = elapsedNs(start);
+			return bytes ? ns : 0.0;
+		});
+
+		const auto start = Clock::now();
+		perCall(threads, options.messages, [&](int thread, int calls) {
+			for (int i = 0; i < calls; i++)
+				logOne(thread, i);
+			return 0.0;
+		});
+		Util::Logger::Flush();
+		const double sustained = elapsedNs(start) / (double(threads) * options.messages);
+		Util::Logger::ClearBuffer();
+
+		fmt::print("{:>7} {:>14.1f} {:>15.1f} {:>14.1f} {:>14.1f} {:>14.0f}\n", threads, burst, runtime, format, sustained,
+				   1e9 / sustained);
+	}
+	return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Util
+{
+	// Appends the zlib stream (RFC 1950) of `data` to `out`: LZ77 over a 32 KiB
+	// window with hash chains and lazy matching, dynamic Huffman blocks (RFC 1951),
+	// stored blocks where that's smaller. `effort` is the longest hash chain
+	// followed, more compresses better and slower. Each call is independent, so
+	// separate buffers compress in parallel.
+	void ZlibCompress(const uint8_t *data, size_t size, std::vector<uint8_t> &out, int effort = 32);
+
+	// The raw deflate blocks of `data` without the zlib header and checksum. With
+	// `last` false the stream is left open on a byte boundary, so pieces compressed
+	// separately (in parallel) concatenate into one stream, the final piece `last`.
+	// Matches don't reach back into earlier pieces.
+	void Deflate(const uint8_t *data, size_t size, std::vector<uint8_t> &out, bool last, int effort = 32);
+
+	// Adler-32 as zlib computes it. Pass the previous result as `adler` to checksum data in pieces.
+	uint32_t Adler32(const void *data, size_t size, uint32_t adler = 1);
+	// The Adler-32 of two pieces one after the other, from the checksum of each
+	uint32_t Adler32Combine(uint32_t first, uint32_t second, uint64_t secondSize);
+}
@@ -30,4 +30,7 @@ namespace Util
 
 	bool IsInteger(const char *value);
 	uint32_t GetInteger(const char *imm, uint32_t size);
+
+	// Resident set size of this process in bytes, 0 when it can't be queried.
+	uint64_t GetResidentMemory();
 }
\ No newline at end of file
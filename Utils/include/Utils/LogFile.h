@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Utils/Logger.h"
+#include "Utils/MappedFile.h"
+
+namespace Util
+{
+	constexpr uint32_t LOG_FILE_VERSION = 1;
+
+	// A log file is this header, then records of LogFileRecord, the message and
+	// the fields, each padded to 8 bytes. A field is its type, the length of its
+	// name, the name, then 8 bytes of value or, for strings, a 32 bit length and
+	// the text. `usedBytes` grows after every record, so after a crash the file
+	// still reads up to the last complete record.
+	struct LogFileHeader
+	{
+		char magic[4]; // "RDLG"
+		uint32_t version;
+		uint32_t headerSize;
+		uint32_t reserved;
+		uint64_t usedBytes; // Header included
+		int64_t created;	// Nanoseconds since the Unix epoch
+	};
+	static_assert(sizeof(LogFileHeader) == 32, "The log file header is part of the file format");
+
+	struct LogFileRecord
+	{
+		uint32_t size; // Header, message and fields, padded
+		uint32_t thread;
+		int64_t time; // Nanoseconds since the Unix epoch
+		uint64_t sequence;
+		uint32_t messageBytes;
+		uint8_t level; // Logger::Level
+		uint8_t fields;
+		uint16_t reserved;
+	};
+	static_assert(sizeof(LogFileRecord) == 32, "The log file record is part of the file format");
+
+	struct LogFileOptions
+	{
+		uint64_t rotateBytes = 64ull << 20; // A new file starts when a record doesn't fit
+		int keep = 4;						// Rotated files kept as path.1 (newest) to path.keep
+	};
+
+	// Writes records into a mapped file, the page cache takes them to disk in
+	// the background. Full files rotate, and so does a file left at the path
+	// when it's opened.
+	class LogFile
+	{
+	public:
+		LogFile() = default;
+		~LogFile();
+
+		LogFile(const LogFile &) = delete;
+		LogFile &operator=(const LogFile &) = delete;
+
+		bool Open(const std::string &path, const LogFileOptions &options);
+		bool Write(int64_t time, uint64_t sequence, uint32_t thread, Logger::Level level, std::string_view message,
+				   const std::vector<LogDetail::LogField> &fields);
+		void Close();
+		inline bool IsOpen() const { return m_File.IsOpen(); }
+
+	private:
+		bool create(uint64_t size);
+		bool rotate(uint64_t size);
+
+		MappedFile m_File;
+		std::string m_Path;
+		LogFileOptions m_Options;
+		uint64_t m_Used = 0;
+	};
+
+	struct LogEntry
+	{
+		int64_t time = 0;
+		uint64_t sequence = 0;
+		uint32_t thread = 0;
+		Logger::Level level = Logger::Level::Info;
+		std::string_view message;
+		std::vector<LogDetail::LogField> fields; // Names and texts point into the file
+	};
+
+	// Reads the records of one file in order
+	class LogFileReader
+	{
+	public:
+		bool Open(const std::string &path);
+		// False at the end of the file or at a corrupted record
+		bool Next(LogEntry &entry);
+		inline bool Corrupted() const { return m_Corrupted; }
+
+	private:
+		MappedFile m_File;
+		uint64_t m_Used = 0;
+		uint64_t m_Offset = 0;
+		bool m_Corrupted = false;
+	};
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "imgui.h"
+
+// The Logger window's lines and the index of those passing its filter
+namespace Util
+{
+	namespace LogDetail
+	{
+		// The window's lines, the oldest go once there are LINES of them or their
+		// text would overflow TEXT_BYTES. A line is numbered by how many came before
+		// it and its text is contiguous, like the records of the thread rings.
+		class LineRing
+		{
+		public:
+			static constexpr uint64_t LINES = 1 << 14;
+			static constexpr uint64_t TEXT_BYTES = 1 << 21;
+			// Longer lines are cut, no line may take a large part of the text
+			static constexpr uint64_t MAX_LINE = 4096;
+
+			struct Line
+			{
+				uint64_t start; // Bytes of text ever written before it
+				uint32_t size;
+				int color;
+			};
+
+			void Push(std::string_view text, int color)
+			{
+				const uint64_t size = std::min<uint64_t>(text.size(), MAX_LINE);
+				const uint64_t left = TEXT_BYTES - m_TextHead % TEXT_BYTES;
+				const uint64_t start = m_TextHead + (size > left ? left : 0);
+				const uint64_t end = start + size;
+				while (m_First < m_Next && (m_Next - m_First == LINES || (end > TEXT_BYTES && m_Lines[m_First % LINES].start < end - TEXT_BYTES)))
+					m_First++;
+				std::memcpy(&m_Text[start % TEXT_BYTES], text.data(), size);
+				m_Lines[m_Next % LINES] = {start, (uint32_t)size, color};
+				m_Next++;
+				m_TextHead = end;
+			}
+
+			void Clear() { m_First = m_Next; }
+
+			inline uint64_t First() const { return m_First; }
+			inline uint64_t Next() const { return m_Next; }
+			inline const Line &At(uint64_t line) const { return m_Lines[line % LINES]; }
+			inline const char *Text(const Line &line) const { return &m_Text[line.start % TEXT_BYTES]; }
+
+		private:
+			std::unique_ptr<char[]> m_Text{new char[TEXT_BYTES]};
+			std::unique_ptr<Line[]> m_Lines{new Line[LINES]};
+			uint64_t m_First = 0;
+			uint64_t m_Next = 0;
+			uint64_t m_TextHead = 0;
+		};
+
+		// Lines passing the window's filter, brought up to date as lines come and
+		// go, rebuilt only when the filter changes
+		struct FilterIndex
+		{
+			std::vector<uint64_t> lines; // From `start` on, ascending
+			size_t start = 0;
+			uint64_t indexedTo = 0; // Lines before it were tested
+			std::string filter;
+
+			void Update(const ImGuiTextFilter &textFilter, const LineRing &ring)
+			{
+				if (filter != textFilter.InputBuf)
+				{
+					filter = textFilter.InputBuf;
+					lines.clear();
+					start = 0;
+					indexedTo = ring.First();
+				}
+				// Evicted lines leave from the front, compacted once they are half of it
+				while (start < lines.size() && lines[start] < ring.First())
+					start++;
+				if (start > lines.size() / 2)
+				{
+					lines.erase(lines.begin(), lines.begin() + start);
+					start = 0;
+				}
+				for (uint64_t line = std::max(indexedTo, ring.First()); line < ring.Next(); line++)
+				{
+					const char *text = ring.Text(ring.At(line));
+					if (textFilter.PassFilter(text, text + ring.At(line).size))
+						lines.push_back(line);
+				}
+				indexedTo = ring.Next();
+			}
+
+			inline size_t Size() const { return lines.size() - start; }
+			inline uint64_t operator[](size_t i) const { return lines[start + i]; }
+		};
+	}
+}
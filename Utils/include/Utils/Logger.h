@@ -1,134 +1,409 @@
 #pragma once
 
+#include <cstdint>
+#include <cstring>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
 #include <fmt/core.h>
 #include <fmt/color.h>
+#include <fmt/compile.h>
 
 #include "imgui.h"
 
 #define COLOR(str) fmt::color::str
 
+// Lowest level compiled in, see Logger::Level: 0 keeps every line, 5 only errors.
+// Lines below it compile to nothing, their arguments aren't even evaluated.
+#ifndef UTIL_LOG_LEVEL
+#ifdef NDEBUG
+#define UTIL_LOG_LEVEL 1
+#else
+#define UTIL_LOG_LEVEL 0
+#endif
+#endif
+
 namespace Util
 {
+	struct LogFileOptions;
+
+	namespace LogDetail
+	{
+		// How an argument travels through the ring: written by the calling thread,
+		// read back by the log thread as `Decoded` and formatted there. Types
+		// without a specialization are formatted by the caller instead.
+		template <class T, class = void>
+		struct LogArg
+		{
+			static constexpr bool deferred = false;
+		};
+
+		template <class T>
+		struct LogArg<T, std::enable_if_t<std::is_arithmetic_v<T>>>
+		{
+			static constexpr bool deferred = true;
+			using Decoded = T;
+
+			inline static size_t Size(const T &) { return sizeof(T); }
+			inline static char *Write(char *out, const T &value)
+			{
+				std::memcpy(out, &value, sizeof(T));
+				return out + sizeof(T);
+			}
+			inline static T Read(const char *&in)
+			{
+				T value;
+				std::memcpy(&value, in, sizeof(T));
+				in += sizeof(T);
+				return value;
+			}
+		};
+
+		// Strings are copied, the caller's may be gone by the time it's formatted
+		struct LogString
+		{
+			static constexpr bool deferred = true;
+			using Decoded = std::string_view;
+
+			inline static size_t Size(std::string_view text) { return sizeof(uint32_t) + text.size(); }
+			inline static char *Write(char *out, std::string_view text)
+			{
+				const uint32_t size = (uint32_t)text.size();
+				std::memcpy(out, &size, sizeof(size));
+				std::memcpy(out + sizeof(size), text.data(), size);
+				return out + sizeof(size) + size;
+			}
+			inline static std::string_view Read(const char *&in)
+			{
+				uint32_t size;
+				std::memcpy(&size, in, sizeof(size));
+				const std::string_view text(in + sizeof(size), size);
+				in += sizeof(size) + size;
+				return text;
+			}
+		};
+
+		template <>
+		struct LogArg<std::string> : LogString {};
+		template <>
+		struct LogArg<std::string_view> : LogString {};
+		template <>
+		struct LogArg<const char *> : LogString {};
+		template <>
+		struct LogArg<char *> : LogString {};
+
+		template <class Decoded>
+		struct NamedValue
+		{
+			const char *name;
+			Decoded value;
+		};
+
+		// fmt::arg("step", step), the name becomes the name of the field
+		template <class T>
+		struct LogArg<fmt::detail::named_arg<char, T>, std::enable_if_t<LogArg<std::decay_t<T>>::deferred>>
+		{
+			using Value = LogArg<std::decay_t<T>>;
+			static constexpr bool deferred = true;
+			using Decoded = NamedValue<typename Value::Decoded>;
+
+			// The name is stored with its terminator, fmt wants a C string
+			inline static size_t Size(const fmt::detail::named_arg<char, T> &arg)
+			{
+				return LogString::Size(arg.name) + 1 + Value::Size(arg.value);
+			}
+			inline static char *Write(char *out, const fmt::detail::named_arg<char, T> &arg)
+			{
+				out = LogString::Write(out, std::string_view(arg.name, std::strlen(arg.name) + 1));
+				return Value::Write(out, arg.value);
+			}
+			inline static Decoded Read(const char *&in)
+			{
+				const char *name = LogString::Read(in).data();
+				return {name, Value::Read(in)};
+			}
+		};
+
+		template <class Decoded>
+		inline const Decoded &Unwrap(const Decoded &value) { return value; }
+		template <class Decoded>
+		inline auto Unwrap(const NamedValue<Decoded> &named) { return fmt::arg(named.name, named.value); }
+
+		// The arguments of a line as typed fields, for the structured log file
+		enum class FieldType : uint8_t
+		{
+			Int,
+			UInt,
+			Float,
+			Bool,
+			Char,
+			String
+		};
+
+		struct LogField
+		{
+			std::string_view name; // Set for named arguments
+			FieldType type = FieldType::Int;
+			union
+			{
+				int64_t i;
+				uint64_t u;
+				double f;
+			};
+			std::string_view text;
+		};
+
+		template <class Decoded>
+		LogField MakeField(const Decoded &value)
+		{
+			LogField field;
+			field.u = 0;
+			if constexpr (std::is_same_v<Decoded, std::string_view>)
+			{
+				field.type = FieldType::String;
+				field.text = value;
+			}
+			else if constexpr (std::is_same_v<Decoded, bool>)
+			{
+				field.type = FieldType::Bool;
+				field.u = value;
+			}
+			else if constexpr (std::is_same_v<Decoded, char>)
+			{
+				field.type = FieldType::Char;
+				field.u = (unsigned char)value;
+			}
+			else if constexpr (std::is_floating_point_v<Decoded>)
+			{
+				field.type = FieldType::Float;
+				field.f = (double)value;
+			}
+			else if constexpr (std::is_signed_v<Decoded>)
+			{
+				field.type = FieldType::Int;
+				field.i = (int64_t)value;
+			}
+			else
+			{
+				field.type = FieldType::UInt;
+				field.u = (uint64_t)value;
+			}
+			return field;
+		}
+
+		template <class Decoded>
+		LogField MakeField(const NamedValue<Decoded> &named)
+		{
+			LogField field = MakeField(named.value);
+			field.name = named.name;
+			return field;
+		}
+
+		// Formats the line into `out` and, when asked for, lists the arguments in `fields`
+		using DecodeFn = void (*)(const char *payload, fmt::memory_buffer &out, std::vector<LogField> *fields);
+
+		// A runtime format string is stored in front of the arguments
+		template <class... Stored>
+		void Decode(const char *payload, fmt::memory_buffer &out, std::vector<LogField> *fields)
+		{
+			const std::string_view format = LogString::Read(payload);
+			// Braced initialization reads the arguments in order
+			const std::tuple<typename LogArg<Stored>::Decoded...> args{LogArg<Stored>::Read(payload)...};
+			std::apply([&](const auto &...values) {
+				if (fields)
+					(fields->push_back(MakeField(values)), ...);
+				fmt::vformat_to(fmt::appender(out), format, fmt::make_format_args(Unwrap(values)...));
+			}, args);
+		}
+
+		// A compiled one is part of the decoder, the payload holds the arguments only
+		template <class Format, class... Stored>
+		void DecodeCompiled([[maybe_unused]] const char *payload, fmt::memory_buffer &out, std::vector<LogField> *fields)
+		{
+			const std::tuple<typename LogArg<Stored>::Decoded...> args{LogArg<Stored>::Read(payload)...};
+			std::apply([&](const auto &...values) {
+				if (fields)
+					(fields->push_back(MakeField(values)), ...);
+				fmt::format_to(fmt::appender(out), Format(), Unwrap(values)...);
+			}, args);
+		}
+	}
+
+	// Log calls only copy their arguments into a ring of the calling thread, the
+	// formatting and the console and window output happen on a log thread. A call
+	// costs tens of nanoseconds and is safe from any thread. Lines of one thread
+	// keep their order, lines of different threads are ordered by when they were
+	// logged, except that a line still being written when the log thread passes
+	// comes after the lines committed meanwhile.
+	//
+	// LOG_INFO("{} cells", count) and the other macros below check the format at
+	// compile time and compile it, Info() and the like take formats only known at
+	// run time.
 	class Logger
 	{
 	public:
+		// Ordered by severity
+		enum class Level : uint8_t
+		{
+			Debug,
+			Info,
+			Print,
+			Success,
+			Warning,
+			Error
+		};
+		static constexpr Level COMPILED_LEVEL = (Level)UTIL_LOG_LEVEL;
+		// Bytes of each thread's ring, a line longer than half of it is written by its caller
+		static constexpr uint64_t RING_BYTES = 1 << 16;
+
 		template <class... ArgsType>
 		inline static void Debug(std::string_view fmt, ArgsType &&...args)
 		{
-			if (enabled)
-			{
-				int oldSize = m_Buf.size();
-				int color = 0xFFFFFFFF;
-				
-				std::string msg = fmt::format(fmt, std::forward<ArgsType>(args)...);
-				msg = fmt::format("{}{}\n", "[Debug] ", msg);
-				fmt::print(fg(fmt::color::white), "{}", msg);
-				
-				m_Buf.append(msg.c_str());
-				AddOffset(oldSize, color);
-			}
+			Log<Level::Debug>(fmt, std::forward<ArgsType>(args)...);
 		}
 
 		template <class... ArgsType>
 		inline static void Info(std::string_view fmt, ArgsType &&...args)
 		{
-			if (enabled)
-			{
-				int oldSize = m_Buf.size();
-				int color = 0xFFee0000;
-				
-				std::string msg = fmt::format(fmt, std::forward<ArgsType>(args)...);
-				msg = fmt::format("{}{}\n", "[Info] ", msg);
-				fmt::print(fg(fmt::color::sky_blue), "{}", msg);
-
-				m_Buf.append(msg.c_str());
-				AddOffset(oldSize, color);
-			}
+			Log<Level::Info>(fmt, std::forward<ArgsType>(args)...);
 		}
 
 		template <class... ArgsType>
 		inline static void Error(std::string_view fmt, ArgsType &&...args)
 		{
-			if (enabled)
-			{
-				int oldSize = m_Buf.size();
-				int color = 0xFF0000FF;
-				
-				std::string msg = fmt::format(fmt, std::forward<ArgsType>(args)...);
-				msg = fmt::format("{}{}\n", "[Error] ", msg);
-				fmt::print(fg(fmt::color::red), "{}", msg);
-				
-				m_Buf.append(msg.c_str());
-				AddOffset(oldSize, color);
-			}
+			Log<Level::Error>(fmt, std::forward<ArgsType>(args)...);
 		}
 
 		template <class... ArgsType>
 		inline static void Success(std::string_view fmt, ArgsType &&...args)
 		{
-			if (enabled)
-			{
-				int oldSize = m_Buf.size();
-				int color = 0xFF00FF00;
-
-				std::string msg = fmt::format(fmt, std::forward<ArgsType>(args)...);
-				msg = fmt::format("{}{}\n", "[Success] ", msg);
-				fmt::print(fg(fmt::color::green), "{}", msg);
-				
-				m_Buf.append(msg.c_str());
-				AddOffset(oldSize, color);
-			}
+			Log<Level::Success>(fmt, std::forward<ArgsType>(args)...);
 		}
 
 		template <class... ArgsType>
 		inline static void Warning(std::string_view fmt, ArgsType &&...args)
 		{
-			if (enabled)
-			{
-				int oldSize = m_Buf.size();
-				int color = 0xFF00FFFF;
-
-				std::string msg = fmt::format(fmt, std::forward<ArgsType>(args)...);
-				msg = fmt::format("{}{}\n", "[Warning] ", msg);
-				fmt::print(fg(fmt::color::yellow), "{}", msg);
-
-				m_Buf.append(msg.c_str());
-				AddOffset(oldSize, color);
-			}
+			Log<Level::Warning>(fmt, std::forward<ArgsType>(args)...);
 		}
 
 		template <class... ArgsType>
 		inline static void Print(std::string_view fmt, ArgsType &&...args)
 		{
-			if (enabled)
-			{
-				int oldSize = m_Buf.size();
-				int color = 0xFFFFFFFF;
-
-				std::string msg = fmt::format(fmt, std::forward<ArgsType>(args)...);
-				msg = fmt::format("{}{}\n", "[Print] ", msg);
-				fmt::print(fg(fmt::color::white), "{}", msg);
+			Log<Level::Print>(fmt, std::forward<ArgsType>(args)...);
+		}
 
-				m_Buf.append(msg.c_str());
-				AddOffset(oldSize, color);
+		// `fmt` is a runtime format string or one made by FMT_COMPILE
+		template <Level level, class Format, class... ArgsType>
+		static void Log(const Format &fmt, ArgsType &&...args)
+		{
+			constexpr bool compiled = fmt::detail::is_compiled_string<Format>::value;
+			if constexpr (level < COMPILED_LEVEL)
+				return;
+			else if constexpr ((LogDetail::LogArg<std::decay_t<ArgsType>>::deferred && ...))
+			{
+				if (!enabled)
+					return;
+				using LogDetail::LogArg;
+				size_t bytes = (LogArg<std::decay_t<ArgsType>>::Size(args) + ... + 0);
+				if constexpr (!compiled)
+					bytes += LogDetail::LogString::Size(fmt);
+				char *out;
+				if constexpr (compiled)
+					out = Begin(level, bytes, &LogDetail::DecodeCompiled<Format, std::decay_t<ArgsType>...>);
+				else
+					out = Begin(level, bytes, &LogDetail::Decode<std::decay_t<ArgsType>...>);
+				if (!out)
+				{
+					// No log thread or too long for the ring
+					Write(level, format(fmt, std::forward<ArgsType>(args)...));
+					return;
+				}
+				if constexpr (!compiled)
+					out = LogDetail::LogString::Write(out, fmt);
+				((out = LogArg<std::decay_t<ArgsType>>::Write(out, args)), ...);
+				Commit();
 			}
+			else if (enabled)
+				Log<level>(FMT_COMPILE("{}"), format(fmt, std::forward<ArgsType>(args)...));
 		}
 
+		// Lines from `minimum` on also go to a structured binary log, see LogFile
+		static bool OpenFile(const std::string &path, const LogFileOptions &options, Level minimum = Level::Debug);
+		static void CloseFile();
+		static const char *LevelName(Level level);
+
+		// Returns once every line logged before the call is on the console, in the window and in the file
+		static void Flush();
+		// Stops the log thread after writing what's left, later lines are written by their caller
+		static void Shutdown();
+
 		static void ClearBuffer();
+		// The window keeps the latest lines only, up to a fixed number and size
 		static void Draw(std::string_view title, bool *p_open = nullptr, ImGuiWindowFlags flags = ImGuiWindowFlags_None);
 		static bool enabled;
+		static bool console; // Lines go to stdout too
 
 	private:
-		static void AddOffset(int oldSize, int color);
-		inline Logger() { ClearBuffer(); }
+		template <class Format, class... ArgsType>
+		inline static std::string format(const Format &fmt, ArgsType &&...args)
+		{
+			if constexpr (fmt::detail::is_compiled_string<Format>::value)
+				return fmt::format(fmt, std::forward<ArgsType>(args)...);
+			else
+				return fmt::format(fmt::runtime(fmt), std::forward<ArgsType>(args)...);
+		}
+
+		static char *Begin(Level level, size_t payloadBytes, LogDetail::DecodeFn decode);
+		static void Commit();
+		static void Write(Level level, std::string_view message);
+		static void Run();
+		static uint64_t Drain(fmt::memory_buffer &line);
+		static void Output(Level level, std::string_view line);
+		Logger();
+		~Logger();
 		static Logger s_Instance;
-		static ImGuiTextBuffer m_Buf;
 		static ImGuiTextFilter m_Filter;
-		static ImVector<int> m_LineOffsets; // Index to lines offset. We maintain this with AddLog() calls.
-		static ImVector<int> m_Colors;
 		static bool m_AutoScroll;
 	};
-}
\ No newline at end of file
+}
+
+// Compile time checked and compiled formats, lines below UTIL_LOG_LEVEL vanish
+#define LOG_DEBUG(FORMAT, ...)                                                                         \
+	do                                                                                                 \
+	{                                                                                                  \
+		if constexpr (Util::Logger::Level::Debug >= Util::Logger::COMPILED_LEVEL)                      \
+			Util::Logger::Log<Util::Logger::Level::Debug>(FMT_COMPILE(FORMAT), ##__VA_ARGS__);         \
+	} while (0)
+#define LOG_INFO(FORMAT, ...)                                                                          \
+	do                                                                                                 \
+	{                                                                                                  \
+		if constexpr (Util::Logger::Level::Info >= Util::Logger::COMPILED_LEVEL)                       \
+			Util::Logger::Log<Util::Logger::Level::Info>(FMT_COMPILE(FORMAT), ##__VA_ARGS__);          \
+	} while (0)
+#define LOG_PRINT(FORMAT, ...)                                                                         \
+	do                                                                                                 \
+	{                                                                                                  \
+		if constexpr (Util::Logger::Level::Print >= Util::Logger::COMPILED_LEVEL)                      \
+			Util::Logger::Log<Util::Logger::Level::Print>(FMT_COMPILE(FORMAT), ##__VA_ARGS__);         \
+	} while (0)
+#define LOG_SUCCESS(FORMAT, ...)                                                                       \
+	do                                                                                                 \
+	{                                                                                                  \
+		if constexpr (Util::Logger::Level::Success >= Util::Logger::COMPILED_LEVEL)                    \
+			Util::Logger::Log<Util::Logger::Level::Success>(FMT_COMPILE(FORMAT), ##__VA_ARGS__);       \
+	} while (0)
+#define LOG_WARNING(FORMAT, ...)                                                                       \
+	do                                                                                                 \
+	{                                                                                                  \
+		if constexpr (Util::Logger::Level::Warning >= Util::Logger::COMPILED_LEVEL)                    \
+			Util::Logger::Log<Util::Logger::Level::Warning>(FMT_COMPILE(FORMAT), ##__VA_ARGS__);       \
+	} while (0)
+#define LOG_ERROR(FORMAT, ...)                                                                         \
+	do                                                                                                 \
+	{                                                                                                  \
+		if constexpr (Util::Logger::Level::Error >= Util::Logger::COMPILED_LEVEL)                      \
+			Util::Logger::Log<Util::Logger::Level::Error>(FMT_COMPILE(FORMAT), ##__VA_ARGS__);         \
+	} while (0)
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace Util
+{
+	// Memory mapping of a whole file, mmap on POSIX and CreateFileMapping on Windows.
+	class MappedFile
+	{
+	public:
+		enum class Access
+		{
+			ReadOnly,    // Shared read-only view
+			CopyOnWrite, // Writable private view, writes never reach the file
+			ReadWrite    // Writable shared view, writes end up in the file
+		};
+
+		enum class Advice
+		{
+			WillNeed, // Start reading the range in the background
+			DontNeed  // Drop the range from the working set, shared dirty pages are still written back
+		};
+
+		MappedFile() = default;
+		~MappedFile();
+
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+		MappedFile(MappedFile &&other) noexcept;
+		MappedFile &operator=(MappedFile &&other) noexcept;
+
+		// Maps an existing file, pages are loaded lazily on first touch.
+		bool Open(const std::string &path, Access access);
+		// Creates (or truncates) a file of the given size and maps it ReadWrite.
+		bool Create(const std::string &path, uint64_t size);
+		// Writes dirty pages of the range back to the file, the whole file when length is 0.
+		// With `wait` false the write back is only scheduled.
+		bool Flush(uint64_t offset = 0, uint64_t length = 0, bool wait = true);
+		// Paging hint for a range, a no-op where the platform has no equivalent.
+		void Advise(uint64_t offset, uint64_t length, Advice advice);
+		void Close();
+
+		inline uint8_t *Data() const { return m_Data; }
+		inline uint64_t Size() const { return m_Size; }
+		inline bool IsOpen() const { return m_Data != nullptr; }
+
+	private:
+		void Swap(MappedFile &other) noexcept;
+
+		uint8_t *m_Data = nullptr;
+		uint64_t m_Size = 0;
+#ifdef _WIN32
+		void *m_File = nullptr;
+		void *m_Mapping = nullptr;
+#else
+		int m_Fd = -1;
+#endif
+	};
+}
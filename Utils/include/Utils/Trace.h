@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace Util
+{
+	// Scoped timing events written as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+	// Every thread records into its own ring of the last CAPACITY events, so recording
+	// takes no lock. While disabled a scope costs one relaxed load.
+	class Trace
+	{
+	public:
+		static constexpr uint32_t CAPACITY = 1 << 16;
+
+		static void Enable(bool enabled);
+		inline static bool Enabled() { return s_Enabled.load(std::memory_order_relaxed); }
+
+		// Nanoseconds since the first call
+		static uint64_t Now();
+		// `name` must outlive the trace, in practice a string literal.
+		static void Record(const char *name, uint64_t start, uint64_t end);
+		// Shown as the track name of the calling thread.
+		static void SetThreadName(const std::string &name);
+		// Writes what the rings hold. Events being recorded meanwhile may be missed.
+		static bool Write(const std::string &path);
+
+	private:
+		static std::atomic<bool> s_Enabled;
+	};
+
+	class TraceScope
+	{
+	public:
+		inline explicit TraceScope(const char *name)
+			: m_Name(name), m_Active(Trace::Enabled())
+		{
+			if (m_Active)
+				m_Start = Trace::Now();
+		}
+
+		inline ~TraceScope()
+		{
+			if (m_Active)
+				Trace::Record(m_Name, m_Start, Trace::Now());
+		}
+
+		TraceScope(const TraceScope &) = delete;
+		TraceScope &operator=(const TraceScope &) = delete;
+
+	private:
+		const char *m_Name;
+		uint64_t m_Start = 0;
+		bool m_Active;
+	};
+}
+
+#define TRACE_CONCAT_IMPL(A, B) A##B
+#define TRACE_CONCAT(A, B) TRACE_CONCAT_IMPL(A, B)
+#define TRACE_SCOPE(NAME) Util::TraceScope TRACE_CONCAT(traceScope_, __LINE__)(NAME)
@@ -0,0 +1,54 @@
+#include "Utils/Checksum.h"
+
+#include <cstring>
+
+namespace
+{
+	// Slicing-by-8 tables, table[0] is the classic byte-wise table
+	struct Crc32Tables
+	{
+		uint32_t table[8][256];
+
+		Crc32Tables()
+		{
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				uint32_t crc = i;
+				for (int k = 0; k < 8; k++)
+					crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+				table[0][i] = crc;
+			}
+			for (uint32_t i = 0; i < 256; i++)
+				for (int t = 1; t < 8; t++)
+					table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+		}
+	};
+
+	const Crc32Tables s_Tables;
+}
+
+namespace Util
+{
+	uint32_t Crc32(const void *data, size_t size, uint32_t crc)
+	{
+		const auto &t = s_Tables.table;
+		const uint8_t *p = (const uint8_t *)data;
+		crc = ~crc;
+
+		while (size >= 8)
+		{
+			uint32_t lo, hi;
+			std::memcpy(&lo, p, 4);
+			std::memcpy(&hi, p + 4, 4);
+			lo ^= crc;
+			crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+				  t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+			p += 8;
+			size -= 8;
+		}
+		while (size--)
+			crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+
+		return ~crc;
+	}
+}
@@ -0,0 +1,509 @@
+#include "Utils/Deflate.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	constexpr int64_t WINDOW = 32768;
+	constexpr int MIN_MATCH = 3;
+	constexpr int MAX_MATCH = 258;
+	constexpr int HASH_BITS = 15;
+	constexpr size_t BLOCK_TOKENS = 1 << 16;
+	// Three byte matches further back than this usually cost more than the literals
+	constexpr int64_t TOO_FAR = 4096;
+	// A match this long isn't worth looking one byte further for a better one
+	constexpr int LAZY_LIMIT = 32;
+
+	const uint16_t LENGTH_BASE[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+									  31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+	const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+	const uint16_t DIST_BASE[30] = {1,	 2,	  3,   4,	5,	 7,	   9,	 13,   17,	 25,   33,	 49,   65,	  97,	 129,
+									193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+	const uint8_t DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+	const uint8_t CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+	struct CodeTables
+	{
+		uint8_t length[MAX_MATCH + 1]; // Length code minus 257, by match length
+		uint8_t nearDistance[256];	   // Distance code by distance - 1, up to 256
+		uint8_t farDistance[256];	   // Distance code by (distance - 1) >> 7, above 256
+
+		CodeTables()
+		{
+			for (int code = 0; code < 29; code++)
+				for (int match = LENGTH_BASE[code]; match < LENGTH_BASE[code] + (1 << LENGTH_EXTRA[code]) && match <= MAX_MATCH; match++)
+					length[match] = (uint8_t)code;
+			length[MAX_MATCH] = 28;
+			for (int code = 0; code < 30; code++)
+			{
+				for (int distance = DIST_BASE[code]; distance < DIST_BASE[code] + (1 << DIST_EXTRA[code]); distance++)
+				{
+					if (distance <= 256)
+						nearDistance[distance - 1] = (uint8_t)code;
+					else
+						farDistance[(distance - 1) >> 7] = (uint8_t)code;
+				}
+			}
+		}
+
+		inline int Distance(int distance) const
+		{
+			return distance <= 256 ? nearDistance[distance - 1] : farDistance[(distance - 1) >> 7];
+		}
+	};
+
+	const CodeTables s_Codes;
+
+	// A literal (distance 0, the byte in length) or a match
+	struct Token
+	{
+		uint16_t length;
+		uint16_t distance;
+	};
+
+	// Deflate packs bits from the least significant end of each byte
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(std::vector<uint8_t> &out) : m_Out(out) {}
+
+		inline void Put(uint32_t value, int bits)
+		{
+			m_Bits |= (uint64_t)value << m_Count;
+			m_Count += bits;
+			while (m_Count >= 8)
+			{
+				m_Out.push_back((uint8_t)m_Bits);
+				m_Bits >>= 8;
+				m_Count -= 8;
+			}
+		}
+
+		inline void Align()
+		{
+			if (m_Count > 0)
+				Put(0, 8 - m_Count);
+		}
+
+	private:
+		std::vector<uint8_t> &m_Out;
+		uint64_t m_Bits = 0;
+		int m_Count = 0;
+	};
+
+	// Huffman code lengths of at most `limit` bits, 0 for unused symbols. The code
+	// is always complete: fewer than two used symbols get two codes of one bit.
+	void buildLengths(const uint32_t *freq, int count, int limit, uint8_t *lengths)
+	{
+		std::fill_n(lengths, count, 0);
+		std::vector<int> symbols;
+		for (int s = 0; s < count; s++)
+			if (freq[s])
+				symbols.push_back(s);
+		if (symbols.size() < 2)
+		{
+			const int used = symbols.empty() ? 0 : symbols[0];
+			lengths[used] = 1;
+			lengths[used == 0 ? 1 : 0] = 1;
+			return;
+		}
+		std::stable_sort(symbols.begin(), symbols.end(), [&](int a, int b) { return freq[a] < freq[b]; });
+
+		// Two queue Huffman: leaves in frequency order, internal nodes in creation order
+		const int n = (int)symbols.size();
+		std::vector<uint64_t> weight(2 * n - 1);
+		std::vector<int> parent(2 * n - 1);
+		for (int i = 0; i < n; i++)
+			weight[i] = freq[symbols[i]];
+		int leaf = 0, node = n;
+		auto take = [&](int next) {
+			if (leaf < n && (node >= next || weight[leaf] <= weight[node]))
+				return leaf++;
+			return node++;
+		};
+		for (int next = n; next < 2 * n - 1; next++)
+		{
+			const int a = take(next);
+			const int b = take(next);
+			weight[next] = weight[a] + weight[b];
+			parent[a] = parent[b] = next;
+		}
+		std::vector<int> depth(2 * n - 1, 0);
+		int lengthCount[33] = {};
+		for (int i = 2 * n - 3; i >= 0; i--)
+			depth[i] = depth[parent[i]] + 1;
+		for (int i = 0; i < n; i++)
+			lengthCount[std::min(depth[i], limit)]++;
+
+		// Folding the deep codes into `limit` oversubscribes the code, lengthen
+		// shorter ones until it's exactly complete again
+		uint32_t total = 0;
+		for (int length = limit; length > 0; length--)
+			total += (uint32_t)lengthCount[length] << (limit - length);
+		while (total != (1u << limit))
+		{
+			lengthCount[limit]--;
+			for (int length = limit - 1; length > 0; length--)
+			{
+				if (lengthCount[length])
+				{
+					lengthCount[length]--;
+					lengthCount[length + 1] += 2;
+					break;
+				}
+			}
+			total--;
+		}
+
+		// The rarest symbols take the longest codes
+		int next = 0;
+		for (int length = limit; length > 0; length--)
+			for (int k = 0; k < lengthCount[length]; k++)
+				lengths[symbols[next++]] = (uint8_t)length;
+	}
+
+	// Canonical codes (RFC 1951 3.2.2), bit reversed for BitWriter
+	void buildCodes(const uint8_t *lengths, int count, uint16_t *codes)
+	{
+		int lengthCount[16] = {};
+		for (int s = 0; s < count; s++)
+			lengthCount[lengths[s]]++;
+		lengthCount[0] = 0;
+		uint32_t nextCode[16] = {};
+		uint32_t code = 0;
+		for (int length = 1; length < 16; length++)
+		{
+			code = (code + lengthCount[length - 1]) << 1;
+			nextCode[length] = code;
+		}
+		for (int s = 0; s < count; s++)
+		{
+			const int length = lengths[s];
+			if (!length)
+				continue;
+			uint32_t value = nextCode[length]++, reversed = 0;
+			for (int bit = 0; bit < length; bit++)
+				reversed |= ((value >> bit) & 1) << (length - 1 - bit);
+			codes[s] = (uint16_t)reversed;
+		}
+	}
+
+	void writeStored(BitWriter &bits, const uint8_t *raw, size_t size, bool last, std::vector<uint8_t> &out)
+	{
+		do
+		{
+			const size_t chunk = std::min<size_t>(size, 65535);
+			size -= chunk;
+			bits.Put(last && size == 0 ? 1 : 0, 1);
+			bits.Put(0, 2);
+			bits.Align();
+			const uint16_t length = (uint16_t)chunk;
+			bits.Put(length, 16);
+			bits.Put((uint16_t)~length, 16);
+			out.insert(out.end(), raw, raw + chunk);
+			raw += chunk;
+		} while (size > 0);
+	}
+
+	void writeBlock(BitWriter &bits, const std::vector<Token> &tokens, const uint8_t *raw, size_t rawSize, bool last,
+					std::vector<uint8_t> &out)
+	{
+		uint32_t litFreq[286] = {}, distFreq[30] = {};
+		for (const Token &token : tokens)
+		{
+			if (token.distance == 0)
+				litFreq[token.length]++;
+			else
+			{
+				litFreq[257 + s_Codes.length[token.length]]++;
+				distFreq[s_Codes.Distance(token.distance)]++;
+			}
+		}
+		litFreq[256]++;
+
+		uint8_t litLengths[286], distLengths[30];
+		buildLengths(litFreq, 286, 15, litLengths);
+		buildLengths(distFreq, 30, 15, distLengths);
+		int hlit = 286, hdist = 30;
+		while (hlit > 257 && !litLengths[hlit - 1])
+			hlit--;
+		while (hdist > 1 && !distLengths[hdist - 1])
+			hdist--;
+
+		// Both length lists in one, run length coded with symbols 16 to 18
+		uint8_t all[286 + 30];
+		std::memcpy(all, litLengths, hlit);
+		std::memcpy(all + hlit, distLengths, hdist);
+		struct Run
+		{
+			uint8_t symbol, extraBits, extra;
+		};
+		std::vector<Run> runs;
+		const int total = hlit + hdist;
+		for (int i = 0; i < total;)
+		{
+			const uint8_t value = all[i];
+			int run = 1;
+			while (i + run < total && all[i + run] == value)
+				run++;
+			i += run;
+			if (value == 0)
+			{
+				for (; run >= 11; run -= std::min(run, 138))
+					runs.push_back({18, 7, (uint8_t)(std::min(run, 138) - 11)});
+				if (run >= 3)
+				{
+					runs.push_back({17, 3, (uint8_t)(run - 3)});
+					run = 0;
+				}
+			}
+			else
+			{
+				runs.push_back({value, 0, 0});
+				run--;
+				for (; run >= 3; run -= std::min(run, 6))
+					runs.push_back({16, 2, (uint8_t)(std::min(run, 6) - 3)});
+			}
+			for (; run > 0; run--)
+				runs.push_back({value, 0, 0});
+		}
+		uint32_t clFreq[19] = {};
+		for (const Run &r : runs)
+			clFreq[r.symbol]++;
+		uint8_t clLengths[19];
+		buildLengths(clFreq, 19, 7, clLengths);
+		int hclen = 19;
+		while (hclen > 4 && !clLengths[CODE_LENGTH_ORDER[hclen - 1]])
+			hclen--;
+
+		// Stored wins on data that doesn't compress
+		uint64_t dynamicBits = 3 + 14 + 3 * hclen + litLengths[256];
+		for (const Run &r : runs)
+			dynamicBits += clLengths[r.symbol] + r.extraBits;
+		for (int s = 0; s < 286; s++)
+			if (s != 256)
+				dynamicBits += (uint64_t)litFreq[s] * litLengths[s];
+		for (int c = 0; c < 29; c++)
+			dynamicBits += (uint64_t)litFreq[257 + c] * LENGTH_EXTRA[c];
+		for (int c = 0; c < 30; c++)
+			dynamicBits += (uint64_t)distFreq[c] * (distLengths[c] + DIST_EXTRA[c]);
+		const uint64_t storedBits = (rawSize + 5 * (rawSize / 65535 + 1)) * 8 + 8;
+		if (storedBits < dynamicBits)
+		{
+			writeStored(bits, raw, rawSize, last, out);
+			return;
+		}
+
+		uint16_t litCodes[286], distCodes[30], clCodes[19];
+		buildCodes(litLengths, 286, litCodes);
+		buildCodes(distLengths, 30, distCodes);
+		buildCodes(clLengths, 19, clCodes);
+
+		bits.Put(last ? 1 : 0, 1);
+		bits.Put(2, 2);
+		bits.Put(hlit - 257, 5);
+		bits.Put(hdist - 1, 5);
+		bits.Put(hclen - 4, 4);
+		for (int i = 0; i < hclen; i++)
+			bits.Put(clLengths[CODE_LENGTH_ORDER[i]], 3);
+		for (const Run &r : runs)
+		{
+			bits.Put(clCodes[r.symbol], clLengths[r.symbol]);
+			if (r.extraBits)
+				bits.Put(r.extra, r.extraBits);
+		}
+		for (const Token &token : tokens)
+		{
+			if (token.distance == 0)
+			{
+				bits.Put(litCodes[token.length], litLengths[token.length]);
+				continue;
+			}
+			const int lengthCode = s_Codes.length[token.length];
+			bits.Put(litCodes[257 + lengthCode], litLengths[257 + lengthCode]);
+			bits.Put(token.length - LENGTH_BASE[lengthCode], LENGTH_EXTRA[lengthCode]);
+			const int distCode = s_Codes.Distance(token.distance);
+			bits.Put(distCodes[distCode], distLengths[distCode]);
+			bits.Put(token.distance - DIST_BASE[distCode], DIST_EXTRA[distCode]);
+		}
+		bits.Put(litCodes[256], litLengths[256]);
+	}
+
+	class Matcher
+	{
+	public:
+		Matcher(const uint8_t *data, size_t size, int effort)
+			: m_Data(data), m_Size((int64_t)size), m_Effort(std::max(1, effort)), m_Head(1 << HASH_BITS, -1), m_Prev(WINDOW, -1)
+		{
+		}
+
+		inline void Insert(int64_t pos)
+		{
+			if (pos + MIN_MATCH > m_Size)
+				return;
+			const uint32_t h = hash(pos);
+			m_Prev[pos & (WINDOW - 1)] = m_Head[h];
+			m_Head[h] = pos;
+		}
+
+		// Longest match for `pos` among earlier inserted positions, 0 if under MIN_MATCH
+		int Find(int64_t pos, int &distance) const
+		{
+			const int limit = (int)std::min<int64_t>(MAX_MATCH, m_Size - pos);
+			if (limit < MIN_MATCH)
+				return 0;
+			const uint8_t *target = m_Data + pos;
+			int best = MIN_MATCH - 1;
+			int64_t candidate = m_Head[hash(pos)];
+			for (int chain = m_Effort; candidate >= 0 && pos - candidate <= WINDOW && chain > 0; chain--)
+			{
+				const uint8_t *match = m_Data + candidate;
+				if (match[best] == target[best] && match[0] == target[0])
+				{
+					int length = 0;
+					while (length < limit && match[length] == target[length])
+						length++;
+					if (length > best)
+					{
+						best = length;
+						distance = (int)(pos - candidate);
+						if (length == limit)
+							break;
+					}
+				}
+				const int64_t previous = m_Prev[candidate & (WINDOW - 1)];
+				if (previous >= candidate)
+					break;
+				candidate = previous;
+			}
+			if (best < MIN_MATCH || (best == MIN_MATCH && distance > TOO_FAR))
+				return 0;
+			return best;
+		}
+
+	private:
+		inline uint32_t hash(int64_t pos) const
+		{
+			const uint8_t *p = m_Data + pos;
+			return (((uint32_t)p[0] << 10) ^ ((uint32_t)p[1] << 5) ^ p[2]) & ((1u << HASH_BITS) - 1);
+		}
+
+		const uint8_t *m_Data;
+		int64_t m_Size;
+		int m_Effort;
+		std::vector<int64_t> m_Head;
+		std::vector<int64_t> m_Prev;
+	};
+
+	void putBigEndian(std::vector<uint8_t> &out, uint32_t value)
+	{
+		for (int shift = 24; shift >= 0; shift -= 8)
+			out.push_back((uint8_t)(value >> shift));
+	}
+}
+
+namespace Util
+{
+	void ZlibCompress(const uint8_t *data, size_t size, std::vector<uint8_t> &out, int effort)
+	{
+		// 32 KiB window, default level
+		out.push_back(0x78);
+		out.push_back(0x9C);
+		Deflate(data, size, out, true, effort);
+		putBigEndian(out, Adler32(data, size));
+	}
+
+	void Deflate(const uint8_t *data, size_t size, std::vector<uint8_t> &out, bool last, int effort)
+	{
+		BitWriter bits(out);
+		Matcher matcher(data, size, effort);
+		std::vector<Token> tokens;
+		tokens.reserve(BLOCK_TOKENS);
+		int64_t pos = 0, blockStart = 0;
+		const int64_t end = (int64_t)size;
+		// The match found one byte on by the lazy check, -1 when there is none
+		int lookahead = -1, lookaheadDistance = 0;
+		while (pos < end)
+		{
+			int distance = lookaheadDistance;
+			const int length = lookahead >= 0 ? lookahead : matcher.Find(pos, distance);
+			lookahead = -1;
+			matcher.Insert(pos);
+			// Lazy matching: a longer match one byte on makes this byte a literal
+			if (length >= MIN_MATCH && length < LAZY_LIMIT)
+			{
+				lookahead = matcher.Find(pos + 1, lookaheadDistance);
+				if (lookahead <= length)
+					lookahead = -1;
+			}
+			if (length >= MIN_MATCH && lookahead < 0)
+			{
+				tokens.push_back({(uint16_t)length, (uint16_t)distance});
+				for (int k = 1; k < length; k++)
+					matcher.Insert(pos + k);
+				pos += length;
+			}
+			else
+			{
+				tokens.push_back({data[pos], 0});
+				pos++;
+			}
+
+			if (tokens.size() >= BLOCK_TOKENS)
+			{
+				writeBlock(bits, tokens, data + blockStart, (size_t)(pos - blockStart), false, out);
+				tokens.clear();
+				blockStart = pos;
+			}
+		}
+		if (last || !tokens.empty())
+			writeBlock(bits, tokens, data + blockStart, (size_t)(pos - blockStart), last, out);
+		// An empty stored block brings an open stream to a byte boundary, like a zlib sync flush
+		if (!last)
+			writeStored(bits, data, 0, false, out);
+		bits.Align();
+	}
+
+	uint32_t Adler32(const void *data, size_t size, uint32_t adler)
+	{
+		// The most bytes before the sums can overflow 32 bits
+		constexpr size_t NMAX = 5552;
+		const uint8_t *p = (const uint8_t *)data;
+		uint32_t a = adler & 0xFFFF, b = adler >> 16;
+		while (size > 0)
+		{
+			const size_t chunk = std::min(size, NMAX);
+			size -= chunk;
+			for (size_t i = 0; i < chunk; i++)
+			{
+				a += p[i];
+				b += a;
+			}
+			p += chunk;
+			a %= 65521;
+			b %= 65521;
+		}
+		return (b << 16) | a;
+	}
+
+	uint32_t Adler32Combine(uint32_t first, uint32_t second, uint64_t secondSize)
+	{
+		// As zlib's adler32_combine: the second sum gains the first's low sum once per byte of the second piece
+		constexpr uint32_t BASE = 65521;
+		const uint32_t remainder = (uint32_t)(secondSize % BASE);
+		uint32_t a = first & 0xFFFF;
+		uint32_t b = (uint32_t)((uint64_t)remainder * a % BASE);
+		a += (second & 0xFFFF) + BASE - 1;
+		b += (first >> 16) + (second >> 16) + BASE - remainder;
+		if (a >= BASE)
+			a -= BASE;
+		if (a >= BASE)
+			a -= BASE;
+		if (b >= 2 * BASE)
+			b -= 2 * BASE;
+		if (b >= BASE)
+			b -= BASE;
+		return (b << 16) | a;
+	}
+}
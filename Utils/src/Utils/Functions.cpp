@@ -2,6 +2,17 @@
 #define IMGUI_DEFINE_MATH_OPERATORS
 #include "imgui_internal.h"
 
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
 static ImVector<ImRect> s_GroupPanelLabelStack;
 namespace Util
 {
@@ -205,4 +216,23 @@ namespace Util
 			sum *= -1;
 		return sum;
 	}
+
+	uint64_t GetResidentMemory()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters{};
+		if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return 0;
+		return counters.WorkingSetSize;
+#else
+		// statm: total program size then resident pages
+		FILE *file = fopen("/proc/self/statm", "r");
+		if (!file)
+			return 0;
+		unsigned long long size = 0, resident = 0;
+		int read = fscanf(file, "%llu %llu", &size, &resident);
+		fclose(file);
+		return read == 2 ? resident * (uint64_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+	}
 }
\ No newline at end of file
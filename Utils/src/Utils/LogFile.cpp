@@ -0,0 +1,220 @@
+#include "Utils/LogFile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+namespace
+{
+	using Util::LogDetail::FieldType;
+	using Util::LogDetail::LogField;
+
+	inline uint64_t padded(uint64_t size) { return (size + 7) & ~uint64_t(7); }
+
+	uint64_t fieldBytes(const LogField &field)
+	{
+		const uint64_t name = std::min<size_t>(field.name.size(), 255);
+		return 2 + name + (field.type == FieldType::String ? sizeof(uint32_t) + field.text.size() : sizeof(uint64_t));
+	}
+
+	uint8_t *writeField(uint8_t *out, const LogField &field)
+	{
+		const uint8_t name = (uint8_t)std::min<size_t>(field.name.size(), 255);
+		*out++ = (uint8_t)field.type;
+		*out++ = name;
+		std::memcpy(out, field.name.data(), name);
+		out += name;
+		if (field.type == FieldType::String)
+		{
+			const uint32_t size = (uint32_t)field.text.size();
+			std::memcpy(out, &size, sizeof(size));
+			std::memcpy(out + sizeof(size), field.text.data(), size);
+			return out + sizeof(size) + size;
+		}
+		std::memcpy(out, &field.u, sizeof(field.u));
+		return out + sizeof(field.u);
+	}
+
+	// False when the field runs past `end`
+	bool readField(const uint8_t *&in, const uint8_t *end, LogField &field)
+	{
+		if (end - in < 2 || in[0] > (uint8_t)FieldType::String || end - in - 2 < in[1])
+			return false;
+		field.type = (FieldType)in[0];
+		field.name = std::string_view((const char *)in + 2, in[1]);
+		in += 2 + field.name.size();
+		field.text = {};
+		if (field.type == FieldType::String)
+		{
+			uint32_t size;
+			if (end - in < (ptrdiff_t)sizeof(size))
+				return false;
+			std::memcpy(&size, in, sizeof(size));
+			in += sizeof(size);
+			if ((uint64_t)(end - in) < size)
+				return false;
+			field.text = std::string_view((const char *)in, size);
+			in += size;
+			return true;
+		}
+		if (end - in < (ptrdiff_t)sizeof(field.u))
+			return false;
+		std::memcpy(&field.u, in, sizeof(field.u));
+		in += sizeof(field.u);
+		return true;
+	}
+}
+
+namespace Util
+{
+	LogFile::~LogFile()
+	{
+		Close();
+	}
+
+	bool LogFile::Open(const std::string &path, const LogFileOptions &options)
+	{
+		Close();
+		m_Path = path;
+		m_Options = options;
+		m_Options.rotateBytes = std::max<uint64_t>(m_Options.rotateBytes, 4096);
+		// A previous run's log moves to path.1 like a full one, a restart keeps it
+		std::error_code ec;
+		if (std::filesystem::exists(m_Path, ec))
+			return rotate(m_Options.rotateBytes);
+		return create(m_Options.rotateBytes);
+	}
+
+	bool LogFile::create(uint64_t size)
+	{
+		if (!m_File.Create(m_Path, size))
+			return false;
+		LogFileHeader header{};
+		std::memcpy(header.magic, "RDLG", 4);
+		header.version = LOG_FILE_VERSION;
+		header.headerSize = sizeof(LogFileHeader);
+		header.usedBytes = sizeof(LogFileHeader);
+		header.created = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		std::memcpy(m_File.Data(), &header, sizeof(header));
+		m_Used = sizeof(LogFileHeader);
+		return true;
+	}
+
+	bool LogFile::rotate(uint64_t size)
+	{
+		Close();
+		// path.keep goes, the others move up one, the full file becomes path.1
+		std::error_code ec;
+		const int keep = std::max(0, m_Options.keep);
+		std::filesystem::remove(m_Path + "." + std::to_string(keep), ec);
+		for (int i = keep - 1; i >= 1; i--)
+			std::filesystem::rename(m_Path + "." + std::to_string(i), m_Path + "." + std::to_string(i + 1), ec);
+		if (keep > 0)
+			std::filesystem::rename(m_Path, m_Path + ".1", ec);
+		return create(std::max(m_Options.rotateBytes, size));
+	}
+
+	bool LogFile::Write(int64_t time, uint64_t sequence, uint32_t thread, Logger::Level level, std::string_view message,
+						const std::vector<LogDetail::LogField> &fields)
+	{
+		if (!m_File.IsOpen())
+			return false;
+
+		const size_t count = std::min<size_t>(fields.size(), 255);
+		uint64_t size = sizeof(LogFileRecord) + message.size();
+		for (size_t i = 0; i < count; i++)
+			size += fieldBytes(fields[i]);
+		size = padded(size);
+		if (m_Used + size > m_File.Size() && !rotate(sizeof(LogFileHeader) + size))
+			return false;
+
+		uint8_t *out = m_File.Data() + m_Used;
+		const LogFileRecord record{(uint32_t)size, thread, time, sequence, (uint32_t)message.size(), (uint8_t)level, (uint8_t)count, 0};
+		std::memcpy(out, &record, sizeof(record));
+		std::memcpy(out + sizeof(record), message.data(), message.size());
+		uint8_t *end = out + sizeof(record) + message.size();
+		for (size_t i = 0; i < count; i++)
+			end = writeField(end, fields[i]);
+		std::memset(end, 0, out + size - end);
+
+		// Published after the record, a reader never sees half of one
+		m_Used += size;
+		std::memcpy(m_File.Data() + offsetof(LogFileHeader, usedBytes), &m_Used, sizeof(m_Used));
+		return true;
+	}
+
+	void LogFile::Close()
+	{
+		if (!m_File.IsOpen())
+			return;
+		// The unused tail goes, the write back is left to the page cache
+		m_File.Flush(0, 0, false);
+		m_File.Close();
+		std::error_code ec;
+		std::filesystem::resize_file(m_Path, m_Used, ec);
+	}
+
+	bool LogFileReader::Open(const std::string &path)
+	{
+		m_Corrupted = false;
+		if (!m_File.Open(path, MappedFile::Access::ReadOnly))
+			return false;
+		LogFileHeader header;
+		if (m_File.Size() < sizeof(header))
+		{
+			LOG_ERROR("{} is too small to be a log file", path);
+			return false;
+		}
+		std::memcpy(&header, m_File.Data(), sizeof(header));
+		if (std::memcmp(header.magic, "RDLG", 4) != 0 || header.headerSize < sizeof(header))
+		{
+			LOG_ERROR("{} is not a log file", path);
+			return false;
+		}
+		if (header.version != LOG_FILE_VERSION)
+		{
+			LOG_ERROR("{} has version {}, expected {}", path, header.version, LOG_FILE_VERSION);
+			return false;
+		}
+		m_Used = std::min(header.usedBytes, m_File.Size());
+		m_Offset = header.headerSize;
+		return true;
+	}
+
+	bool LogFileReader::Next(LogEntry &entry)
+	{
+		if (m_Offset + sizeof(LogFileRecord) > m_Used)
+			return false;
+		LogFileRecord record;
+		std::memcpy(&record, m_File.Data() + m_Offset, sizeof(record));
+		if (record.size < sizeof(record) || record.size % 8 || m_Offset + record.size > m_Used ||
+			record.messageBytes > record.size - sizeof(record) || record.level > (uint8_t)Logger::Level::Error)
+		{
+			m_Corrupted = true;
+			return false;
+		}
+
+		const uint8_t *in = m_File.Data() + m_Offset + sizeof(record);
+		const uint8_t *end = m_File.Data() + m_Offset + record.size;
+		entry.time = record.time;
+		entry.sequence = record.sequence;
+		entry.thread = record.thread;
+		entry.level = (Logger::Level)record.level;
+		entry.message = std::string_view((const char *)in, record.messageBytes);
+		in += record.messageBytes;
+		entry.fields.resize(record.fields);
+		for (LogDetail::LogField &field : entry.fields)
+		{
+			if (!readField(in, end, field))
+			{
+				m_Corrupted = true;
+				return false;
+			}
+		}
+		m_Offset += record.size;
+		return true;
+	}
+}
@@ -1,39 +1,378 @@
 #include "Utils/Logger.h"
+#include "Utils/LogFile.h"
+#include "Utils/LogLines.h"
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <iostream>
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+	using Level = Util::Logger::Level;
+
+	constexpr uint64_t RING_BYTES = Util::Logger::RING_BYTES;
+	// How long the log thread sleeps when the rings are empty
+	constexpr auto IDLE_WAIT = std::chrono::milliseconds(2);
+
+	struct LevelStyle
+	{
+		const char *prefix;
+		fmt::color console;
+		int window;
+	};
+
+	// Indexed by level
+	constexpr LevelStyle s_Styles[] = {
+		{"[Debug] ", fmt::color::white, (int)0xFFFFFFFF},
+		{"[Info] ", fmt::color::sky_blue, (int)0xFFee0000},
+		{"[Print] ", fmt::color::white, (int)0xFFFFFFFF},
+		{"[Success] ", fmt::color::green, (int)0xFF00FF00},
+		{"[Warning] ", fmt::color::yellow, (int)0xFF00FFFF},
+		{"[Error] ", fmt::color::red, (int)0xFF0000FF},
+	};
+
+	// Records are 8 byte aligned and never wrap. The end of the ring is skipped
+	// with a record without a decoder, or silently when not even a record fits.
+	struct Record
+	{
+		uint32_t size;
+		Level level;
+		uint64_t sequence;
+		int64_t time; // Only taken while there is a log file
+		Util::LogDetail::DecodeFn decode;
+	};
+
+	// Single producer, the owning thread, single consumer, the log thread.
+	// `head` and `tail` count bytes ever written and read, the release stores
+	// publish the records before them.
+	struct ThreadRing
+	{
+		std::unique_ptr<uint64_t[]> data{new uint64_t[RING_BYTES / sizeof(uint64_t)]};
+		alignas(64) std::atomic<uint64_t> head{0};
+		uint64_t pending = 0;    // Head once the record being written is committed
+		uint64_t cachedTail = 0; // Producer's copy of tail, refreshed when the ring looks full
+		alignas(64) std::atomic<uint64_t> tail{0};
+		uint32_t id = 0; // The thread of the log file, rings are reused so it's the ring's
+		bool inUse = false;
+
+		inline Record *At(uint64_t position) { return (Record *)((char *)data.get() + position % RING_BYTES); }
+		inline static uint64_t Left(uint64_t position) { return RING_BYTES - position % RING_BYTES; }
+	};
+
+	std::mutex s_RegistryMutex;
+	std::vector<std::unique_ptr<ThreadRing>> s_Rings;
+
+	// Hands the ring back when its thread exits, a new thread continues it
+	struct RingLease
+	{
+		ThreadRing *ring = nullptr;
+
+		~RingLease()
+		{
+			if (!ring)
+				return;
+			std::lock_guard<std::mutex> lk(s_RegistryMutex);
+			ring->inUse = false;
+		}
+	};
+	thread_local RingLease t_Lease;
+
+	ThreadRing &threadRing()
+	{
+		if (!t_Lease.ring)
+		{
+			std::lock_guard<std::mutex> lk(s_RegistryMutex);
+			for (auto &ring : s_Rings)
+			{
+				if (!ring->inUse)
+				{
+					t_Lease.ring = ring.get();
+					break;
+				}
+			}
+			if (!t_Lease.ring)
+			{
+				s_Rings.push_back(std::make_unique<ThreadRing>());
+				t_Lease.ring = s_Rings.back().get();
+				t_Lease.ring->id = (uint32_t)s_Rings.size();
+			}
+			t_Lease.ring->inUse = true;
+		}
+		return *t_Lease.ring;
+	}
+
+	std::atomic<uint64_t> s_Sequence{0};
+	std::atomic<bool> s_Running{false};
+	std::thread s_Thread;
+
+	// Wakes the log thread, Flush asks for a pass and waits until one finished
+	std::mutex s_WakeMutex;
+	std::condition_variable s_Wake;
+	std::condition_variable s_Flushed;
+	uint64_t s_FlushWanted = 0;
+	uint64_t s_FlushDone = 0;
+	std::atomic<bool> s_Full{false}; // A caller waits for room in its ring
+
+	// Guards the window lines and the console
+	std::mutex s_OutputMutex;
+
+	// The structured log, written by the log thread
+	std::mutex s_FileMutex;
+	Util::LogFile s_File;
+	std::atomic<bool> s_FileOpen{false};
+	std::atomic<Level> s_FileMinimum{Level::Debug};
+	std::vector<Util::LogDetail::LogField> s_Fields;
+
+	int64_t nowNs()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	using Util::LogDetail::FilterIndex;
+	using Util::LogDetail::LineRing;
+	LineRing s_Lines;
+	FilterIndex s_FilterIndex;
+}
 
 namespace Util
 {
-	ImGuiTextBuffer Logger::m_Buf{};
 	ImGuiTextFilter Logger::m_Filter{};
-	ImVector<int> Logger::m_LineOffsets{};
-	ImVector<int> Logger::m_Colors{};
 	bool Logger::enabled = true;
+	bool Logger::console = true;
 	bool Logger::m_AutoScroll = true;
 	Logger Logger::s_Instance{};
 
-	void Logger::AddOffset(int oldSize, int color)
+	Logger::Logger()
+	{
+		s_Running.store(true);
+		s_Thread = std::thread(&Logger::Run);
+		ClearBuffer();
+	}
+
+	Logger::~Logger()
+	{
+		// Before the window buffer is destroyed
+		Shutdown();
+	}
+
+	char *Logger::Begin(Level level, size_t payloadBytes, LogDetail::DecodeFn decode)
+	{
+		const uint64_t size = (sizeof(Record) + payloadBytes + 7) & ~uint64_t(7);
+		if (size > RING_BYTES / 2 || !s_Running.load(std::memory_order_relaxed))
+			return nullptr;
+
+		ThreadRing &ring = threadRing();
+		uint64_t head = ring.head.load(std::memory_order_relaxed);
+		const uint64_t skip = size > ThreadRing::Left(head) ? ThreadRing::Left(head) : 0;
+		while (head + skip + size - ring.cachedTail > RING_BYTES)
+		{
+			ring.cachedTail = ring.tail.load(std::memory_order_acquire);
+			if (head + skip + size - ring.cachedTail <= RING_BYTES)
+				break;
+			// Full, the log thread is behind
+			s_Full.store(true);
+			s_Wake.notify_one();
+			std::this_thread::yield();
+		}
+		if (skip)
+		{
+			if (skip >= sizeof(Record))
+				*ring.At(head) = Record{(uint32_t)skip, level, 0, 0, nullptr};
+			head += skip;
+		}
+		Record *record = ring.At(head);
+		const int64_t time = s_FileOpen.load(std::memory_order_relaxed) ? nowNs() : 0;
+		*record = Record{(uint32_t)size, level, s_Sequence.fetch_add(1, std::memory_order_relaxed), time, decode};
+		ring.pending = head + size;
+		return (char *)(record + 1);
+	}
+
+	void Logger::Commit()
+	{
+		ThreadRing &ring = threadRing();
+		ring.head.store(ring.pending, std::memory_order_release);
+	}
+
+	void Logger::Write(Level level, std::string_view message)
+	{
+		// Everything queued before comes first
+		Flush();
+		fmt::memory_buffer line;
+		fmt::format_to(fmt::appender(line), "{}{}\n", s_Styles[(int)level].prefix, message);
+		Output(level, std::string_view(line.data(), line.size()));
+		if (s_FileOpen.load())
+		{
+			std::lock_guard<std::mutex> lk(s_FileMutex);
+			s_File.Write(nowNs(), s_Sequence.fetch_add(1), 0, level, message, {});
+		}
+	}
+
+	void Logger::Output(Level level, std::string_view line)
+	{
+		const LevelStyle &style = s_Styles[(int)level];
+		std::lock_guard<std::mutex> lk(s_OutputMutex);
+		if (console)
+			fmt::print(fg(style.console), "{}", line);
+		// A line per line of the message, without the newline
+		for (size_t begin = 0; begin < line.size();)
+		{
+			const size_t end = std::min(line.find('\n', begin), line.size());
+			s_Lines.Push(line.substr(begin, end - begin), style.window);
+			begin = end + 1;
+		}
+	}
+
+	uint64_t Logger::Drain(fmt::memory_buffer &line)
 	{
-		for (int newSize = m_Buf.size(); oldSize < newSize; oldSize++)
+		std::vector<ThreadRing *> rings;
 		{
-			auto value = m_Buf[oldSize];
-			if (value == '\n')
+			std::lock_guard<std::mutex> lk(s_RegistryMutex);
+			for (auto &ring : s_Rings)
+				rings.push_back(ring.get());
+		}
+		std::vector<uint64_t> heads(rings.size());
+		for (size_t i = 0; i < rings.size(); i++)
+			heads[i] = rings[i]->head.load(std::memory_order_acquire);
+
+		// Merges the rings by sequence, what arrives meanwhile waits for the next pass
+		uint64_t count = 0;
+		while (true)
+		{
+			ThreadRing *next = nullptr;
+			uint64_t nextTail = 0;
+			for (size_t i = 0; i < rings.size(); i++)
 			{
-				m_LineOffsets.push_back(oldSize + 1);
-				m_Colors.push_back(color);
+				ThreadRing &ring = *rings[i];
+				uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+				if (tail < heads[i] && (ThreadRing::Left(tail) < sizeof(Record) || !ring.At(tail)->decode))
+				{
+					tail += ThreadRing::Left(tail);
+					ring.tail.store(tail, std::memory_order_release);
+				}
+				if (tail < heads[i] && (!next || ring.At(tail)->sequence < next->At(nextTail)->sequence))
+				{
+					next = &ring;
+					nextTail = tail;
+				}
 			}
+			if (!next)
+				return count;
+
+			const Record &record = *next->At(nextTail);
+			const bool toFile = s_FileOpen.load(std::memory_order_relaxed) && record.level >= s_FileMinimum.load(std::memory_order_relaxed);
+			line.clear();
+			s_Fields.clear();
+			const size_t prefix = std::strlen(s_Styles[(int)record.level].prefix);
+			line.append(s_Styles[(int)record.level].prefix, s_Styles[(int)record.level].prefix + prefix);
+			try
+			{
+				record.decode((const char *)(&record + 1), line, toFile ? &s_Fields : nullptr);
+			}
+			catch (const fmt::format_error &error)
+			{
+				fmt::format_to(fmt::appender(line), "<invalid log format: {}>", error.what());
+			}
+			if (toFile)
+			{
+				std::lock_guard<std::mutex> lk(s_FileMutex);
+				s_File.Write(record.time, record.sequence, next->id, record.level,
+							 std::string_view(line.data() + prefix, line.size() - prefix), s_Fields);
+			}
+			line.push_back('\n');
+			Output(record.level, std::string_view(line.data(), line.size()));
+			next->tail.store(nextTail + record.size, std::memory_order_release);
+			count++;
 		}
 	}
 
+	void Logger::Run()
+	{
+		fmt::memory_buffer line;
+		while (true)
+		{
+			uint64_t flush;
+			{
+				std::lock_guard<std::mutex> lk(s_WakeMutex);
+				flush = s_FlushWanted;
+			}
+			const bool running = s_Running.load();
+			const uint64_t count = Drain(line);
+			{
+				std::unique_lock<std::mutex> lk(s_WakeMutex);
+				if (flush != s_FlushDone)
+				{
+					s_FlushDone = flush;
+					s_Flushed.notify_all();
+				}
+				if (!running)
+					return;
+				if (count == 0)
+					s_Wake.wait_for(lk, IDLE_WAIT, [] { return s_Full.exchange(false) || s_FlushWanted != s_FlushDone || !s_Running.load(); });
+			}
+		}
+	}
+
+	void Logger::Flush()
+	{
+		if (!s_Running.load() || std::this_thread::get_id() == s_Thread.get_id())
+			return;
+		std::unique_lock<std::mutex> lk(s_WakeMutex);
+		// The pass that takes this request starts after the call
+		const uint64_t wanted = ++s_FlushWanted;
+		s_Wake.notify_one();
+		s_Flushed.wait(lk, [wanted] { return s_FlushDone >= wanted || !s_Running.load(); });
+	}
+
+	void Logger::Shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lk(s_WakeMutex);
+			if (!s_Running.load())
+				return;
+			s_Running.store(false);
+			s_Wake.notify_one();
+			s_Flushed.notify_all();
+		}
+		// The last pass runs after running is cleared, it sees every committed line
+		s_Thread.join();
+		CloseFile();
+	}
+
+	bool Logger::OpenFile(const std::string &path, const LogFileOptions &options, Level minimum)
+	{
+		std::lock_guard<std::mutex> lk(s_FileMutex);
+		s_FileOpen.store(false);
+		s_FileMinimum.store(minimum);
+		if (!s_File.Open(path, options))
+			return false;
+		s_FileOpen.store(true);
+		return true;
+	}
+
+	void Logger::CloseFile()
+	{
+		std::lock_guard<std::mutex> lk(s_FileMutex);
+		s_FileOpen.store(false);
+		s_File.Close();
+	}
+
+	const char *Logger::LevelName(Level level)
+	{
+		static constexpr const char *names[] = {"Debug", "Info", "Print", "Success", "Warning", "Error"};
+		return (size_t)level < std::size(names) ? names[(size_t)level] : "Unknown";
+	}
+
 	void Logger::ClearBuffer()
 	{
-		m_LineOffsets.clear();
-		m_Buf.clear();
-		m_Colors.clear();
-		Info("Initializing Logger");
+		// Only the window gets the marker, stdout may be the output of a tool
+		std::lock_guard<std::mutex> lk(s_OutputMutex);
+		s_Lines.Clear();
+		s_Lines.Push("[Info] Initializing Logger", s_Styles[(int)Level::Info].window);
 	}
 
 	void Logger::Draw(std::string_view title, bool *p_open, ImGuiWindowFlags flags)
@@ -64,46 +403,27 @@ namespace Util
 		ImGui::BeginChild("scrolling", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
 
 		ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
-		const char *buf = m_Buf.begin();
-		const char *buf_end = m_Buf.end();
-		if (m_Filter.IsActive())
-		{
-			for (int line_no = 0; line_no < m_LineOffsets.Size; line_no++)
-			{
-				const char *line_start = buf + m_LineOffsets[line_no];
-				const char *line_end = (line_no + 1 < m_LineOffsets.Size) ? (buf + m_LineOffsets[line_no + 1] - 1) : buf_end;
-				if (m_Filter.PassFilter(line_start, line_end))
-				{
-					if (line_no + 1 >= m_Colors.Size)
-						ImGui::PushStyleColor(ImGuiCol_Text, ImU32(m_Colors[m_Colors.Size - 1]));
-					else
-						ImGui::PushStyleColor(ImGuiCol_Text, ImU32(m_Colors[line_no + 1]));
-					ImGui::TextUnformatted(line_start, line_end);
-					ImGui::PopStyleColor();
-				}
-			}
-		}
-		else
+		// The log thread appends meanwhile
+		std::unique_lock<std::mutex> lk(s_OutputMutex);
+		const bool filtered = m_Filter.IsActive();
+		if (filtered)
+			s_FilterIndex.Update(m_Filter, s_Lines);
+		// Only the visible lines are touched, filtered or not
+		ImGuiListClipper clipper;
+		clipper.Begin(filtered ? (int)s_FilterIndex.Size() : (int)(s_Lines.Next() - s_Lines.First()));
+		while (clipper.Step())
 		{
-			ImGuiListClipper clipper;
-			clipper.Begin(m_LineOffsets.Size);
-			while (clipper.Step())
+			for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
 			{
-				for (int line_no = clipper.DisplayStart; line_no < clipper.DisplayEnd; line_no++)
-				{
-					int offset = (false) ? 0 : m_LineOffsets[line_no];
-					const char *line_start = buf + offset;
-					const char *line_end = (line_no + 1 < m_LineOffsets.Size) ? (buf + m_LineOffsets[line_no + 1] - 1) : buf_end;
-					if (line_no + 1 >= m_Colors.Size)
-						ImGui::PushStyleColor(ImGuiCol_Text, ImU32(m_Colors[m_Colors.Size - 1]));
-					else
-						ImGui::PushStyleColor(ImGuiCol_Text, ImU32(m_Colors[line_no + 1]));
-					ImGui::TextUnformatted(line_start, line_end);
-					ImGui::PopStyleColor();
-				}
+				const LineRing::Line &line = s_Lines.At(filtered ? s_FilterIndex[row] : s_Lines.First() + row);
+				const char *text = s_Lines.Text(line);
+				ImGui::PushStyleColor(ImGuiCol_Text, ImU32(line.color));
+				ImGui::TextUnformatted(text, text + line.size);
+				ImGui::PopStyleColor();
 			}
-			clipper.End();
 		}
+		clipper.End();
+		lk.unlock();
 		ImGui::PopStyleVar();
 
 		if (m_AutoScroll && ImGui::GetScrollY() >= ImGui::GetScrollMaxY())
@@ -112,4 +432,4 @@ namespace Util
 		ImGui::EndChild();
 		ImGui::End();
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,285 @@
+#include "Utils/MappedFile.h"
+#include "Utils/Logger.h"
+
+#include <algorithm>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Util
+{
+	MappedFile::~MappedFile()
+	{
+		Close();
+	}
+
+	MappedFile::MappedFile(MappedFile &&other) noexcept
+	{
+		Swap(other);
+	}
+
+	MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+	{
+		if (this != &other)
+		{
+			Close();
+			Swap(other);
+		}
+		return *this;
+	}
+
+	void MappedFile::Swap(MappedFile &other) noexcept
+	{
+		std::swap(m_Data, other.m_Data);
+		std::swap(m_Size, other.m_Size);
+#ifdef _WIN32
+		std::swap(m_File, other.m_File);
+		std::swap(m_Mapping, other.m_Mapping);
+#else
+		std::swap(m_Fd, other.m_Fd);
+#endif
+	}
+
+#ifdef _WIN32
+	bool MappedFile::Open(const std::string &path, Access access)
+	{
+		Close();
+		DWORD desired = GENERIC_READ | (access == Access::ReadWrite ? GENERIC_WRITE : 0);
+		HANDLE file = CreateFileA(path.c_str(), desired, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			LOG_ERROR("Could not open {}", path);
+			return false;
+		}
+		LARGE_INTEGER size{};
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+		{
+			LOG_ERROR("Could not map {}: the file is empty", path);
+			CloseHandle(file);
+			return false;
+		}
+
+		DWORD protect = PAGE_READONLY;
+		DWORD viewAccess = FILE_MAP_READ;
+		if (access == Access::CopyOnWrite)
+		{
+			protect = PAGE_WRITECOPY;
+			viewAccess = FILE_MAP_COPY;
+		}
+		else if (access == Access::ReadWrite)
+		{
+			protect = PAGE_READWRITE;
+			viewAccess = FILE_MAP_WRITE;
+		}
+
+		HANDLE mapping = CreateFileMappingA(file, nullptr, protect, 0, 0, nullptr);
+		void *data = mapping ? MapViewOfFile(mapping, viewAccess, 0, 0, 0) : nullptr;
+		if (!data)
+		{
+			LOG_ERROR("Could not map {}", path);
+			if (mapping)
+				CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+
+		m_File = file;
+		m_Mapping = mapping;
+		m_Data = (uint8_t *)data;
+		m_Size = (uint64_t)size.QuadPart;
+		return true;
+	}
+
+	bool MappedFile::Create(const std::string &path, uint64_t size)
+	{
+		Close();
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			LOG_ERROR("Could not create {}", path);
+			return false;
+		}
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, DWORD(size >> 32), DWORD(size & 0xFFFFFFFF), nullptr);
+		void *data = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0) : nullptr;
+		if (!data)
+		{
+			LOG_ERROR("Could not map {} with {} bytes", path, size);
+			if (mapping)
+				CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+
+		m_File = file;
+		m_Mapping = mapping;
+		m_Data = (uint8_t *)data;
+		m_Size = size;
+		return true;
+	}
+
+	bool MappedFile::Flush(uint64_t offset, uint64_t length, bool wait)
+	{
+		if (!m_Data)
+			return false;
+		if (length == 0)
+			length = m_Size - offset;
+		// FlushViewOfFile only starts the write back, FlushFileBuffers waits for it
+		if (!FlushViewOfFile(m_Data + offset, (SIZE_T)length))
+			return false;
+		return !wait || FlushFileBuffers(m_File) != 0;
+	}
+
+	void MappedFile::Advise(uint64_t offset, uint64_t length, Advice advice)
+	{
+		if (!m_Data || offset >= m_Size)
+			return;
+		length = std::min(length, m_Size - offset);
+		if (advice == Advice::WillNeed)
+		{
+			WIN32_MEMORY_RANGE_ENTRY range{m_Data + offset, (SIZE_T)length};
+			PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+		}
+		else
+		{
+			// Unlocking pages that aren't locked evicts them from the working set
+			VirtualUnlock(m_Data + offset, (SIZE_T)length);
+		}
+	}
+
+	void MappedFile::Close()
+	{
+		if (m_Data)
+			UnmapViewOfFile(m_Data);
+		if (m_Mapping)
+			CloseHandle(m_Mapping);
+		if (m_File)
+			CloseHandle(m_File);
+		m_Data = nullptr;
+		m_Mapping = nullptr;
+		m_File = nullptr;
+		m_Size = 0;
+	}
+#else
+	bool MappedFile::Open(const std::string &path, Access access)
+	{
+		Close();
+		int fd = ::open(path.c_str(), access == Access::ReadWrite ? O_RDWR : O_RDONLY);
+		if (fd < 0)
+		{
+			LOG_ERROR("Could not open {}", path);
+			return false;
+		}
+		struct stat st{};
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			LOG_ERROR("Could not map {}: the file is empty", path);
+			::close(fd);
+			return false;
+		}
+
+		int protect = PROT_READ;
+		int flags = MAP_SHARED;
+		if (access == Access::CopyOnWrite)
+		{
+			protect |= PROT_WRITE;
+			flags = MAP_PRIVATE;
+		}
+		else if (access == Access::ReadWrite)
+			protect |= PROT_WRITE;
+
+		void *data = mmap(nullptr, (size_t)st.st_size, protect, flags, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			LOG_ERROR("Could not map {}", path);
+			::close(fd);
+			return false;
+		}
+
+		m_Fd = fd;
+		m_Data = (uint8_t *)data;
+		m_Size = (uint64_t)st.st_size;
+		return true;
+	}
+
+	bool MappedFile::Create(const std::string &path, uint64_t size)
+	{
+		Close();
+		int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+		{
+			LOG_ERROR("Could not create {}", path);
+			return false;
+		}
+		// ftruncate leaves the file sparse, blocks are only allocated when pages get written
+		if (ftruncate(fd, (off_t)size) != 0)
+		{
+			LOG_ERROR("Could not resize {} to {} bytes", path, size);
+			::close(fd);
+			return false;
+		}
+		void *data = mmap(nullptr, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			LOG_ERROR("Could not map {} with {} bytes", path, size);
+			::close(fd);
+			return false;
+		}
+
+		m_Fd = fd;
+		m_Data = (uint8_t *)data;
+		m_Size = size;
+		return true;
+	}
+
+	bool MappedFile::Flush(uint64_t offset, uint64_t length, bool wait)
+	{
+		if (!m_Data)
+			return false;
+		if (length == 0)
+			length = m_Size - offset;
+		// msync wants a page aligned start address
+		uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+		uint64_t start = offset - offset % pageSize;
+		return msync(m_Data + start, (size_t)(length + offset - start), wait ? MS_SYNC : MS_ASYNC) == 0;
+	}
+
+	void MappedFile::Advise(uint64_t offset, uint64_t length, Advice advice)
+	{
+		if (!m_Data || offset >= m_Size)
+			return;
+		length = std::min(length, m_Size - offset);
+		uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+		uint64_t start = offset - offset % pageSize;
+		uint64_t end = offset + length;
+		if (advice == Advice::DontNeed)
+		{
+			// Only drop pages completely inside the range, neighbours may still be in use
+			start = (offset + pageSize - 1) / pageSize * pageSize;
+			end -= end % pageSize;
+			if (end <= start)
+				return;
+		}
+		madvise(m_Data + start, (size_t)(end - start), advice == Advice::WillNeed ? MADV_WILLNEED : MADV_DONTNEED);
+	}
+
+	void MappedFile::Close()
+	{
+		if (m_Data)
+			munmap(m_Data, (size_t)m_Size);
+		if (m_Fd >= 0)
+			::close(m_Fd);
+		m_Data = nullptr;
+		m_Fd = -1;
+		m_Size = 0;
+	}
+#endif
+}
@@ -0,0 +1,163 @@
+#include "Utils/Trace.h"
+#include "Utils/Logger.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	struct TraceEvent
+	{
+		const char *name;
+		uint64_t start;
+		uint64_t duration;
+	};
+
+	// Written by its thread only. `head` counts every event ever recorded, the
+	// release store publishes the slot written before it.
+	struct ThreadBuffer
+	{
+		std::unique_ptr<TraceEvent[]> events{new TraceEvent[Util::Trace::CAPACITY]};
+		std::atomic<uint64_t> head{0};
+		uint32_t tid = 0;
+		std::string name;
+		bool inUse = false;
+	};
+
+	std::mutex s_RegistryMutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> s_Buffers;
+
+	// Hands the buffer back when its thread exits, short lived pool threads then
+	// reuse buffers instead of adding new ones
+	struct BufferLease
+	{
+		ThreadBuffer *buffer = nullptr;
+
+		~BufferLease()
+		{
+			if (!buffer)
+				return;
+			std::lock_guard<std::mutex> lk(s_RegistryMutex);
+			buffer->inUse = false;
+		}
+	};
+	thread_local BufferLease t_Lease;
+
+	const std::chrono::steady_clock::time_point s_Epoch = std::chrono::steady_clock::now();
+
+	ThreadBuffer &threadBuffer()
+	{
+		if (!t_Lease.buffer)
+		{
+			// Buffers outlive their threads so a late Write still sees their events
+			std::lock_guard<std::mutex> lk(s_RegistryMutex);
+			for (auto &buffer : s_Buffers)
+			{
+				if (!buffer->inUse)
+				{
+					t_Lease.buffer = buffer.get();
+					break;
+				}
+			}
+			if (!t_Lease.buffer)
+			{
+				s_Buffers.push_back(std::make_unique<ThreadBuffer>());
+				t_Lease.buffer = s_Buffers.back().get();
+				t_Lease.buffer->tid = (uint32_t)s_Buffers.size();
+			}
+			t_Lease.buffer->inUse = true;
+		}
+		return *t_Lease.buffer;
+	}
+
+	void writeEscaped(FILE *file, const char *text)
+	{
+		for (const char *c = text; *c; c++)
+		{
+			if (*c == '"' || *c == '\\')
+				fputc('\\', file);
+			fputc(*c, file);
+		}
+	}
+}
+
+namespace Util
+{
+	std::atomic<bool> Trace::s_Enabled{false};
+
+	void Trace::Enable(bool enabled)
+	{
+		s_Enabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	uint64_t Trace::Now()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_Epoch).count();
+	}
+
+	void Trace::Record(const char *name, uint64_t start, uint64_t end)
+	{
+		ThreadBuffer &buffer = threadBuffer();
+		const uint64_t head = buffer.head.load(std::memory_order_relaxed);
+		buffer.events[head % CAPACITY] = {name, start, end - start};
+		buffer.head.store(head + 1, std::memory_order_release);
+	}
+
+	void Trace::SetThreadName(const std::string &name)
+	{
+		ThreadBuffer &buffer = threadBuffer();
+		std::lock_guard<std::mutex> lk(s_RegistryMutex);
+		buffer.name = name;
+	}
+
+	bool Trace::Write(const std::string &path)
+	{
+		FILE *file = fopen(path.c_str(), "wb");
+		if (!file)
+		{
+			LOG_ERROR("Could not open {} for the trace", path);
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lk(s_RegistryMutex);
+		fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+		bool first = true;
+		uint64_t count = 0;
+		for (const auto &buffer : s_Buffers)
+		{
+			if (!buffer->name.empty())
+			{
+				fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", first ? "" : ",\n", buffer->tid);
+				writeEscaped(file, buffer->name.c_str());
+				fputs("\"}}", file);
+				first = false;
+			}
+
+			// Leave a margin, the owner may be overwriting the oldest slots right now
+			const uint64_t head = buffer->head.load(std::memory_order_acquire);
+			const uint64_t margin = CAPACITY / 16;
+			const uint64_t begin = head > CAPACITY - margin ? head - (CAPACITY - margin) : 0;
+			for (uint64_t i = begin; i < head; i++)
+			{
+				const TraceEvent &event = buffer->events[i % CAPACITY];
+				// Chrome wants microseconds, fractions keep the nanoseconds
+				fprintf(file, "%s{\"name\":\"", first ? "" : ",\n");
+				writeEscaped(file, event.name);
+				fprintf(file, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+						buffer->tid, event.start / 1000.0, event.duration / 1000.0);
+				first = false;
+				count++;
+			}
+		}
+		fputs("\n]}\n", file);
+		const bool ok = fclose(file) == 0;
+		if (ok)
+			LOG_INFO("Wrote {} trace events to {}", count, path);
+		else
+			LOG_ERROR("Could not write the trace to {}", path);
+		return ok;
+	}
+}
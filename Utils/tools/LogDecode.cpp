@@ -0,0 +1,194 @@
+// Prints structured log files (Logger::OpenFile) as text or as JSON, one record
+// per line. Rotated files are read in the order given, oldest first:
+//   LogDecode --json run.rdl.2 run.rdl.1 run.rdl > run.jsonl
+
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/chrono.h>
+#include <fmt/core.h>
+
+#include "Utils/LogFile.h"
+
+using Util::LogDetail::FieldType;
+using Util::LogDetail::LogField;
+
+static std::string isoTime(int64_t ns)
+{
+	const std::time_t seconds = (std::time_t)(ns / 1000000000);
+	return fmt::format("{:%Y-%m-%dT%H:%M:%S}.{:09}Z", fmt::gmtime(seconds), ns % 1000000000);
+}
+
+static void appendEscaped(std::string &out, std::string_view text)
+{
+	for (char c : text)
+	{
+		switch (c)
+		{
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				if ((unsigned char)c < 0x20)
+					out += fmt::format("\\u{:04x}", (int)c);
+				else
+					out += c;
+		}
+	}
+}
+
+// Text output keeps a record on one line
+static std::string oneLine(std::string_view text)
+{
+	std::string out;
+	for (char c : text)
+		out += c == '\n' ? std::string("\\n") : std::string(1, c);
+	return out;
+}
+
+static const char *typeName(FieldType type)
+{
+	switch (type)
+	{
+		case FieldType::Int: return "int";
+		case FieldType::UInt: return "uint";
+		case FieldType::Float: return "float";
+		case FieldType::Bool: return "bool";
+		case FieldType::Char: return "char";
+		case FieldType::String: return "string";
+	}
+	return "unknown";
+}
+
+// The value as JSON, strings and chars quoted
+static std::string jsonValue(const LogField &field)
+{
+	std::string out;
+	switch (field.type)
+	{
+		case FieldType::Int: return fmt::format("{}", field.i);
+		case FieldType::UInt: return fmt::format("{}", field.u);
+		// JSON has no NaN or infinities
+		case FieldType::Float: return std::isfinite(field.f) ? fmt::format("{}", field.f) : fmt::format("\"{}\"", field.f);
+		case FieldType::Bool: return field.u ? "true" : "false";
+		case FieldType::Char:
+			out = "\"";
+			appendEscaped(out, std::string(1, (char)field.u));
+			return out + "\"";
+		case FieldType::String:
+			out = "\"";
+			appendEscaped(out, field.text);
+			return out + "\"";
+	}
+	return "null";
+}
+
+static std::string textValue(const LogField &field)
+{
+	switch (field.type)
+	{
+		case FieldType::Int: return fmt::format("{}", field.i);
+		case FieldType::UInt: return fmt::format("{}", field.u);
+		case FieldType::Float: return fmt::format("{}", field.f);
+		case FieldType::Bool: return field.u ? "true" : "false";
+		case FieldType::Char: return std::string(1, (char)field.u);
+		case FieldType::String: return fmt::format("\"{}\"", oneLine(field.text));
+	}
+	return "?";
+}
+
+static void printText(const Util::LogEntry &entry)
+{
+	std::string line = fmt::format("{} {:<7} thread {:<3} {}", isoTime(entry.time), Util::Logger::LevelName(entry.level), entry.thread,
+								   oneLine(entry.message));
+	for (size_t i = 0; i < entry.fields.size(); i++)
+	{
+		const LogField &field = entry.fields[i];
+		line += i == 0 ? "  | " : ", ";
+		if (field.name.empty())
+			line += fmt::format("{}:{}", typeName(field.type), textValue(field));
+		else
+			line += fmt::format("{}={}", field.name, textValue(field));
+	}
+	fmt::print("{}\n", line);
+}
+
+static void printJson(const Util::LogEntry &entry)
+{
+	std::string line = fmt::format("{{\"time\":\"{}\",\"ns\":{},\"sequence\":{},\"thread\":{},\"level\":\"{}\",\"message\":\"",
+								   isoTime(entry.time), entry.time, entry.sequence, entry.thread, Util::Logger::LevelName(entry.level));
+	appendEscaped(line, entry.message);
+	line += "\",\"fields\":[";
+	for (size_t i = 0; i < entry.fields.size(); i++)
+	{
+		const LogField &field = entry.fields[i];
+		line += i == 0 ? "{" : ",{";
+		if (!field.name.empty())
+		{
+			line += "\"name\":\"";
+			appendEscaped(line, field.name);
+			line += "\",";
+		}
+		line += fmt::format("\"type\":\"{}\",\"value\":{}}}", typeName(field.type), jsonValue(field));
+	}
+	fmt::print("{}]}}\n", line);
+}
+
+static void helpMessage()
+{
+	fmt::print("Usage:\n");
+	fmt::print("LogDecode.exe [--json] <file>...\n");
+	fmt::print("\t- json: One JSON object per record instead of text\n");
+}
+
+int main(int argc, const char *argv[])
+{
+	bool json = false;
+	std::vector<std::string> paths;
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--help")
+		{
+			helpMessage();
+			return 0;
+		}
+		if (arg == "--json")
+			json = true;
+		else
+			paths.push_back(arg);
+	}
+	if (paths.empty())
+	{
+		helpMessage();
+		return 1;
+	}
+
+	// Errors are written when they happen, between the records around them
+	Util::Logger::Shutdown();
+	int status = 0;
+	for (const std::string &path : paths)
+	{
+		Util::LogFileReader reader;
+		if (!reader.Open(path))
+		{
+			status = 1;
+			continue;
+		}
+		Util::LogEntry entry;
+		while (reader.Next(entry))
+			json ? printJson(entry) : printText(entry);
+		if (reader.Corrupted())
+		{
+			fmt::print(stderr, "{}: stopped at a corrupted record\n", path);
+			status = 1;
+		}
+	}
+	return status;
+}